@@ -6,38 +6,511 @@
 #include <cstdlib>
 #include <cstdint>
 #include <algorithm>
+#include <vector>
+#include <random>
+#include <limits>
+#include <stdexcept>
+#include <utility>
 #include "bst.h"
+#include "fork_join.h"
+#include "frozen_tree.h"
 #include <cassert>
 
 struct KeyError { };
 
 /**
-* A special kind of node for an AVL tree, which adds the balance as a data member, plus
-* other additional helper functions. You do NOT need to implement any functionality or
-* add additional data members or helper functions.
+* One entry of a change set for AVLTree::apply_batch: an upsert of key to
+* value, or the removal of key when erase is set (value is then ignored).
 */
 template <typename Key, typename Value>
-class AVLNode : public Node<Key, Value>
+struct BatchOp
+{
+    Key key;
+    Value value;
+    bool erase;
+};
+
+/**
+* Recursion policy for the join-based algorithms that never forks.
+*/
+struct SequentialExec
+{
+    bool fork(int, int) const
+    {
+        return false;
+    }
+    template<typename F1, typename F2>
+    void invoke(F1& a, F2& b) const
+    {
+        a();
+        b();
+    }
+};
+
+/**
+* Recursion policy that runs both halves of a join-based algorithm on a
+* ForkJoinPool until the inputs drop below cutoff entries, after which the
+* recursion continues sequentially. Since sizes are not stored, the cutoff
+* is applied to heights: a subtree shorter than the bit length of cutoff
+* is certainly smaller than cutoff.
+*/
+struct ParallelExec
+{
+    ParallelExec(ForkJoinPool& p, std::size_t cutoff) :
+        pool(p), cutoffHeight(0)
+    {
+        while(cutoff > 0) {
+            ++cutoffHeight;
+            cutoff >>= 1;
+        }
+    }
+    bool fork(int h1, int h2) const
+    {
+        return std::min(h1, h2) >= cutoffHeight;
+    }
+    template<typename F1, typename F2>
+    void invoke(F1& a, F2& b)
+    {
+        pool.invoke(a, b);
+    }
+
+    ForkJoinPool& pool;
+    int cutoffHeight;
+};
+
+/**
+* Runs body directly, or on the pool for the parallel policy so that its
+* invoke calls can fork.
+*/
+template<typename F>
+void runWith(SequentialExec&, F& body)
+{
+    body();
+}
+
+template<typename F>
+void runWith(ParallelExec& exec, F& body)
+{
+    exec.pool.run(body);
+}
+
+/**
+* Calls fn(lo, hi) over pieces of [lo, hi) no larger than cutoff, forking
+* the halves of larger ranges.
+*/
+template<typename F>
+void parallelFor(ParallelExec& exec, std::size_t lo, std::size_t hi, std::size_t cutoff, F& fn)
+{
+    if(hi - lo <= cutoff || cutoff == 0) {
+      fn(lo, hi);
+      return;
+    }
+    std::size_t mid = lo + (hi - lo) / 2;
+    auto left = [&]() { parallelFor(exec, lo, mid, cutoff, fn); };
+    auto right = [&]() { parallelFor(exec, mid, hi, cutoff, fn); };
+    exec.invoke(left, right);
+}
+
+/**
+* What AVLTree::apply_batch did to the tree.
+*/
+struct BatchResult
+{
+    std::size_t inserted;
+    std::size_t updated;
+    std::size_t erased;
+};
+
+/**
+* Augmentation policies let every AVLNode cache a summary of its subtree.
+* A policy names the per-node Data (which AVLNode inherits, so empty Data
+* costs nothing) and an update(n) that recomputes n's Data from its item
+* and its children's Data. AVLTree calls update bottom-up on every node
+* whose subtree changes; enabled tells it whether that is worth doing.
+* A lazy policy also keeps work pending for a subtree, and push(n) hands
+* n's pending work down to its children; AVLTree pushes a node before it
+* looks below it or relinks it.
+*
+* NoAugment is the default and caches nothing. The other policies derive
+* from it for the hooks they do not need.
+*/
+struct NoAugment
+{
+    static const bool enabled = false;
+    static const bool lazy = false;
+    struct Data { };
+    template<typename NodeType>
+    static void update(NodeType*)
+    {
+
+    }
+    template<typename NodeType>
+    static void push(NodeType*)
+    {
+
+    }
+};
+
+/**
+* Caches subtree sizes, which gives an AVLTree select, rank, count_range,
+* sample and size in O(log n).
+*/
+struct OrderStatistics : public NoAugment
+{
+    static const bool enabled = true;
+    struct Data
+    {
+        std::size_t size;
+    };
+    template<typename NodeType>
+    static void update(NodeType* n)
+    {
+        n->augment().size = 1 + subtreeSize(n->getLeft()) + subtreeSize(n->getRight());
+    }
+    template<typename NodeType>
+    static std::size_t subtreeSize(const NodeType* n)
+    {
+        return n == NULL ? 0 : n->augment().size;
+    }
+};
+
+/**
+* Caches the combination, in key order, of Monoid::of(value) over every
+* entry of a subtree, which gives an AVLTree aggregate(lo, hi) in
+* O(log n). A Monoid provides value_type, identity(), an associative
+* combine(a, b) and of(value); see SumMonoid for an example. Base is
+* another policy to keep alongside, e.g. OrderStatistics.
+*
+* The caches are maintained by the tree's own updates (insert,
+* insert_or_assign, upsert, apply_batch, ...). Writing a value through an
+* iterator or operator[] bypasses them.
+*/
+template<typename Monoid, typename Base = NoAugment>
+struct RangeAggregate : public Base
+{
+    typedef Monoid monoid_type;
+    typedef typename Monoid::value_type aggregate_type;
+    static const bool enabled = true;
+    struct Data : public Base::Data
+    {
+        aggregate_type total;
+    };
+    template<typename NodeType>
+    static void update(NodeType* n)
+    {
+        Base::update(n);
+        n->augment().total = Monoid::combine(Monoid::combine(total(n->getLeft()), Monoid::of(n->getValue())),
+                                             total(n->getRight()));
+    }
+    template<typename NodeType>
+    static aggregate_type total(const NodeType* n)
+    {
+        return n == NULL ? Monoid::identity() : n->augment().total;
+    }
+};
+
+/**
+* Monoids for RangeAggregate: the sum, minimum and maximum of the values,
+* and both extremes at once as a (min, max) pair.
+*/
+template<typename T>
+struct SumMonoid
+{
+    typedef T value_type;
+    static T identity()
+    {
+        return T();
+    }
+    static T combine(const T& a, const T& b)
+    {
+        return a + b;
+    }
+    template<typename V>
+    static T of(const V& value)
+    {
+        return value;
+    }
+};
+
+template<typename T>
+struct MinMonoid
+{
+    typedef T value_type;
+    static T identity()
+    {
+        return std::numeric_limits<T>::max();
+    }
+    static T combine(const T& a, const T& b)
+    {
+        return std::min(a, b);
+    }
+    template<typename V>
+    static T of(const V& value)
+    {
+        return value;
+    }
+};
+
+template<typename T>
+struct MaxMonoid
+{
+    typedef T value_type;
+    static T identity()
+    {
+        return std::numeric_limits<T>::lowest();
+    }
+    static T combine(const T& a, const T& b)
+    {
+        return std::max(a, b);
+    }
+    template<typename V>
+    static T of(const V& value)
+    {
+        return value;
+    }
+};
+
+template<typename T>
+struct MinMaxMonoid
+{
+    typedef std::pair<T, T> value_type;
+    static value_type identity()
+    {
+        return value_type(std::numeric_limits<T>::max(), std::numeric_limits<T>::lowest());
+    }
+    static value_type combine(const value_type& a, const value_type& b)
+    {
+        return value_type(std::min(a.first, b.first), std::max(a.second, b.second));
+    }
+    template<typename V>
+    static value_type of(const V& value)
+    {
+        return value_type(value, value);
+    }
+};
+
+/**
+* Lets AVLTree::range_update apply an Action to every value in a key range
+* in O(log n). The Action is stored on the roots of the subtrees it covers
+* and pushed towards the leaves only as later operations pass through.
+*
+* An Action provides a tag value_type with identity(), isIdentity(tag) and
+* compose(later, earlier); apply(tag, value) for one value;
+* applyToSummary(tag, data, basePolicy) to adjust whatever Base caches for
+* a whole subtree; and validate(tag, basePolicy), which throws if that
+* cannot be done for tag. See AffineAction.
+*/
+template<typename Action, typename Base = NoAugment>
+struct LazyUpdate : public Base
+{
+    typedef Action action_type;
+    typedef typename Action::value_type tag_type;
+    static const bool enabled = Base::enabled;
+    static const bool lazy = true;
+    struct Data : public Base::Data
+    {
+        Data() : pending(Action::identity()) { }
+        tag_type pending;
+    };
+    template<typename NodeType>
+    static void push(NodeType* n)
+    {
+        Base::push(n);
+        tag_type& pending = n->augment().pending;
+        if(Action::isIdentity(pending)) {
+            return;
+        }
+        applyTag(n->getLeft(), pending);
+        applyTag(n->getRight(), pending);
+        pending = Action::identity();
+    }
+    static void validate(const tag_type& tag)
+    {
+        Action::validate(tag, static_cast<Base*>(NULL));
+    }
+    // Applies tag to n's own value and cached data right away, and leaves
+    // it pending for n's children
+    template<typename NodeType>
+    static void applyTag(NodeType* n, const tag_type& tag)
+    {
+        if(n == NULL) {
+            return;
+        }
+        Action::apply(tag, n->getValue());
+        Action::applyToSummary(tag, n->augment(), static_cast<Base*>(NULL));
+        n->augment().pending = Action::compose(tag, n->augment().pending);
+    }
+};
+
+/**
+* The Action value -> scale * value + offset, for LazyUpdate. Besides
+* plain values it keeps the totals of RangeAggregate with SumMonoid (which
+* then needs OrderStatistics for the counts), MinMonoid, MaxMonoid and
+* MinMaxMonoid, of any arithmetic type. A negative scale turns minima into
+* maxima, so with MinMonoid or MaxMonoid it throws std::invalid_argument;
+* MinMaxMonoid swaps the pair instead. Any other monoid is a compile
+* error, since its totals would silently go stale.
+*/
+template<typename T>
+struct AffineAction
+{
+    struct Map
+    {
+        T scale;
+        T offset;
+    };
+    typedef Map value_type;
+
+    static Map add(const T& delta)
+    {
+        Map m = { T(1), delta };
+        return m;
+    }
+    static Map multiply(const T& factor)
+    {
+        Map m = { factor, T() };
+        return m;
+    }
+    static Map identity()
+    {
+        return add(T());
+    }
+    static bool isIdentity(const Map& m)
+    {
+        return m.scale == T(1) && m.offset == T();
+    }
+    static Map compose(const Map& later, const Map& earlier)
+    {
+        Map m = { later.scale * earlier.scale, later.scale * earlier.offset + later.offset };
+        return m;
+    }
+    template<typename V>
+    static void apply(const Map& m, V& value)
+    {
+        value = m.scale * value + m.offset;
+    }
+
+    // Nothing value-based is cached
+    template<typename Data>
+    static void applyToSummary(const Map&, Data&, NoAugment*)
+    {
+
+    }
+    template<typename Data>
+    static void applyToSummary(const Map&, Data&, OrderStatistics*)
+    {
+
+    }
+    // Adjusts this aggregate's total, then whatever B caches beneath it
+    template<typename Data, typename Monoid, typename B>
+    static void applyToSummary(const Map& m, Data& data, RangeAggregate<Monoid, B>*)
+    {
+        typename RangeAggregate<Monoid, B>::Data& own = data;
+        applyToTotal(m, own, own.total, static_cast<Monoid*>(NULL));
+        applyToSummary(m, static_cast<typename B::Data&>(own), static_cast<B*>(NULL));
+    }
+    template<typename Data, typename Policy>
+    static void applyToSummary(const Map&, Data&, Policy*)
+    {
+        static_assert(sizeof(Policy) == 0, "AffineAction cannot keep this policy's data up to date");
+    }
+
+    template<typename Data, typename U>
+    static void applyToTotal(const Map& m, Data& data, U& total, SumMonoid<U>*)
+    {
+        total = static_cast<U>(m.scale) * total + static_cast<U>(m.offset) * static_cast<U>(data.size);
+    }
+    template<typename Data, typename U>
+    static void applyToTotal(const Map& m, Data&, U& total, MinMonoid<U>*)
+    {
+        total = static_cast<U>(m.scale) * total + static_cast<U>(m.offset);
+    }
+    template<typename Data, typename U>
+    static void applyToTotal(const Map& m, Data&, U& total, MaxMonoid<U>*)
+    {
+        total = static_cast<U>(m.scale) * total + static_cast<U>(m.offset);
+    }
+    template<typename Data, typename U>
+    static void applyToTotal(const Map& m, Data&, std::pair<U, U>& total, MinMaxMonoid<U>*)
+    {
+        U first = static_cast<U>(m.scale) * total.first + static_cast<U>(m.offset);
+        U second = static_cast<U>(m.scale) * total.second + static_cast<U>(m.offset);
+        total = (m.scale < T()) ? std::make_pair(second, first) : std::make_pair(first, second);
+    }
+    template<typename Data, typename Total, typename Monoid>
+    static void applyToTotal(const Map&, Data&, Total&, Monoid*)
+    {
+        static_assert(sizeof(Monoid) == 0, "AffineAction cannot keep this monoid's totals up to date");
+    }
+
+    // Throws if a negative scale would have to be applied to a lone
+    // minimum or maximum
+    template<typename Policy>
+    static void validate(const Map&, Policy*)
+    {
+
+    }
+    template<typename Monoid, typename B>
+    static void validate(const Map& m, RangeAggregate<Monoid, B>*)
+    {
+        if(m.scale < T() && isLoneExtreme(static_cast<Monoid*>(NULL))) {
+            throw std::invalid_argument("AffineAction: negative scale needs MinMaxMonoid");
+        }
+        validate(m, static_cast<B*>(NULL));
+    }
+    template<typename U>
+    static bool isLoneExtreme(MinMonoid<U>*)
+    {
+        return true;
+    }
+    template<typename U>
+    static bool isLoneExtreme(MaxMonoid<U>*)
+    {
+        return true;
+    }
+    template<typename Monoid>
+    static bool isLoneExtreme(Monoid*)
+    {
+        return false;
+    }
+};
+
+/**
+* A special kind of node for an AVL tree, which adds the balance plus
+* other additional helper functions. The balance lives in the tag bits of
+* the parent link, so an AVLNode is no larger than a plain Node.
+*/
+template <typename Key, typename Value, typename Augment = NoAugment>
+class AVLNode : public Node<Key, Value>, private Augment::Data
 {
 public:
     // Constructor/destructor.
-    AVLNode(const Key& key, const Value& value, AVLNode<Key, Value>* parent);
-    virtual ~AVLNode();
+    AVLNode(const Key& key, const Value& value, AVLNode<Key, Value, Augment>* parent);
+    template<typename... Args>
+    AVLNode(AVLNode<Key, Value, Augment>* parent, Args&&... itemArgs);
+    ~AVLNode();
 
     // Getter/setter for the node's height.
     int8_t getBalance () const;
     void setBalance (int8_t balance);
     void updateBalance(int8_t diff);
 
-    // Getters for parent, left, and right. These need to be redefined since they
+    // Getters for parent, left, and right. These hide the Node versions since they
     // return pointers to AVLNodes - not plain Nodes. See the Node class in bst.h
     // for more information.
-    virtual AVLNode<Key, Value>* getParent() const override;
-    virtual AVLNode<Key, Value>* getLeft() const override;
-    virtual AVLNode<Key, Value>* getRight() const override;
+    AVLNode<Key, Value, Augment>* getParent() const;
+    AVLNode<Key, Value, Augment>* getLeft() const;
+    AVLNode<Key, Value, Augment>* getRight() const;
+
+    // The Augment data for the subtree rooted here.
+    typename Augment::Data& augment();
+    const typename Augment::Data& augment() const;
+    void updateAugment();
 
 protected:
-    int8_t balance_;    // effectively a signed char
+    // The balance is stored in the tag as balance + BALANCE_BIAS, which keeps
+    // the temporary +/-2 seen during rebalancing within the three tag bits.
+    static const int BALANCE_BIAS = 2;
 };
 
 /*
@@ -50,18 +523,31 @@ protected:
 * An explicit constructor to initialize the elements by calling the base class constructor and setting
 * the color to red since every new node will be red when it is first inserted.
 */
-template<class Key, class Value>
-AVLNode<Key, Value>::AVLNode(const Key& key, const Value& value, AVLNode<Key, Value> *parent) :
-    Node<Key, Value>(key, value, parent), balance_(0)
+template<class Key, class Value, class Augment>
+AVLNode<Key, Value, Augment>::AVLNode(const Key& key, const Value& value, AVLNode<Key, Value, Augment> *parent) :
+    Node<Key, Value>(key, value, parent)
 {
+    this->setTag(BALANCE_BIAS);
+    Augment::update(this);
+}
 
+/**
+* A constructor that builds the item in place; see the matching Node constructor.
+*/
+template<class Key, class Value, class Augment>
+template<typename... Args>
+AVLNode<Key, Value, Augment>::AVLNode(AVLNode<Key, Value, Augment> *parent, Args&&... itemArgs) :
+    Node<Key, Value>(parent, std::forward<Args>(itemArgs)...)
+{
+    this->setTag(BALANCE_BIAS);
+    Augment::update(this);
 }
 
 /**
 * A destructor which does nothing.
 */
-template<class Key, class Value>
-AVLNode<Key, Value>::~AVLNode()
+template<class Key, class Value, class Augment>
+AVLNode<Key, Value, Augment>::~AVLNode()
 {
 
 }
@@ -69,56 +555,81 @@ AVLNode<Key, Value>::~AVLNode()
 /**
 * A getter for the balance of a AVLNode.
 */
-template<class Key, class Value>
-int8_t AVLNode<Key, Value>::getBalance() const
+template<class Key, class Value, class Augment>
+int8_t AVLNode<Key, Value, Augment>::getBalance() const
 {
-    return balance_;
+    return static_cast<int8_t>(static_cast<int>(this->getTag()) - BALANCE_BIAS);
 }
 
 /**
 * A setter for the balance of a AVLNode.
 */
-template<class Key, class Value>
-void AVLNode<Key, Value>::setBalance(int8_t balance)
+template<class Key, class Value, class Augment>
+void AVLNode<Key, Value, Augment>::setBalance(int8_t balance)
 {
-    balance_ = balance;
+    this->setTag(static_cast<std::uintptr_t>(balance + BALANCE_BIAS));
 }
 
 /**
 * Adds diff to the balance of a AVLNode.
 */
-template<class Key, class Value>
-void AVLNode<Key, Value>::updateBalance(int8_t diff)
+template<class Key, class Value, class Augment>
+void AVLNode<Key, Value, Augment>::updateBalance(int8_t diff)
+{
+    setBalance(static_cast<int8_t>(getBalance() + diff));
+}
+
+/**
+* A getter for the parent that hides the Node version, since a static_cast is necessary to make
+* sure that our node is a AVLNode.
+*/
+template<class Key, class Value, class Augment>
+AVLNode<Key, Value, Augment> *AVLNode<Key, Value, Augment>::getParent() const
+{
+    return static_cast<AVLNode<Key, Value, Augment>*>(Node<Key, Value>::getParent());
+}
+
+/**
+* Hidden for the same reasons as above.
+*/
+template<class Key, class Value, class Augment>
+AVLNode<Key, Value, Augment> *AVLNode<Key, Value, Augment>::getLeft() const
 {
-    balance_ += diff;
+    return static_cast<AVLNode<Key, Value, Augment>*>(this->left_);
 }
 
 /**
-* An overridden function for getting the parent since a static_cast is necessary to make sure
-* that our node is a AVLNode.
+* Hidden for the same reasons as above.
 */
-template<class Key, class Value>
-AVLNode<Key, Value> *AVLNode<Key, Value>::getParent() const
+template<class Key, class Value, class Augment>
+AVLNode<Key, Value, Augment> *AVLNode<Key, Value, Augment>::getRight() const
 {
-    return static_cast<AVLNode<Key, Value>*>(this->parent_);
+    return static_cast<AVLNode<Key, Value, Augment>*>(this->right_);
 }
 
 /**
-* Overridden for the same reasons as above.
+* Getters for the augmentation data of this node.
 */
-template<class Key, class Value>
-AVLNode<Key, Value> *AVLNode<Key, Value>::getLeft() const
+template<class Key, class Value, class Augment>
+typename Augment::Data& AVLNode<Key, Value, Augment>::augment()
 {
-    return static_cast<AVLNode<Key, Value>*>(this->left_);
+    return *this;
+}
+
+template<class Key, class Value, class Augment>
+const typename Augment::Data& AVLNode<Key, Value, Augment>::augment() const
+{
+    return *this;
 }
 
 /**
-* Overridden for the same reasons as above.
+* Recomputes the augmentation data from the item and the children, which
+* must already be up to date.
 */
-template<class Key, class Value>
-AVLNode<Key, Value> *AVLNode<Key, Value>::getRight() const
+template<class Key, class Value, class Augment>
+void AVLNode<Key, Value, Augment>::updateAugment()
 {
-    return static_cast<AVLNode<Key, Value>*>(this->right_);
+    Augment::update(this);
 }
 
 
@@ -128,98 +639,1337 @@ AVLNode<Key, Value> *AVLNode<Key, Value>::getRight() const
   -----------------------------------------------
 */
 
+/**
+* The buildSorted hook for AVL trees: a node's balance is the difference
+* of its subtree heights, which are known once both children are built.
+*/
+struct AVLBuildHook
+{
+    template<typename NodeType>
+    void operator()(NodeType* n, int leftHeight, int rightHeight) const
+    {
+        n->setBalance(static_cast<int8_t>(rightHeight - leftHeight));
+        n->updateAugment();
+    }
+};
 
-template <class Key, class Value>
-class AVLTree : public BinarySearchTree<Key, Value>
+
+/**
+* A self-balancing AVL tree. Nodes come from the same Alloc as in
+* BinarySearchTree, and carry the per-subtree data of the Augment policy.
+*/
+template <class Key, class Value, class Alloc = NodePool, class Augment = NoAugment, class Compare = std::less<Key> >
+class AVLTree : public BinarySearchTree<Key, Value, Alloc, Compare>
 {
 public:
+    AVLTree();
+    // See BinarySearchTree; copies keep every balance as is.
+    AVLTree(const AVLTree& other);
+    AVLTree(AVLTree&& other) noexcept(std::is_nothrow_move_constructible<Alloc>::value);
+    AVLTree& operator=(const AVLTree& other);
+    AVLTree& operator=(AVLTree&& other)
+        noexcept(std::is_nothrow_move_constructible<Alloc>::value && std::is_nothrow_move_assignable<Alloc>::value);
+    virtual ~AVLTree();
     virtual void insert (const std::pair<const Key, Value> &new_item); // TODO
     virtual void remove(const Key& key);  // TODO
+
+    // Single-descent insertion; these hide the BinarySearchTree versions
+    // so that new nodes are AVLNodes and get rebalanced.
+    typedef typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator iterator;
+    template<typename... Args>
+    std::pair<iterator, bool> emplace(Args&&... args);
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(const Key& key, Args&&... args);
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(Key&& key, Args&&... args);
+    template<typename V>
+    std::pair<iterator, bool> insert_or_assign(const Key& key, V&& value);
+    template<typename V>
+    std::pair<iterator, bool> insert_or_assign(Key&& key, V&& value);
+    template<typename Fn>
+    std::pair<iterator, bool> upsert(const Key& key, Fn fn);
+
+    // See BinarySearchTree::assign_sorted; balances are set directly.
+    template<typename ForwardIt>
+    void assign_sorted(ForwardIt first, ForwardIt last);
+
+    // Applies a change set of m BatchOps in O(m log(n/m + 1)), touching
+    // only the subtrees the keys fall into. When several ops name the same
+    // key, the last one wins.
+    template<typename InputIt>
+    BatchResult apply_batch(InputIt first, InputIt last);
+
+    // Moves the keys below key into less and those above it into greater in
+    // O(log n). Only the entry for key itself, if any, stays in this tree.
+    bool split(const Key& key, AVLTree& less, AVLTree& greater);
+    // Makes this tree the concatenation of left, (key, value) and right in
+    // O(log n). Every key of left must be below key and every key of right
+    // above it. left and right are left empty; either may be *this.
+    void join(AVLTree& left, const Key& key, const Value& value, AVLTree& right);
+
+    // Join-based set algebra in O(m log(n/m + 1)) for sizes m <= n. Each
+    // consumes other, leaving it empty, and reuses its nodes.
+    // For keys in both trees, unionWith keeps other's value and
+    // intersectWith keeps this tree's value.
+    void unionWith(AVLTree& other);
+    void intersectWith(AVLTree& other);
+    void differenceWith(AVLTree& other);
+
+    // Parallel versions of the above and of assign_sorted. Independent
+    // subproblems run on pool until they shrink below cutoff entries.
+    static const std::size_t PARALLEL_CUTOFF = 4096;
+    void unionWith(AVLTree& other, ForkJoinPool& pool, std::size_t cutoff = PARALLEL_CUTOFF);
+    void intersectWith(AVLTree& other, ForkJoinPool& pool, std::size_t cutoff = PARALLEL_CUTOFF);
+    void differenceWith(AVLTree& other, ForkJoinPool& pool, std::size_t cutoff = PARALLEL_CUTOFF);
+    template<typename RandomIt>
+    void assign_sorted(RandomIt first, RandomIt last, ForkJoinPool& pool, std::size_t cutoff = PARALLEL_CUTOFF);
+
+    // Order statistics in O(log n); these need Augment = OrderStatistics.
+    // select counts from 0 and returns end() past the last entry; rank is
+    // the number of keys below key; count_range counts keys in [lo, hi).
+    std::size_t size() const;
+    iterator select(std::size_t k) const;
+    std::size_t rank(const Key& key) const;
+    std::size_t count_range(const Key& lo, const Key& hi) const;
+    template<typename URNG>
+    iterator sample(URNG& gen) const;
+
+    // Range aggregates in O(log n); these need Augment = RangeAggregate.
+    // The combination, in key order, of the values with keys in [lo, hi),
+    // or over the whole tree.
+    template<typename A = Augment>
+    typename A::aggregate_type aggregate(const Key& lo, const Key& hi) const;
+    template<typename A = Augment>
+    typename A::aggregate_type aggregate() const;
+
+    // Lazy range updates in O(log n); these need Augment = LazyUpdate.
+    // Applies tag to every value with a key in [lo, hi). The work is left
+    // on subtree roots and pushed down only along the paths that later
+    // lookups, updates and iterator steps take, so each stays O(log n).
+    template<typename A = Augment>
+    void range_update(const Key& lo, const Key& hi, const typename A::tag_type& tag);
+    Value get(const Key& key) const;
+
+    // Copies the entries into an immutable FrozenTree, whose lookups are
+    // several times faster. Later changes to this tree do not reach it.
+    FrozenTree<Key, Value, Compare> freeze() const;
+
+    // These hide the BinarySearchTree versions to settle the pending range
+    // updates above the entries they return.
+    typedef typename BinarySearchTree<Key, Value, Alloc, Compare>::const_iterator const_iterator;
+    typedef typename BinarySearchTree<Key, Value, Alloc, Compare>::reverse_iterator reverse_iterator;
+    typedef typename BinarySearchTree<Key, Value, Alloc, Compare>::const_reverse_iterator const_reverse_iterator;
+    typedef typename BinarySearchTree<Key, Value, Alloc, Compare>::range_view range_view;
+    iterator begin() const;
+    iterator end() const;
+    const_iterator cbegin() const;
+    const_iterator cend() const;
+    reverse_iterator rbegin() const;
+    reverse_iterator rend() const;
+    const_reverse_iterator crbegin() const;
+    const_reverse_iterator crend() const;
+    iterator find(const Key& key) const;
+    Value& operator[](const Key& key);
+    Value const & operator[](const Key& key) const;
+    iterator lower_bound(const Key& key) const;
+    iterator upper_bound(const Key& key) const;
+    std::pair<iterator, iterator> equal_range(const Key& key) const;
+    iterator floor(const Key& key) const;
+    iterator ceiling(const Key& key) const;
+    range_view range(const Key& lo, const Key& hi) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    iterator find(const K& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    iterator lower_bound(const K& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    iterator upper_bound(const K& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    std::pair<iterator, iterator> equal_range(const K& key) const;
 protected:
-    virtual void nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2);
+    virtual void nodeSwap( AVLNode<Key, Value, Augment>* n1, AVLNode<Key, Value, Augment>* n2);
 
     //helper functions
-    void rotateLeft(AVLNode<Key,Value>* n);
-    void rotateRight(AVLNode<Key,Value>* n);
-    void insertFix(AVLNode<Key,Value>* p, AVLNode<Key,Value>* n);
-    void removeFix(AVLNode<Key, Value>* p, int diff);
-    AVLNode<Key,Value>* findKey(AVLNode<Key,Value>* n, const Key& key);
+    void rotateLeft(AVLNode<Key, Value, Augment>* n);
+    void rotateRight(AVLNode<Key, Value, Augment>* n);
+    void insertFix(AVLNode<Key, Value, Augment>* p, AVLNode<Key, Value, Augment>* n);
+    std::pair<iterator, bool> insertRebalance(std::pair<AVLNode<Key, Value, Augment>*, bool> result);
+    void removeFix(AVLNode<Key, Value, Augment>* p, int diff);
+    void removeNode(AVLNode<Key, Value, Augment>* n);
+    static void updatePath(AVLNode<Key, Value, Augment>* n);
+    void flushUpdates() const;
+    static void pushAll(AVLNode<Key, Value, Augment>* n);
+    static void pushFromRoot(AVLNode<Key, Value, Augment>* n);
+    static void pushOne(Node<Key, Value>* n);
+    void pushPath(const Key& key) const;
+    iterator settled(iterator it) const;
+    int avlHeight() const;
+    static int subtreeHeight(AVLNode<Key, Value, Augment>* n);
+    static void childHeights(AVLNode<Key, Value, Augment>* n, int height, int& leftHeight, int& rightHeight);
+
+    // Node-level split/join; subtrees are passed around with their heights
+    static AVLNode<Key, Value, Augment>* link(AVLNode<Key, Value, Augment>* left, int leftHeight, AVLNode<Key, Value, Augment>* n,
+                                     AVLNode<Key, Value, Augment>* right, int rightHeight, int& height);
+    static AVLNode<Key, Value, Augment>* joinNodes(AVLNode<Key, Value, Augment>* left, int leftHeight, AVLNode<Key, Value, Augment>* n,
+                                          AVLNode<Key, Value, Augment>* right, int rightHeight, int& height);
+    static AVLNode<Key, Value, Augment>* joinRight(AVLNode<Key, Value, Augment>* left, int leftHeight, AVLNode<Key, Value, Augment>* n,
+                                          AVLNode<Key, Value, Augment>* right, int rightHeight, int& height);
+    static AVLNode<Key, Value, Augment>* joinLeft(AVLNode<Key, Value, Augment>* left, int leftHeight, AVLNode<Key, Value, Augment>* n,
+                                         AVLNode<Key, Value, Augment>* right, int rightHeight, int& height);
+    static void splitNodes(AVLNode<Key, Value, Augment>* t, int height, const Key& key,
+                           AVLNode<Key, Value, Augment>*& less, int& lessHeight,
+                           AVLNode<Key, Value, Augment>*& greater, int& greaterHeight, AVLNode<Key, Value, Augment>*& found);
+    AVLNode<Key, Value, Augment>* takeNodes(AVLTree& other, int& height);
+    static AVLNode<Key, Value, Augment>* expose(AVLNode<Key, Value, Augment>* t, int height,
+                                       AVLNode<Key, Value, Augment>*& left, int& leftHeight,
+                                       AVLNode<Key, Value, Augment>*& right, int& rightHeight);
+    static AVLNode<Key, Value, Augment>* splitLast(AVLNode<Key, Value, Augment>* t, int height,
+                                          AVLNode<Key, Value, Augment>*& last, int& restHeight);
+    static AVLNode<Key, Value, Augment>* join2(AVLNode<Key, Value, Augment>* left, int leftHeight,
+                                      AVLNode<Key, Value, Augment>* right, int rightHeight, int& height);
+
+    // Set algebra; nodes to destroy are collected in a NodeList so that
+    // parallel branches never touch the allocator
+    typedef std::vector<AVLNode<Key, Value, Augment>*> NodeList;
+    enum SetOperation { SET_UNION, SET_INTERSECTION, SET_DIFFERENCE };
+    template<typename Exec>
+    void applySetOperation(AVLTree& other, SetOperation op, Exec& exec);
+    template<typename Exec, typename LeftCall, typename RightCall>
+    static void recurseBoth(Exec& exec, int h1, int h2, NodeList& doomed, LeftCall& leftCall, RightCall& rightCall);
+    template<typename Exec>
+    static AVLNode<Key, Value, Augment>* unionNodes(AVLNode<Key, Value, Augment>* t1, int h1, AVLNode<Key, Value, Augment>* t2, int h2,
+                                           int& height, NodeList& doomed, Exec& exec);
+    template<typename Exec>
+    static AVLNode<Key, Value, Augment>* intersectNodes(AVLNode<Key, Value, Augment>* t1, int h1, AVLNode<Key, Value, Augment>* t2, int h2,
+                                               int& height, NodeList& doomed, Exec& exec);
+    template<typename Exec>
+    static AVLNode<Key, Value, Augment>* differenceNodes(AVLNode<Key, Value, Augment>* t1, int h1, AVLNode<Key, Value, Augment>* t2, int h2,
+                                                int& height, NodeList& doomed, Exec& exec);
+    static AVLNode<Key, Value, Augment>* buildParallel(AVLNode<Key, Value, Augment>** nodes, std::size_t n, int& height,
+                                              ParallelExec& exec, std::size_t cutoff);
+    AVLNode<Key, Value, Augment>* cloneNodes(const AVLNode<Key, Value, Augment>* src);
+    static AVLNode<Key, Value, Augment>* batchNodes(AVLNode<Key, Value, Augment>* t, int h, const std::vector<BatchOp<Key, Value> >& ops,
+                                           AVLNode<Key, Value, Augment>** fresh, std::size_t lo, std::size_t hi,
+                                           int& height, NodeList& doomed, BatchResult& result);
+    AVLNode<Key, Value, Augment>* findKey(AVLNode<Key, Value, Augment>* n, const Key& key);
+    virtual void destroyNode(Node<Key,Value>* n);
+
+    // Set while some node may hold a pending range update
+    mutable bool lazyPending_;
 };
 
+/**
+* Default constructor.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+AVLTree<Key, Value, Alloc, Augment, Compare>::AVLTree() :
+    lazyPending_(false)
+{
+    if(Augment::lazy) {
+      this->pushNode_ = &pushOne;
+    }
+}
+
+/**
+* Copy constructor, which clones other node for node.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+AVLTree<Key, Value, Alloc, Augment, Compare>::AVLTree(const AVLTree& other) :
+    BinarySearchTree<Key, Value, Alloc, Compare>(),
+    lazyPending_(other.lazyPending_)
+{
+    if(Augment::lazy) {
+      this->pushNode_ = &pushOne;
+    }
+    this->root_ = cloneNodes(static_cast<AVLNode<Key, Value, Augment>*>(other.root_));
+    this->resetLast();
+}
+
+/**
+* Move constructor, which takes other's nodes, allocator and any pending
+* range updates.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+AVLTree<Key, Value, Alloc, Augment, Compare>::AVLTree(AVLTree&& other)
+    noexcept(std::is_nothrow_move_constructible<Alloc>::value) :
+    BinarySearchTree<Key, Value, Alloc, Compare>(std::move(other)),
+    lazyPending_(other.lazyPending_)
+{
+    if(Augment::lazy) {
+      this->pushNode_ = &pushOne;
+    }
+    other.lazyPending_ = false;
+}
+
+/**
+* Copy assignment; the copy is made first, so a failure leaves this tree
+* as it was.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+AVLTree<Key, Value, Alloc, Augment, Compare>&
+AVLTree<Key, Value, Alloc, Augment, Compare>::operator=(const AVLTree& other)
+{
+    if(this != &other) {
+      AVLTree copy(other);
+      *this = std::move(copy);
+    }
+    return *this;
+}
+
+/**
+* Move assignment; see BinarySearchTree.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+AVLTree<Key, Value, Alloc, Augment, Compare>&
+AVLTree<Key, Value, Alloc, Augment, Compare>::operator=(AVLTree&& other)
+    noexcept(std::is_nothrow_move_constructible<Alloc>::value && std::is_nothrow_move_assignable<Alloc>::value)
+{
+    if(this != &other) {
+      BinarySearchTree<Key, Value, Alloc, Compare>::operator=(std::move(other));
+      lazyPending_ = other.lazyPending_;
+      other.lazyPending_ = false;
+    }
+    return *this;
+}
+
+/**
+* Destructor, which clears the tree here so that the AVLNode override of
+* destroyNode is still in effect.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+AVLTree<Key, Value, Alloc, Augment, Compare>::~AVLTree()
+{
+    this->clear();
+}
+
+/**
+* Destroys an AVLNode and hands its memory back to the allocator.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+void AVLTree<Key, Value, Alloc, Augment, Compare>::destroyNode(Node<Key,Value>* n)
+{
+    AVLNode<Key, Value, Augment>* avl = static_cast<AVLNode<Key, Value, Augment>*>(n);
+    avl->~AVLNode();
+    this->alloc_.deallocate(avl, sizeof(AVLNode<Key, Value, Augment>));
+}
+
 /*
  * Recall: If key is already in the tree, you should 
  * overwrite the current value with the updated value.
  */
-template<class Key, class Value>
-void AVLTree<Key, Value>::insert(const std::pair<const Key, Value> &new_item)
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+void AVLTree<Key, Value, Alloc, Augment, Compare>::insert(const std::pair<const Key, Value> &new_item)
 {
-    if(this->root_ == NULL){ 
-      this->root_ = new AVLNode<Key, Value>(new_item.first, new_item.second, NULL);
-      static_cast<AVLNode<Key, Value>*>(this->root_)->setBalance(0);
-      return;
-     } 
-    else if(findKey(static_cast<AVLNode<Key, Value>*>(this->root_), new_item.first) != NULL) {
-      AVLNode<Key,Value> * result = findKey(static_cast<AVLNode<Key, Value>*>(this->root_), new_item.first);
-      //just update the value
-      result->setValue(new_item.second);
+    pushPath(new_item.first);
+    insertRebalance(this->template insertOrAssignNode<AVLNode<Key, Value, Augment> >(new_item.first, new_item.second));
+}
+
+/**
+* See BinarySearchTree::emplace.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+template<typename... Args>
+std::pair<typename AVLTree<Key, Value, Alloc, Augment, Compare>::iterator, bool>
+AVLTree<Key, Value, Alloc, Augment, Compare>::emplace(Args&&... args)
+{
+    return insertRebalance(this->template emplaceNode<AVLNode<Key, Value, Augment> >(std::forward<Args>(args)...));
+}
+
+/**
+* See BinarySearchTree::try_emplace.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+template<typename... Args>
+std::pair<typename AVLTree<Key, Value, Alloc, Augment, Compare>::iterator, bool>
+AVLTree<Key, Value, Alloc, Augment, Compare>::try_emplace(const Key& key, Args&&... args)
+{
+    return insertRebalance(this->template tryEmplaceNode<AVLNode<Key, Value, Augment> >(key, std::forward<Args>(args)...));
+}
+
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+template<typename... Args>
+std::pair<typename AVLTree<Key, Value, Alloc, Augment, Compare>::iterator, bool>
+AVLTree<Key, Value, Alloc, Augment, Compare>::try_emplace(Key&& key, Args&&... args)
+{
+    return insertRebalance(this->template tryEmplaceNode<AVLNode<Key, Value, Augment> >(std::move(key), std::forward<Args>(args)...));
+}
+
+/**
+* See BinarySearchTree::insert_or_assign.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+template<typename V>
+std::pair<typename AVLTree<Key, Value, Alloc, Augment, Compare>::iterator, bool>
+AVLTree<Key, Value, Alloc, Augment, Compare>::insert_or_assign(const Key& key, V&& value)
+{
+    pushPath(key);
+    return insertRebalance(this->template insertOrAssignNode<AVLNode<Key, Value, Augment> >(key, std::forward<V>(value)));
+}
+
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+template<typename V>
+std::pair<typename AVLTree<Key, Value, Alloc, Augment, Compare>::iterator, bool>
+AVLTree<Key, Value, Alloc, Augment, Compare>::insert_or_assign(Key&& key, V&& value)
+{
+    pushPath(key);
+    return insertRebalance(this->template insertOrAssignNode<AVLNode<Key, Value, Augment> >(std::move(key), std::forward<V>(value)));
+}
+
+/**
+* See BinarySearchTree::upsert.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+template<typename Fn>
+std::pair<typename AVLTree<Key, Value, Alloc, Augment, Compare>::iterator, bool>
+AVLTree<Key, Value, Alloc, Augment, Compare>::upsert(const Key& key, Fn fn)
+{
+    pushPath(key);
+    std::pair<AVLNode<Key, Value, Augment>*, bool> result = this->template tryEmplaceNode<AVLNode<Key, Value, Augment> >(key);
+    fn(result.first->getValue());
+    return insertRebalance(result);
+}
+
+/**
+* Replaces the contents with a balanced tree built in O(n) from items in
+* strictly ascending key order, all allocated from one contiguous block.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+template<typename ForwardIt>
+void AVLTree<Key, Value, Alloc, Augment, Compare>::assign_sorted(ForwardIt first, ForwardIt last)
+{
+    this->clear();
+    std::size_t n = static_cast<std::size_t>(std::distance(first, last));
+    this->alloc_.reserve(sizeof(AVLNode<Key, Value, Augment>), n);
+    int height;
+    AVLBuildHook hook;
+    auto source = [&]() {
+      AVLNode<Key, Value, Augment>* n = this->template createNode<AVLNode<Key, Value, Augment> >(
+          static_cast<AVLNode<Key, Value, Augment>*>(NULL), *first);
+      ++first;
+      return n;
+    };
+    this->root_ = this->template buildSorted<AVLNode<Key, Value, Augment> >(
+        source, n, static_cast<AVLNode<Key, Value, Augment>*>(NULL), height, hook);
+    this->resetLast();
+}
+
+/**
+* Sorts the change set, keeps only the last op per key, and applies it.
+* The nodes for upserts are made first, so an allocation failure leaves
+* the tree untouched. Then the tree is split around the middle op, each
+* half takes its ops recursively, and the halves are joined back. A
+* subtree no op falls into is left alone, so a batch of m ops costs
+* O(m log(n/m + 1)). Scattered ops share the top of the tree, and packed
+* ops rebuild only the key range they cover (see batchNodes).
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+template<typename InputIt>
+BatchResult AVLTree<Key, Value, Alloc, Augment, Compare>::apply_batch(InputIt first, InputIt last)
+{
+    typedef BatchOp<Key, Value> Op;
+    std::vector<Op> ops(first, last);
+    std::stable_sort(ops.begin(), ops.end(), [](const Op& a, const Op& b) {
+      return AVLTree<Key, Value, Alloc, Augment, Compare>::compareKeys(a.key, b.key) < 0;
+    });
+    std::size_t kept = 0;
+    for(std::size_t i = 0; i < ops.size(); ++i) {
+      if(i + 1 < ops.size() && this->compareKeys(ops[i].key, ops[i + 1].key) == 0) {
+        continue;
+      }
+      if(kept != i) {
+        ops[kept] = std::move(ops[i]);
+      }
+      ++kept;
+    }
+    ops.erase(ops.begin() + kept, ops.end());
+
+    std::vector<AVLNode<Key, Value, Augment>*> fresh(ops.size(), static_cast<AVLNode<Key, Value, Augment>*>(NULL));
+    std::size_t i = 0;
+    try {
+      for(; i < ops.size(); ++i) {
+        if(!ops[i].erase) {
+          fresh[i] = this->template createNode<AVLNode<Key, Value, Augment> >(
+              static_cast<AVLNode<Key, Value, Augment>*>(NULL), std::move(ops[i].key), std::move(ops[i].value));
+        }
+      }
+    }
+    catch(...) {
+      for(std::size_t j = 0; j < i; ++j) {
+        if(fresh[j] != NULL) {
+          this->destroyNode(fresh[j]);
+        }
+      }
+      throw;
+    }
+
+    BatchResult result = {0, 0, 0};
+    if(ops.empty()) {
+      return result;
+    }
+    AVLNode<Key, Value, Augment>* root = static_cast<AVLNode<Key, Value, Augment>*>(this->root_);
+    int height;
+    NodeList doomed;
+    this->root_ = batchNodes(root, subtreeHeight(root), ops, fresh.data(), 0, ops.size(), height, doomed, result);
+    this->resetLast();
+    for(std::size_t j = 0; j < doomed.size(); ++j) {
+      this->destroyNode(doomed[j]);
+    }
+    return result;
+}
+
+/**
+* Applies ops[lo, hi) to the detached subtree t of height h. The middle op
+* splits t; its own node, if any, is dropped into doomed and replaced by
+* the op's fresh node, or just dropped for an erase. A key taken from a
+* moved-from op is read from its fresh node instead.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+AVLNode<Key, Value, Augment>* AVLTree<Key, Value, Alloc, Augment, Compare>::batchNodes(AVLNode<Key, Value, Augment>* t, int h,
+                                                            const std::vector<BatchOp<Key, Value> >& ops,
+                                                            AVLNode<Key, Value, Augment>** fresh, std::size_t lo, std::size_t hi,
+                                                            int& height, NodeList& doomed, BatchResult& result)
+{
+    if(lo == hi) {
+      height = h;
+      return t;
+    }
+    std::size_t mid = lo + (hi - lo) / 2;
+    AVLNode<Key, Value, Augment>* pivot = fresh[mid];
+    AVLNode<Key, Value, Augment>* less;
+    AVLNode<Key, Value, Augment>* greater;
+    AVLNode<Key, Value, Augment>* found;
+    int lessHeight;
+    int greaterHeight;
+    splitNodes(t, h, pivot != NULL ? pivot->getKey() : ops[mid].key, less, lessHeight, greater, greaterHeight, found);
+    int leftHeight;
+    int rightHeight;
+    AVLNode<Key, Value, Augment>* left = batchNodes(less, lessHeight, ops, fresh, lo, mid, leftHeight, doomed, result);
+    AVLNode<Key, Value, Augment>* right = batchNodes(greater, greaterHeight, ops, fresh, mid + 1, hi, rightHeight, doomed, result);
+    if(found != NULL) {
+      doomed.push_back(found);
+    }
+    if(pivot == NULL) {
+      if(found != NULL) {
+        ++result.erased;
+      }
+      return join2(left, leftHeight, right, rightHeight, height);
+    }
+    if(found != NULL) {
+      ++result.updated;
+    }
+    else {
+      ++result.inserted;
+    }
+    return joinNodes(left, leftHeight, pivot, right, rightHeight, height);
+}
+
+/**
+* Returns the height of the tree in O(height) by always stepping into the
+* taller child, which the balance factors identify.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+int AVLTree<Key, Value, Alloc, Augment, Compare>::avlHeight() const
+{
+    return subtreeHeight(static_cast<AVLNode<Key, Value, Augment>*>(this->root_));
+}
+
+/**
+* The same as avlHeight for the subtree rooted at n.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+int AVLTree<Key, Value, Alloc, Augment, Compare>::subtreeHeight(AVLNode<Key, Value, Augment>* n)
+{
+    int height = 0;
+    while(n != NULL) {
+      ++height;
+      n = (n->getBalance() > 0) ? n->getRight() : n->getLeft();
+    }
+    return height;
+}
+
+/**
+* Given the height of n, derives the heights of its children from its
+* balance in O(1).
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+void AVLTree<Key, Value, Alloc, Augment, Compare>::childHeights(AVLNode<Key, Value, Augment>* n, int height, int& leftHeight, int& rightHeight)
+{
+    int balance = n->getBalance();
+    leftHeight = height - 1 - (balance > 0 ? 1 : 0);
+    rightHeight = height - 1 - (balance < 0 ? 1 : 0);
+}
+
+/**
+* Split: the tree is cut along the search path for key. Each node on the
+* path is joined, as the pivot, onto the pieces coming back up, which
+* telescopes to O(log n). No node is copied or reallocated. The pieces
+* each keep the old arena alive but allocate from arenas of their own (see
+* NodePool::share), so they can be handed to different threads.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+bool AVLTree<Key, Value, Alloc, Augment, Compare>::split(const Key& key, AVLTree& less, AVLTree& greater)
+{
+    if(&less != this) {
+      less.clear();
+      less.alloc_.share(this->alloc_);
+      less.lazyPending_ = this->lazyPending_;
+    }
+    if(&greater != this) {
+      greater.clear();
+      greater.alloc_.share(this->alloc_);
+      greater.lazyPending_ = this->lazyPending_;
+    }
+    AVLNode<Key, Value, Augment>* lessRoot;
+    AVLNode<Key, Value, Augment>* greaterRoot;
+    AVLNode<Key, Value, Augment>* found;
+    int lessHeight;
+    int greaterHeight;
+    AVLNode<Key, Value, Augment>* root = static_cast<AVLNode<Key, Value, Augment>*>(this->root_);
+    splitNodes(root, subtreeHeight(root), key, lessRoot, lessHeight, greaterRoot, greaterHeight, found);
+    this->root_ = found;
+    less.root_ = lessRoot;
+    greater.root_ = greaterRoot;
+    this->resetLast();
+    less.resetLast();
+    greater.resetLast();
+    return found != NULL;
+}
+
+/**
+* Join: the shorter tree is hung, under a new node for key, off the spine
+* of the taller one at the point where the heights match, and the spine is
+* rebalanced on the way back up. O(difference in heights).
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+void AVLTree<Key, Value, Alloc, Augment, Compare>::join(AVLTree& left, const Key& key, const Value& value, AVLTree& right)
+{
+    if(&left != this && &right != this) {
+      this->clear();
+    }
+    int leftHeight;
+    int rightHeight;
+    AVLNode<Key, Value, Augment>* leftRoot = takeNodes(left, leftHeight);
+    AVLNode<Key, Value, Augment>* rightRoot = takeNodes(right, rightHeight);
+    AVLNode<Key, Value, Augment>* pivot = this->template createNode<AVLNode<Key, Value, Augment> >(
+        static_cast<AVLNode<Key, Value, Augment>*>(NULL), key, value);
+    int height;
+    this->root_ = joinNodes(leftRoot, leftHeight, pivot, rightRoot, rightHeight, height);
+    this->resetLast();
+}
+
+/**
+* Detaches the nodes of other so this tree can link them in, and returns
+* their root and height. They are moved when this tree's allocator can
+* take over other's memory, which a NodePool always can in O(1), and
+* copied (structure and all) otherwise.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+AVLNode<Key, Value, Augment>* AVLTree<Key, Value, Alloc, Augment, Compare>::takeNodes(AVLTree& other, int& height)
+{
+    AVLNode<Key, Value, Augment>* root = static_cast<AVLNode<Key, Value, Augment>*>(other.root_);
+    height = subtreeHeight(root);
+    this->lazyPending_ = this->lazyPending_ || other.lazyPending_;
+    if(&other != this && !this->alloc_.adopt(other.alloc_)) {
+      AVLNode<Key, Value, Augment>* copy = cloneNodes(root);
+      other.clear();
+      return copy;
+    }
+    other.root_ = NULL;
+    other.last_ = NULL;
+    return root;
+}
+
+/**
+* Copies the whole tree rooted at src, balances and augmented data
+* included, into nodes from this tree's allocator.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+AVLNode<Key, Value, Augment>* AVLTree<Key, Value, Alloc, Augment, Compare>::cloneNodes(const AVLNode<Key, Value, Augment>* src)
+{
+    auto copyNode = [this](const AVLNode<Key, Value, Augment>* from, AVLNode<Key, Value, Augment>* parent) {
+      AVLNode<Key, Value, Augment>* n = this->template createNode<AVLNode<Key, Value, Augment> >(parent, from->getItem());
+      n->setBalance(from->getBalance());
+      // copied as is, including any pending range update
+      n->augment() = from->augment();
+      return n;
+    };
+    return this->template cloneTree<AVLNode<Key, Value, Augment> >(src, copyNode);
+}
+
+/**
+* Union: split this tree by the root key of other, recurse on both sides
+* and join the results with other's root node.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+void AVLTree<Key, Value, Alloc, Augment, Compare>::unionWith(AVLTree& other)
+{
+    SequentialExec exec;
+    applySetOperation(other, SET_UNION, exec);
+}
+
+/**
+* Intersection: like unionWith, but a root key of other that is missing
+* here is dropped and the two sides are joined without it. A key found here
+* keeps this tree's node, and so its value.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+void AVLTree<Key, Value, Alloc, Augment, Compare>::intersectWith(AVLTree& other)
+{
+    SequentialExec exec;
+    applySetOperation(other, SET_INTERSECTION, exec);
+}
+
+/**
+* Difference: removes every key of other from this tree.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+void AVLTree<Key, Value, Alloc, Augment, Compare>::differenceWith(AVLTree& other)
+{
+    SequentialExec exec;
+    applySetOperation(other, SET_DIFFERENCE, exec);
+}
+
+/**
+* unionWith with the two recursive calls at each level run as parallel
+* tasks on pool while both inputs have at least cutoff entries.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+void AVLTree<Key, Value, Alloc, Augment, Compare>::unionWith(AVLTree& other, ForkJoinPool& pool, std::size_t cutoff)
+{
+    ParallelExec exec(pool, cutoff);
+    applySetOperation(other, SET_UNION, exec);
+}
+
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+void AVLTree<Key, Value, Alloc, Augment, Compare>::intersectWith(AVLTree& other, ForkJoinPool& pool, std::size_t cutoff)
+{
+    ParallelExec exec(pool, cutoff);
+    applySetOperation(other, SET_INTERSECTION, exec);
+}
+
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+void AVLTree<Key, Value, Alloc, Augment, Compare>::differenceWith(AVLTree& other, ForkJoinPool& pool, std::size_t cutoff)
+{
+    ParallelExec exec(pool, cutoff);
+    applySetOperation(other, SET_DIFFERENCE, exec);
+}
+
+/**
+* Shared driver for the set operations: takes other's nodes, runs the
+* node-level algorithm under the given recursion policy, and only then
+* destroys the nodes it dropped.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+template<typename Exec>
+void AVLTree<Key, Value, Alloc, Augment, Compare>::applySetOperation(AVLTree& other, SetOperation op, Exec& exec)
+{
+    if(&other == this) {
+      if(op == SET_DIFFERENCE) {
+        this->clear();
+      }
       return;
     }
-    AVLNode<Key,Value> * traverse = static_cast<AVLNode<Key, Value>*>(this->root_);
-    //pointer that maintains the previous position of traverse
-    AVLNode<Key, Value>* previous = NULL;
-    AVLNode<Key, Value>* n = new AVLNode<Key, Value>(new_item.first, new_item.second, NULL);
-    n->setBalance(0);
-    while ( traverse != NULL ) {
-      previous = traverse;
-      if( new_item.first < traverse->getKey() ) {
-        traverse = traverse->getLeft();
+    int otherHeight;
+    AVLNode<Key, Value, Augment>* otherRoot = takeNodes(other, otherHeight);
+    AVLNode<Key, Value, Augment>* root = static_cast<AVLNode<Key, Value, Augment>*>(this->root_);
+    int rootHeight = subtreeHeight(root);
+    int height;
+    NodeList doomed;
+    auto body = [&]() {
+      if(op == SET_UNION) {
+        this->root_ = unionNodes(root, rootHeight, otherRoot, otherHeight, height, doomed, exec);
+      }
+      else if(op == SET_INTERSECTION) {
+        this->root_ = intersectNodes(root, rootHeight, otherRoot, otherHeight, height, doomed, exec);
       }
       else {
-        traverse = traverse->getRight();
+        this->root_ = differenceNodes(root, rootHeight, otherRoot, otherHeight, height, doomed, exec);
+      }
+    };
+    runWith(exec, body);
+    this->resetLast();
+    for(std::size_t i = 0; i < doomed.size(); ++i) {
+      this->clearTree(doomed[i]);
+    }
+}
+
+/**
+* Runs leftCall and rightCall, each given a list for the nodes it drops,
+* either one after the other or as two parallel tasks.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+template<typename Exec, typename LeftCall, typename RightCall>
+void AVLTree<Key, Value, Alloc, Augment, Compare>::recurseBoth(Exec& exec, int h1, int h2, NodeList& doomed,
+                                            LeftCall& leftCall, RightCall& rightCall)
+{
+    if(!exec.fork(h1, h2)) {
+      leftCall(doomed);
+      rightCall(doomed);
+      return;
+    }
+    NodeList rightDoomed;
+    auto left = [&]() { leftCall(doomed); };
+    auto right = [&]() { rightCall(rightDoomed); };
+    exec.invoke(left, right);
+    doomed.insert(doomed.end(), rightDoomed.begin(), rightDoomed.end());
+}
+
+/**
+* Node-level union of two detached subtrees. Keys in both keep t2's node.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+template<typename Exec>
+AVLNode<Key, Value, Augment>* AVLTree<Key, Value, Alloc, Augment, Compare>::unionNodes(AVLNode<Key, Value, Augment>* t1, int h1,
+                                                            AVLNode<Key, Value, Augment>* t2, int h2,
+                                                            int& height, NodeList& doomed, Exec& exec)
+{
+    if(t1 == NULL) {
+      height = h2;
+      return t2;
+    }
+    if(t2 == NULL) {
+      height = h1;
+      return t1;
+    }
+    AVLNode<Key, Value, Augment>* l2;
+    AVLNode<Key, Value, Augment>* r2;
+    int l2Height;
+    int r2Height;
+    AVLNode<Key, Value, Augment>* pivot = expose(t2, h2, l2, l2Height, r2, r2Height);
+    AVLNode<Key, Value, Augment>* l1;
+    AVLNode<Key, Value, Augment>* r1;
+    AVLNode<Key, Value, Augment>* found;
+    int l1Height;
+    int r1Height;
+    splitNodes(t1, h1, pivot->getKey(), l1, l1Height, r1, r1Height, found);
+    if(found != NULL) {
+      doomed.push_back(found);
+    }
+    AVLNode<Key, Value, Augment>* left;
+    AVLNode<Key, Value, Augment>* right;
+    int leftHeight;
+    int rightHeight;
+    auto leftCall = [&](NodeList& d) { left = unionNodes(l1, l1Height, l2, l2Height, leftHeight, d, exec); };
+    auto rightCall = [&](NodeList& d) { right = unionNodes(r1, r1Height, r2, r2Height, rightHeight, d, exec); };
+    recurseBoth(exec, h1, h2, doomed, leftCall, rightCall);
+    return joinNodes(left, leftHeight, pivot, right, rightHeight, height);
+}
+
+/**
+* Node-level intersection of two detached subtrees. Surviving keys keep
+* t1's node; all other nodes are dropped.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+template<typename Exec>
+AVLNode<Key, Value, Augment>* AVLTree<Key, Value, Alloc, Augment, Compare>::intersectNodes(AVLNode<Key, Value, Augment>* t1, int h1,
+                                                                AVLNode<Key, Value, Augment>* t2, int h2,
+                                                                int& height, NodeList& doomed, Exec& exec)
+{
+    if(t1 == NULL || t2 == NULL) {
+      if(t1 != NULL) {
+        doomed.push_back(t1);
+      }
+      if(t2 != NULL) {
+        doomed.push_back(t2);
+      }
+      height = 0;
+      return NULL;
+    }
+    AVLNode<Key, Value, Augment>* l2;
+    AVLNode<Key, Value, Augment>* r2;
+    int l2Height;
+    int r2Height;
+    AVLNode<Key, Value, Augment>* pivot = expose(t2, h2, l2, l2Height, r2, r2Height);
+    AVLNode<Key, Value, Augment>* l1;
+    AVLNode<Key, Value, Augment>* r1;
+    AVLNode<Key, Value, Augment>* found;
+    int l1Height;
+    int r1Height;
+    splitNodes(t1, h1, pivot->getKey(), l1, l1Height, r1, r1Height, found);
+    doomed.push_back(pivot);
+    AVLNode<Key, Value, Augment>* left;
+    AVLNode<Key, Value, Augment>* right;
+    int leftHeight;
+    int rightHeight;
+    auto leftCall = [&](NodeList& d) { left = intersectNodes(l1, l1Height, l2, l2Height, leftHeight, d, exec); };
+    auto rightCall = [&](NodeList& d) { right = intersectNodes(r1, r1Height, r2, r2Height, rightHeight, d, exec); };
+    recurseBoth(exec, h1, h2, doomed, leftCall, rightCall);
+    if(found != NULL) {
+      return joinNodes(left, leftHeight, found, right, rightHeight, height);
+    }
+    return join2(left, leftHeight, right, rightHeight, height);
+}
+
+/**
+* Node-level difference t1 - t2 of two detached subtrees. Every node of t2,
+* and every node of t1 whose key is in t2, is dropped.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+template<typename Exec>
+AVLNode<Key, Value, Augment>* AVLTree<Key, Value, Alloc, Augment, Compare>::differenceNodes(AVLNode<Key, Value, Augment>* t1, int h1,
+                                                                 AVLNode<Key, Value, Augment>* t2, int h2,
+                                                                 int& height, NodeList& doomed, Exec& exec)
+{
+    if(t1 == NULL || t2 == NULL) {
+      if(t2 != NULL) {
+        doomed.push_back(t2);
+      }
+      height = h1;
+      return t1;
+    }
+    AVLNode<Key, Value, Augment>* l2;
+    AVLNode<Key, Value, Augment>* r2;
+    int l2Height;
+    int r2Height;
+    AVLNode<Key, Value, Augment>* pivot = expose(t2, h2, l2, l2Height, r2, r2Height);
+    AVLNode<Key, Value, Augment>* l1;
+    AVLNode<Key, Value, Augment>* r1;
+    AVLNode<Key, Value, Augment>* found;
+    int l1Height;
+    int r1Height;
+    splitNodes(t1, h1, pivot->getKey(), l1, l1Height, r1, r1Height, found);
+    doomed.push_back(pivot);
+    if(found != NULL) {
+      doomed.push_back(found);
+    }
+    AVLNode<Key, Value, Augment>* left;
+    AVLNode<Key, Value, Augment>* right;
+    int leftHeight;
+    int rightHeight;
+    auto leftCall = [&](NodeList& d) { left = differenceNodes(l1, l1Height, l2, l2Height, leftHeight, d, exec); };
+    auto rightCall = [&](NodeList& d) { right = differenceNodes(r1, r1Height, r2, r2Height, rightHeight, d, exec); };
+    recurseBoth(exec, h1, h2, doomed, leftCall, rightCall);
+    return join2(left, leftHeight, right, rightHeight, height);
+}
+
+/**
+* Parallel assign_sorted. Node memory is taken from the allocator up front
+* on this thread; the nodes are then constructed and linked by parallel
+* tasks, each owning a disjoint index range, so no task allocates.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+template<typename RandomIt>
+void AVLTree<Key, Value, Alloc, Augment, Compare>::assign_sorted(RandomIt first, RandomIt last, ForkJoinPool& pool, std::size_t cutoff)
+{
+    this->clear();
+    std::size_t n = static_cast<std::size_t>(last - first);
+    this->alloc_.reserve(sizeof(AVLNode<Key, Value, Augment>), n);
+    std::vector<void*> blocks;
+    blocks.reserve(n);
+    std::vector<char> built(n, 0);
+    try {
+      for(std::size_t i = 0; i < n; ++i) {
+        blocks.push_back(this->alloc_.allocate(sizeof(AVLNode<Key, Value, Augment>)));
+      }
+      std::vector<AVLNode<Key, Value, Augment>*> nodes(n);
+      auto body = [&]() {
+        ParallelExec exec(pool, cutoff);
+        auto construct = [&](std::size_t lo, std::size_t hi) {
+          for(std::size_t i = lo; i < hi; ++i) {
+            nodes[i] = new (blocks[i]) AVLNode<Key, Value, Augment>(static_cast<AVLNode<Key, Value, Augment>*>(NULL), first[i]);
+            built[i] = 1;
+          }
+        };
+        parallelFor(exec, 0, n, cutoff, construct);
+        int height;
+        this->root_ = buildParallel(nodes.empty() ? NULL : &nodes[0], n, height, exec, cutoff);
+      };
+      pool.run(body);
+      this->resetLast();
+    }
+    catch(...) {
+      this->root_ = NULL;
+      for(std::size_t i = 0; i < blocks.size(); ++i) {
+        if(built[i]) {
+          static_cast<AVLNode<Key, Value, Augment>*>(blocks[i])->~AVLNode();
+        }
+        this->alloc_.deallocate(blocks[i], sizeof(AVLNode<Key, Value, Augment>));
       }
+      throw;
     }
-    //Set parent node
-    n->setParent(previous);
-    //Insert the node
-    if(n->getKey() < previous->getKey()) {
-      previous->setLeft(n);
+}
+
+/**
+* Links the already constructed, sorted nodes[0, n) into a perfectly
+* balanced subtree with the same shape buildSorted gives, forking the two
+* halves while they hold more than cutoff nodes.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+AVLNode<Key, Value, Augment>* AVLTree<Key, Value, Alloc, Augment, Compare>::buildParallel(AVLNode<Key, Value, Augment>** nodes, std::size_t n, int& height,
+                                                               ParallelExec& exec, std::size_t cutoff)
+{
+    if(n == 0) {
+      height = 0;
+      return NULL;
+    }
+    std::size_t leftCount = n / 2;
+    AVLNode<Key, Value, Augment>* left;
+    AVLNode<Key, Value, Augment>* right;
+    int leftHeight;
+    int rightHeight;
+    auto buildLeft = [&]() { left = buildParallel(nodes, leftCount, leftHeight, exec, cutoff); };
+    auto buildRight = [&]() { right = buildParallel(nodes + leftCount + 1, n - leftCount - 1, rightHeight, exec, cutoff); };
+    if(n > cutoff) {
+      exec.invoke(buildLeft, buildRight);
     }
     else {
-      previous->setRight(n);
+      buildLeft();
+      buildRight();
+    }
+    return link(left, leftHeight, nodes[leftCount], right, rightHeight, height);
+}
+
+/**
+* Detaches the children of t and returns t itself, unlinked, along with
+* the children and their heights.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+AVLNode<Key, Value, Augment>* AVLTree<Key, Value, Alloc, Augment, Compare>::expose(AVLNode<Key, Value, Augment>* t, int height,
+                                                        AVLNode<Key, Value, Augment>*& left, int& leftHeight,
+                                                        AVLNode<Key, Value, Augment>*& right, int& rightHeight)
+{
+    Augment::push(t);
+    left = t->getLeft();
+    right = t->getRight();
+    childHeights(t, height, leftHeight, rightHeight);
+    if(left != NULL) {
+      left->setParent(NULL);
+    }
+    if(right != NULL) {
+      right->setParent(NULL);
+    }
+    int ignored;
+    return link(NULL, 0, t, NULL, 0, ignored);
+}
+
+/**
+* Removes the node with the largest key from the detached subtree t,
+* returning it in last and the remaining subtree as the result.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+AVLNode<Key, Value, Augment>* AVLTree<Key, Value, Alloc, Augment, Compare>::splitLast(AVLNode<Key, Value, Augment>* t, int height,
+                                                           AVLNode<Key, Value, Augment>*& last, int& restHeight)
+{
+    AVLNode<Key, Value, Augment>* left;
+    AVLNode<Key, Value, Augment>* right;
+    int leftHeight;
+    int rightHeight;
+    AVLNode<Key, Value, Augment>* middle = expose(t, height, left, leftHeight, right, rightHeight);
+    if(right == NULL) {
+      last = middle;
+      restHeight = leftHeight;
+      return left;
+    }
+    int restRightHeight;
+    AVLNode<Key, Value, Augment>* restRight = splitLast(right, rightHeight, last, restRightHeight);
+    return joinNodes(left, leftHeight, middle, restRight, restRightHeight, restHeight);
+}
+
+/**
+* Joins two detached subtrees without a middle node by borrowing the
+* largest node of the left one.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+AVLNode<Key, Value, Augment>* AVLTree<Key, Value, Alloc, Augment, Compare>::join2(AVLNode<Key, Value, Augment>* left, int leftHeight,
+                                                       AVLNode<Key, Value, Augment>* right, int rightHeight, int& height)
+{
+    if(left == NULL) {
+      height = rightHeight;
+      return right;
+    }
+    AVLNode<Key, Value, Augment>* last;
+    int restHeight;
+    AVLNode<Key, Value, Augment>* rest = splitLast(left, leftHeight, last, restHeight);
+    return joinNodes(rest, restHeight, last, right, rightHeight, height);
+}
+
+/**
+* Makes n the parent of left and right, sets its balance from the given
+* heights and returns it as the root of a detached subtree.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+AVLNode<Key, Value, Augment>* AVLTree<Key, Value, Alloc, Augment, Compare>::link(AVLNode<Key, Value, Augment>* left, int leftHeight, AVLNode<Key, Value, Augment>* n,
+                                                      AVLNode<Key, Value, Augment>* right, int rightHeight, int& height)
+{
+    n->setParent(NULL);
+    n->setLeft(left);
+    n->setRight(right);
+    if(left != NULL) {
+      left->setParent(n);
+    }
+    if(right != NULL) {
+      right->setParent(n);
+    }
+    n->setBalance(static_cast<int8_t>(rightHeight - leftHeight));
+    n->updateAugment();
+    height = 1 + std::max(leftHeight, rightHeight);
+    return n;
+}
+
+/**
+* Joins two detached AVL subtrees and a middle node into one, returning its
+* root and height.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+AVLNode<Key, Value, Augment>* AVLTree<Key, Value, Alloc, Augment, Compare>::joinNodes(AVLNode<Key, Value, Augment>* left, int leftHeight, AVLNode<Key, Value, Augment>* n,
+                                                           AVLNode<Key, Value, Augment>* right, int rightHeight, int& height)
+{
+    if(leftHeight > rightHeight + 1) {
+      return joinRight(left, leftHeight, n, right, rightHeight, height);
+    }
+    if(rightHeight > leftHeight + 1) {
+      return joinLeft(left, leftHeight, n, right, rightHeight, height);
+    }
+    return link(left, leftHeight, n, right, rightHeight, height);
+}
+
+/**
+* joinNodes for a left subtree more than one level taller than the right:
+* walk down its right spine until the heights are within one, link there,
+* and rotate on the way back up where the spine became too tall.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+AVLNode<Key, Value, Augment>* AVLTree<Key, Value, Alloc, Augment, Compare>::joinRight(AVLNode<Key, Value, Augment>* left, int leftHeight, AVLNode<Key, Value, Augment>* n,
+                                                           AVLNode<Key, Value, Augment>* right, int rightHeight, int& height)
+{
+    Augment::push(left);
+    AVLNode<Key, Value, Augment>* a = left->getLeft();
+    AVLNode<Key, Value, Augment>* c = left->getRight();
+    int aHeight;
+    int cHeight;
+    childHeights(left, leftHeight, aHeight, cHeight);
+    if(a != NULL) {
+      a->setParent(NULL);
+    }
+    if(c != NULL) {
+      c->setParent(NULL);
     }
-    if((int) previous->getBalance() == -1 || (int) previous->getBalance() == 1 ) {
-      previous->setBalance(0);
+
+    int tHeight;
+    if(cHeight <= rightHeight + 1) {
+      AVLNode<Key, Value, Augment>* t = link(c, cHeight, n, right, rightHeight, tHeight);
+      if(tHeight <= aHeight + 1) {
+        return link(a, aHeight, left, t, tHeight, height);
+      }
+      // double rotation: c rises above both left and n
+      Augment::push(c);
+      AVLNode<Key, Value, Augment>* cl = c->getLeft();
+      AVLNode<Key, Value, Augment>* cr = c->getRight();
+      int clHeight;
+      int crHeight;
+      childHeights(c, cHeight, clHeight, crHeight);
+      int lHeight;
+      int rHeight;
+      AVLNode<Key, Value, Augment>* l = link(a, aHeight, left, cl, clHeight, lHeight);
+      AVLNode<Key, Value, Augment>* r = link(cr, crHeight, n, right, rightHeight, rHeight);
+      return link(l, lHeight, c, r, rHeight, height);
+    }
+
+    AVLNode<Key, Value, Augment>* t = joinRight(c, cHeight, n, right, rightHeight, tHeight);
+    if(tHeight <= aHeight + 1) {
+      return link(a, aHeight, left, t, tHeight, height);
+    }
+    // single rotation: t rises above left
+    AVLNode<Key, Value, Augment>* tl = t->getLeft();
+    AVLNode<Key, Value, Augment>* tr = t->getRight();
+    int tlHeight;
+    int trHeight;
+    childHeights(t, tHeight, tlHeight, trHeight);
+    int lHeight;
+    AVLNode<Key, Value, Augment>* l = link(a, aHeight, left, tl, tlHeight, lHeight);
+    return link(l, lHeight, t, tr, trHeight, height);
+}
+
+/**
+* The mirror image of joinRight.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+AVLNode<Key, Value, Augment>* AVLTree<Key, Value, Alloc, Augment, Compare>::joinLeft(AVLNode<Key, Value, Augment>* left, int leftHeight, AVLNode<Key, Value, Augment>* n,
+                                                          AVLNode<Key, Value, Augment>* right, int rightHeight, int& height)
+{
+    Augment::push(right);
+    AVLNode<Key, Value, Augment>* c = right->getLeft();
+    AVLNode<Key, Value, Augment>* b = right->getRight();
+    int cHeight;
+    int bHeight;
+    childHeights(right, rightHeight, cHeight, bHeight);
+    if(c != NULL) {
+      c->setParent(NULL);
+    }
+    if(b != NULL) {
+      b->setParent(NULL);
+    }
+
+    int tHeight;
+    if(cHeight <= leftHeight + 1) {
+      AVLNode<Key, Value, Augment>* t = link(left, leftHeight, n, c, cHeight, tHeight);
+      if(tHeight <= bHeight + 1) {
+        return link(t, tHeight, right, b, bHeight, height);
+      }
+      // double rotation: c rises above both n and right
+      Augment::push(c);
+      AVLNode<Key, Value, Augment>* cl = c->getLeft();
+      AVLNode<Key, Value, Augment>* cr = c->getRight();
+      int clHeight;
+      int crHeight;
+      childHeights(c, cHeight, clHeight, crHeight);
+      int lHeight;
+      int rHeight;
+      AVLNode<Key, Value, Augment>* l = link(left, leftHeight, n, cl, clHeight, lHeight);
+      AVLNode<Key, Value, Augment>* r = link(cr, crHeight, right, b, bHeight, rHeight);
+      return link(l, lHeight, c, r, rHeight, height);
+    }
+
+    AVLNode<Key, Value, Augment>* t = joinLeft(left, leftHeight, n, c, cHeight, tHeight);
+    if(tHeight <= bHeight + 1) {
+      return link(t, tHeight, right, b, bHeight, height);
+    }
+    // single rotation: t rises above right
+    AVLNode<Key, Value, Augment>* tl = t->getLeft();
+    AVLNode<Key, Value, Augment>* tr = t->getRight();
+    int tlHeight;
+    int trHeight;
+    childHeights(t, tHeight, tlHeight, trHeight);
+    int rHeight;
+    AVLNode<Key, Value, Augment>* r = link(tr, trHeight, right, b, bHeight, rHeight);
+    return link(tl, tlHeight, t, r, rHeight, height);
+}
+
+/**
+* Splits the detached subtree t (of the given height) around key into the
+* subtrees less and greater. The node holding key, if any, is unlinked and
+* returned in found.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+void AVLTree<Key, Value, Alloc, Augment, Compare>::splitNodes(AVLNode<Key, Value, Augment>* t, int height, const Key& key,
+                                           AVLNode<Key, Value, Augment>*& less, int& lessHeight,
+                                           AVLNode<Key, Value, Augment>*& greater, int& greaterHeight, AVLNode<Key, Value, Augment>*& found)
+{
+    if(t == NULL) {
+      less = NULL;
+      greater = NULL;
+      lessHeight = 0;
+      greaterHeight = 0;
+      found = NULL;
       return;
     }
-    if(previous->getLeft() == n) {
-      previous->updateBalance(-1);
+    Augment::push(t);
+    AVLNode<Key, Value, Augment>* a = t->getLeft();
+    AVLNode<Key, Value, Augment>* b = t->getRight();
+    int aHeight;
+    int bHeight;
+    childHeights(t, height, aHeight, bHeight);
+    if(a != NULL) {
+      a->setParent(NULL);
+    }
+    if(b != NULL) {
+      b->setParent(NULL);
+    }
+
+    int cmp = AVLTree::compareKeys(key, t->getKey());
+    if(cmp == 0) {
+      less = a;
+      lessHeight = aHeight;
+      greater = b;
+      greaterHeight = bHeight;
+      int ignored;
+      found = link(NULL, 0, t, NULL, 0, ignored);
+    }
+    else if(cmp < 0) {
+      AVLNode<Key, Value, Augment>* rest;
+      int restHeight;
+      splitNodes(a, aHeight, key, less, lessHeight, rest, restHeight, found);
+      greater = joinNodes(rest, restHeight, t, b, bHeight, greaterHeight);
+    }
+    else {
+      AVLNode<Key, Value, Augment>* rest;
+      int restHeight;
+      splitNodes(b, bHeight, key, rest, restHeight, greater, greaterHeight, found);
+      less = joinNodes(a, aHeight, t, rest, restHeight, lessHeight);
+    }
+}
+
+/**
+* Restores the AVL property after the insertion helpers attached a new
+* leaf, then wraps their result for the public API. Nothing is done if
+* the key was already present.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+std::pair<typename AVLTree<Key, Value, Alloc, Augment, Compare>::iterator, bool>
+AVLTree<Key, Value, Alloc, Augment, Compare>::insertRebalance(std::pair<AVLNode<Key, Value, Augment>*, bool> result)
+{
+    AVLNode<Key, Value, Augment>* n = result.first;
+    AVLNode<Key, Value, Augment>* previous = n->getParent();
+    if(Augment::lazy && this->lazyPending_ && !result.second) {
+      pushFromRoot(n);
+    }
+    else if(Augment::lazy && this->lazyPending_ && previous != NULL) {
+      // settle the work pending above the new node without letting it
+      // reach the node
+      if(previous->getLeft() == n) {
+        previous->setLeft(NULL);
+        pushFromRoot(previous);
+        previous->setLeft(n);
+      }
+      else {
+        previous->setRight(NULL);
+        pushFromRoot(previous);
+        previous->setRight(n);
+      }
     }
-    else if (previous->getRight() == n) {
-      previous->updateBalance(1);
+    // n is new or has a new value
+    updatePath(n);
+    if(result.second && previous != NULL) {
+      if((int) previous->getBalance() == -1 || (int) previous->getBalance() == 1 ) {
+        previous->setBalance(0);
+      }
+      else {
+        if(previous->getLeft() == n) {
+          previous->updateBalance(-1);
+        }
+        else {
+          previous->updateBalance(1);
+        }
+        insertFix(previous, n);
+      }
     }
-    insertFix(previous, n);
+    return std::make_pair(this->makeIterator(n), result.second);
 }
 
 /*
  * Recall: The writeup specifies that if a node has 2 children you
  * should swap with the predecessor and then remove.
  */
-template<class Key, class Value>
-void AVLTree<Key, Value>::remove(const Key& key)
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+void AVLTree<Key, Value, Alloc, Augment, Compare>::remove(const Key& key)
 {
-  int diff = 0;
   //Check if key is in tree
-  AVLNode<Key,Value> *n = findKey(static_cast<AVLNode<Key, Value>*>(this->root_),key);
-  if (!n) {
-    return;
+  AVLNode<Key, Value, Augment> *n = findKey(static_cast<AVLNode<Key, Value, Augment>*>(this->root_),key);
+  if (n) {
+    removeNode(n);
   }
+}
+
+/**
+* Unlinks and destroys a node that is known to be in the tree, then
+* rebalances on the way up.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+void AVLTree<Key, Value, Alloc, Augment, Compare>::removeNode(AVLNode<Key, Value, Augment>* n)
+{
+  int diff = 0;
+  pushFromRoot(n);
 
   if(n->getRight() && n->getLeft()){
-    AVLNode<Key,Value> * previous = static_cast<AVLNode<Key, Value>*>(this->predecessor(n));
+    AVLNode<Key, Value, Augment> * previous = n->getLeft();
+    Augment::push(previous);
+    while(previous->getRight() != NULL) {
+      previous = previous->getRight();
+      Augment::push(previous);
+    }
     nodeSwap(n, previous);
   }
 
-  AVLNode<Key,Value>* p = n->getParent();
+  AVLNode<Key, Value, Augment>* p = n->getParent();
   if(p != NULL ) {
     if( p->getLeft() == n ) {
       diff = 1;
@@ -231,7 +1981,10 @@ void AVLTree<Key, Value>::remove(const Key& key)
 
     //Check how many children
   if( n->getLeft() == NULL || n->getRight() == NULL) {
-      AVLNode<Key,Value>* tmp;
+      if(n == this->last_) {
+        this->last_ = this->predecessor(n);
+      }
+      AVLNode<Key, Value, Augment>* tmp;
       if( n->getRight() == NULL ) {
         tmp = n->getLeft();
       }
@@ -244,8 +1997,7 @@ void AVLTree<Key, Value>::remove(const Key& key)
           tmp->setParent(p);
         }
         this->root_ = tmp;
-        n = NULL;
-        delete n;
+        this->destroyNode(n);
       }
       else {
         if( n == p->getLeft() ) {
@@ -257,10 +2009,10 @@ void AVLTree<Key, Value>::remove(const Key& key)
         if(tmp != NULL) {
           tmp->setParent(p);
         }
-        n = NULL;
-        delete n;
+        this->destroyNode(n);
 
       }
+      updatePath(p);
       removeFix(p, diff);
       
     }
@@ -268,22 +2020,38 @@ void AVLTree<Key, Value>::remove(const Key& key)
   
 }
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2)
+/**
+* Recomputes the augmentation data of n and each of its ancestors after
+* the set of nodes below n changed. Free when Augment caches nothing.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+void AVLTree<Key, Value, Alloc, Augment, Compare>::updatePath(AVLNode<Key, Value, Augment>* n)
+{
+    if(!Augment::enabled) {
+      return;
+    }
+    while(n != NULL) {
+      n->updateAugment();
+      n = n->getParent();
+    }
+}
+
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+void AVLTree<Key, Value, Alloc, Augment, Compare>::nodeSwap( AVLNode<Key, Value, Augment>* n1, AVLNode<Key, Value, Augment>* n2)
 {
-    BinarySearchTree<Key, Value>::nodeSwap(n1, n2);
+    BinarySearchTree<Key, Value, Alloc, Compare>::nodeSwap(n1, n2);
     int8_t tempB = n1->getBalance();
     n1->setBalance(n2->getBalance());
     n2->setBalance(tempB);
 }
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::insertFix(AVLNode<Key,Value>* p, AVLNode<Key,Value>* n) {
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+void AVLTree<Key, Value, Alloc, Augment, Compare>::insertFix(AVLNode<Key, Value, Augment>* p, AVLNode<Key, Value, Augment>* n) {
   if( p == NULL || p->getParent() == NULL ) {
     return;
   }
 
-  AVLNode<Key,Value>* g = p->getParent();
+  AVLNode<Key, Value, Augment>* g = p->getParent();
   if( g->getLeft() == p) {
     g->updateBalance(-1);
     //Case 1
@@ -368,13 +2136,13 @@ void AVLTree<Key, Value>::insertFix(AVLNode<Key,Value>* p, AVLNode<Key,Value>* n
 }
 }
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::removeFix(AVLNode<Key, Value>* n, int diff) {
-  int ndiff;
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+void AVLTree<Key, Value, Alloc, Augment, Compare>::removeFix(AVLNode<Key, Value, Augment>* n, int diff) {
+  int ndiff = 0;
   if( n == NULL ) {
     return;
   }
-  AVLNode<Key,Value>* p = n->getParent();
+  AVLNode<Key, Value, Augment>* p = n->getParent();
   if( p != NULL ) {
     if(p->getLeft() == n) {
       ndiff = 1;
@@ -386,7 +2154,7 @@ void AVLTree<Key, Value>::removeFix(AVLNode<Key, Value>* n, int diff) {
   if(diff == -1) {
     //Case 1: balance(n) + diff == -2
     if( (int) n->getBalance() + diff == -2 ) {
-      AVLNode<Key,Value>* c = n->getLeft();
+      AVLNode<Key, Value, Augment>* c = n->getLeft();
       //case 1a: b(c) == -1
       if((int) c->getBalance() == -1) {
         rotateRight(n);
@@ -403,7 +2171,7 @@ void AVLTree<Key, Value>::removeFix(AVLNode<Key, Value>* n, int diff) {
       }
       else if ( (int) c->getBalance() == 1 ) {
         //case 1c b(c) = +1
-        AVLNode<Key,Value>* g = c->getRight();
+        AVLNode<Key, Value, Augment>* g = c->getRight();
         rotateLeft(c);
         rotateRight(n);
         if((int) g->getBalance() == 1) {
@@ -438,7 +2206,7 @@ void AVLTree<Key, Value>::removeFix(AVLNode<Key, Value>* n, int diff) {
   if(diff == 1) {
     //Case 1: balance(n) + diff == 2
     if( (int) n->getBalance() + diff == 2 ) {
-      AVLNode<Key,Value>* c = n->getRight();
+      AVLNode<Key, Value, Augment>* c = n->getRight();
       //case 1a: b(c) == 1
       if((int) c->getBalance() == 1) {
         rotateLeft(n);
@@ -455,7 +2223,7 @@ void AVLTree<Key, Value>::removeFix(AVLNode<Key, Value>* n, int diff) {
       }
       //case 1c b(c) = +1
       else if( (int) c->getBalance() == -1) {
-        AVLNode<Key,Value>* g = c->getLeft();
+        AVLNode<Key, Value, Augment>* g = c->getLeft();
         rotateRight(c);
         rotateLeft(n);
         if((int) g->getBalance() == -1) {
@@ -494,12 +2262,14 @@ void AVLTree<Key, Value>::removeFix(AVLNode<Key, Value>* n, int diff) {
 }
 
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::rotateLeft(AVLNode<Key,Value>* x){
-   AVLNode<Key,Value> *y = x->getRight(); // x  
-  //  AVLNode<Key,Value> *tmp = n->getRight(); // z 
-   AVLNode<Key,Value> *b = y->getLeft(); // b Switches
-   AVLNode<Key,Value> *p = x->getParent();
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+void AVLTree<Key, Value, Alloc, Augment, Compare>::rotateLeft(AVLNode<Key, Value, Augment>* x){
+   Augment::push(x);
+   AVLNode<Key, Value, Augment> *y = x->getRight(); // x  
+   Augment::push(y);
+  //  AVLNode<Key, Value, Augment> *tmp = n->getRight(); // z 
+   AVLNode<Key, Value, Augment> *b = y->getLeft(); // b Switches
+   AVLNode<Key, Value, Augment> *p = x->getParent();
 
   // Link p and y
   y->setParent(p);
@@ -522,17 +2292,21 @@ void AVLTree<Key, Value>::rotateLeft(AVLNode<Key,Value>* x){
   if (b) {
     b->setParent(x);
   }
+  x->updateAugment();
+  y->updateAugment();
 
   return;
           
 }
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::rotateRight(AVLNode<Key,Value>* x){
-   AVLNode<Key,Value> *y = x->getLeft(); // x  
-  //  AVLNode<Key,Value> *tmp = n->getRight(); // z 
-   AVLNode<Key,Value> *b = y->getRight(); // b Switches
-   AVLNode<Key,Value> *p = x->getParent();
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+void AVLTree<Key, Value, Alloc, Augment, Compare>::rotateRight(AVLNode<Key, Value, Augment>* x){
+   Augment::push(x);
+   AVLNode<Key, Value, Augment> *y = x->getLeft(); // x  
+   Augment::push(y);
+  //  AVLNode<Key, Value, Augment> *tmp = n->getRight(); // z 
+   AVLNode<Key, Value, Augment> *b = y->getRight(); // b Switches
+   AVLNode<Key, Value, Augment> *p = x->getParent();
 
   // Link p and y
   y->setParent(p);
@@ -555,28 +2329,603 @@ void AVLTree<Key, Value>::rotateRight(AVLNode<Key,Value>* x){
   if (b) {
     b->setParent(x);
   }
+  x->updateAugment();
+  y->updateAugment();
   return;  
 }
 
 
-template<class Key, class Value>
-AVLNode<Key,Value>* AVLTree<Key, Value>::findKey(AVLNode<Key,Value>* n, const Key& key) {
-  if(n == NULL) {
-    return NULL;
-  }
-  else if(n->getKey() == key) {
-    return n;
-  }
-  //look through the left subtree
-  else if (n->getKey() > key) {
-    
-    n = findKey(n->getLeft(), key);
-    return n;
-  }
-  //look through the right subtree
-  else {
-    n = findKey(n->getRight(), key);
-    return n;
+/**
+* Returns the number of entries, which the root caches.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+std::size_t AVLTree<Key, Value, Alloc, Augment, Compare>::size() const
+{
+    return Augment::subtreeSize(static_cast<AVLNode<Key, Value, Augment>*>(this->root_));
+}
+
+/**
+* Returns the entry with exactly k smaller keys, steering by the sizes of
+* the left subtrees on the way down and settling pending range updates
+* only along that path.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+typename AVLTree<Key, Value, Alloc, Augment, Compare>::iterator
+AVLTree<Key, Value, Alloc, Augment, Compare>::select(std::size_t k) const
+{
+    AVLNode<Key, Value, Augment>* n = static_cast<AVLNode<Key, Value, Augment>*>(this->root_);
+    while(n != NULL) {
+      if(Augment::lazy && lazyPending_) {
+        Augment::push(n);
+      }
+      std::size_t leftSize = Augment::subtreeSize(n->getLeft());
+      if(k < leftSize) {
+        n = n->getLeft();
+      }
+      else if(k == leftSize) {
+        return this->makeIterator(n);
+      }
+      else {
+        k -= leftSize + 1;
+        n = n->getRight();
+      }
+    }
+    return this->end();
+}
+
+/**
+* Returns the number of keys below key, whether or not key is present.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+std::size_t AVLTree<Key, Value, Alloc, Augment, Compare>::rank(const Key& key) const
+{
+    std::size_t below = 0;
+    AVLNode<Key, Value, Augment>* n = static_cast<AVLNode<Key, Value, Augment>*>(this->root_);
+    while(n != NULL) {
+      if(this->compareKeys(key, n->getKey()) <= 0) {
+        n = n->getLeft();
+      }
+      else {
+        below += Augment::subtreeSize(n->getLeft()) + 1;
+        n = n->getRight();
+      }
+    }
+    return below;
+}
+
+/**
+* Returns the number of keys k with lo <= k < hi.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+std::size_t AVLTree<Key, Value, Alloc, Augment, Compare>::count_range(const Key& lo, const Key& hi) const
+{
+    if(this->compareKeys(lo, hi) >= 0) {
+      return 0;
+    }
+    return rank(hi) - rank(lo);
+}
+
+/**
+* Returns an entry chosen uniformly at random with gen, or end() if the
+* tree is empty.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+template<typename URNG>
+typename AVLTree<Key, Value, Alloc, Augment, Compare>::iterator
+AVLTree<Key, Value, Alloc, Augment, Compare>::sample(URNG& gen) const
+{
+    std::size_t n = size();
+    if(n == 0) {
+      return this->end();
+    }
+    std::uniform_int_distribution<std::size_t> pick(0, n - 1);
+    return select(pick(gen));
+}
+
+/**
+* Finds the highest node with a key in [lo, hi); every entry in range is
+* in its subtree. Keys at or above lo in its left subtree and keys below hi
+* in its right subtree are then summed along one path each, taking whole
+* subtrees wherever a path steps past them.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+template<typename A>
+typename A::aggregate_type AVLTree<Key, Value, Alloc, Augment, Compare>::aggregate(const Key& lo, const Key& hi) const
+{
+    typedef typename A::monoid_type Monoid;
+    typedef typename A::aggregate_type Total;
+    AVLNode<Key, Value, Augment>* top = static_cast<AVLNode<Key, Value, Augment>*>(this->root_);
+    while(top != NULL) {
+      Augment::push(top);
+      if(this->compareKeys(top->getKey(), lo) < 0) {
+        top = top->getRight();
+      }
+      else if(this->compareKeys(top->getKey(), hi) >= 0) {
+        top = top->getLeft();
+      }
+      else {
+        break;
+      }
+    }
+    if(top == NULL) {
+      return Monoid::identity();
+    }
+
+    Total fromLo = Monoid::identity();
+    AVLNode<Key, Value, Augment>* n = top->getLeft();
+    while(n != NULL) {
+      Augment::push(n);
+      if(this->compareKeys(n->getKey(), lo) < 0) {
+        n = n->getRight();
+      }
+      else {
+        // n and its right subtree come before everything summed so far
+        Total here = Monoid::combine(Monoid::of(n->getValue()), A::total(n->getRight()));
+        fromLo = Monoid::combine(here, fromLo);
+        n = n->getLeft();
+      }
+    }
+    Total toHi = Monoid::identity();
+    n = top->getRight();
+    while(n != NULL) {
+      Augment::push(n);
+      if(this->compareKeys(n->getKey(), hi) >= 0) {
+        n = n->getLeft();
+      }
+      else {
+        Total here = Monoid::combine(A::total(n->getLeft()), Monoid::of(n->getValue()));
+        toHi = Monoid::combine(toHi, here);
+        n = n->getRight();
+      }
+    }
+    return Monoid::combine(Monoid::combine(fromLo, Monoid::of(top->getValue())), toHi);
+}
+
+/**
+* Returns the aggregate over every entry, which the root caches.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+template<typename A>
+typename A::aggregate_type AVLTree<Key, Value, Alloc, Augment, Compare>::aggregate() const
+{
+    return A::total(static_cast<AVLNode<Key, Value, Augment>*>(this->root_));
+}
+
+/**
+* Finds the highest node with a key in [lo, hi) as aggregate does, then
+* walks the two paths below it: wherever a path steps past a subtree that
+* lies entirely in range, tag is left on that subtree's root. The caches
+* on both paths and above are then recomputed from the bottom up. Throws,
+* changing nothing, if the Action rejects tag for what the tree caches.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+template<typename A>
+void AVLTree<Key, Value, Alloc, Augment, Compare>::range_update(const Key& lo, const Key& hi, const typename A::tag_type& tag)
+{
+    A::validate(tag);
+    AVLNode<Key, Value, Augment>* top = static_cast<AVLNode<Key, Value, Augment>*>(this->root_);
+    while(top != NULL) {
+      A::push(top);
+      if(this->compareKeys(top->getKey(), lo) < 0) {
+        top = top->getRight();
+      }
+      else if(this->compareKeys(top->getKey(), hi) >= 0) {
+        top = top->getLeft();
+      }
+      else {
+        break;
+      }
+    }
+    if(top == NULL) {
+      return;
+    }
+    this->lazyPending_ = true;
+
+    AVLNode<Key, Value, Augment>* last = top;
+    AVLNode<Key, Value, Augment>* n = top->getLeft();
+    while(n != NULL) {
+      A::push(n);
+      last = n;
+      if(this->compareKeys(n->getKey(), lo) < 0) {
+        n = n->getRight();
+      }
+      else {
+        A::action_type::apply(tag, n->getValue());
+        A::applyTag(n->getRight(), tag);
+        n = n->getLeft();
+      }
+    }
+    for(; last != top; last = last->getParent()) {
+      last->updateAugment();
+    }
+
+    n = top->getRight();
+    while(n != NULL) {
+      A::push(n);
+      last = n;
+      if(this->compareKeys(n->getKey(), hi) >= 0) {
+        n = n->getLeft();
+      }
+      else {
+        A::action_type::apply(tag, n->getValue());
+        A::applyTag(n->getLeft(), tag);
+        n = n->getRight();
+      }
+    }
+    for(; last != top; last = last->getParent()) {
+      last->updateAugment();
+    }
+
+    A::action_type::apply(tag, top->getValue());
+    updatePath(top);
+}
+
+/**
+* Returns a copy of the value for key, settling only the range updates
+* pending on its search path. Throws std::out_of_range if key is missing.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+Value AVLTree<Key, Value, Alloc, Augment, Compare>::get(const Key& key) const
+{
+    AVLNode<Key, Value, Augment>* n = static_cast<AVLNode<Key, Value, Augment>*>(this->root_);
+    while(n != NULL) {
+      Augment::push(n);
+      int cmp = this->compareKeys(key, n->getKey());
+      if(cmp == 0) {
+        return n->getValue();
+      }
+      n = (cmp < 0) ? n->getLeft() : n->getRight();
+    }
+    throw std::out_of_range("Invalid key");
+}
+
+/**
+* See BinarySearchTree::begin. Like every lookup here it settles the
+* range updates pending above the entry it returns; iterators settle the
+* rest as they step (see pushNode_).
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+typename AVLTree<Key, Value, Alloc, Augment, Compare>::iterator
+AVLTree<Key, Value, Alloc, Augment, Compare>::begin() const
+{
+    return settled(BinarySearchTree<Key, Value, Alloc, Compare>::begin());
+}
+
+/**
+* See BinarySearchTree::end. --end() settles its way to the last item.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+typename AVLTree<Key, Value, Alloc, Augment, Compare>::iterator
+AVLTree<Key, Value, Alloc, Augment, Compare>::end() const
+{
+    return BinarySearchTree<Key, Value, Alloc, Compare>::end();
+}
+
+/**
+* See BinarySearchTree::cbegin.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+typename AVLTree<Key, Value, Alloc, Augment, Compare>::const_iterator
+AVLTree<Key, Value, Alloc, Augment, Compare>::cbegin() const
+{
+    return begin();
+}
+
+/**
+* See BinarySearchTree::cend.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+typename AVLTree<Key, Value, Alloc, Augment, Compare>::const_iterator
+AVLTree<Key, Value, Alloc, Augment, Compare>::cend() const
+{
+    return end();
+}
+
+/**
+* See BinarySearchTree::rbegin.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+typename AVLTree<Key, Value, Alloc, Augment, Compare>::reverse_iterator
+AVLTree<Key, Value, Alloc, Augment, Compare>::rbegin() const
+{
+    return reverse_iterator(end());
+}
+
+/**
+* See BinarySearchTree::rend.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+typename AVLTree<Key, Value, Alloc, Augment, Compare>::reverse_iterator
+AVLTree<Key, Value, Alloc, Augment, Compare>::rend() const
+{
+    return reverse_iterator(begin());
+}
+
+/**
+* See BinarySearchTree::crbegin.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+typename AVLTree<Key, Value, Alloc, Augment, Compare>::const_reverse_iterator
+AVLTree<Key, Value, Alloc, Augment, Compare>::crbegin() const
+{
+    return const_reverse_iterator(end());
+}
+
+/**
+* See BinarySearchTree::crend.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+typename AVLTree<Key, Value, Alloc, Augment, Compare>::const_reverse_iterator
+AVLTree<Key, Value, Alloc, Augment, Compare>::crend() const
+{
+    return const_reverse_iterator(begin());
+}
+
+/**
+* See BinarySearchTree::find.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+typename AVLTree<Key, Value, Alloc, Augment, Compare>::iterator
+AVLTree<Key, Value, Alloc, Augment, Compare>::find(const Key& key) const
+{
+    return settled(BinarySearchTree<Key, Value, Alloc, Compare>::find(key));
+}
+
+/**
+* See BinarySearchTree::operator[].
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+Value& AVLTree<Key, Value, Alloc, Augment, Compare>::operator[](const Key& key)
+{
+    pushPath(key);
+    return BinarySearchTree<Key, Value, Alloc, Compare>::operator[](key);
+}
+
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+Value const & AVLTree<Key, Value, Alloc, Augment, Compare>::operator[](const Key& key) const
+{
+    pushPath(key);
+    return BinarySearchTree<Key, Value, Alloc, Compare>::operator[](key);
+}
+
+/**
+* See BinarySearchTree::lower_bound.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+typename AVLTree<Key, Value, Alloc, Augment, Compare>::iterator
+AVLTree<Key, Value, Alloc, Augment, Compare>::lower_bound(const Key& key) const
+{
+    return settled(BinarySearchTree<Key, Value, Alloc, Compare>::lower_bound(key));
+}
+
+/**
+* See BinarySearchTree::upper_bound.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+typename AVLTree<Key, Value, Alloc, Augment, Compare>::iterator
+AVLTree<Key, Value, Alloc, Augment, Compare>::upper_bound(const Key& key) const
+{
+    return settled(BinarySearchTree<Key, Value, Alloc, Compare>::upper_bound(key));
+}
+
+/**
+* See BinarySearchTree::equal_range.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+std::pair<typename AVLTree<Key, Value, Alloc, Augment, Compare>::iterator,
+          typename AVLTree<Key, Value, Alloc, Augment, Compare>::iterator>
+AVLTree<Key, Value, Alloc, Augment, Compare>::equal_range(const Key& key) const
+{
+    std::pair<iterator, iterator> found = BinarySearchTree<Key, Value, Alloc, Compare>::equal_range(key);
+    return std::make_pair(settled(found.first), settled(found.second));
+}
+
+/**
+* See BinarySearchTree::floor.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+typename AVLTree<Key, Value, Alloc, Augment, Compare>::iterator
+AVLTree<Key, Value, Alloc, Augment, Compare>::floor(const Key& key) const
+{
+    return settled(BinarySearchTree<Key, Value, Alloc, Compare>::floor(key));
+}
+
+/**
+* See BinarySearchTree::ceiling.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+typename AVLTree<Key, Value, Alloc, Augment, Compare>::iterator
+AVLTree<Key, Value, Alloc, Augment, Compare>::ceiling(const Key& key) const
+{
+    return settled(BinarySearchTree<Key, Value, Alloc, Compare>::ceiling(key));
+}
+
+/**
+* See the heterogeneous BinarySearchTree::find.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+template<typename K, typename C, typename>
+typename AVLTree<Key, Value, Alloc, Augment, Compare>::iterator
+AVLTree<Key, Value, Alloc, Augment, Compare>::find(const K& key) const
+{
+    return settled(BinarySearchTree<Key, Value, Alloc, Compare>::find(key));
+}
+
+/**
+* See the heterogeneous BinarySearchTree::lower_bound.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+template<typename K, typename C, typename>
+typename AVLTree<Key, Value, Alloc, Augment, Compare>::iterator
+AVLTree<Key, Value, Alloc, Augment, Compare>::lower_bound(const K& key) const
+{
+    return settled(BinarySearchTree<Key, Value, Alloc, Compare>::lower_bound(key));
+}
+
+/**
+* See the heterogeneous BinarySearchTree::upper_bound.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+template<typename K, typename C, typename>
+typename AVLTree<Key, Value, Alloc, Augment, Compare>::iterator
+AVLTree<Key, Value, Alloc, Augment, Compare>::upper_bound(const K& key) const
+{
+    return settled(BinarySearchTree<Key, Value, Alloc, Compare>::upper_bound(key));
+}
+
+/**
+* See the heterogeneous BinarySearchTree::equal_range.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+template<typename K, typename C, typename>
+std::pair<typename AVLTree<Key, Value, Alloc, Augment, Compare>::iterator,
+          typename AVLTree<Key, Value, Alloc, Augment, Compare>::iterator>
+AVLTree<Key, Value, Alloc, Augment, Compare>::equal_range(const K& key) const
+{
+    std::pair<iterator, iterator> found = BinarySearchTree<Key, Value, Alloc, Compare>::equal_range(key);
+    return std::make_pair(settled(found.first), settled(found.second));
+}
+
+/**
+* See BinarySearchTree::range.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+typename AVLTree<Key, Value, Alloc, Augment, Compare>::range_view
+AVLTree<Key, Value, Alloc, Augment, Compare>::range(const Key& lo, const Key& hi) const
+{
+    range_view view = BinarySearchTree<Key, Value, Alloc, Compare>::range(lo, hi);
+    settled(view.begin());
+    return view;
+}
+
+/**
+* Builds the snapshot from an in-order walk, after settling pending range
+* updates.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+FrozenTree<Key, Value, Compare> AVLTree<Key, Value, Alloc, Augment, Compare>::freeze() const
+{
+    flushUpdates();
+    return FrozenTree<Key, Value, Compare>(BinarySearchTree<Key, Value, Alloc, Compare>::begin(),
+                                           BinarySearchTree<Key, Value, Alloc, Compare>::end());
+}
+
+/**
+* Pushes every pending range update all the way down, so that values can
+* be read in place. Free unless the policy is lazy and updates are pending.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+void AVLTree<Key, Value, Alloc, Augment, Compare>::flushUpdates() const
+{
+    if(!Augment::lazy || !lazyPending_) {
+      return;
+    }
+    pushAll(static_cast<AVLNode<Key, Value, Augment>*>(this->root_));
+    lazyPending_ = false;
+}
+
+/**
+* Helper that pushes every node of the subtree rooted at root, parents
+* first. It walks in preorder along parent links, so it needs no stack.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+void AVLTree<Key, Value, Alloc, Augment, Compare>::pushAll(AVLNode<Key, Value, Augment>* root)
+{
+    AVLNode<Key, Value, Augment>* n = root;
+    while(n != NULL) {
+      Augment::push(n);
+      if(n->getLeft() != NULL) {
+        n = n->getLeft();
+        continue;
+      }
+      if(n->getRight() != NULL) {
+        n = n->getRight();
+        continue;
+      }
+      // climb to the nearest ancestor with a right subtree still to visit
+      AVLNode<Key, Value, Augment>* next = NULL;
+      while(n != root) {
+        AVLNode<Key, Value, Augment>* parent = n->getParent();
+        if(n == parent->getLeft() && parent->getRight() != NULL) {
+          next = parent->getRight();
+          break;
+        }
+        n = parent;
+      }
+      n = next;
+    }
+}
+
+/**
+* Helper that pushes n and each of its ancestors, from the root down.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+void AVLTree<Key, Value, Alloc, Augment, Compare>::pushFromRoot(AVLNode<Key, Value, Augment>* n)
+{
+    if(!Augment::lazy || n == NULL) {
+      return;
+    }
+    pushFromRoot(n->getParent());
+    Augment::push(n);
+}
+
+/**
+* Helper installed as pushNode_ for lazy policies, so iterators settle
+* each node they step down from.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+void AVLTree<Key, Value, Alloc, Augment, Compare>::pushOne(Node<Key, Value>* n)
+{
+    Augment::push(static_cast<AVLNode<Key, Value, Augment>*>(n));
+}
+
+/**
+* Helper that settles the range updates pending above the entry it points
+* to, and the entry itself, in O(log n); returns it.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+typename AVLTree<Key, Value, Alloc, Augment, Compare>::iterator
+AVLTree<Key, Value, Alloc, Augment, Compare>::settled(iterator it) const
+{
+    if(Augment::lazy && lazyPending_) {
+      pushFromRoot(static_cast<AVLNode<Key, Value, Augment>*>(this->iteratorNode(it)));
+    }
+    return it;
+}
+
+/**
+* Helper that pushes every node on the search path for key, so its value
+* can be overwritten and its ancestors' caches recomputed.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+void AVLTree<Key, Value, Alloc, Augment, Compare>::pushPath(const Key& key) const
+{
+    if(!Augment::lazy || !lazyPending_) {
+      return;
+    }
+    AVLNode<Key, Value, Augment>* n = static_cast<AVLNode<Key, Value, Augment>*>(this->root_);
+    while(n != NULL) {
+      Augment::push(n);
+      int cmp = this->compareKeys(key, n->getKey());
+      if(cmp == 0) {
+        return;
+      }
+      n = (cmp < 0) ? n->getLeft() : n->getRight();
+    }
+}
+
+/**
+* Helper that looks key up in the subtree rooted at n, or returns NULL.
+*/
+template<class Key, class Value, class Alloc, class Augment, class Compare>
+AVLNode<Key, Value, Augment>* AVLTree<Key, Value, Alloc, Augment, Compare>::findKey(AVLNode<Key, Value, Augment>* n, const Key& key) {
+  while(n != NULL) {
+    int cmp = this->compareKeys(key, n->getKey());
+    if(cmp == 0) {
+      return n;
+    }
+    //look through the left or right subtree
+    n = (cmp < 0) ? n->getLeft() : n->getRight();
   }
   return NULL;
 }
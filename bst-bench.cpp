@@ -0,0 +1,1127 @@
+#include <iostream>
+#include <map>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include <chrono>
+#include <random>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include "bst.h"
+#include "avlbst.h"
+#include "interval_tree.h"
+#include "string_tree.h"
+#include "btree.h"
+#include "compact_avl.h"
+#include "rcu_tree.h"
+#include "concurrent_avl.h"
+#include "persistent_avl.h"
+
+using namespace std;
+
+// Keeps the optimizer from discarding the work being timed.
+static volatile long long sink;
+
+double elapsedMs(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+void reportLine(const string& name, double ms, size_t ops)
+{
+    cout << "  " << name << ": " << ms << " ms (" << (ms * 1e6 / ops) << " ns/op)" << endl;
+}
+
+// Bytes each entry costs in node storage. A std::map node carries a color
+// and three links in front of its pair.
+void benchNodeSize()
+{
+    cout << "Bytes per entry (int -> int):" << endl;
+    cout << "  Node<int,int>:    " << sizeof(Node<int,int>) << endl;
+    cout << "  AVLNode<int,int>: " << sizeof(AVLNode<int,int>) << endl;
+    cout << "  std::map node:    " << (sizeof(std::pair<const int,int>) + 4 * sizeof(void*)) << endl;
+}
+
+void benchLookup(size_t n)
+{
+    vector<int> keys(n);
+    for(size_t i = 0; i < n; ++i) {
+        keys[i] = (int)i;
+    }
+    mt19937 gen(42);
+    shuffle(keys.begin(), keys.end(), gen);
+
+    AVLTree<int,int> tree;
+    map<int,int> stdMap;
+    for(size_t i = 0; i < n; ++i) {
+        tree.insert(make_pair(keys[i], (int)i));
+        stdMap.insert(make_pair(keys[i], (int)i));
+    }
+    shuffle(keys.begin(), keys.end(), gen);
+
+    cout << "Random lookups, n = " << n << ":" << endl;
+    long long sum = 0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        sum += tree.find(keys[i])->second;
+    }
+    reportLine("AVLTree::find", elapsedMs(start), n);
+
+    start = chrono::steady_clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        sum += stdMap.find(keys[i])->second;
+    }
+    reportLine("std::map::find", elapsedMs(start), n);
+    sink = sum;
+}
+
+// The same int -> int workload on the AVL tree, the B+ tree and std::map.
+// BTreeMap packs dozens of items into each cache-line-sized node, so a
+// lookup touches a handful of nodes instead of one per level.
+void benchBTree(size_t n)
+{
+    vector<int> keys(n);
+    for(size_t i = 0; i < n; ++i) {
+        keys[i] = (int)i;
+    }
+    mt19937 gen(31);
+    shuffle(keys.begin(), keys.end(), gen);
+
+    cout << "B+ tree, n = " << n << " (nodes of " << BTreeMap<int,int>::leafBytes() << " bytes):" << endl;
+    AVLTree<int,int> tree;
+    BTreeMap<int,int> btree;
+    map<int,int> stdMap;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        tree.insert(make_pair(keys[i], (int)i));
+    }
+    reportLine("AVLTree::insert", elapsedMs(start), n);
+    start = chrono::steady_clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        btree.insert(make_pair(keys[i], (int)i));
+    }
+    reportLine("BTreeMap::insert", elapsedMs(start), n);
+    start = chrono::steady_clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        stdMap.insert(make_pair(keys[i], (int)i));
+    }
+    reportLine("std::map::insert", elapsedMs(start), n);
+    shuffle(keys.begin(), keys.end(), gen);
+
+    long long sum = 0;
+    start = chrono::steady_clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        sum += tree.find(keys[i])->second;
+    }
+    reportLine("AVLTree::find", elapsedMs(start), n);
+    start = chrono::steady_clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        sum += btree.find(keys[i])->second;
+    }
+    reportLine("BTreeMap::find", elapsedMs(start), n);
+    start = chrono::steady_clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        sum += stdMap.find(keys[i])->second;
+    }
+    reportLine("std::map::find", elapsedMs(start), n);
+
+    start = chrono::steady_clock::now();
+    for(AVLTree<int,int>::iterator it = tree.begin(); it != tree.end(); ++it) {
+        sum += it->second;
+    }
+    reportLine("AVLTree scan", elapsedMs(start), n);
+    start = chrono::steady_clock::now();
+    for(BTreeMap<int,int>::iterator it = btree.begin(); it != btree.end(); ++it) {
+        sum += it->second;
+    }
+    reportLine("BTreeMap scan", elapsedMs(start), n);
+
+    start = chrono::steady_clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        tree.remove(keys[i]);
+    }
+    reportLine("AVLTree::remove", elapsedMs(start), n);
+    start = chrono::steady_clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        btree.remove(keys[i]);
+    }
+    reportLine("BTreeMap::remove", elapsedMs(start), n);
+    start = chrono::steady_clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        stdMap.erase(keys[i]);
+    }
+    reportLine("std::map::erase", elapsedMs(start), n);
+    sink = sum;
+}
+
+// Point lookups in a tree against the FrozenTree snapshot of it.
+void benchFreeze(size_t n)
+{
+    vector<int> keys(n);
+    for(size_t i = 0; i < n; ++i) {
+        keys[i] = (int)i;
+    }
+    mt19937 gen(37);
+    shuffle(keys.begin(), keys.end(), gen);
+    AVLTree<int,int> tree;
+    for(size_t i = 0; i < n; ++i) {
+        tree.insert(make_pair(keys[i], (int)i));
+    }
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    FrozenTree<int,int> frozen = tree.freeze();
+    double freezeMs = elapsedMs(start);
+    shuffle(keys.begin(), keys.end(), gen);
+
+    cout << "Frozen snapshot, n = " << n << " (built in " << freezeMs << " ms):" << endl;
+    cout << "  bytes per entry: AVLTree " << sizeof(AVLNode<int,int>) << ", FrozenTree "
+         << (frozen.bytes() / n) << endl;
+    long long sum = 0;
+    start = chrono::steady_clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        sum += tree.find(keys[i])->second;
+    }
+    reportLine("AVLTree::find", elapsedMs(start), n);
+    start = chrono::steady_clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        sum += frozen.find(keys[i])->second;
+    }
+    reportLine("FrozenTree::find", elapsedMs(start), n);
+    start = chrono::steady_clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        sum += frozen.lower_bound(keys[i])->first;
+    }
+    reportLine("FrozenTree::lower_bound", elapsedMs(start), n);
+    sink = sum;
+}
+
+// AVLTree against CompactAVLTree, whose nodes link by 32-bit indices into
+// one array, filled with and without reserving the array first.
+void benchCompact(size_t n)
+{
+    vector<int> keys(n);
+    for(size_t i = 0; i < n; ++i) {
+        keys[i] = (int)i;
+    }
+    mt19937 gen(41);
+    shuffle(keys.begin(), keys.end(), gen);
+
+    cout << "Index-linked nodes, n = " << n << ":" << endl;
+    cout << "  bytes per node: AVLNode<int,int> " << sizeof(AVLNode<int,int>)
+         << ", CompactAVLTree<int,int> " << CompactAVLTree<int,int>::nodeBytes() << endl;
+    AVLTree<int,int> tree;
+    CompactAVLTree<int,int> compact;
+    CompactAVLTree<int,int> reserved;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        tree.insert(make_pair(keys[i], (int)i));
+    }
+    reportLine("AVLTree::insert", elapsedMs(start), n);
+    start = chrono::steady_clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        compact.insert(make_pair(keys[i], (int)i));
+    }
+    reportLine("CompactAVLTree::insert", elapsedMs(start), n);
+    start = chrono::steady_clock::now();
+    reserved.reserve(n);
+    for(size_t i = 0; i < n; ++i) {
+        reserved.insert(make_pair(keys[i], (int)i));
+    }
+    reportLine("after reserve(n)", elapsedMs(start), n);
+    shuffle(keys.begin(), keys.end(), gen);
+
+    long long sum = 0;
+    start = chrono::steady_clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        sum += tree.find(keys[i])->second;
+    }
+    reportLine("AVLTree::find", elapsedMs(start), n);
+    start = chrono::steady_clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        sum += compact.find(keys[i])->second;
+    }
+    reportLine("CompactAVLTree::find", elapsedMs(start), n);
+
+    start = chrono::steady_clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        tree.remove(keys[i]);
+    }
+    reportLine("AVLTree::remove", elapsedMs(start), n);
+    start = chrono::steady_clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        compact.remove(keys[i]);
+    }
+    reportLine("CompactAVLTree::remove", elapsedMs(start), n);
+    sink = sum;
+}
+
+// A consistent copy for a long scan: AVLTree copied item by item against
+// PersistentAVLTree::snapshot(), and what live snapshots cost updates.
+void benchSnapshot(size_t n)
+{
+    vector<int> keys(n);
+    for(size_t i = 0; i < n; ++i) {
+        keys[i] = (int)i;
+    }
+    mt19937 gen(43);
+    shuffle(keys.begin(), keys.end(), gen);
+
+    cout << "Snapshots, n = " << n << ":" << endl;
+    AVLTree<int,int> tree;
+    PersistentAVLTree<int,int> persistent;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        tree.insert(make_pair(keys[i], (int)i));
+    }
+    reportLine("AVLTree::insert", elapsedMs(start), n);
+    start = chrono::steady_clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        persistent.insert(make_pair(keys[i], (int)i));
+    }
+    reportLine("PersistentAVLTree::insert", elapsedMs(start), n);
+
+    start = chrono::steady_clock::now();
+    {
+        AVLTree<int,int> copy;
+        for(AVLTree<int,int>::iterator it = tree.begin(); it != tree.end(); ++it) {
+            copy.insert(*it);
+        }
+        sink = copy.find(keys[0])->second;
+    }
+    cout << "  AVLTree item-by-item copy: " << elapsedMs(start) << " ms" << endl;
+    const size_t rounds = 1000;
+    start = chrono::steady_clock::now();
+    for(size_t i = 0; i < rounds; ++i) {
+        PersistentAVLTree<int,int>::Snapshot view = persistent.snapshot();
+        sink = view.size();
+    }
+    reportLine("PersistentAVLTree::snapshot", elapsedMs(start), rounds);
+
+    size_t updates = min(n, (size_t)200000);
+    start = chrono::steady_clock::now();
+    for(size_t i = 0; i < updates; ++i) {
+        tree.insert(make_pair(keys[i], 0));
+    }
+    reportLine("AVLTree overwrite", elapsedMs(start), updates);
+    start = chrono::steady_clock::now();
+    for(size_t i = 0; i < updates; ++i) {
+        persistent.insert(make_pair(keys[i], 0));
+    }
+    reportLine("PersistentAVLTree overwrite", elapsedMs(start), updates);
+    start = chrono::steady_clock::now();
+    {
+        PersistentAVLTree<int,int>::Snapshot view;
+        for(size_t i = 0; i < updates; ++i) {
+            if(i % 1000 == 0) {
+                view = persistent.snapshot();
+            }
+            persistent.insert(make_pair(keys[i], 1));
+        }
+    }
+    reportLine("  with a new snapshot every 1000", elapsedMs(start), updates);
+}
+
+void benchCopy(size_t n)
+{
+    vector<int> keys(n);
+    for(size_t i = 0; i < n; ++i) {
+        keys[i] = (int)i;
+    }
+    mt19937 gen(47);
+    shuffle(keys.begin(), keys.end(), gen);
+
+    cout << "Copy and move, n = " << n << ":" << endl;
+    AVLTree<int,int> tree;
+    for(size_t i = 0; i < n; ++i) {
+        tree.insert(make_pair(keys[i], (int)i));
+    }
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    {
+        AVLTree<int,int> copy;
+        for(AVLTree<int,int>::iterator it = tree.begin(); it != tree.end(); ++it) {
+            copy.insert(*it);
+        }
+        sink = copy.find(keys[0])->second;
+    }
+    reportLine("Item-by-item copy", elapsedMs(start), n);
+    start = chrono::steady_clock::now();
+    {
+        AVLTree<int,int> copy(tree);
+        sink = copy.find(keys[0])->second;
+    }
+    reportLine("AVLTree copy constructor", elapsedMs(start), n);
+
+    const size_t rounds = 1000;
+    start = chrono::steady_clock::now();
+    for(size_t i = 0; i < rounds; ++i) {
+        AVLTree<int,int> moved(std::move(tree));
+        tree = std::move(moved);
+    }
+    sink = tree.find(keys[0])->second;
+    reportLine("AVLTree move there and back", elapsedMs(start), rounds);
+}
+
+void benchBalanceCheck(size_t n)
+{
+    cout << "Balance check and clear, n = " << n << ":" << endl;
+    AVLTree<int,int> tree;
+    for(size_t i = 0; i < n; ++i) {
+        tree.insert(make_pair((int)i, (int)i));
+    }
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    sink = tree.isBalanced();
+    reportLine("AVLTree::isBalanced", elapsedMs(start), n);
+
+    // sorted keys make a plain BST one long chain
+    size_t depth = min(n, (size_t)20000);
+    BinarySearchTree<int,string> chain;
+    for(size_t i = 0; i < depth; ++i) {
+        chain.insert(make_pair((int)i, string("x")));
+    }
+    start = chrono::steady_clock::now();
+    sink = chain.isBalanced();
+    reportLine("BinarySearchTree::isBalanced, one chain", elapsedMs(start), depth);
+    start = chrono::steady_clock::now();
+    chain.clear();
+    reportLine("BinarySearchTree::clear, one chain", elapsedMs(start), depth);
+}
+
+// Runs fn(id, stop) on threads 0..readers while one more thread calls
+// write(stop), for ms milliseconds; returns the total that fn reported.
+template<typename ReadFn, typename WriteFn>
+long long runReaders(unsigned readers, int ms, ReadFn fn, WriteFn write)
+{
+    atomic<bool> stop(false);
+    atomic<long long> total(0);
+    vector<thread> threads;
+    for(unsigned r = 0; r < readers; ++r) {
+        threads.push_back(thread([&, r]() { total += fn(r, stop); }));
+    }
+    thread writer([&]() { write(stop); });
+    this_thread::sleep_for(chrono::milliseconds(ms));
+    stop = true;
+    for(size_t i = 0; i < threads.size(); ++i) {
+        threads[i].join();
+    }
+    writer.join();
+    return total;
+}
+
+// Lookups from 1 to 8 reader threads while a writer keeps replacing
+// entries: an AVLTree behind a mutex against RcuAVLTree, whose readers
+// take no lock.
+void benchConcurrentReads(size_t n)
+{
+    const int window = 300;
+    int keys = (int)min(n, (size_t)100000);
+    AVLTree<int,int> locked;
+    mutex lock;
+    RcuAVLTree<int,int> rcu;
+    for(int i = 0; i < keys; ++i) {
+        locked.insert(make_pair(i, i));
+        rcu.insert(make_pair(i, i));
+    }
+
+    cout << "Concurrent lookups with one writer, " << keys << " keys, "
+         << thread::hardware_concurrency() << " hardware threads (lookups per ms):" << endl;
+    for(unsigned readers = 1; readers <= 8; readers *= 2) {
+        long long viaMutex = runReaders(readers, window,
+            [&](unsigned id, atomic<bool>& stop) {
+                mt19937 gen(id);
+                long long done = 0;
+                while(!stop.load(memory_order_relaxed)) {
+                    int key = (int)(gen() % keys);
+                    lock_guard<mutex> guard(lock);
+                    sink = locked.find(key)->second;
+                    ++done;
+                }
+                return done;
+            },
+            [&](atomic<bool>& stop) {
+                mt19937 gen(99);
+                while(!stop.load(memory_order_relaxed)) {
+                    int key = (int)(gen() % keys);
+                    lock_guard<mutex> guard(lock);
+                    locked.insert(make_pair(key, key));
+                }
+            });
+        long long viaRcu = runReaders(readers, window,
+            [&](unsigned id, atomic<bool>& stop) {
+                mt19937 gen(id);
+                long long done = 0;
+                int value = 0;
+                while(!stop.load(memory_order_relaxed)) {
+                    rcu.find((int)(gen() % keys), value);
+                    sink = value;
+                    ++done;
+                }
+                return done;
+            },
+            [&](atomic<bool>& stop) {
+                mt19937 gen(99);
+                while(!stop.load(memory_order_relaxed)) {
+                    int key = (int)(gen() % keys);
+                    rcu.insert(make_pair(key, key));
+                }
+            });
+        cout << "  " << readers << " readers: mutex-wrapped AVLTree " << (viaMutex / window)
+             << ", RcuAVLTree " << (viaRcu / window) << endl;
+    }
+}
+
+// A mix of 80% lookups, 10% inserts and 10% removes from 1 to 32 threads:
+// an AVLTree behind a mutex against ConcurrentAVLTree, which locks only the
+// nodes an update touches.
+void benchConcurrentMixed(size_t n)
+{
+    const int window = 300;
+    int keys = (int)min(n, (size_t)100000);
+    AVLTree<int,int> locked;
+    mutex lock;
+    ConcurrentAVLTree<int,int> shared;
+    for(int i = 0; i < keys; i += 2) {
+        locked.insert(make_pair(i, i));
+        shared.insert(make_pair(i, i));
+    }
+    auto nothing = [](atomic<bool>&) {};
+
+    cout << "Concurrent mixed operations, " << keys << " keys, "
+         << thread::hardware_concurrency() << " hardware threads (operations per ms):" << endl;
+    for(unsigned workers = 1; workers <= 32; workers *= 2) {
+        long long viaMutex = runReaders(workers, window,
+            [&](unsigned id, atomic<bool>& stop) {
+                mt19937 gen(id);
+                long long done = 0;
+                while(!stop.load(memory_order_relaxed)) {
+                    int key = (int)(gen() % keys);
+                    unsigned op = gen() % 10;
+                    lock_guard<mutex> guard(lock);
+                    if(op == 0) {
+                        locked.insert(make_pair(key, key));
+                    }
+                    else if(op == 1) {
+                        locked.remove(key);
+                    }
+                    else {
+                        sink = (locked.find(key) != locked.end());
+                    }
+                    ++done;
+                }
+                return done;
+            }, nothing);
+        long long viaConcurrent = runReaders(workers, window,
+            [&](unsigned id, atomic<bool>& stop) {
+                mt19937 gen(id);
+                long long done = 0;
+                int value = 0;
+                while(!stop.load(memory_order_relaxed)) {
+                    int key = (int)(gen() % keys);
+                    unsigned op = gen() % 10;
+                    if(op == 0) {
+                        shared.insert(make_pair(key, key));
+                    }
+                    else if(op == 1) {
+                        shared.remove(key);
+                    }
+                    else {
+                        sink = shared.find(key, value);
+                    }
+                    ++done;
+                }
+                return done;
+            }, nothing);
+        cout << "  " << workers << " threads: mutex-wrapped AVLTree " << (viaMutex / window)
+             << ", ConcurrentAVLTree " << (viaConcurrent / window) << endl;
+    }
+}
+
+// Lookups of string keys passed as const char*: the default comparator
+// builds a std::string per call, StringCompare compares in place.
+void benchStringLookup(size_t n)
+{
+    vector<string> keys(n);
+    for(size_t i = 0; i < n; ++i) {
+        keys[i] = "customer-account-" + to_string(i);
+    }
+    mt19937 gen(23);
+    shuffle(keys.begin(), keys.end(), gen);
+    AVLTree<string,int> tree;
+    AVLTree<string,int,NodePool,NoAugment,StringCompare> transparent;
+    for(size_t i = 0; i < n; ++i) {
+        tree.insert(make_pair(keys[i], (int)i));
+        transparent.insert(make_pair(keys[i], (int)i));
+    }
+    shuffle(keys.begin(), keys.end(), gen);
+
+    cout << "String lookups by const char*, n = " << n << ":" << endl;
+    long long sum = 0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        sum += tree.find(keys[i].c_str())->second;
+    }
+    reportLine("AVLTree<string,int>::find", elapsedMs(start), n);
+
+    start = chrono::steady_clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        sum += transparent.find(keys[i].c_str())->second;
+    }
+    reportLine("with StringCompare", elapsedMs(start), n);
+    sink = sum;
+}
+
+// URL-like keys, without the scheme so that they differ early:
+// AVLTree<string,int> against StringTree<int>, whose nodes keep an inline
+// prefix and whose key bytes share one arena.
+void benchStringTree(size_t n)
+{
+    vector<string> keys(n);
+    for(size_t i = 0; i < n; ++i) {
+        keys[i] = "https://shop" + to_string(i % 9973) + ".example.com/items/" + to_string(i);
+    }
+    AVLTree<string,int> tree;
+    StringTree<int> packed;
+    size_t keyBytes = 0;
+    for(size_t i = 0; i < n; ++i) {
+        tree.insert(make_pair(keys[i], (int)i));
+        packed.insert(keys[i], (int)i);
+        keyBytes += keys[i].size();
+    }
+    mt19937 gen(29);
+    shuffle(keys.begin(), keys.end(), gen);
+
+    cout << "URL-keyed lookups, n = " << n << ":" << endl;
+    cout << "  bytes per entry: AVLTree<string,int> " << sizeof(AVLNode<string,int>) << " + "
+         << (keyBytes / n + 1) << "-byte heap block, StringTree<int> "
+         << sizeof(AVLNode<ArenaKey,int>) << " + " << (packed.arenaBytes() / n) << " arena bytes" << endl;
+    long long sum = 0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        sum += tree.find(keys[i])->second;
+    }
+    reportLine("AVLTree<string,int>::find", elapsedMs(start), n);
+
+    start = chrono::steady_clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        sum += packed.find(keys[i])->second;
+    }
+    reportLine("StringTree<int>::find", elapsedMs(start), n);
+    sink = sum;
+
+    // replace every key once: removed bytes are compacted away
+    size_t before = packed.arenaBytes();
+    start = chrono::steady_clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        packed.remove(keys[i]);
+        keys[i] += "/v2";
+        packed.insert(keys[i], (int)i);
+    }
+    reportLine("StringTree<int> remove + insert", elapsedMs(start), n);
+    size_t churned = packed.arenaBytes();
+    packed.compact();
+    cout << "  arena bytes: " << before << " before, " << churned << " after churn, "
+         << packed.arenaBytes() << " after compact(); common prefix \""
+         << packed.commonPrefix() << "\"" << endl;
+}
+
+void benchSortedLoad(size_t n)
+{
+    vector<pair<int,int> > items(n);
+    for(size_t i = 0; i < n; ++i) {
+        items[i] = make_pair((int)i, (int)i);
+    }
+
+    cout << "Sorted load, n = " << n << ":" << endl;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    {
+        AVLTree<int,int> tree;
+        for(size_t i = 0; i < n; ++i) {
+            tree.insert(items[i]);
+        }
+        reportLine("AVLTree::insert", elapsedMs(start), n);
+    }
+
+    start = chrono::steady_clock::now();
+    {
+        AVLTree<int,int> tree;
+        tree.assign_sorted(items.begin(), items.end());
+        reportLine("AVLTree::assign_sorted", elapsedMs(start), n);
+    }
+}
+
+// Applies a change set touching every other key of an n-entry tree.
+void benchBatch(size_t n)
+{
+    vector<pair<int,int> > items(n);
+    for(size_t i = 0; i < n; ++i) {
+        items[i] = make_pair((int)(2 * i), (int)i);
+    }
+    vector<BatchOp<int,int> > ops(n);
+    mt19937 gen(7);
+    for(size_t i = 0; i < n; ++i) {
+        BatchOp<int,int> op = { (int)(gen() % (2 * n)), (int)i, (gen() % 4) == 0 };
+        ops[i] = op;
+    }
+
+    cout << "Dense change set, n = " << n << ":" << endl;
+    AVLTree<int,int> perKey;
+    perKey.assign_sorted(items.begin(), items.end());
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        if(ops[i].erase) {
+            perKey.remove(ops[i].key);
+        }
+        else {
+            perKey.insert(make_pair(ops[i].key, ops[i].value));
+        }
+    }
+    reportLine("insert/remove per key", elapsedMs(start), n);
+
+    AVLTree<int,int> batched;
+    batched.assign_sorted(items.begin(), items.end());
+    start = chrono::steady_clock::now();
+    batched.apply_batch(ops.begin(), ops.end());
+    reportLine("AVLTree::apply_batch", elapsedMs(start), n);
+}
+
+// Applies change sets of n / 1000 to n / 10 keys to an n-entry tree, both
+// scattered over the whole key space and packed into one key range.
+void benchBatchSizes(size_t n)
+{
+    vector<pair<int,int> > items(n);
+    for(size_t i = 0; i < n; ++i) {
+        items[i] = make_pair((int)(2 * i), (int)i);
+    }
+    mt19937 gen(13);
+    for(size_t m = n / 1000; m <= n / 10; m *= 10) {
+        if(m == 0) {
+            continue;
+        }
+        for(int packed = 0; packed < 2; ++packed) {
+            vector<BatchOp<int,int> > ops(m);
+            int from = (int)(gen() % n);
+            for(size_t i = 0; i < m; ++i) {
+                int key = packed ? from + (int)i : (int)(gen() % (2 * n));
+                BatchOp<int,int> op = { key, (int)i, (gen() % 4) == 0 };
+                ops[i] = op;
+            }
+            cout << "Change set of " << m << (packed ? " packed" : " scattered")
+                 << " keys, n = " << n << ":" << endl;
+            AVLTree<int,int> perKey;
+            perKey.assign_sorted(items.begin(), items.end());
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            for(size_t i = 0; i < m; ++i) {
+                if(ops[i].erase) {
+                    perKey.remove(ops[i].key);
+                }
+                else {
+                    perKey.insert(make_pair(ops[i].key, ops[i].value));
+                }
+            }
+            reportLine("insert/remove per key", elapsedMs(start), m);
+
+            AVLTree<int,int> batched;
+            batched.assign_sorted(items.begin(), items.end());
+            start = chrono::steady_clock::now();
+            batched.apply_batch(ops.begin(), ops.end());
+            reportLine("AVLTree::apply_batch", elapsedMs(start), m);
+        }
+    }
+}
+
+// Merges a delta of n / 100 keys into an n-entry base tree.
+void benchUnion(size_t n)
+{
+    vector<pair<int,int> > items(n);
+    for(size_t i = 0; i < n; ++i) {
+        items[i] = make_pair((int)(2 * i), (int)i);
+    }
+    size_t m = n / 100 + 1;
+    mt19937 gen(11);
+    vector<pair<int,int> > delta(m);
+    for(size_t i = 0; i < m; ++i) {
+        delta[i] = make_pair((int)(gen() % (2 * n)), -1);
+    }
+
+    cout << "Union of a " << m << "-key delta into n = " << n << ":" << endl;
+    AVLTree<int,int> perKey;
+    perKey.assign_sorted(items.begin(), items.end());
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for(size_t i = 0; i < m; ++i) {
+        perKey.insert(delta[i]);
+    }
+    reportLine("insert per key", elapsedMs(start), m);
+
+    AVLTree<int,int> base;
+    base.assign_sorted(items.begin(), items.end());
+    AVLTree<int,int> deltaTree;
+    for(size_t i = 0; i < m; ++i) {
+        deltaTree.insert(delta[i]);
+    }
+    start = chrono::steady_clock::now();
+    base.unionWith(deltaTree);
+    reportLine("AVLTree::unionWith", elapsedMs(start), m);
+}
+
+// Reads of 100 consecutive keys: a walk from begin() against range(lo, hi).
+void benchRangeScan(size_t n)
+{
+    vector<pair<int,int> > items(n);
+    for(size_t i = 0; i < n; ++i) {
+        items[i] = make_pair((int)(2 * i), (int)i);
+    }
+    AVLTree<int,int> tree;
+    tree.assign_sorted(items.begin(), items.end());
+    size_t queries = 200;
+    vector<int> starts(queries);
+    mt19937 gen(3);
+    for(size_t i = 0; i < queries; ++i) {
+        starts[i] = (int)(gen() % (2 * n));
+    }
+
+    cout << "Range reads of 100 keys, n = " << n << ":" << endl;
+    long long sum = 0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for(size_t i = 0; i < queries; ++i) {
+        for(AVLTree<int,int>::iterator it = tree.begin(); it != tree.end() && it->first < starts[i] + 200; ++it) {
+            if(it->first >= starts[i]) {
+                sum += it->second;
+            }
+        }
+    }
+    reportLine("walk from begin()", elapsedMs(start), queries);
+
+    start = chrono::steady_clock::now();
+    for(size_t i = 0; i < queries; ++i) {
+        AVLTree<int,int>::range_view keys = tree.range(starts[i], starts[i] + 200);
+        for(AVLTree<int,int>::iterator it = keys.begin(); it != keys.end(); ++it) {
+            sum -= it->second;
+        }
+    }
+    reportLine("AVLTree::range", elapsedMs(start), queries);
+    sink = sum;
+}
+
+// The 100 largest entries: a reverse walk from rbegin() against a forward
+// scan that keeps the last 100 it saw.
+void benchLatest(size_t n)
+{
+    vector<pair<int,int> > items(n);
+    for(size_t i = 0; i < n; ++i) {
+        items[i] = make_pair((int)i, (int)i);
+    }
+    AVLTree<int,int> tree;
+    tree.assign_sorted(items.begin(), items.end());
+    size_t queries = 20;
+
+    cout << "Latest 100 of n = " << n << ":" << endl;
+    long long sum = 0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for(size_t i = 0; i < queries; ++i) {
+        vector<int> window(100);
+        size_t seen = 0;
+        for(AVLTree<int,int>::iterator it = tree.begin(); it != tree.end(); ++it) {
+            window[seen++ % 100] = it->second;
+        }
+        for(size_t k = 0; k < 100; ++k) {
+            sum += window[k];
+        }
+    }
+    reportLine("forward scan with buffer", elapsedMs(start), queries);
+
+    start = chrono::steady_clock::now();
+    for(size_t i = 0; i < queries; ++i) {
+        AVLTree<int,int>::reverse_iterator it = tree.rbegin();
+        for(size_t k = 0; k < 100 && it != tree.rend(); ++k, ++it) {
+            sum -= it->second;
+        }
+    }
+    reportLine("reverse walk from rbegin()", elapsedMs(start), queries);
+    sink = sum;
+}
+
+// Sequential against fork-join versions of bulk build and a union of two
+// interleaved n-entry trees.
+void benchParallel(size_t n)
+{
+    ForkJoinPool pool;
+    vector<pair<int,int> > evens(n);
+    vector<pair<int,int> > odds(n);
+    for(size_t i = 0; i < n; ++i) {
+        evens[i] = make_pair((int)(2 * i), (int)i);
+        odds[i] = make_pair((int)(2 * i + 1), (int)i);
+    }
+
+    cout << "Parallel bulk operations, n = " << n << ", " << pool.size() << " workers:" << endl;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    {
+        AVLTree<int,int> tree;
+        tree.assign_sorted(evens.begin(), evens.end());
+        reportLine("assign_sorted", elapsedMs(start), n);
+    }
+    start = chrono::steady_clock::now();
+    {
+        AVLTree<int,int> tree;
+        tree.assign_sorted(evens.begin(), evens.end(), pool);
+        reportLine("assign_sorted (pool)", elapsedMs(start), n);
+    }
+
+    AVLTree<int,int> a;
+    AVLTree<int,int> b;
+    a.assign_sorted(evens.begin(), evens.end());
+    b.assign_sorted(odds.begin(), odds.end());
+    start = chrono::steady_clock::now();
+    a.unionWith(b);
+    reportLine("unionWith", elapsedMs(start), 2 * n);
+
+    AVLTree<int,int> c;
+    AVLTree<int,int> d;
+    c.assign_sorted(evens.begin(), evens.end());
+    d.assign_sorted(odds.begin(), odds.end());
+    start = chrono::steady_clock::now();
+    c.unionWith(d, pool);
+    reportLine("unionWith (pool)", elapsedMs(start), 2 * n);
+}
+
+// Full in-order scans, with int keys and with string keys, against
+// std::map.
+void benchFullScan(size_t n)
+{
+    vector<int> keys(n);
+    for(size_t i = 0; i < n; ++i) {
+        keys[i] = (int)i;
+    }
+    mt19937 gen(19);
+    shuffle(keys.begin(), keys.end(), gen);
+    AVLTree<int,int> tree;
+    map<int,int> stdMap;
+    AVLTree<string,int> stringTree;
+    map<string,int> stringMap;
+    for(size_t i = 0; i < n; ++i) {
+        tree.insert(make_pair(keys[i], (int)i));
+        stdMap.insert(make_pair(keys[i], (int)i));
+        string key = "user:" + to_string(keys[i]);
+        stringTree.insert(make_pair(key, (int)i));
+        stringMap.insert(make_pair(key, (int)i));
+    }
+
+    cout << "Full scans, n = " << n << ":" << endl;
+    long long sum = 0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for(AVLTree<int,int>::iterator it = tree.begin(); it != tree.end(); ++it) {
+        sum += it->second;
+    }
+    reportLine("AVLTree<int,int>", elapsedMs(start), n);
+
+    start = chrono::steady_clock::now();
+    for(map<int,int>::iterator it = stdMap.begin(); it != stdMap.end(); ++it) {
+        sum += it->second;
+    }
+    reportLine("std::map<int,int>", elapsedMs(start), n);
+
+    start = chrono::steady_clock::now();
+    for(AVLTree<string,int>::iterator it = stringTree.begin(); it != stringTree.end(); ++it) {
+        sum += it->second;
+    }
+    reportLine("AVLTree<string,int>", elapsedMs(start), n);
+
+    start = chrono::steady_clock::now();
+    for(map<string,int>::iterator it = stringMap.begin(); it != stringMap.end(); ++it) {
+        sum += it->second;
+    }
+    reportLine("std::map<string,int>", elapsedMs(start), n);
+    sink = sum;
+}
+
+// Offset queries: select(k) against walking k steps from begin().
+void benchSelect(size_t n)
+{
+    vector<pair<int,int> > items(n);
+    for(size_t i = 0; i < n; ++i) {
+        items[i] = make_pair((int)i, (int)i);
+    }
+    AVLTree<int,int,NodePool,OrderStatistics> tree;
+    tree.assign_sorted(items.begin(), items.end());
+    size_t queries = 200;
+    vector<size_t> offsets(queries);
+    mt19937 gen(5);
+    for(size_t i = 0; i < queries; ++i) {
+        offsets[i] = gen() % n;
+    }
+
+    cout << "Offset lookups, n = " << n << ":" << endl;
+    long long sum = 0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for(size_t i = 0; i < queries; ++i) {
+        AVLTree<int,int,NodePool,OrderStatistics>::iterator it = tree.begin();
+        for(size_t k = 0; k < offsets[i]; ++k) {
+            ++it;
+        }
+        sum += it->second;
+    }
+    reportLine("++begin() k times", elapsedMs(start), queries);
+
+    start = chrono::steady_clock::now();
+    for(size_t i = 0; i < queries; ++i) {
+        sum += tree.select(offsets[i])->second;
+    }
+    reportLine("AVLTree::select", elapsedMs(start), queries);
+    sink = sum;
+}
+
+// Range sums over a tenth of the keys: aggregate(lo, hi) against an
+// iterator walk.
+void benchAggregate(size_t n)
+{
+    typedef AVLTree<int,long long,NodePool,RangeAggregate<SumMonoid<long long> > > SumTree;
+    vector<pair<int,long long> > items(n);
+    for(size_t i = 0; i < n; ++i) {
+        items[i] = make_pair((int)i, (long long)i);
+    }
+    SumTree tree;
+    tree.assign_sorted(items.begin(), items.end());
+    size_t queries = 200;
+    vector<int> starts(queries);
+    mt19937 gen(9);
+    for(size_t i = 0; i < queries; ++i) {
+        starts[i] = (int)(gen() % (n - n / 10));
+    }
+    int width = (int)(n / 10);
+
+    cout << "Range sums over " << width << " keys, n = " << n << ":" << endl;
+    long long sum = 0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for(size_t i = 0; i < queries; ++i) {
+        for(SumTree::iterator it = tree.find(starts[i]); it != tree.end() && it->first < starts[i] + width; ++it) {
+            sum += it->second;
+        }
+    }
+    reportLine("iterator walk", elapsedMs(start), queries);
+
+    start = chrono::steady_clock::now();
+    for(size_t i = 0; i < queries; ++i) {
+        sum += tree.aggregate(starts[i], starts[i] + width);
+    }
+    reportLine("AVLTree::aggregate", elapsedMs(start), queries);
+    sink = sum;
+}
+
+// Adds a delta to the values of a tenth of the keys: range_update against
+// an iterator walk.
+void benchRangeUpdate(size_t n)
+{
+    typedef AVLTree<int,long long,NodePool,LazyUpdate<AffineAction<long long> > > LazyTree;
+    vector<pair<int,long long> > items(n);
+    for(size_t i = 0; i < n; ++i) {
+        items[i] = make_pair((int)i, (long long)i);
+    }
+    size_t updates = 200;
+    vector<int> starts(updates);
+    mt19937 gen(13);
+    for(size_t i = 0; i < updates; ++i) {
+        starts[i] = (int)(gen() % (n - n / 10));
+    }
+    int width = (int)(n / 10);
+
+    cout << "Range updates over " << width << " keys, n = " << n << ":" << endl;
+    AVLTree<int,long long> walked;
+    walked.assign_sorted(items.begin(), items.end());
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for(size_t i = 0; i < updates; ++i) {
+        AVLTree<int,long long>::iterator it = walked.find(starts[i]);
+        for(; it != walked.end() && it->first < starts[i] + width; ++it) {
+            it->second += 1;
+        }
+    }
+    reportLine("iterator walk", elapsedMs(start), updates);
+
+    LazyTree lazy;
+    lazy.assign_sorted(items.begin(), items.end());
+    start = chrono::steady_clock::now();
+    for(size_t i = 0; i < updates; ++i) {
+        lazy.range_update(starts[i], starts[i] + width, AffineAction<long long>::add(1));
+    }
+    reportLine("AVLTree::range_update", elapsedMs(start), updates);
+    sink = lazy.get(starts[0]);
+
+    // a reprice loop: each update is followed by lookups that settle only
+    // their own paths
+    start = chrono::steady_clock::now();
+    for(size_t i = 0; i < updates; ++i) {
+        lazy.range_update(starts[i], starts[i] + width, AffineAction<long long>::add(1));
+        LazyTree::iterator it = lazy.find(starts[(i + 1) % updates]);
+        if(it != lazy.end()) {
+            sink = it->second;
+        }
+    }
+    reportLine("range_update, then find", elapsedMs(start), updates);
+}
+
+// Stabbing queries over n short intervals: for_each_stabbing against a
+// scan of every entry.
+void benchStabbing(size_t n)
+{
+    mt19937 gen(17);
+    IntervalTree<int,int> tree;
+    for(size_t i = 0; i < n; ++i) {
+        int low = (int)(gen() % n);
+        tree.insert(make_pair(Interval<int>(low, low + (int)(gen() % 100)), (int)i));
+    }
+    size_t queries = 20;
+    vector<int> points(queries);
+    for(size_t i = 0; i < queries; ++i) {
+        points[i] = (int)(gen() % n);
+    }
+
+    cout << "Stabbing queries over " << n << " intervals:" << endl;
+    long long sum = 0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for(size_t i = 0; i < queries; ++i) {
+        for(IntervalTree<int,int>::iterator it = tree.begin(); it != tree.end(); ++it) {
+            if(it->first.low <= points[i] && points[i] <= it->first.high) {
+                sum += it->second;
+            }
+        }
+    }
+    reportLine("full scan", elapsedMs(start), queries);
+
+    start = chrono::steady_clock::now();
+    for(size_t i = 0; i < queries; ++i) {
+        tree.for_each_stabbing(points[i], [&](const pair<const Interval<int>,int>& item) { sum -= item.second; });
+    }
+    reportLine("IntervalTree::for_each_stabbing", elapsedMs(start), queries);
+    sink = sum;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t n = 1000000;
+    if(argc > 1) {
+        n = (size_t)atol(argv[1]);
+    }
+    benchNodeSize();
+    benchLookup(n);
+    benchBTree(n);
+    benchFreeze(n);
+    benchCompact(n);
+    benchSnapshot(n);
+    benchCopy(n);
+    benchBalanceCheck(n);
+    benchStringLookup(n);
+    benchStringTree(n);
+    benchSortedLoad(n);
+    benchBatch(n);
+    benchBatchSizes(n);
+    benchUnion(n);
+    benchRangeScan(n);
+    benchLatest(n);
+    benchFullScan(n);
+    benchParallel(n);
+    benchConcurrentReads(n);
+    benchConcurrentMixed(n);
+    benchSelect(n);
+    benchAggregate(n);
+    benchRangeUpdate(n);
+    benchStabbing(n);
+    return 0;
+}
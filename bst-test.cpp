@@ -1,7 +1,16 @@
 #include <iostream>
 #include <map>
+#include <vector>
+#include <string>
 #include "bst.h"
 #include "avlbst.h"
+#include "interval_tree.h"
+#include "string_tree.h"
+#include "btree.h"
+#include "compact_avl.h"
+#include "rcu_tree.h"
+#include "concurrent_avl.h"
+#include "persistent_avl.h"
 
 using namespace std;
 
@@ -44,5 +53,260 @@ int main(int argc, char *argv[])
     cout << "Erasing b" << endl;
     at.remove('b');
 
+    // Single-descent updates
+    AVLTree<char,int> counts;
+    const char* word = "mississippi";
+    for(const char* c = word; *c != '\0'; ++c) {
+        counts.upsert(*c, [](int& v) { ++v; });
+    }
+    cout << "\nLetter counts in " << word << ":" << endl;
+    for(AVLTree<char,int>::iterator it = counts.begin(); it != counts.end(); ++it) {
+        cout << it->first << " " << it->second << endl;
+    }
+    if(!counts.try_emplace('s', 100).second && counts['s'] == 4) {
+        cout << "try_emplace kept existing s" << endl;
+    }
+    if(!counts.insert_or_assign('s', 0).second && counts['s'] == 0) {
+        cout << "insert_or_assign replaced s" << endl;
+    }
+
+    // Custom ordering and lookup by const char*
+    AVLTree<string,int,NodePool,NoAugment,StringCompare> ages;
+    ages.insert(make_pair(string("carol"), 41));
+    ages.insert(make_pair(string("alice"), 34));
+    ages.insert(make_pair(string("bob"), 27));
+    AVLTree<int,char,NodePool,NoAugment,std::greater<int> > descending;
+    for(int i = 1; i <= 5; ++i) {
+        descending.insert(make_pair(i, 'a' + i - 1));
+    }
+    cout << "\nbob is " << ages.find("bob")->second << ", descending starts at "
+         << descending.begin()->first << endl;
+
+    // Arena-backed string keys
+    StringTree<int> hits;
+    hits.insert("/index.html", 120);
+    hits.insert("/images/logo.png", 75);
+    hits.insert("/index.htm", 3);
+    hits.insert("/index.html", 121);
+    cout << "Hits:";
+    for(StringTree<int>::iterator it = hits.begin(); it != hits.end(); ++it) {
+        cout << " " << it->first << "=" << it->second;
+    }
+    cout << " (" << hits.arenaBytes() << " key bytes)" << endl;
+
+    // Bulk load from sorted input
+    vector<pair<int,int> > sorted;
+    for(int i = 0; i < 100; ++i) {
+        sorted.push_back(make_pair(i, i * i));
+    }
+    BinarySearchTree<int,int> loaded;
+    loaded.assign_sorted(sorted.begin(), sorted.end());
+    cout << "\nSorted BST load balanced: " << loaded.isBalanced() << endl;
+    AVLTree<int,int> avlLoaded;
+    avlLoaded.assign_sorted(sorted.begin(), sorted.end());
+    avlLoaded.insert(make_pair(100, 0));
+    cout << "Sorted AVL load balanced after insert: " << avlLoaded.isBalanced() << endl;
+
+    // Batched change set
+    vector<BatchOp<int,int> > ops;
+    for(int i = 0; i < 200; i += 2) {
+        BatchOp<int,int> op = { i, -i, (i % 10) == 0 };
+        ops.push_back(op);
+    }
+    BatchResult applied = avlLoaded.apply_batch(ops.begin(), ops.end());
+    cout << "Batch: " << applied.inserted << " inserted, " << applied.updated << " updated, "
+         << applied.erased << " erased, balanced: " << avlLoaded.isBalanced() << endl;
+
+    // Split and join
+    AVLTree<int,int> below;
+    AVLTree<int,int> above;
+    bool hadPivot = avlLoaded.split(50, below, above);
+    cout << "Split at 50 (present: " << hadPivot << "): below starts at " << below.begin()->first
+         << ", above starts at " << above.begin()->first << endl;
+    avlLoaded.join(below, 50, 2500, above);
+    cout << "Joined back, balanced: " << avlLoaded.isBalanced() << ", 50 -> " << avlLoaded[50] << endl;
+
+    // Ordered lookups
+    AVLTree<int,int>::range_view forties = avlLoaded.range(37, 47);
+    cout << "Keys in [37, 47):";
+    for(AVLTree<int,int>::iterator it = forties.begin(); it != forties.end(); ++it) {
+        cout << " " << it->first;
+    }
+    cout << ", floor(60) = " << avlLoaded.floor(60)->first
+         << ", upper_bound(60) = " << avlLoaded.upper_bound(60)->first << endl;
+
+    // Reverse iteration
+    cout << "Last three keys:";
+    int shown = 0;
+    for(AVLTree<int,int>::reverse_iterator it = avlLoaded.rbegin(); it != avlLoaded.rend() && shown < 3; ++it, ++shown) {
+        cout << " " << it->first;
+    }
+    AVLTree<int,int>::const_iterator last = avlLoaded.cend();
+    --last;
+    cout << ", --end() -> " << last->first << endl;
+
+    // Read-only snapshot
+    FrozenTree<int,int> frozen = avlLoaded.freeze();
+    FrozenTree<int,int>::iterator frozenLast = frozen.end();
+    --frozenLast;
+    cout << "Frozen: " << frozen.size() << " keys from " << frozen.begin()->first << " to "
+         << frozenLast->first << ", lower_bound(101) = " << frozen.lower_bound(101)->first
+         << ", 62 -> " << frozen[62] << endl;
+
+    // Set algebra
+    AVLTree<int,int> evens;
+    AVLTree<int,int> threes;
+    for(int i = 0; i < 30; ++i) {
+        evens.insert(make_pair(2 * i, 0));
+        threes.insert(make_pair(3 * i, 0));
+    }
+    evens.intersectWith(threes);
+    cout << "Multiples of 6 below 60:";
+    for(AVLTree<int,int>::iterator it = evens.begin(); it != evens.end(); ++it) {
+        cout << " " << it->first;
+    }
+    cout << endl;
+
+    // Fork-join versions
+    ForkJoinPool pool(2);
+    vector<pair<int,int> > squares;
+    for(int i = 0; i < 1000; ++i) {
+        squares.push_back(make_pair(i, i * i));
+    }
+    AVLTree<int,int> parallelLoaded;
+    parallelLoaded.assign_sorted(squares.begin(), squares.end(), pool, 16);
+    AVLTree<int,int> odds;
+    for(int i = 1; i < 1000; i += 2) {
+        odds.insert(make_pair(i, 0));
+    }
+    parallelLoaded.differenceWith(odds, pool, 16);
+    cout << "Parallel build minus odds, balanced: " << parallelLoaded.isBalanced()
+         << ", 998 -> " << parallelLoaded[998] << endl;
+
+    // Order statistics
+    AVLTree<int,int,NodePool,OrderStatistics> latencies;
+    for(int i = 0; i < 100; ++i) {
+        latencies.insert(make_pair((i * 37) % 100, i));
+    }
+    latencies.remove(0);
+    cout << "Median of 1..99: " << latencies.select(latencies.size() / 2)->first
+         << ", rank of 90: " << latencies.rank(90)
+         << ", keys in [10, 20): " << latencies.count_range(10, 20) << endl;
+
+    // Range aggregates
+    AVLTree<int,int,NodePool,RangeAggregate<MaxMonoid<int> > > peaks;
+    for(int i = 0; i < 100; ++i) {
+        peaks.insert(make_pair(i, (i * 37) % 100));
+    }
+    peaks.insert_or_assign(15, 1000);
+    cout << "Max value for keys in [10, 20): " << peaks.aggregate(10, 20)
+         << ", in [20, 30): " << peaks.aggregate(20, 30) << endl;
+
+    // Lazy range updates
+    typedef AffineAction<long long> Reprice;
+    AVLTree<int,long long,NodePool,LazyUpdate<Reprice, RangeAggregate<SumMonoid<long long>, OrderStatistics> > > prices;
+    for(int i = 0; i < 100; ++i) {
+        prices.insert(make_pair(i, 10LL));
+    }
+    prices.range_update(0, 50, Reprice::multiply(3));
+    prices.range_update(40, 60, Reprice::add(5));
+    cout << "Prices: 10 -> " << prices.get(10) << ", 45 -> " << prices.get(45)
+         << ", 55 -> " << prices[55] << ", total " << prices.aggregate() << endl;
+
+    // Interval queries
+    IntervalTree<int,char> bookings;
+    bookings.insert(make_pair(Interval<int>(9, 11), 'a'));
+    bookings.insert(make_pair(Interval<int>(10, 12), 'b'));
+    bookings.insert(make_pair(Interval<int>(13, 14), 'c'));
+    bookings.insert(make_pair(Interval<int>(9, 17), 'd'));
+    bookings.insert(make_pair(Interval<int>(16, 18), 'e'));
+    cout << "Booked at 12:";
+    bookings.for_each_stabbing(12, [](const pair<const Interval<int>,char>& b) { cout << " " << b.second; });
+    cout << ", overlapping [14, 16]:";
+    bookings.for_each_overlap(14, 16, [](const pair<const Interval<int>,char>& b) { cout << " " << b.first; });
+    cout << endl;
+
+    // B+ tree
+    BTreeMap<int,int> wide;
+    for(int i = 0; i < 1000; ++i) {
+        wide.insert(make_pair((i * 7) % 1000, i));
+    }
+    for(int i = 0; i < 1000; i += 3) {
+        wide.remove(i);
+    }
+    BTreeMap<int,int>::iterator widest = wide.end();
+    --widest;
+    cout << "B+ tree: " << wide.size() << " keys, balanced: " << wide.isBalanced()
+         << ", 700 -> " << wide[700] << ", lower_bound(300) = " << wide.lower_bound(300)->first
+         << ", last = " << widest->first << endl;
+
+    // Index-linked nodes
+    CompactAVLTree<int,int> compact;
+    compact.reserve(100);
+    for(int i = 0; i < 100; ++i) {
+        compact.insert(make_pair((i * 37) % 100, i));
+    }
+    for(int i = 0; i < 100; i += 2) {
+        compact.remove(i);
+    }
+    cout << "Compact AVL: " << compact.size() << " keys, balanced: " << compact.isBalanced()
+         << ", first " << compact.begin()->first << ", 37 -> " << compact[37] << endl;
+
+    // Lock-free readers
+    RcuAVLTree<int,int> shared;
+    for(int i = 0; i < 10; ++i) {
+        shared.insert(make_pair(i, i * i));
+    }
+    RcuAVLTree<int,int>::Reader pinned(shared);
+    shared.remove(3);
+    int nine = 0;
+    cout << "RCU: 3 still in pinned version: " << (pinned.find(3) != pinned.end())
+         << ", in tree: " << shared.contains(3) << ", 9 found: " << shared.find(9, nine)
+         << " -> " << nine << endl;
+
+    // Fine-grained locking
+    ConcurrentAVLTree<int,int> fine;
+    for(int i = 0; i < 50; ++i) {
+        fine.insert(make_pair(i, -i));
+    }
+    for(int i = 0; i < 50; i += 3) {
+        fine.remove(i);
+    }
+    int minusSeven = 0;
+    cout << "Concurrent AVL: " << fine.size() << " keys, balanced: " << fine.isBalanced()
+         << ", 7 found: " << fine.find(7, minusSeven) << " -> " << minusSeven
+         << ", 9 found: " << fine.contains(9) << endl;
+
+    // Structure-sharing snapshots
+    PersistentAVLTree<int,int> versioned;
+    for(int i = 0; i < 20; ++i) {
+        versioned.insert(make_pair(i, i));
+    }
+    PersistentAVLTree<int,int>::Snapshot before = versioned.snapshot();
+    for(int i = 0; i < 20; i += 2) {
+        versioned.remove(i);
+    }
+    versioned.insert(make_pair(5, 50));
+    cout << "Persistent: snapshot has " << before.size() << " keys, 5 -> " << before[5]
+         << "; tree has " << versioned.size() << " keys, 5 -> " << versioned[5]
+         << ", balanced: " << versioned.isBalanced() << ", snapshot keys:";
+    for(PersistentAVLTree<int,int>::Snapshot::iterator it = before.lower_bound(15); it != before.end(); ++it) {
+        cout << " " << it->first;
+    }
+    cout << endl;
+
+    // Copy and move
+    AVLTree<int,int> original;
+    for(int i = 0; i < 10; ++i) {
+        original.insert(make_pair(i, i * i));
+    }
+    AVLTree<int,int> copied(original);
+    copied.remove(3);
+    AVLTree<int,int> moved(std::move(copied));
+    cout << "Copy: original has 3: " << (original.find(3) != original.end())
+         << ", moved copy has 3: " << (moved.find(3) != moved.end())
+         << ", 9 -> " << moved.find(9)->second << ", balanced: " << moved.isBalanced()
+         << ", moved-from empty: " << copied.empty() << endl;
+
     return 0;
 }
@@ -4,21 +4,35 @@
 #include <iostream>
 #include <exception>
 #include <cstdlib>
+#include <cstdint>
 #include <utility>
+#include <tuple>
+#include <iterator>
+#include <functional>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include "node_pool.h"
 
 /**
  * A templated class for a Node in a search tree.
- * The getters for parent/left/right are virtual so
- * that they can be overridden for future kinds of
- * search trees, such as Red Black trees, Splay trees,
- * and AVL trees.
+ * The getters for parent/left/right are not virtual:
+ * derived nodes for other kinds of search trees (such as
+ * AVLNode) hide them with versions that return their own
+ * type. Every step of a traversal is then resolved at
+ * compile time and a node carries no vtable pointer.
  */
 template <typename Key, typename Value>
 class Node
 {
 public:
     Node(const Key& key, const Value& value, Node<Key, Value>* parent);
-    virtual ~Node();
+    template<typename... Args>
+    Node(Node<Key, Value>* parent, Args&&... itemArgs);
+    ~Node();
 
     const std::pair<const Key, Value>& getItem() const;
     std::pair<const Key, Value>& getItem();
@@ -26,9 +40,9 @@ public:
     const Value& getValue() const;
     Value& getValue();
 
-    virtual Node<Key, Value>* getParent() const;
-    virtual Node<Key, Value>* getLeft() const;
-    virtual Node<Key, Value>* getRight() const;
+    Node<Key, Value>* getParent() const;
+    Node<Key, Value>* getLeft() const;
+    Node<Key, Value>* getRight() const;
 
     void setParent(Node<Key, Value>* parent);
     void setLeft(Node<Key, Value>* left);
@@ -36,8 +50,15 @@ public:
     void setValue(const Value &value);
 
 protected:
+    // Nodes are 8-byte aligned, so the low bits of the parent link are
+    // always zero. Derived nodes may keep a small tag there (AVLNode keeps
+    // its balance) instead of growing the node.
+    static const std::uintptr_t TAG_MASK = 7;
+    std::uintptr_t getTag() const;
+    void setTag(std::uintptr_t tag);
+
     std::pair<const Key, Value> item_;
-    Node<Key, Value>* parent_;
+    alignas(8) std::uintptr_t parent_;
     Node<Key, Value>* left_;
     Node<Key, Value>* right_;
 };
@@ -54,7 +75,22 @@ protected:
 template<typename Key, typename Value>
 Node<Key, Value>::Node(const Key& key, const Value& value, Node<Key, Value>* parent) :
     item_(key, value),
-    parent_(parent),
+    parent_(reinterpret_cast<std::uintptr_t>(parent)),
+    left_(NULL),
+    right_(NULL)
+{
+
+}
+
+/**
+* A constructor that builds the item in place from the given arguments,
+* which are forwarded to the std::pair constructor.
+*/
+template<typename Key, typename Value>
+template<typename... Args>
+Node<Key, Value>::Node(Node<Key, Value>* parent, Args&&... itemArgs) :
+    item_(std::forward<Args>(itemArgs)...),
+    parent_(reinterpret_cast<std::uintptr_t>(parent)),
     left_(NULL),
     right_(NULL)
 {
@@ -118,16 +154,16 @@ Value& Node<Key, Value>::getValue()
 }
 
 /**
-* An implementation of the virtual function for retreiving the parent.
+* A getter for the parent, which strips any tag stored in the low bits.
 */
 template<typename Key, typename Value>
 Node<Key, Value>* Node<Key, Value>::getParent() const
 {
-    return parent_;
+    return reinterpret_cast<Node<Key, Value>*>(parent_ & ~TAG_MASK);
 }
 
 /**
-* An implementation of the virtual function for retreiving the left child.
+* A getter for the left child.
 */
 template<typename Key, typename Value>
 Node<Key, Value>* Node<Key, Value>::getLeft() const
@@ -136,7 +172,7 @@ Node<Key, Value>* Node<Key, Value>::getLeft() const
 }
 
 /**
-* An implementation of the virtual function for retreiving the right child.
+* A getter for the right child.
 */
 template<typename Key, typename Value>
 Node<Key, Value>* Node<Key, Value>::getRight() const
@@ -145,12 +181,12 @@ Node<Key, Value>* Node<Key, Value>::getRight() const
 }
 
 /**
-* A setter for setting the parent of a node.
+* A setter for setting the parent of a node. The tag bits are kept.
 */
 template<typename Key, typename Value>
 void Node<Key, Value>::setParent(Node<Key, Value>* parent)
 {
-    parent_ = parent;
+    parent_ = reinterpret_cast<std::uintptr_t>(parent) | (parent_ & TAG_MASK);
 }
 
 /**
@@ -180,20 +216,124 @@ void Node<Key, Value>::setValue(const Value& value)
     item_.second = value;
 }
 
+/**
+* A getter for the tag kept in the low bits of the parent link.
+*/
+template<typename Key, typename Value>
+std::uintptr_t Node<Key, Value>::getTag() const
+{
+    return parent_ & TAG_MASK;
+}
+
+/**
+* A setter for the tag kept in the low bits of the parent link.
+*/
+template<typename Key, typename Value>
+void Node<Key, Value>::setTag(std::uintptr_t tag)
+{
+    parent_ = (parent_ & ~TAG_MASK) | (tag & TAG_MASK);
+}
+
 /*
   ---------------------------------------
   End implementations for the Node class.
   ---------------------------------------
 */
 
+/**
+* The buildSorted hook used by trees whose nodes carry nothing extra.
+*/
+struct NoBuildHook
+{
+    template<typename NodeType>
+    void operator()(NodeType*, int, int) const { }
+};
+
+/**
+* A transparent comparator using operator<, like C++14's std::less<>.
+* Trees using it accept any type that compares with Key in find and the
+* bound lookups, so no temporary Key is built for them.
+*/
+struct TransparentLess
+{
+    typedef void is_transparent;
+
+    template<typename A, typename B>
+    bool operator()(const A& a, const B& b) const
+    {
+        return a < b;
+    }
+};
+
+/**
+* A transparent comparator for std::string keys. Its compare() settles
+* each node with one three-way comparison rather than up to two calls to
+* operator<, and lookups may pass a const char* as is.
+*/
+struct StringCompare
+{
+    typedef void is_transparent;
+
+    template<typename A, typename B>
+    bool operator()(const A& a, const B& b) const
+    {
+        return compare(a, b) < 0;
+    }
+
+    static int compare(const std::string& a, const std::string& b)
+    {
+        return a.compare(b);
+    }
+    static int compare(const std::string& a, const char* b)
+    {
+        return a.compare(b);
+    }
+    static int compare(const char* a, const std::string& b)
+    {
+        int cmp = b.compare(a);
+        return (cmp < 0) - (cmp > 0);
+    }
+};
+
+/**
+* Three-way comparison under comp: a single call to comp.compare(a, b)
+* when the comparator has one, otherwise up to two calls to comp itself.
+*/
+template<typename Compare, typename A, typename B>
+auto compareWith(const Compare& comp, const A& a, const B& b, int) -> decltype(comp.compare(a, b))
+{
+    return comp.compare(a, b);
+}
+
+template<typename Compare, typename A, typename B>
+int compareWith(const Compare& comp, const A& a, const B& b, long)
+{
+    if(comp(a, b)) {
+      return -1;
+    }
+    return comp(b, a) ? 1 : 0;
+}
+
 /**
 * A templated unbalanced binary search tree.
+* Nodes are obtained from an Alloc (see node_pool.h), which by default is a
+* slab pool that recycles removed nodes. Keys are ordered by Compare, which
+* is default constructed where needed rather than stored; see
+* TransparentLess and StringCompare for heterogeneous lookup.
 */
-template <typename Key, typename Value>
+template <typename Key, typename Value, typename Alloc = NodePool, typename Compare = std::less<Key> >
 class BinarySearchTree
 {
 public:
     BinarySearchTree(); //TODO
+    // Copies keep the other tree's shape and are built in O(n) in a fresh
+    // allocator, with no rebalancing. Moves take the nodes and the
+    // allocator over in O(1) and leave the source empty.
+    BinarySearchTree(const BinarySearchTree& other);
+    BinarySearchTree(BinarySearchTree&& other) noexcept(std::is_nothrow_move_constructible<Alloc>::value);
+    BinarySearchTree& operator=(const BinarySearchTree& other);
+    BinarySearchTree& operator=(BinarySearchTree&& other)
+        noexcept(std::is_nothrow_move_constructible<Alloc>::value && std::is_nothrow_move_assignable<Alloc>::value);
     virtual ~BinarySearchTree(); //TODO
     virtual void insert(const std::pair<const Key, Value>& keyValuePair); //TODO
     virtual void remove(const Key& key); //TODO
@@ -202,15 +342,24 @@ public:
     void print() const;
     bool empty() const;
 
-    template<typename PPKey, typename PPValue>
-    friend void prettyPrintBST(BinarySearchTree<PPKey, PPValue> & tree);
+    template<typename PPKey, typename PPValue, typename PPAlloc, typename PPCompare>
+    friend void prettyPrintBST(BinarySearchTree<PPKey, PPValue, PPAlloc, PPCompare> & tree);
 public:
+    class const_iterator;
+
     /**
     * An internal iterator class for traversing the contents of the BST.
+    * It is bidirectional; decrementing end() gives the last item.
     */
     class iterator  // TODO
     {
     public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef std::pair<const Key, Value>* pointer;
+        typedef std::pair<const Key, Value>& reference;
+
         iterator();
 
         std::pair<const Key,Value>& operator*() const;
@@ -220,23 +369,130 @@ public:
         bool operator!=(const iterator& rhs) const;
 
         iterator& operator++();
+        iterator operator++(int);
+        iterator& operator--();
+        iterator operator--(int);
+
+    protected:
+        friend class BinarySearchTree<Key, Value, Alloc, Compare>;
+        friend class const_iterator;
+        iterator(Node<Key,Value>* ptr, const BinarySearchTree* tree);
+        Node<Key, Value> *current_;
+        const BinarySearchTree* tree_;
+    };
+
+    /**
+    * An iterator through which items cannot be modified. Every iterator
+    * converts to one.
+    */
+    class const_iterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const std::pair<const Key, Value>* pointer;
+        typedef const std::pair<const Key, Value>& reference;
+
+        const_iterator();
+        const_iterator(const iterator& it);
+
+        const std::pair<const Key,Value>& operator*() const;
+        const std::pair<const Key,Value>* operator->() const;
+
+        bool operator==(const const_iterator& rhs) const;
+        bool operator!=(const const_iterator& rhs) const;
+
+        const_iterator& operator++();
+        const_iterator operator++(int);
+        const_iterator& operator--();
+        const_iterator operator--(int);
 
     protected:
-        friend class BinarySearchTree<Key, Value>;
-        iterator(Node<Key,Value>* ptr);
         Node<Key, Value> *current_;
+        const BinarySearchTree* tree_;
     };
 
+    typedef std::reverse_iterator<iterator> reverse_iterator;
+    typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+
 public:
     iterator begin() const;
     iterator end() const;
+    const_iterator cbegin() const;
+    const_iterator cend() const;
+    // The last item is cached, so rbegin() and --end() cost O(1).
+    reverse_iterator rbegin() const;
+    reverse_iterator rend() const;
+    const_reverse_iterator crbegin() const;
+    const_reverse_iterator crend() const;
     iterator find(const Key& key) const;
     Value& operator[](const Key& key);
     Value const & operator[](const Key& key) const;
 
+    // Heterogeneous lookups, available when Compare is transparent
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    iterator find(const K& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    iterator lower_bound(const K& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    iterator upper_bound(const K& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    std::pair<iterator, iterator> equal_range(const K& key) const;
+
+    // Ordered lookups in O(log n), each returning end() if there is no such
+    // key. lower_bound and ceiling give the first key not below key,
+    // upper_bound the first key above it and floor the last key not above it.
+    iterator lower_bound(const Key& key) const;
+    iterator upper_bound(const Key& key) const;
+    std::pair<iterator, iterator> equal_range(const Key& key) const;
+    iterator floor(const Key& key) const;
+    iterator ceiling(const Key& key) const;
+
+    /**
+    * The entries with keys in [lo, hi), as returned by range(). Finding
+    * the ends costs O(log n) and walking the k entries between them O(k).
+    */
+    class range_view
+    {
+    public:
+        range_view(const iterator& first, const iterator& last);
+
+        iterator begin() const;
+        iterator end() const;
+        bool empty() const;
+
+    private:
+        iterator first_;
+        iterator last_;
+    };
+
+    range_view range(const Key& lo, const Key& hi) const;
+
+    // Single-descent insertion. Each returns an iterator to the key's
+    // node and whether a new node was created.
+    template<typename... Args>
+    std::pair<iterator, bool> emplace(Args&&... args);
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(const Key& key, Args&&... args);
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(Key&& key, Args&&... args);
+    template<typename V>
+    std::pair<iterator, bool> insert_or_assign(const Key& key, V&& value);
+    template<typename V>
+    std::pair<iterator, bool> insert_or_assign(Key&& key, V&& value);
+    template<typename Fn>
+    std::pair<iterator, bool> upsert(const Key& key, Fn fn);
+
+    // Replaces the contents with a balanced tree built in O(n) from
+    // items in strictly ascending key order.
+    template<typename ForwardIt>
+    void assign_sorted(ForwardIt first, ForwardIt last);
+
 protected:
     // Mandatory helper functions
-    Node<Key, Value>* internalFind(const Key& k) const; // TODO
+    template<typename K>
+    Node<Key, Value>* internalFind(const K& k) const; // TODO
     Node<Key, Value> *getSmallestNode() const;  // TODO
     static Node<Key, Value>* predecessor(Node<Key, Value>* current); // TODO
     // Note:  static means these functions don't have a "this" pointer
@@ -250,12 +506,55 @@ protected:
     static Node<Key, Value>* successor(Node<Key, Value>* current); //Added
     bool checkBalanced(Node<Key,Value> * root) const;
     int findHeight(Node<Key,Value>* root) const;
-    void clearTree(Node<Key,Value>* current) const;
+    int measureHeight(Node<Key,Value>* root, bool& balanced) const;
+    void clearTree(Node<Key,Value>* current);
+    template<typename Visit>
+    static void visitPostorder(Node<Key,Value>* root, Visit& visit);
+
+    // Node allocation helpers; every node goes through alloc_
+    template<typename NodeType, typename... Args>
+    NodeType* createNode(Args&&... args);
+    virtual void destroyNode(Node<Key,Value>* n);
+
+    // Single-descent insertion helpers, shared with derived trees that
+    // use their own node type
+    template<typename A, typename B>
+    static int compareKeys(const A& a, const B& b);
+    template<typename K>
+    Node<Key, Value>* lowerBoundNode(const K& key, bool strict) const;
+    template<typename K>
+    Node<Key, Value>* floorNode(const K& key) const;
+    Node<Key, Value>* findAttachPoint(const Key& key, Node<Key, Value>*& parent, bool& goLeft) const;
+    void attachNode(Node<Key, Value>* n, Node<Key, Value>* parent, bool goLeft);
+    template<typename NodeType, typename... Args>
+    std::pair<NodeType*, bool> emplaceNode(Args&&... args);
+    template<typename NodeType, typename K, typename... Args>
+    std::pair<NodeType*, bool> tryEmplaceNode(K&& key, Args&&... args);
+    template<typename NodeType, typename K, typename V>
+    std::pair<NodeType*, bool> insertOrAssignNode(K&& key, V&& value);
+    iterator makeIterator(Node<Key, Value>* n) const;
+    static Node<Key, Value>* iteratorNode(const iterator& it);
+    Node<Key, Value>* nextNode(Node<Key, Value>* n) const;
+    Node<Key, Value>* prevNode(Node<Key, Value>* n) const;
+    void resetLast();
+
+    // Bulk construction helpers, shared with derived trees
+    template<typename NodeType, typename NodeSource, typename OnBuilt>
+    NodeType* buildSorted(NodeSource& source, std::size_t n, NodeType* parent, int& height, OnBuilt& onBuilt);
+    template<typename NodeType, typename CopyNode>
+    NodeType* cloneTree(const NodeType* src, CopyNode& copyNode);
 
 
 protected:
     Node<Key, Value>* root_;
-    // You should not need other data members
+    // The rightmost node, kept current by insertion and removal and
+    // recomputed by resetLast after bulk operations
+    Node<Key, Value>* last_;
+    Alloc alloc_;
+    // Set by trees whose nodes can hold work pending for their subtrees
+    // (AVLTree's lazy range updates): iterators call it on every node they
+    // step down from, so each node they reach is settled.
+    void (*pushNode_)(Node<Key, Value>*);
 };
 
 /*
@@ -267,30 +566,32 @@ Begin implementations for the BinarySearchTree::iterator class.
 /**
 * Explicit constructor that initializes an iterator with a given node pointer.
 */
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::iterator::iterator(Node<Key,Value> *ptr)
+template<class Key, class Value, class Alloc, class Compare>
+BinarySearchTree<Key, Value, Alloc, Compare>::iterator::iterator(Node<Key,Value> *ptr, const BinarySearchTree* tree)
 {
   //TASK
     current_ = ptr;
+    tree_ = tree;
 }
 
 /**
 * A default constructor that initializes the iterator to NULL.
 */
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::iterator::iterator() 
+template<class Key, class Value, class Alloc, class Compare>
+BinarySearchTree<Key, Value, Alloc, Compare>::iterator::iterator() 
 {
   //TASK.. done
   current_ = NULL;
+  tree_ = NULL;
 
 }
 
 /**
 * Provides access to the item.
 */
-template<class Key, class Value>
+template<class Key, class Value, class Alloc, class Compare>
 std::pair<const Key,Value> &
-BinarySearchTree<Key, Value>::iterator::operator*() const
+BinarySearchTree<Key, Value, Alloc, Compare>::iterator::operator*() const
 {
     return current_->getItem();
 }
@@ -298,9 +599,9 @@ BinarySearchTree<Key, Value>::iterator::operator*() const
 /**
 * Provides access to the address of the item.
 */
-template<class Key, class Value>
+template<class Key, class Value, class Alloc, class Compare>
 std::pair<const Key,Value> *
-BinarySearchTree<Key, Value>::iterator::operator->() const
+BinarySearchTree<Key, Value, Alloc, Compare>::iterator::operator->() const
 {
     return &(current_->getItem());
 }
@@ -309,10 +610,10 @@ BinarySearchTree<Key, Value>::iterator::operator->() const
 * Checks if 'this' iterator's internals have the same value
 * as 'rhs'
 */
-template<class Key, class Value>
+template<class Key, class Value, class Alloc, class Compare>
 bool
-BinarySearchTree<Key, Value>::iterator::operator==(
-    const BinarySearchTree<Key, Value>::iterator& rhs) const
+BinarySearchTree<Key, Value, Alloc, Compare>::iterator::operator==(
+    const BinarySearchTree<Key, Value, Alloc, Compare>::iterator& rhs) const
 {
   //TASK.. done
     return this->current_ == rhs.current_;
@@ -322,10 +623,10 @@ BinarySearchTree<Key, Value>::iterator::operator==(
 * Checks if 'this' iterator's internals have a different value
 * as 'rhs'
 */
-template<class Key, class Value>
+template<class Key, class Value, class Alloc, class Compare>
 bool
-BinarySearchTree<Key, Value>::iterator::operator!=(
-    const BinarySearchTree<Key, Value>::iterator& rhs) const
+BinarySearchTree<Key, Value, Alloc, Compare>::iterator::operator!=(
+    const BinarySearchTree<Key, Value, Alloc, Compare>::iterator& rhs) const
 {
   
 
@@ -336,24 +637,204 @@ BinarySearchTree<Key, Value>::iterator::operator!=(
 /**
 * Advances the iterator's location using an in-order sequencing
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator&
-BinarySearchTree<Key, Value>::iterator::operator++()
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator&
+BinarySearchTree<Key, Value, Alloc, Compare>::iterator::operator++()
 {
   //TASK
   //i think this works??
  
-  current_ = successor(current_);
+  current_ = tree_->nextNode(current_);
   return *this;
   //*this = end(NULL);
   //return *iterator(NULL);;
 
 }
 
+/**
+* Advances the iterator and returns its previous position.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::iterator::operator++(int)
+{
+    iterator previous = *this;
+    current_ = tree_->nextNode(current_);
+    return previous;
+}
+
+/**
+* Moves the iterator back one item; from end() it moves to the last one.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator&
+BinarySearchTree<Key, Value, Alloc, Compare>::iterator::operator--()
+{
+    current_ = tree_->prevNode(current_);
+    return *this;
+}
+
+/**
+* Moves the iterator back and returns its previous position.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::iterator::operator--(int)
+{
+    iterator previous = *this;
+    --(*this);
+    return previous;
+}
+
+/**
+* A default constructor that initializes the iterator to NULL.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+BinarySearchTree<Key, Value, Alloc, Compare>::const_iterator::const_iterator() :
+    current_(NULL),
+    tree_(NULL)
+{
+}
+
+/**
+* Converts an iterator to the same position.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+BinarySearchTree<Key, Value, Alloc, Compare>::const_iterator::const_iterator(const iterator& it) :
+    current_(it.current_),
+    tree_(it.tree_)
+{
+}
+
+/**
+* Provides read-only access to the item.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+const std::pair<const Key,Value> &
+BinarySearchTree<Key, Value, Alloc, Compare>::const_iterator::operator*() const
+{
+    return current_->getItem();
+}
+
+/**
+* Provides the address of the item, read-only.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+const std::pair<const Key,Value> *
+BinarySearchTree<Key, Value, Alloc, Compare>::const_iterator::operator->() const
+{
+    return &(current_->getItem());
+}
+
+/**
+* Checks if both iterators are at the same position.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+bool
+BinarySearchTree<Key, Value, Alloc, Compare>::const_iterator::operator==(const const_iterator& rhs) const
+{
+    return current_ == rhs.current_;
+}
+
+/**
+* Checks if the iterators are at different positions.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+bool
+BinarySearchTree<Key, Value, Alloc, Compare>::const_iterator::operator!=(const const_iterator& rhs) const
+{
+    return current_ != rhs.current_;
+}
+
+/**
+* Advances the iterator using an in-order sequencing.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::const_iterator&
+BinarySearchTree<Key, Value, Alloc, Compare>::const_iterator::operator++()
+{
+    current_ = tree_->nextNode(current_);
+    return *this;
+}
+
+/**
+* Advances the iterator and returns its previous position.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::const_iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::const_iterator::operator++(int)
+{
+    const_iterator previous = *this;
+    current_ = tree_->nextNode(current_);
+    return previous;
+}
+
+/**
+* Moves the iterator back one item; from end() it moves to the last one.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::const_iterator&
+BinarySearchTree<Key, Value, Alloc, Compare>::const_iterator::operator--()
+{
+    current_ = tree_->prevNode(current_);
+    return *this;
+}
+
+/**
+* Moves the iterator back and returns its previous position.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::const_iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::const_iterator::operator--(int)
+{
+    const_iterator previous = *this;
+    --(*this);
+    return previous;
+}
+
 
 
 
 
+/**
+* Makes a view of the entries from first up to, but not including, last.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+BinarySearchTree<Key, Value, Alloc, Compare>::range_view::range_view(const iterator& first, const iterator& last) :
+    first_(first),
+    last_(last)
+{
+}
+
+/**
+* Returns an iterator to the first entry of the range.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::range_view::begin() const
+{
+    return first_;
+}
+
+/**
+* Returns an iterator just past the last entry of the range.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::range_view::end() const
+{
+    return last_;
+}
+
+/**
+* Returns true iff the range holds no entries.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+bool BinarySearchTree<Key, Value, Alloc, Compare>::range_view::empty() const
+{
+    return first_ == last_;
+}
+
 /*
 -------------------------------------------------------------
 End implementations for the BinarySearchTree::iterator class.
@@ -369,15 +850,82 @@ Begin implementations for the BinarySearchTree class.
 /**
 * Default constructor for a BinarySearchTree, which sets the root to NULL.
 */
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::BinarySearchTree() 
+template<class Key, class Value, class Alloc, class Compare>
+BinarySearchTree<Key, Value, Alloc, Compare>::BinarySearchTree() 
 {
   //TASK
     root_ = NULL;
+    last_ = NULL;
+    pushNode_ = NULL;
 }
 
-template<typename Key, typename Value>
-BinarySearchTree<Key, Value>::~BinarySearchTree()
+/**
+* Copy constructor, which clones other node for node.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+BinarySearchTree<Key, Value, Alloc, Compare>::BinarySearchTree(const BinarySearchTree& other) :
+    root_(NULL),
+    last_(NULL),
+    pushNode_(NULL)
+{
+    auto copyNode = [this](const Node<Key, Value>* src, Node<Key, Value>* parent) {
+      return createNode<Node<Key, Value> >(parent, src->getItem());
+    };
+    root_ = cloneTree<Node<Key, Value> >(other.root_, copyNode);
+    resetLast();
+}
+
+/**
+* Move constructor; other keeps a moved-from allocator, which must be
+* ready for new nodes.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+BinarySearchTree<Key, Value, Alloc, Compare>::BinarySearchTree(BinarySearchTree&& other)
+    noexcept(std::is_nothrow_move_constructible<Alloc>::value) :
+    root_(other.root_),
+    last_(other.last_),
+    alloc_(std::move(other.alloc_)),
+    pushNode_(NULL)
+{
+    other.root_ = NULL;
+    other.last_ = NULL;
+}
+
+/**
+* Copy assignment; the copy is made first, so a failure leaves this tree
+* as it was.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+BinarySearchTree<Key, Value, Alloc, Compare>&
+BinarySearchTree<Key, Value, Alloc, Compare>::operator=(const BinarySearchTree& other)
+{
+    if(this != &other) {
+      BinarySearchTree copy(other);
+      *this = std::move(copy);
+    }
+    return *this;
+}
+
+/**
+* Move assignment. The old nodes are destroyed and other is left with
+* this tree's emptied allocator.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+BinarySearchTree<Key, Value, Alloc, Compare>&
+BinarySearchTree<Key, Value, Alloc, Compare>::operator=(BinarySearchTree&& other)
+    noexcept(std::is_nothrow_move_constructible<Alloc>::value && std::is_nothrow_move_assignable<Alloc>::value)
+{
+    if(this != &other) {
+      clear();
+      std::swap(root_, other.root_);
+      std::swap(last_, other.last_);
+      std::swap(alloc_, other.alloc_);
+    }
+    return *this;
+}
+
+template<typename Key, typename Value, typename Alloc, typename Compare>
+BinarySearchTree<Key, Value, Alloc, Compare>::~BinarySearchTree()
 {
   //TASK
     clear();
@@ -387,15 +935,15 @@ BinarySearchTree<Key, Value>::~BinarySearchTree()
 /**
  * Returns true if tree is empty
 */
-template<class Key, class Value>
-bool BinarySearchTree<Key, Value>::empty() const
+template<class Key, class Value, class Alloc, class Compare>
+bool BinarySearchTree<Key, Value, Alloc, Compare>::empty() const
 {
   //TASK
     return root_ == NULL;
 }
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::print() const
+template<typename Key, typename Value, typename Alloc, typename Compare>
+void BinarySearchTree<Key, Value, Alloc, Compare>::print() const
 {
     printRoot(root_);
     std::cout << "\n";
@@ -404,46 +952,106 @@ void BinarySearchTree<Key, Value>::print() const
 /**
 * Returns an iterator to the "smallest" item in the tree
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::begin() const
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::begin() const
 {
-    //BinarySearchTree<Key, Value>::iterator begin(getSmallestNode());
-    return iterator(getSmallestNode());
+    //BinarySearchTree<Key, Value, Alloc, Compare>::iterator begin(getSmallestNode());
+    return iterator(getSmallestNode(), this);
 
-    //return BinarySearchTree<Key, Value>::iterator(getSmallestNode());
+    //return BinarySearchTree<Key, Value, Alloc, Compare>::iterator(getSmallestNode());
 }
 
 /**
 * Returns an iterator whose value means INVALID
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::end() const
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::end() const
+{
+    //return BinarySearchTree<Key, Value, Alloc, Compare>::iterator(NULL);
+    //BinarySearchTree<Key, Value, Alloc, Compare>::iterator end(NULL);
+    return iterator(nullptr, this);
+}
+
+/**
+* Returns a read-only iterator to the smallest item in the tree.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::const_iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::cbegin() const
+{
+    return begin();
+}
+
+/**
+* Returns the read-only end iterator.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::const_iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::cend() const
+{
+    return end();
+}
+
+/**
+* Returns a reverse iterator to the largest item in the tree.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::reverse_iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::rbegin() const
+{
+    return reverse_iterator(end());
+}
+
+/**
+* Returns the reverse iterator past the smallest item.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::reverse_iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::rend() const
 {
-    //return BinarySearchTree<Key, Value>::iterator(NULL);
-    //BinarySearchTree<Key, Value>::iterator end(NULL);
-    return iterator(nullptr);
+    return reverse_iterator(begin());
+}
+
+/**
+* Read-only version of rbegin.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::const_reverse_iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::crbegin() const
+{
+    return const_reverse_iterator(cend());
+}
+
+/**
+* Read-only version of rend.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::const_reverse_iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::crend() const
+{
+    return const_reverse_iterator(cbegin());
 }
 
 /**
 * Returns an iterator to the item with the given key, k
 * or the end iterator if k does not exist in the tree
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::find(const Key & k) const
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::find(const Key & k) const
 {
     Node<Key, Value> *curr = internalFind(k);
     /*
     if(curr == NULL ) {
-      //BinarySearchTree<Key, Value>::iterator it(NULL);
+      //BinarySearchTree<Key, Value, Alloc, Compare>::iterator it(NULL);
       //return BinarySearchTree<Key,Value>().end();
       return end();
     }
     */
 
-    BinarySearchTree<Key, Value>::iterator it(curr);
+    BinarySearchTree<Key, Value, Alloc, Compare>::iterator it(curr, this);
     return it;
 }
 
@@ -451,68 +1059,242 @@ BinarySearchTree<Key, Value>::find(const Key & k) const
  * @precondition The key exists in the map
  * Returns the value associated with the key
  */
-template<class Key, class Value>
-Value& BinarySearchTree<Key, Value>::operator[](const Key& key)
+template<class Key, class Value, class Alloc, class Compare>
+Value& BinarySearchTree<Key, Value, Alloc, Compare>::operator[](const Key& key)
 {
     Node<Key, Value> *curr = internalFind(key);
     if(curr == NULL) throw std::out_of_range("Invalid key");
     return curr->getValue();
 }
-template<class Key, class Value>
-Value const & BinarySearchTree<Key, Value>::operator[](const Key& key) const
+template<class Key, class Value, class Alloc, class Compare>
+Value const & BinarySearchTree<Key, Value, Alloc, Compare>::operator[](const Key& key) const
 {
     Node<Key, Value> *curr = internalFind(key);
     if(curr == NULL) throw std::out_of_range("Invalid key");
     return curr->getValue();
 }
 
+/**
+* Returns an iterator to the first item whose key is not below key.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::lower_bound(const Key& key) const
+{
+    return iterator(lowerBoundNode(key, false), this);
+}
+
+/**
+* Returns an iterator to the first item whose key is above key.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::upper_bound(const Key& key) const
+{
+    return iterator(lowerBoundNode(key, true), this);
+}
+
+/**
+* Returns lower_bound(key) and upper_bound(key). With unique keys the
+* upper bound is the successor of a match, so only one descent is made.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+std::pair<typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator,
+          typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator>
+BinarySearchTree<Key, Value, Alloc, Compare>::equal_range(const Key& key) const
+{
+    Node<Key, Value>* first = lowerBoundNode(key, false);
+    if(first == NULL || compareKeys(key, first->getKey()) != 0) {
+        return std::make_pair(iterator(first, this), iterator(first, this));
+    }
+    return std::make_pair(iterator(first, this), iterator(successor(first), this));
+}
+
+/**
+* Returns an iterator to the last item whose key is not above key.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::floor(const Key& key) const
+{
+    return iterator(floorNode(key), this);
+}
+
+/**
+* Same as lower_bound.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::ceiling(const Key& key) const
+{
+    return iterator(lowerBoundNode(key, false), this);
+}
+
+/**
+* Heterogeneous find: key only has to compare with Key under Compare.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+template<typename K, typename C, typename>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::find(const K& key) const
+{
+    return iterator(internalFind(key), this);
+}
+
+/**
+* Heterogeneous lower_bound.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+template<typename K, typename C, typename>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::lower_bound(const K& key) const
+{
+    return iterator(lowerBoundNode(key, false), this);
+}
+
+/**
+* Heterogeneous upper_bound.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+template<typename K, typename C, typename>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::upper_bound(const K& key) const
+{
+    return iterator(lowerBoundNode(key, true), this);
+}
+
+/**
+* Heterogeneous equal_range. Unlike the Key version it makes two descents,
+* since several keys may compare equal to key.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+template<typename K, typename C, typename>
+std::pair<typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator,
+          typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator>
+BinarySearchTree<Key, Value, Alloc, Compare>::equal_range(const K& key) const
+{
+    return std::make_pair(iterator(lowerBoundNode(key, false), this), iterator(lowerBoundNode(key, true), this));
+}
+
+/**
+* Returns a view of the items with keys in [lo, hi), which is empty
+* unless lo is below hi.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::range_view
+BinarySearchTree<Key, Value, Alloc, Compare>::range(const Key& lo, const Key& hi) const
+{
+    if(compareKeys(lo, hi) >= 0) {
+        return range_view(end(), end());
+    }
+    return range_view(iterator(lowerBoundNode(lo, false), this), iterator(lowerBoundNode(hi, false), this));
+}
+
 /**
 * An insert method to insert into a Binary Search Tree.
 * The tree will not remain balanced when inserting.
 * Recall: If key is already in the tree, you should 
 * overwrite the current value with the updated value.
 */
-template<class Key, class Value>
-void BinarySearchTree<Key, Value>::insert(const std::pair<const Key, Value> &keyValuePair)
-{   
-    //Now look for a place in the tree to insert the node
-    //Case 1: BST is currently empty so this node becomes root
-    if(root_ == NULL) {
-      root_ = new Node<Key, Value>(keyValuePair.first, keyValuePair.second, NULL);
-    }
-    else {
-       //pointer that will traverse the tree
-      Node<Key, Value>* traverse = root_;
-      //pointer that maintains the previous position of traverse
-      Node<Key, Value>* previous = NULL;
-      Node<Key, Value>* n = new Node<Key, Value>(keyValuePair.first, keyValuePair.second, NULL);
-      while ( traverse != NULL ) {
-        //if the key is found in the tree, just update the value of that key..
-        //no need to insert the same key in the tree again
-        if(keyValuePair.first == traverse->getKey()) {
-          traverse->setValue(keyValuePair.second);
-          return;
-        }
-        previous = traverse;
-        if( keyValuePair.first < traverse->getKey() ) {
-          traverse = traverse->getLeft();
-        }
-        else {
-          traverse = traverse->getRight();
-        }
-    }
+template<class Key, class Value, class Alloc, class Compare>
+void BinarySearchTree<Key, Value, Alloc, Compare>::insert(const std::pair<const Key, Value> &keyValuePair)
+{
+    insertOrAssignNode<Node<Key, Value> >(keyValuePair.first, keyValuePair.second);
+}
 
-    //Set parent node
-    n->setParent(previous);
-    //Insert the node
-    if(n->getKey() < previous->getKey()) {
-      previous->setLeft(n);
-    }
-    else {
-      previous->setRight(n);
-    }
+/**
+* Constructs an item from args and inserts it unless its key is already
+* present, in which case the new item is discarded.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator, bool>
+BinarySearchTree<Key, Value, Alloc, Compare>::emplace(Args&&... args)
+{
+    std::pair<Node<Key, Value>*, bool> result = emplaceNode<Node<Key, Value> >(std::forward<Args>(args)...);
+    return std::make_pair(iterator(result.first, this), result.second);
+}
 
-    }
+/**
+* Inserts key with a value built from args if key is not present.
+* Nothing is constructed (and args are not moved from) otherwise.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator, bool>
+BinarySearchTree<Key, Value, Alloc, Compare>::try_emplace(const Key& key, Args&&... args)
+{
+    std::pair<Node<Key, Value>*, bool> result = tryEmplaceNode<Node<Key, Value> >(key, std::forward<Args>(args)...);
+    return std::make_pair(iterator(result.first, this), result.second);
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator, bool>
+BinarySearchTree<Key, Value, Alloc, Compare>::try_emplace(Key&& key, Args&&... args)
+{
+    std::pair<Node<Key, Value>*, bool> result = tryEmplaceNode<Node<Key, Value> >(std::move(key), std::forward<Args>(args)...);
+    return std::make_pair(iterator(result.first, this), result.second);
+}
+
+/**
+* Inserts key with the given value, or assigns the value if key is present.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+template<typename V>
+std::pair<typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator, bool>
+BinarySearchTree<Key, Value, Alloc, Compare>::insert_or_assign(const Key& key, V&& value)
+{
+    std::pair<Node<Key, Value>*, bool> result = insertOrAssignNode<Node<Key, Value> >(key, std::forward<V>(value));
+    return std::make_pair(iterator(result.first, this), result.second);
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+template<typename V>
+std::pair<typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator, bool>
+BinarySearchTree<Key, Value, Alloc, Compare>::insert_or_assign(Key&& key, V&& value)
+{
+    std::pair<Node<Key, Value>*, bool> result = insertOrAssignNode<Node<Key, Value> >(std::move(key), std::forward<V>(value));
+    return std::make_pair(iterator(result.first, this), result.second);
+}
+
+/**
+* Calls fn on the value stored under key, first inserting a
+* value-initialized Value if key is not present. Suited to counters:
+* upsert(k, [](int& v) { ++v; }).
+*/
+template<class Key, class Value, class Alloc, class Compare>
+template<typename Fn>
+std::pair<typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator, bool>
+BinarySearchTree<Key, Value, Alloc, Compare>::upsert(const Key& key, Fn fn)
+{
+    std::pair<Node<Key, Value>*, bool> result = tryEmplaceNode<Node<Key, Value> >(key);
+    fn(result.first->getValue());
+    return std::make_pair(iterator(result.first, this), result.second);
+}
+
+/**
+* Replaces the contents of the tree with the items in [first, last),
+* which must be sorted by strictly ascending key. Every node is taken
+* from one contiguous block and the result is as balanced as possible,
+* so sorted loads no longer degenerate into a linked list.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+template<typename ForwardIt>
+void BinarySearchTree<Key, Value, Alloc, Compare>::assign_sorted(ForwardIt first, ForwardIt last)
+{
+    clear();
+    std::size_t n = static_cast<std::size_t>(std::distance(first, last));
+    alloc_.reserve(sizeof(Node<Key, Value>), n);
+    int height;
+    NoBuildHook hook;
+    auto source = [&]() {
+      Node<Key, Value>* n = createNode<Node<Key, Value> >(static_cast<Node<Key, Value>*>(NULL), *first);
+      ++first;
+      return n;
+    };
+    root_ = buildSorted<Node<Key, Value> >(source, n, static_cast<Node<Key, Value>*>(NULL), height, hook);
+    resetLast();
 }
 
 /**
@@ -520,13 +1302,13 @@ void BinarySearchTree<Key, Value>::insert(const std::pair<const Key, Value> &key
 * Recall: The writeup specifies that if a node has 2 children you
 * should swap with the predecessor and then remove.
 */
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::remove(const Key& key)
+template<typename Key, typename Value, typename Alloc, typename Compare>
+void BinarySearchTree<Key, Value, Alloc, Compare>::remove(const Key& key)
 {
 
   //Check if key is in tree
-  if(internalFind(key) != NULL ) {
-    Node<Key,Value> * current = internalFind(key);
+  Node<Key,Value> * current = internalFind(key);
+  if(current != NULL ) {
 
   if(current->getRight() && current->getLeft()){
     Node<Key,Value> * previous = predecessor(current);
@@ -535,6 +1317,9 @@ void BinarySearchTree<Key, Value>::remove(const Key& key)
     
     //Check how many children
   if( current->getLeft() == NULL || current->getRight() == NULL) {
+      if(current == last_) {
+        last_ = predecessor(current);
+      }
       Node<Key,Value>* previous = current->getParent();
       Node<Key,Value>* tmp;
       if( current->getRight() == NULL ) {
@@ -549,8 +1334,7 @@ void BinarySearchTree<Key, Value>::remove(const Key& key)
           tmp->setParent(previous);
         }
         root_ = tmp;
-        current = NULL;
-        delete current;
+        destroyNode(current);
       }
       else {
         if( current == previous->getLeft() ) {
@@ -562,8 +1346,7 @@ void BinarySearchTree<Key, Value>::remove(const Key& key)
         if(tmp != NULL) {
           tmp->setParent(previous);
         }
-        current = NULL;
-        delete current;
+        destroyNode(current);
 
       }
       
@@ -580,28 +1363,27 @@ void BinarySearchTree<Key, Value>::remove(const Key& key)
 
 
 
-template<class Key, class Value>
+/**
+* Returns the in-order predecessor of current, or NULL. Climbs while
+* current is a left child, so only links are compared, never keys.
+*/
+template<class Key, class Value, class Alloc, class Compare>
 Node<Key, Value>*
-BinarySearchTree<Key, Value>::predecessor(Node<Key, Value>* current)
+BinarySearchTree<Key, Value, Alloc, Compare>::predecessor(Node<Key, Value>* current)
 {
   if( current == NULL ) {
     return NULL;
   }
   if(current->getLeft() != NULL ) {
-    Node<Key,Value>* tmp;
-    tmp = current;
     current = current->getLeft();
     while(current->getRight() != NULL){
-      tmp = current;
       current = current->getRight();
     }
      return current;
   }
   Node<Key,Value>* pred = current->getParent();
-  while( pred != NULL ) {
-    if ( pred->getKey() < current->getKey() ) {
-      return pred;
-    }
+  while( pred != NULL && pred->getLeft() == current ) {
+    current = pred;
     pred = pred->getParent();
   }
 
@@ -609,29 +1391,27 @@ BinarySearchTree<Key, Value>::predecessor(Node<Key, Value>* current)
 
 }
 
-
-template<class Key, class Value>
+/**
+* Returns the in-order successor of current, or NULL. Each step of an
+* iteration costs amortized O(1) link reads and no key comparisons.
+*/
+template<class Key, class Value, class Alloc, class Compare>
 Node<Key, Value>*
-BinarySearchTree<Key, Value>::successor(Node<Key, Value>* current)
+BinarySearchTree<Key, Value, Alloc, Compare>::successor(Node<Key, Value>* current)
 {
   if( current == NULL ) {
     return NULL;
   }
   if(current->getRight() != NULL ) {
-    Node<Key,Value>* tmp;
-    tmp = current;
     current = current->getRight();
     while(current->getLeft() != NULL){
-      tmp = current;
       current = current->getLeft();
     }
      return current;
   }
   Node<Key,Value>* succ = current->getParent();
-  while( succ != NULL ) {
-    if ( succ->getKey() > current->getKey() ) {
-      return succ;
-    }
+  while( succ != NULL && succ->getRight() == current ) {
+    current = succ;
     succ = succ->getParent();
   }
 
@@ -639,58 +1419,505 @@ BinarySearchTree<Key, Value>::successor(Node<Key, Value>* current)
 
 }
 
-template<class Key, class Value>
-int BinarySearchTree<Key, Value>::findHeight(Node<Key,Value>* root) const {
+/**
+* Visits every node of the subtree rooted at root, children before their
+* parent, by following parent links: O(n) time and no stack. The next node
+* is found before visit(n) is called, so visit may not change the links
+* of nodes still to come, but it may read anything.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+template<typename Visit>
+void BinarySearchTree<Key, Value, Alloc, Compare>::visitPostorder(Node<Key,Value>* root, Visit& visit)
+{
   if(root == NULL) {
-    return 0;
+    return;
   }
+  // the first node in postorder under n: keep going down, left first
+  auto firstUnder = [](Node<Key,Value>* n) {
+    for(;;) {
+      if(n->getLeft() != NULL) {
+        n = n->getLeft();
+      }
+      else if(n->getRight() != NULL) {
+        n = n->getRight();
+      }
+      else {
+        return n;
+      }
+    }
+  };
+  Node<Key,Value>* n = firstUnder(root);
+  while(n != root) {
+    Node<Key,Value>* parent = n->getParent();
+    Node<Key,Value>* next = parent;
+    if(n == parent->getLeft() && parent->getRight() != NULL) {
+      next = firstUnder(parent->getRight());
+    }
+    visit(n);
+    n = next;
+  }
+  visit(root);
+}
 
-  return 1 + std::max(findHeight(root->getLeft()), findHeight(root->getRight()));
-
+/**
+* Returns the height of the subtree rooted at root, computed bottom-up in
+* one pass, and sets balanced to whether every node in it has subtrees
+* whose heights differ by at most one. Child heights wait on a stack until
+* their parent is visited, so the stack never holds more than one entry
+* per level.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+int BinarySearchTree<Key, Value, Alloc, Compare>::measureHeight(Node<Key,Value>* root, bool& balanced) const {
+  std::vector<int> heights;
+  balanced = true;
+  auto visit = [&heights, &balanced](Node<Key,Value>* n) {
+    // the right subtree finished last, so its height is on top
+    int height_right = 0;
+    if(n->getRight() != NULL) {
+      height_right = heights.back();
+      heights.pop_back();
+    }
+    int height_left = 0;
+    if(n->getLeft() != NULL) {
+      height_left = heights.back();
+      heights.pop_back();
+    }
+    if( (height_left - height_right > 1) || (height_right - height_left > 1) ) {
+      balanced = false;
+    }
+    heights.push_back(1 + std::max(height_left, height_right));
+  };
+  visitPostorder(root, visit);
+  return heights.empty() ? 0 : heights.back();
 }
 
-template<class Key, class Value>
-bool BinarySearchTree<Key, Value>::checkBalanced(Node<Key,Value>* root) const {
-  if(root == NULL) {
-    return true;
-  }
-  int height_left = findHeight(root->getLeft());
-  int height_right = findHeight(root->getRight());
+template<class Key, class Value, class Alloc, class Compare>
+int BinarySearchTree<Key, Value, Alloc, Compare>::findHeight(Node<Key,Value>* root) const {
+  bool balanced;
+  return measureHeight(root, balanced);
+}
 
-  if( (height_left - height_right > 1) || (height_right - height_left > 1)  ) {
-    return false;
-  }
-  return checkBalanced(root->getLeft()) && checkBalanced(root->getRight());
+template<class Key, class Value, class Alloc, class Compare>
+bool BinarySearchTree<Key, Value, Alloc, Compare>::checkBalanced(Node<Key,Value>* root) const {
+  bool balanced;
+  measureHeight(root, balanced);
+  return balanced;
 }
 
-template<class Key, class Value>
-void BinarySearchTree<Key, Value>::clearTree(Node<Key,Value>* current) const {
-  if(current == NULL) {
-    return;
+/**
+* Destroys the subtree rooted at current in O(n) time and constant space.
+* A node with a left child is rotated right, so the tree turns into a
+* chain of right children that is freed from the top. Only child links
+* are read, so subtrees with stale parent links are fine.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+void BinarySearchTree<Key, Value, Alloc, Compare>::clearTree(Node<Key,Value>* current) {
+  while(current != NULL) {
+    Node<Key,Value>* left = current->getLeft();
+    if(left != NULL) {
+      current->setLeft(left->getRight());
+      left->setRight(current);
+      current = left;
+    }
+    else {
+      Node<Key,Value>* right = current->getRight();
+      destroyNode(current);
+      current = right;
+    }
   }
-  clearTree(current->getLeft());
-  clearTree(current->getRight());
-  delete current;
 }
 
 /**
 * A method to remove all contents of the tree and
 * reset the values in the tree for use again.
+* When the items have nothing to destroy and the allocator can drop
+* its whole arena at once, no node is visited.
 */
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::clear()
+template<typename Key, typename Value, typename Alloc, typename Compare>
+void BinarySearchTree<Key, Value, Alloc, Compare>::clear()
 {
-    clearTree(this->root_);
+    if(!std::is_trivially_destructible<std::pair<const Key, Value> >::value
+        || !alloc_.release()) {
+      clearTree(this->root_);
+      alloc_.release();
+    }
     root_ = NULL;
+    last_ = NULL;
 }
 
+/**
+* Allocates a node of the given type from alloc_ and constructs it in place.
+*/
+template<typename Key, typename Value, typename Alloc, typename Compare>
+template<typename NodeType, typename... Args>
+NodeType* BinarySearchTree<Key, Value, Alloc, Compare>::createNode(Args&&... args)
+{
+    void* mem = alloc_.allocate(sizeof(NodeType));
+    try {
+      return new (mem) NodeType(std::forward<Args>(args)...);
+    }
+    catch(...) {
+      alloc_.deallocate(mem, sizeof(NodeType));
+      throw;
+    }
+}
+
+/**
+* Destroys a node and hands its memory back to alloc_. Trees that
+* allocate a derived node type override this.
+*/
+template<typename Key, typename Value, typename Alloc, typename Compare>
+void BinarySearchTree<Key, Value, Alloc, Compare>::destroyNode(Node<Key,Value>* n)
+{
+    n->~Node<Key, Value>();
+    alloc_.deallocate(n, sizeof(Node<Key, Value>));
+}
+
+
+/**
+* Three-way comparison of two keys, or of a key and a value comparable with
+* keys: negative, zero or positive as a is less than, equal to or greater
+* than b under Compare.
+*/
+template<typename Key, typename Value, typename Alloc, typename Compare>
+template<typename A, typename B>
+int BinarySearchTree<Key, Value, Alloc, Compare>::compareKeys(const A& a, const B& b)
+{
+    Compare comp;
+    return compareWith(comp, a, b, 0);
+}
+
+/**
+* Helper for the ordered lookups: returns the first node whose key is not
+* below key, or above it if strict, or NULL if there is none.
+*/
+template<typename Key, typename Value, typename Alloc, typename Compare>
+template<typename K>
+Node<Key, Value>* BinarySearchTree<Key, Value, Alloc, Compare>::lowerBoundNode(const K& key, bool strict) const
+{
+    Node<Key, Value>* bound = NULL;
+    Node<Key, Value>* n = root_;
+    while(n != NULL) {
+      int cmp = compareKeys(key, n->getKey());
+      if(cmp < 0 || (cmp == 0 && !strict)) {
+        bound = n;
+        n = n->getLeft();
+      }
+      else {
+        n = n->getRight();
+      }
+    }
+    return bound;
+}
+
+/**
+* Helper for floor: returns the last node whose key is not above key, or
+* NULL if there is none.
+*/
+template<typename Key, typename Value, typename Alloc, typename Compare>
+template<typename K>
+Node<Key, Value>* BinarySearchTree<Key, Value, Alloc, Compare>::floorNode(const K& key) const
+{
+    Node<Key, Value>* bound = NULL;
+    Node<Key, Value>* n = root_;
+    while(n != NULL) {
+      int cmp = compareKeys(key, n->getKey());
+      if(cmp == 0) {
+        return n;
+      }
+      if(cmp > 0) {
+        bound = n;
+        n = n->getRight();
+      }
+      else {
+        n = n->getLeft();
+      }
+    }
+    return bound;
+}
+
+/**
+* Helper that descends once from the root looking for key. Returns the
+* node holding key, or NULL if there is none, in which case parent and
+* goLeft say where a node for key would be attached.
+*/
+template<typename Key, typename Value, typename Alloc, typename Compare>
+Node<Key, Value>* BinarySearchTree<Key, Value, Alloc, Compare>::findAttachPoint(
+    const Key& key, Node<Key, Value>*& parent, bool& goLeft) const
+{
+    Node<Key, Value>* current = root_;
+    parent = NULL;
+    goLeft = false;
+    while(current != NULL) {
+      int cmp = compareKeys(key, current->getKey());
+      if(cmp == 0) {
+        return current;
+      }
+      parent = current;
+      goLeft = cmp < 0;
+      current = goLeft ? current->getLeft() : current->getRight();
+    }
+    return NULL;
+}
+
+/**
+* Links a node whose parent pointer is already set into the spot found
+* by findAttachPoint.
+*/
+template<typename Key, typename Value, typename Alloc, typename Compare>
+void BinarySearchTree<Key, Value, Alloc, Compare>::attachNode(
+    Node<Key, Value>* n, Node<Key, Value>* parent, bool goLeft)
+{
+    if(parent == NULL) {
+      root_ = n;
+      last_ = n;
+    }
+    else if(goLeft) {
+      parent->setLeft(n);
+    }
+    else {
+      parent->setRight(n);
+      if(parent == last_) {
+        last_ = n;
+      }
+    }
+}
+
+/**
+* Builds a node of the given type from args, then descends with its key.
+* The node is destroyed again if the key turns out to be present.
+*/
+template<typename Key, typename Value, typename Alloc, typename Compare>
+template<typename NodeType, typename... Args>
+std::pair<NodeType*, bool> BinarySearchTree<Key, Value, Alloc, Compare>::emplaceNode(Args&&... args)
+{
+    NodeType* n = createNode<NodeType>(static_cast<NodeType*>(NULL), std::forward<Args>(args)...);
+    Node<Key, Value>* parent;
+    bool goLeft;
+    Node<Key, Value>* existing = findAttachPoint(n->getKey(), parent, goLeft);
+    if(existing != NULL) {
+      destroyNode(n);
+      return std::make_pair(static_cast<NodeType*>(existing), false);
+    }
+    n->setParent(parent);
+    attachNode(n, parent, goLeft);
+    return std::make_pair(n, true);
+}
+
+/**
+* Descends once with key and, if it is absent, attaches a node of the
+* given type whose value is built from args.
+*/
+template<typename Key, typename Value, typename Alloc, typename Compare>
+template<typename NodeType, typename K, typename... Args>
+std::pair<NodeType*, bool> BinarySearchTree<Key, Value, Alloc, Compare>::tryEmplaceNode(K&& key, Args&&... args)
+{
+    Node<Key, Value>* parent;
+    bool goLeft;
+    Node<Key, Value>* existing = findAttachPoint(key, parent, goLeft);
+    if(existing != NULL) {
+      return std::make_pair(static_cast<NodeType*>(existing), false);
+    }
+    NodeType* n = createNode<NodeType>(static_cast<NodeType*>(parent), std::piecewise_construct,
+                                       std::forward_as_tuple(std::forward<K>(key)),
+                                       std::forward_as_tuple(std::forward<Args>(args)...));
+    attachNode(n, parent, goLeft);
+    return std::make_pair(n, true);
+}
+
+/**
+* Descends once with key and either assigns value to the existing node
+* or attaches a new node of the given type.
+*/
+template<typename Key, typename Value, typename Alloc, typename Compare>
+template<typename NodeType, typename K, typename V>
+std::pair<NodeType*, bool> BinarySearchTree<Key, Value, Alloc, Compare>::insertOrAssignNode(K&& key, V&& value)
+{
+    Node<Key, Value>* parent;
+    bool goLeft;
+    Node<Key, Value>* existing = findAttachPoint(key, parent, goLeft);
+    if(existing != NULL) {
+      existing->getValue() = std::forward<V>(value);
+      return std::make_pair(static_cast<NodeType*>(existing), false);
+    }
+    NodeType* n = createNode<NodeType>(static_cast<NodeType*>(parent),
+                                       std::forward<K>(key), std::forward<V>(value));
+    attachNode(n, parent, goLeft);
+    return std::make_pair(n, true);
+}
+
+/**
+* Builds a perfectly balanced subtree out of the next n nodes produced by
+* source() (in key order) and returns its root. The nodes may be new or
+* unlinked from elsewhere; their links are all overwritten. The left half
+* gets the extra node when n is even. height is set to the subtree's
+* height, and onBuilt(node, leftHeight, rightHeight) is called on every
+* node once its children are complete, so derived trees can fill in their
+* own fields.
+*/
+template<typename Key, typename Value, typename Alloc, typename Compare>
+template<typename NodeType, typename NodeSource, typename OnBuilt>
+NodeType* BinarySearchTree<Key, Value, Alloc, Compare>::buildSorted(
+    NodeSource& source, std::size_t n, NodeType* parent, int& height, OnBuilt& onBuilt)
+{
+    if(n == 0) {
+      height = 0;
+      return NULL;
+    }
+    std::size_t leftCount = n / 2;
+    int leftHeight;
+    int rightHeight;
+    NodeType* left = buildSorted<NodeType>(source, leftCount, static_cast<NodeType*>(NULL), leftHeight, onBuilt);
+    NodeType* middle = source();
+    middle->setParent(parent);
+    NodeType* right = buildSorted<NodeType>(source, n - leftCount - 1, middle, rightHeight, onBuilt);
+    middle->setLeft(left);
+    middle->setRight(right);
+    if(left != NULL) {
+      left->setParent(middle);
+    }
+    height = 1 + std::max(leftHeight, rightHeight);
+    onBuilt(middle, leftHeight, rightHeight);
+    return middle;
+}
+
+/**
+* Copies the whole tree rooted at src, shape and all, and returns the new
+* root. Nodes are copied in preorder by walking both trees in step along
+* their parent links, so no recursion or stack is needed, and the source
+* is only read once: counting it first to reserve space costs as much as
+* the copy. The allocator's growing slabs keep the copies close together.
+* copyNode(source, newParent) makes each node, filling in any fields a
+* derived node adds. If it throws, the nodes copied so far are destroyed.
+*/
+template<typename Key, typename Value, typename Alloc, typename Compare>
+template<typename NodeType, typename CopyNode>
+NodeType* BinarySearchTree<Key, Value, Alloc, Compare>::cloneTree(const NodeType* src, CopyNode& copyNode)
+{
+    if(src == NULL) {
+      return NULL;
+    }
+    NodeType* root = copyNode(src, static_cast<NodeType*>(NULL));
+    try {
+      const NodeType* from = src;
+      NodeType* to = root;
+      for(;;) {
+        if(from->getLeft() != NULL && to->getLeft() == NULL) {
+          to->setLeft(copyNode(from->getLeft(), to));
+          from = from->getLeft();
+          to = to->getLeft();
+        }
+        else if(from->getRight() != NULL && to->getRight() == NULL) {
+          to->setRight(copyNode(from->getRight(), to));
+          from = from->getRight();
+          to = to->getRight();
+        }
+        else if(from == src) {
+          break;
+        }
+        else {
+          from = from->getParent();
+          to = to->getParent();
+        }
+      }
+    }
+    catch(...) {
+      clearTree(root);
+      throw;
+    }
+    return root;
+}
+
+/**
+* Wraps a node in an iterator; lets derived trees build iterators.
+*/
+template<typename Key, typename Value, typename Alloc, typename Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::makeIterator(Node<Key, Value>* n) const
+{
+    return iterator(n, this);
+}
+
+/**
+* Unwraps an iterator; lets derived trees reach the node it points to.
+*/
+template<typename Key, typename Value, typename Alloc, typename Compare>
+Node<Key, Value>* BinarySearchTree<Key, Value, Alloc, Compare>::iteratorNode(const iterator& it)
+{
+    return it.current_;
+}
+
+/**
+* The in-order successor of n, for iterators. When pushNode_ is set, it is
+* called on n and on each node passed on the way down to the successor.
+*/
+template<typename Key, typename Value, typename Alloc, typename Compare>
+Node<Key, Value>* BinarySearchTree<Key, Value, Alloc, Compare>::nextNode(Node<Key, Value>* n) const
+{
+    if(pushNode_ == NULL || n->getRight() == NULL) {
+      return successor(n);
+    }
+    pushNode_(n);
+    n = n->getRight();
+    while(n->getLeft() != NULL) {
+      pushNode_(n);
+      n = n->getLeft();
+    }
+    return n;
+}
+
+/**
+* The in-order predecessor of n, or the last node if n is NULL (end()), for
+* iterators. Pushes on the way down like nextNode; the last node is
+* reached from the root.
+*/
+template<typename Key, typename Value, typename Alloc, typename Compare>
+Node<Key, Value>* BinarySearchTree<Key, Value, Alloc, Compare>::prevNode(Node<Key, Value>* n) const
+{
+    if(pushNode_ == NULL) {
+      return (n == NULL) ? last_ : predecessor(n);
+    }
+    if(n == NULL) {
+      n = root_;
+      if(n == NULL) {
+        return NULL;
+      }
+      while(n->getRight() != NULL) {
+        pushNode_(n);
+        n = n->getRight();
+      }
+      return n;
+    }
+    if(n->getLeft() == NULL) {
+      return predecessor(n);
+    }
+    pushNode_(n);
+    n = n->getLeft();
+    while(n->getRight() != NULL) {
+      pushNode_(n);
+      n = n->getRight();
+    }
+    return n;
+}
+
+/**
+* Finds the rightmost node again after the tree was rebuilt wholesale.
+*/
+template<typename Key, typename Value, typename Alloc, typename Compare>
+void BinarySearchTree<Key, Value, Alloc, Compare>::resetLast()
+{
+    last_ = root_;
+    while(last_ != NULL && last_->getRight() != NULL) {
+      last_ = last_->getRight();
+    }
+}
 
 /**
 * A helper function to find the smallest node in the tree.
 */
-template<typename Key, typename Value>
+template<typename Key, typename Value, typename Alloc, typename Compare>
 Node<Key, Value>*
-BinarySearchTree<Key, Value>::getSmallestNode() const
+BinarySearchTree<Key, Value, Alloc, Compare>::getSmallestNode() const
 {
     // to get the smallest node traverse all the way to the left until you can't
     Node<Key, Value>* n = root_;
@@ -709,18 +1936,20 @@ BinarySearchTree<Key, Value>::getSmallestNode() const
 * return a pointer to it or NULL if no item with that key
 * exists
 */
-template<typename Key, typename Value>
-Node<Key, Value>* BinarySearchTree<Key, Value>::internalFind(const Key& key) const
+template<typename Key, typename Value, typename Alloc, typename Compare>
+template<typename K>
+Node<Key, Value>* BinarySearchTree<Key, Value, Alloc, Compare>::internalFind(const K& key) const
 {
   Node<Key,Value>* current = root_;
   if(root_ == NULL) {
     return NULL;
   }
   while ( current!= NULL ) {
-    if( key > current->getKey() ) {
+    int cmp = compareKeys(key, current->getKey());
+    if( cmp > 0 ) {
       current = current->getRight();
     }
-    else if( key < current->getKey() ) {
+    else if( cmp < 0 ) {
       current = current->getLeft();
     }
     else {
@@ -735,16 +1964,16 @@ Node<Key, Value>* BinarySearchTree<Key, Value>::internalFind(const Key& key) con
 /**
  * Return true iff the BST is balanced.
  */
-template<typename Key, typename Value>
-bool BinarySearchTree<Key, Value>::isBalanced() const
+template<typename Key, typename Value, typename Alloc, typename Compare>
+bool BinarySearchTree<Key, Value, Alloc, Compare>::isBalanced() const
 {
     return checkBalanced(this->root_);
 }
 
 
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::nodeSwap( Node<Key,Value>* n1, Node<Key,Value>* n2)
+template<typename Key, typename Value, typename Alloc, typename Compare>
+void BinarySearchTree<Key, Value, Alloc, Compare>::nodeSwap( Node<Key,Value>* n1, Node<Key,Value>* n2)
 {
     if((n1 == n2) || (n1 == NULL) || (n2 == NULL) ) {
         return;
@@ -0,0 +1,993 @@
+#ifndef BTREE_H
+#define BTREE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include "node_pool.h"
+
+/**
+* Padding that rounds a node of the given size up to whole 64-byte cache
+* lines.
+*/
+template<std::size_t Bytes, std::size_t Rem = Bytes % 64>
+struct CacheLinePad
+{
+    char pad_[64 - Rem];
+};
+
+template<std::size_t Bytes>
+struct CacheLinePad<Bytes, 0>
+{
+};
+
+/**
+* An ordered map with the interface of BinarySearchTree, stored as a B+
+* tree. Inner nodes hold only separator keys and child links, and every
+* item lives in a leaf, so a lookup reads a few wide nodes instead of one
+* node per level of a binary tree. Nodes are sized to about NODE_BYTES and
+* padded to whole cache lines. Integral keys under std::less are searched
+* with a branchless linear scan the compiler can vectorize; other keys use
+* binary search.
+*
+* Leaves are linked in key order, so iterators step in O(1) without
+* touching inner nodes. Inserts split full nodes and removes top up thin
+* nodes on the way down, so each update is one root-to-leaf pass.
+*
+* Iterators are invalidated by any insert or remove, since items move
+* within and between leaves.
+*/
+template <typename Key, typename Value, typename Alloc = NodePool, typename Compare = std::less<Key> >
+class BTreeMap
+{
+private:
+    typedef std::pair<const Key, Value> Item;
+
+    static const std::size_t NODE_BYTES = 256;
+    static const std::size_t LEAF_FIT = (NODE_BYTES - 3 * sizeof(void*)) / sizeof(Item);
+    static const std::size_t INNER_FIT = (NODE_BYTES - 2 * sizeof(void*)) / (sizeof(Key) + sizeof(void*));
+    static const std::size_t LEAF_CAPACITY = (LEAF_FIT > 4) ? LEAF_FIT : 4;
+    static const std::size_t INNER_CAPACITY = (INNER_FIT > 4) ? INNER_FIT : 4;
+    // A node is topped up before the descent enters it when it holds no
+    // more than this, so it can lose one entry; two such nodes plus a
+    // separator still fit in one.
+    static const std::size_t LEAF_MIN = (LEAF_CAPACITY - 1) / 2;
+    static const std::size_t INNER_MIN = (INNER_CAPACITY - 1) / 2;
+
+    struct NodeHeader
+    {
+        std::uint16_t count;
+        bool leaf;
+    };
+    struct LeafNode;
+    struct LeafBody : public NodeHeader
+    {
+        LeafNode* prev;
+        LeafNode* next;
+        typename std::aligned_storage<sizeof(Item), std::alignment_of<Item>::value>::type items[LEAF_CAPACITY];
+    };
+    struct LeafNode : public LeafBody, public CacheLinePad<sizeof(LeafBody)>
+    {
+        Item* item(std::size_t i) { return reinterpret_cast<Item*>(&this->items[i]); }
+    };
+    struct InnerBody : public NodeHeader
+    {
+        typename std::aligned_storage<sizeof(Key), std::alignment_of<Key>::value>::type keys[INNER_CAPACITY];
+        NodeHeader* children[INNER_CAPACITY + 1];
+    };
+    struct InnerNode : public InnerBody, public CacheLinePad<sizeof(InnerBody)>
+    {
+        Key* key(std::size_t i) { return reinterpret_cast<Key*>(&this->keys[i]); }
+        const Key* keyArray() const { return reinterpret_cast<const Key*>(&this->keys[0]); }
+        NodeHeader*& child(std::size_t i) { return this->children[i]; }
+    };
+
+public:
+    BTreeMap();
+    ~BTreeMap();
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    void clear();
+    bool isBalanced() const;
+    bool empty() const;
+    std::size_t size() const;
+
+    /**
+    * A bidirectional iterator over the items in key order.
+    */
+    class iterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef std::pair<const Key, Value>* pointer;
+        typedef std::pair<const Key, Value>& reference;
+
+        iterator();
+
+        std::pair<const Key,Value>& operator*() const;
+        std::pair<const Key,Value>* operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+        iterator operator++(int);
+        iterator& operator--();
+        iterator operator--(int);
+
+    protected:
+        friend class BTreeMap<Key, Value, Alloc, Compare>;
+        iterator(LeafNode* leaf, std::size_t index, const BTreeMap* tree);
+        LeafNode* leaf_;
+        std::size_t index_;
+        const BTreeMap* tree_;
+    };
+
+    iterator begin() const;
+    iterator end() const;
+    iterator find(const Key& key) const;
+    iterator lower_bound(const Key& key) const;
+    Value& operator[](const Key& key);
+    Value const & operator[](const Key& key) const;
+
+    // Bytes taken by one leaf and one inner node.
+    static std::size_t leafBytes();
+    static std::size_t innerBytes();
+
+private:
+    BTreeMap(const BTreeMap&);
+    BTreeMap& operator=(const BTreeMap&);
+
+    typedef std::integral_constant<bool, std::is_integral<Key>::value && !std::is_same<Key, bool>::value
+                                         && std::is_same<Compare, std::less<Key> >::value> LinearSearch;
+
+    static std::size_t childIndex(InnerNode* n, const Key& key);
+    static std::size_t childIndex(InnerNode* n, const Key& key, std::true_type);
+    static std::size_t childIndex(InnerNode* n, const Key& key, std::false_type);
+    static std::size_t leafLowerBound(LeafNode* n, const Key& key);
+    static std::size_t leafLowerBound(LeafNode* n, const Key& key, std::true_type);
+    static std::size_t leafLowerBound(LeafNode* n, const Key& key, std::false_type);
+    LeafNode* findLeaf(const Key& key) const;
+
+    LeafNode* newLeaf();
+    InnerNode* newInner();
+    static bool isFull(NodeHeader* n);
+    static bool isThin(NodeHeader* n);
+    void splitChild(InnerNode* parent, std::size_t i);
+    std::size_t fixChild(InnerNode* parent, std::size_t i);
+    void borrowFromLeft(InnerNode* parent, std::size_t i);
+    void borrowFromRight(InnerNode* parent, std::size_t i);
+    void mergeChildren(InnerNode* parent, std::size_t i);
+    static void moveItem(Item* dst, Item* src);
+    static void moveKey(Key* dst, Key* src);
+    static void insertChild(InnerNode* parent, std::size_t i, NodeHeader* right);
+    static void eraseChild(InnerNode* parent, std::size_t i);
+    void destroyTree(NodeHeader* n);
+    static int leafDepth(NodeHeader* n);
+
+    NodeHeader* root_;
+    LeafNode* first_;
+    LeafNode* last_;
+    std::size_t size_;
+    Alloc leafAlloc_;
+    Alloc innerAlloc_;
+};
+
+/*
+  ---------------------------------------------------
+  Begin implementations for the BTreeMap::iterator class.
+  ---------------------------------------------------
+*/
+
+/**
+* A default constructor that initializes the iterator to end().
+*/
+template<class Key, class Value, class Alloc, class Compare>
+BTreeMap<Key, Value, Alloc, Compare>::iterator::iterator() :
+    leaf_(NULL),
+    index_(0),
+    tree_(NULL)
+{
+}
+
+/**
+* Points at item index of leaf, or at end() if leaf is NULL.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+BTreeMap<Key, Value, Alloc, Compare>::iterator::iterator(LeafNode* leaf, std::size_t index, const BTreeMap* tree) :
+    leaf_(leaf),
+    index_(index),
+    tree_(tree)
+{
+}
+
+/**
+* Provides access to the item.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+std::pair<const Key,Value>&
+BTreeMap<Key, Value, Alloc, Compare>::iterator::operator*() const
+{
+    return *leaf_->item(index_);
+}
+
+/**
+* Provides access to the address of the item.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+std::pair<const Key,Value>*
+BTreeMap<Key, Value, Alloc, Compare>::iterator::operator->() const
+{
+    return leaf_->item(index_);
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+bool BTreeMap<Key, Value, Alloc, Compare>::iterator::operator==(const iterator& rhs) const
+{
+    return leaf_ == rhs.leaf_ && index_ == rhs.index_;
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+bool BTreeMap<Key, Value, Alloc, Compare>::iterator::operator!=(const iterator& rhs) const
+{
+    return !(*this == rhs);
+}
+
+/**
+* Moves to the next item, following the leaf chain at the end of a leaf.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+typename BTreeMap<Key, Value, Alloc, Compare>::iterator&
+BTreeMap<Key, Value, Alloc, Compare>::iterator::operator++()
+{
+    if(++index_ == leaf_->count) {
+        leaf_ = leaf_->next;
+        index_ = 0;
+    }
+    return *this;
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+typename BTreeMap<Key, Value, Alloc, Compare>::iterator
+BTreeMap<Key, Value, Alloc, Compare>::iterator::operator++(int)
+{
+    iterator previous = *this;
+    ++(*this);
+    return previous;
+}
+
+/**
+* Moves to the previous item; from end() it moves to the last one.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+typename BTreeMap<Key, Value, Alloc, Compare>::iterator&
+BTreeMap<Key, Value, Alloc, Compare>::iterator::operator--()
+{
+    if(leaf_ == NULL) {
+        leaf_ = tree_->last_;
+        index_ = leaf_->count - 1;
+    }
+    else if(index_ == 0) {
+        leaf_ = leaf_->prev;
+        index_ = leaf_->count - 1;
+    }
+    else {
+        --index_;
+    }
+    return *this;
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+typename BTreeMap<Key, Value, Alloc, Compare>::iterator
+BTreeMap<Key, Value, Alloc, Compare>::iterator::operator--(int)
+{
+    iterator previous = *this;
+    --(*this);
+    return previous;
+}
+
+/*
+  -------------------------------------------------
+  End implementations for the BTreeMap::iterator class.
+  -------------------------------------------------
+*/
+
+/*
+  ---------------------------------------------
+  Begin implementations for the BTreeMap class.
+  ---------------------------------------------
+*/
+
+/**
+* Default constructor for an empty map. No node exists until the first
+* insert.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+BTreeMap<Key, Value, Alloc, Compare>::BTreeMap() :
+    root_(NULL),
+    first_(NULL),
+    last_(NULL),
+    size_(0)
+{
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+BTreeMap<Key, Value, Alloc, Compare>::~BTreeMap()
+{
+    clear();
+}
+
+/**
+* Inserts the item, or overwrites the value if its key is present. A full
+* node met on the way down is split first, so there is always room for a
+* separator in the parent.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+void BTreeMap<Key, Value, Alloc, Compare>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    const Key& key = keyValuePair.first;
+    if(root_ == NULL) {
+        LeafNode* leaf = newLeaf();
+        new (leaf->item(0)) Item(keyValuePair);
+        leaf->count = 1;
+        root_ = leaf;
+        first_ = leaf;
+        last_ = leaf;
+        size_ = 1;
+        return;
+    }
+    if(isFull(root_)) {
+        InnerNode* top = newInner();
+        top->child(0) = root_;
+        root_ = top;
+        splitChild(top, 0);
+    }
+    NodeHeader* n = root_;
+    while(!n->leaf) {
+        InnerNode* inner = static_cast<InnerNode*>(n);
+        std::size_t i = childIndex(inner, key);
+        if(isFull(inner->child(i))) {
+            splitChild(inner, i);
+            Compare comp;
+            if(!comp(key, *inner->key(i))) {
+                ++i;
+            }
+        }
+        n = inner->child(i);
+    }
+    LeafNode* leaf = static_cast<LeafNode*>(n);
+    std::size_t pos = leafLowerBound(leaf, key);
+    Compare comp;
+    if(pos < leaf->count && !comp(key, leaf->item(pos)->first)) {
+        leaf->item(pos)->second = keyValuePair.second;
+        return;
+    }
+    for(std::size_t j = leaf->count; j > pos; --j) {
+        moveItem(leaf->item(j), leaf->item(j - 1));
+    }
+    new (leaf->item(pos)) Item(keyValuePair);
+    ++leaf->count;
+    ++size_;
+}
+
+/**
+* Removes key if present. Each thin node met on the way down borrows from
+* or merges with a sibling first, so the leaf can lose an item without
+* any fix-up on the way back.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+void BTreeMap<Key, Value, Alloc, Compare>::remove(const Key& key)
+{
+    if(root_ == NULL) {
+        return;
+    }
+    NodeHeader* n = root_;
+    while(!n->leaf) {
+        InnerNode* inner = static_cast<InnerNode*>(n);
+        std::size_t i = childIndex(inner, key);
+        if(isThin(inner->child(i))) {
+            i = fixChild(inner, i);
+            if(inner == root_ && inner->count == 0) {
+                // the root's last two children were merged
+                root_ = inner->child(0);
+                innerAlloc_.deallocate(inner, sizeof(InnerNode));
+                n = root_;
+                continue;
+            }
+        }
+        n = inner->child(i);
+    }
+    LeafNode* leaf = static_cast<LeafNode*>(n);
+    std::size_t pos = leafLowerBound(leaf, key);
+    Compare comp;
+    if(pos == leaf->count || comp(key, leaf->item(pos)->first)) {
+        return;
+    }
+    leaf->item(pos)->~Item();
+    for(std::size_t j = pos + 1; j < leaf->count; ++j) {
+        moveItem(leaf->item(j - 1), leaf->item(j));
+    }
+    --leaf->count;
+    --size_;
+    if(leaf->count == 0) {
+        // only the root leaf is ever allowed to run empty
+        leafAlloc_.deallocate(leaf, sizeof(LeafNode));
+        root_ = NULL;
+        first_ = NULL;
+        last_ = NULL;
+    }
+}
+
+/**
+* Deletes every item. When items need no destructor and both pools can let
+* go of their memory, it is handed back wholesale. Both pools are checked
+* first, since the walk needs the leaves and the inner nodes intact.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+void BTreeMap<Key, Value, Alloc, Compare>::clear()
+{
+    if(!std::is_trivially_destructible<Item>::value || !std::is_trivially_destructible<Key>::value
+        || !leafAlloc_.releasable() || !innerAlloc_.releasable()) {
+        destroyTree(root_);
+    }
+    leafAlloc_.release();
+    innerAlloc_.release();
+    root_ = NULL;
+    first_ = NULL;
+    last_ = NULL;
+    size_ = 0;
+}
+
+/**
+* Return true iff every leaf is at the same depth, which the algorithms
+* guarantee; kept for parity with the binary trees.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+bool BTreeMap<Key, Value, Alloc, Compare>::isBalanced() const
+{
+    return root_ == NULL || leafDepth(root_) >= 0;
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+bool BTreeMap<Key, Value, Alloc, Compare>::empty() const
+{
+    return root_ == NULL;
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+std::size_t BTreeMap<Key, Value, Alloc, Compare>::size() const
+{
+    return size_;
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+typename BTreeMap<Key, Value, Alloc, Compare>::iterator
+BTreeMap<Key, Value, Alloc, Compare>::begin() const
+{
+    return iterator(first_, 0, this);
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+typename BTreeMap<Key, Value, Alloc, Compare>::iterator
+BTreeMap<Key, Value, Alloc, Compare>::end() const
+{
+    return iterator(NULL, 0, this);
+}
+
+/**
+* Returns an iterator to the item with the given key, or end().
+*/
+template<class Key, class Value, class Alloc, class Compare>
+typename BTreeMap<Key, Value, Alloc, Compare>::iterator
+BTreeMap<Key, Value, Alloc, Compare>::find(const Key& key) const
+{
+    LeafNode* leaf = findLeaf(key);
+    if(leaf == NULL) {
+        return end();
+    }
+    std::size_t pos = leafLowerBound(leaf, key);
+    Compare comp;
+    if(pos == leaf->count || comp(key, leaf->item(pos)->first)) {
+        return end();
+    }
+    return iterator(leaf, pos, this);
+}
+
+/**
+* Returns an iterator to the first item whose key is not below key.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+typename BTreeMap<Key, Value, Alloc, Compare>::iterator
+BTreeMap<Key, Value, Alloc, Compare>::lower_bound(const Key& key) const
+{
+    LeafNode* leaf = findLeaf(key);
+    if(leaf == NULL) {
+        return end();
+    }
+    std::size_t pos = leafLowerBound(leaf, key);
+    if(pos == leaf->count) {
+        return iterator(leaf->next, 0, this);
+    }
+    return iterator(leaf, pos, this);
+}
+
+/**
+* Returns the value of key, throwing std::out_of_range if it is missing.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+Value& BTreeMap<Key, Value, Alloc, Compare>::operator[](const Key& key)
+{
+    iterator it = find(key);
+    if(it == end()) throw std::out_of_range("Invalid key");
+    return it->second;
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+Value const & BTreeMap<Key, Value, Alloc, Compare>::operator[](const Key& key) const
+{
+    iterator it = find(key);
+    if(it == end()) throw std::out_of_range("Invalid key");
+    return it->second;
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+std::size_t BTreeMap<Key, Value, Alloc, Compare>::leafBytes()
+{
+    return sizeof(LeafNode);
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+std::size_t BTreeMap<Key, Value, Alloc, Compare>::innerBytes()
+{
+    return sizeof(InnerNode);
+}
+
+/**
+* Returns which child of n may hold key: the number of separators that
+* are not above it.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+std::size_t BTreeMap<Key, Value, Alloc, Compare>::childIndex(InnerNode* n, const Key& key)
+{
+    return childIndex(n, key, LinearSearch());
+}
+
+/**
+* Branchless version for integral keys: counts over every key slot,
+* masking the unused ones, with a counter as wide as the key. The fixed
+* trip count and matching widths let the compiler turn the loop into a
+* few vector compares; new inner nodes are zero filled so the masked
+* slots are never read uninitialized.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+std::size_t BTreeMap<Key, Value, Alloc, Compare>::childIndex(InnerNode* n, const Key& key, std::true_type)
+{
+    typedef typename std::make_unsigned<Key>::type Count;
+    const Key* keys = n->keyArray();
+    Count count = static_cast<Count>(n->count);
+    Count i = 0;
+    for(Count j = 0; j < INNER_CAPACITY; ++j) {
+        i += (j < count) & (keys[j] <= key);
+    }
+    return i;
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+std::size_t BTreeMap<Key, Value, Alloc, Compare>::childIndex(InnerNode* n, const Key& key, std::false_type)
+{
+    Compare comp;
+    std::size_t lo = 0;
+    std::size_t hi = n->count;
+    while(lo < hi) {
+        std::size_t mid = (lo + hi) / 2;
+        if(comp(key, *n->key(mid))) {
+            hi = mid;
+        }
+        else {
+            lo = mid + 1;
+        }
+    }
+    return lo;
+}
+
+/**
+* Returns the position of the first item of n whose key is not below key.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+std::size_t BTreeMap<Key, Value, Alloc, Compare>::leafLowerBound(LeafNode* n, const Key& key)
+{
+    return leafLowerBound(n, key, LinearSearch());
+}
+
+/**
+* Items are stored as pairs, so this scan is strided and stays scalar, but
+* it has no branch to mispredict.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+std::size_t BTreeMap<Key, Value, Alloc, Compare>::leafLowerBound(LeafNode* n, const Key& key, std::true_type)
+{
+    std::size_t count = n->count;
+    std::size_t i = 0;
+    for(std::size_t j = 0; j < count; ++j) {
+        i += (n->item(j)->first < key);
+    }
+    return i;
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+std::size_t BTreeMap<Key, Value, Alloc, Compare>::leafLowerBound(LeafNode* n, const Key& key, std::false_type)
+{
+    Compare comp;
+    std::size_t lo = 0;
+    std::size_t hi = n->count;
+    while(lo < hi) {
+        std::size_t mid = (lo + hi) / 2;
+        if(comp(n->item(mid)->first, key)) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/**
+* Helper that descends to the leaf whose range covers key, or returns
+* NULL for an empty map.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+typename BTreeMap<Key, Value, Alloc, Compare>::LeafNode*
+BTreeMap<Key, Value, Alloc, Compare>::findLeaf(const Key& key) const
+{
+    NodeHeader* n = root_;
+    if(n == NULL) {
+        return NULL;
+    }
+    while(!n->leaf) {
+        InnerNode* inner = static_cast<InnerNode*>(n);
+        n = inner->child(childIndex(inner, key));
+    }
+    return static_cast<LeafNode*>(n);
+}
+
+/**
+* Allocates an empty leaf that is not linked anywhere yet.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+typename BTreeMap<Key, Value, Alloc, Compare>::LeafNode*
+BTreeMap<Key, Value, Alloc, Compare>::newLeaf()
+{
+    LeafNode* leaf = new (leafAlloc_.allocate(sizeof(LeafNode))) LeafNode;
+    leaf->count = 0;
+    leaf->leaf = true;
+    leaf->prev = NULL;
+    leaf->next = NULL;
+    return leaf;
+}
+
+/**
+* Allocates an inner node without keys or children.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+typename BTreeMap<Key, Value, Alloc, Compare>::InnerNode*
+BTreeMap<Key, Value, Alloc, Compare>::newInner()
+{
+    InnerNode* inner = new (innerAlloc_.allocate(sizeof(InnerNode))) InnerNode;
+    if(LinearSearch::value) {
+        std::memset(static_cast<void*>(inner->keys), 0, sizeof(inner->keys));
+    }
+    inner->count = 0;
+    inner->leaf = false;
+    return inner;
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+bool BTreeMap<Key, Value, Alloc, Compare>::isFull(NodeHeader* n)
+{
+    return n->count == (n->leaf ? LEAF_CAPACITY : INNER_CAPACITY);
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+bool BTreeMap<Key, Value, Alloc, Compare>::isThin(NodeHeader* n)
+{
+    return n->count <= (n->leaf ? LEAF_MIN : INNER_MIN);
+}
+
+/**
+* Splits the full child i of parent, which has room for one more
+* separator. A leaf's upper half moves to a new leaf whose first key is
+* copied up; an inner node's middle key moves up itself.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+void BTreeMap<Key, Value, Alloc, Compare>::splitChild(InnerNode* parent, std::size_t i)
+{
+    NodeHeader* child = parent->child(i);
+    if(child->leaf) {
+        LeafNode* left = static_cast<LeafNode*>(child);
+        LeafNode* right = newLeaf();
+        std::size_t keep = LEAF_CAPACITY / 2;
+        for(std::size_t j = keep; j < left->count; ++j) {
+            moveItem(right->item(j - keep), left->item(j));
+        }
+        right->count = static_cast<std::uint16_t>(left->count - keep);
+        left->count = static_cast<std::uint16_t>(keep);
+        right->prev = left;
+        right->next = left->next;
+        if(left->next != NULL) {
+            left->next->prev = right;
+        }
+        else {
+            last_ = right;
+        }
+        left->next = right;
+        for(std::size_t j = parent->count; j > i; --j) {
+            moveKey(parent->key(j), parent->key(j - 1));
+        }
+        new (parent->key(i)) Key(right->item(0)->first);
+        insertChild(parent, i, right);
+    }
+    else {
+        InnerNode* left = static_cast<InnerNode*>(child);
+        InnerNode* right = newInner();
+        std::size_t keep = INNER_CAPACITY / 2;
+        for(std::size_t j = keep + 1; j < left->count; ++j) {
+            moveKey(right->key(j - keep - 1), left->key(j));
+        }
+        for(std::size_t j = keep + 1; j <= left->count; ++j) {
+            right->child(j - keep - 1) = left->child(j);
+        }
+        right->count = static_cast<std::uint16_t>(left->count - keep - 1);
+        for(std::size_t j = parent->count; j > i; --j) {
+            moveKey(parent->key(j), parent->key(j - 1));
+        }
+        moveKey(parent->key(i), left->key(keep));
+        left->count = static_cast<std::uint16_t>(keep);
+        insertChild(parent, i, right);
+    }
+}
+
+/**
+* Helper for splitChild: the separator is already at key i, so open child
+* slot i + 1 for right and count the new separator.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+void BTreeMap<Key, Value, Alloc, Compare>::insertChild(InnerNode* parent, std::size_t i, NodeHeader* right)
+{
+    for(std::size_t j = parent->count + 1; j > i + 1; --j) {
+        parent->child(j) = parent->child(j - 1);
+    }
+    parent->child(i + 1) = right;
+    ++parent->count;
+}
+
+/**
+* Gives the thin child i of parent at least one spare entry, borrowing
+* from a sibling that has one or else merging with a sibling. Returns the
+* index of the child that now covers the same keys.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+std::size_t BTreeMap<Key, Value, Alloc, Compare>::fixChild(InnerNode* parent, std::size_t i)
+{
+    if(i > 0 && !isThin(parent->child(i - 1))) {
+        borrowFromLeft(parent, i);
+        return i;
+    }
+    if(i < parent->count && !isThin(parent->child(i + 1))) {
+        borrowFromRight(parent, i);
+        return i;
+    }
+    if(i < parent->count) {
+        mergeChildren(parent, i);
+        return i;
+    }
+    mergeChildren(parent, i - 1);
+    return i - 1;
+}
+
+/**
+* Moves the last entry of child i - 1 to the front of child i, updating
+* the separator between them.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+void BTreeMap<Key, Value, Alloc, Compare>::borrowFromLeft(InnerNode* parent, std::size_t i)
+{
+    if(parent->child(i)->leaf) {
+        LeafNode* left = static_cast<LeafNode*>(parent->child(i - 1));
+        LeafNode* child = static_cast<LeafNode*>(parent->child(i));
+        for(std::size_t j = child->count; j > 0; --j) {
+            moveItem(child->item(j), child->item(j - 1));
+        }
+        moveItem(child->item(0), left->item(left->count - 1));
+        --left->count;
+        ++child->count;
+        *parent->key(i - 1) = child->item(0)->first;
+    }
+    else {
+        InnerNode* left = static_cast<InnerNode*>(parent->child(i - 1));
+        InnerNode* child = static_cast<InnerNode*>(parent->child(i));
+        for(std::size_t j = child->count; j > 0; --j) {
+            moveKey(child->key(j), child->key(j - 1));
+        }
+        for(std::size_t j = child->count + 1; j > 0; --j) {
+            child->child(j) = child->child(j - 1);
+        }
+        moveKey(child->key(0), parent->key(i - 1));
+        child->child(0) = left->child(left->count);
+        moveKey(parent->key(i - 1), left->key(left->count - 1));
+        --left->count;
+        ++child->count;
+    }
+}
+
+/**
+* Moves the first entry of child i + 1 to the back of child i, updating
+* the separator between them.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+void BTreeMap<Key, Value, Alloc, Compare>::borrowFromRight(InnerNode* parent, std::size_t i)
+{
+    if(parent->child(i)->leaf) {
+        LeafNode* child = static_cast<LeafNode*>(parent->child(i));
+        LeafNode* right = static_cast<LeafNode*>(parent->child(i + 1));
+        moveItem(child->item(child->count), right->item(0));
+        for(std::size_t j = 1; j < right->count; ++j) {
+            moveItem(right->item(j - 1), right->item(j));
+        }
+        ++child->count;
+        --right->count;
+        *parent->key(i) = right->item(0)->first;
+    }
+    else {
+        InnerNode* child = static_cast<InnerNode*>(parent->child(i));
+        InnerNode* right = static_cast<InnerNode*>(parent->child(i + 1));
+        moveKey(child->key(child->count), parent->key(i));
+        child->child(child->count + 1) = right->child(0);
+        moveKey(parent->key(i), right->key(0));
+        for(std::size_t j = 1; j < right->count; ++j) {
+            moveKey(right->key(j - 1), right->key(j));
+        }
+        for(std::size_t j = 1; j <= right->count; ++j) {
+            right->child(j - 1) = right->child(j);
+        }
+        ++child->count;
+        --right->count;
+    }
+}
+
+/**
+* Merges child i + 1 of parent into child i and drops the separator
+* between them (an inner merge pulls it down between the two halves).
+*/
+template<class Key, class Value, class Alloc, class Compare>
+void BTreeMap<Key, Value, Alloc, Compare>::mergeChildren(InnerNode* parent, std::size_t i)
+{
+    if(parent->child(i)->leaf) {
+        LeafNode* child = static_cast<LeafNode*>(parent->child(i));
+        LeafNode* right = static_cast<LeafNode*>(parent->child(i + 1));
+        for(std::size_t j = 0; j < right->count; ++j) {
+            moveItem(child->item(child->count + j), right->item(j));
+        }
+        child->count = static_cast<std::uint16_t>(child->count + right->count);
+        child->next = right->next;
+        if(right->next != NULL) {
+            right->next->prev = child;
+        }
+        else {
+            last_ = child;
+        }
+        parent->key(i)->~Key();
+        leafAlloc_.deallocate(right, sizeof(LeafNode));
+    }
+    else {
+        InnerNode* child = static_cast<InnerNode*>(parent->child(i));
+        InnerNode* right = static_cast<InnerNode*>(parent->child(i + 1));
+        moveKey(child->key(child->count), parent->key(i));
+        for(std::size_t j = 0; j < right->count; ++j) {
+            moveKey(child->key(child->count + 1 + j), right->key(j));
+        }
+        for(std::size_t j = 0; j <= right->count; ++j) {
+            child->child(child->count + 1 + j) = right->child(j);
+        }
+        child->count = static_cast<std::uint16_t>(child->count + 1 + right->count);
+        innerAlloc_.deallocate(right, sizeof(InnerNode));
+    }
+    eraseChild(parent, i);
+}
+
+/**
+* Helper for mergeChildren: closes the gap left by separator i, whose key
+* is already gone, and by child i + 1.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+void BTreeMap<Key, Value, Alloc, Compare>::eraseChild(InnerNode* parent, std::size_t i)
+{
+    for(std::size_t j = i + 1; j < parent->count; ++j) {
+        moveKey(parent->key(j - 1), parent->key(j));
+    }
+    for(std::size_t j = i + 2; j <= parent->count; ++j) {
+        parent->child(j - 1) = parent->child(j);
+    }
+    --parent->count;
+}
+
+/**
+* Moves an item into uninitialized storage and ends the source's lifetime.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+void BTreeMap<Key, Value, Alloc, Compare>::moveItem(Item* dst, Item* src)
+{
+    new (dst) Item(std::move(*src));
+    src->~Item();
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+void BTreeMap<Key, Value, Alloc, Compare>::moveKey(Key* dst, Key* src)
+{
+    new (dst) Key(std::move(*src));
+    src->~Key();
+}
+
+/**
+* Helper for clear: destroys every item and separator below n and frees
+* the nodes.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+void BTreeMap<Key, Value, Alloc, Compare>::destroyTree(NodeHeader* n)
+{
+    if(n == NULL) {
+        return;
+    }
+    if(n->leaf) {
+        LeafNode* leaf = static_cast<LeafNode*>(n);
+        for(std::size_t j = 0; j < leaf->count; ++j) {
+            leaf->item(j)->~Item();
+        }
+        leafAlloc_.deallocate(leaf, sizeof(LeafNode));
+        return;
+    }
+    InnerNode* inner = static_cast<InnerNode*>(n);
+    for(std::size_t j = 0; j <= inner->count; ++j) {
+        destroyTree(inner->child(j));
+    }
+    for(std::size_t j = 0; j < inner->count; ++j) {
+        inner->key(j)->~Key();
+    }
+    innerAlloc_.deallocate(inner, sizeof(InnerNode));
+}
+
+/**
+* Helper for isBalanced: the depth of every leaf below n, or -1 if they
+* differ.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+int BTreeMap<Key, Value, Alloc, Compare>::leafDepth(NodeHeader* n)
+{
+    if(n->leaf) {
+        return 0;
+    }
+    InnerNode* inner = static_cast<InnerNode*>(n);
+    int depth = leafDepth(inner->child(0));
+    for(std::size_t j = 1; j <= inner->count && depth >= 0; ++j) {
+        if(leafDepth(inner->child(j)) != depth) {
+            return -1;
+        }
+    }
+    return (depth < 0) ? -1 : depth + 1;
+}
+
+/*
+  -------------------------------------------
+  End implementations for the BTreeMap class.
+  -------------------------------------------
+*/
+
+#endif
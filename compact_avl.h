@@ -0,0 +1,940 @@
+#ifndef COMPACT_AVL_H
+#define COMPACT_AVL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include "tree_walk.h"
+
+/**
+* An AVL tree whose nodes live in one contiguous array and link to each
+* other by 32-bit slot indices instead of pointers. As in AVLNode, the
+* balance rides in the top bits of the parent link. A node is then three
+* 4-byte words plus its item, so int -> int takes 20 bytes a node against
+* 32 for AVLNode. The array grows like a vector, and reserve() allocates
+* it up front.
+*
+* Removal moves the last slot into the hole it leaves, so the array stays
+* dense and clear() needs no traversal. As a consequence iterators are
+* invalidated by any remove, and by an insert that grows the array. At
+* most MAX_SIZE entries fit.
+*/
+template <typename Key, typename Value, typename Compare = std::less<Key> >
+class CompactAVLTree
+{
+private:
+    typedef std::pair<const Key, Value> Item;
+
+    struct Slot
+    {
+        std::uint32_t left;
+        std::uint32_t right;
+        // parent index in the low PARENT_BITS bits, balance + BALANCE_BIAS above
+        std::uint32_t parentBalance;
+        typename std::aligned_storage<sizeof(Item), std::alignment_of<Item>::value>::type item;
+    };
+
+    static const int PARENT_BITS = 29;
+    static const int BALANCE_BIAS = 2;
+    // The "no node" index; every real index is below it.
+    static const std::uint32_t NIL = (1u << PARENT_BITS) - 1;
+
+public:
+    static const std::size_t MAX_SIZE = NIL;
+
+    CompactAVLTree();
+    ~CompactAVLTree();
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    void clear();
+    void reserve(std::size_t n);
+    bool isBalanced() const;
+    bool empty() const;
+    std::size_t size() const;
+
+    /**
+    * A bidirectional iterator in key order.
+    */
+    class iterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef std::pair<const Key, Value>* pointer;
+        typedef std::pair<const Key, Value>& reference;
+
+        iterator();
+
+        std::pair<const Key,Value>& operator*() const;
+        std::pair<const Key,Value>* operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+        iterator operator++(int);
+        iterator& operator--();
+        iterator operator--(int);
+
+    protected:
+        friend class CompactAVLTree<Key, Value, Compare>;
+        iterator(std::uint32_t slot, const CompactAVLTree* tree);
+        std::uint32_t slot_;
+        const CompactAVLTree* tree_;
+    };
+
+    iterator begin() const;
+    iterator end() const;
+    iterator find(const Key& key) const;
+    iterator lower_bound(const Key& key) const;
+    Value& operator[](const Key& key);
+    Value const & operator[](const Key& key) const;
+
+    // Bytes taken by one node.
+    static std::size_t nodeBytes();
+
+private:
+    CompactAVLTree(const CompactAVLTree&);
+    CompactAVLTree& operator=(const CompactAVLTree&);
+
+    // Link accessors
+    std::uint32_t left(std::uint32_t n) const;
+    std::uint32_t right(std::uint32_t n) const;
+    std::uint32_t parent(std::uint32_t n) const;
+    int getBalance(std::uint32_t n) const;
+    void setLeft(std::uint32_t n, std::uint32_t child);
+    void setRight(std::uint32_t n, std::uint32_t child);
+    void setParent(std::uint32_t n, std::uint32_t p);
+    void setBalance(std::uint32_t n, int balance);
+    void updateBalance(std::uint32_t n, int diff);
+    Item* item(std::uint32_t n) const;
+
+    // Slot management
+    std::uint32_t newSlot(const Item& value, std::uint32_t p);
+    void releaseSlot(std::uint32_t n);
+    void relocate(Slot* fresh, std::uint32_t capacity);
+
+    //helper functions
+    std::uint32_t findSlot(const Key& key) const;
+    std::uint32_t lowerBoundSlot(const Key& key) const;
+    std::uint32_t successor(std::uint32_t n) const;
+    std::uint32_t predecessor(std::uint32_t n) const;
+    void nodeSwap(std::uint32_t n1, std::uint32_t n2);
+    void rotateLeft(std::uint32_t x);
+    void rotateRight(std::uint32_t x);
+    void insertFix(std::uint32_t p, std::uint32_t n);
+    void removeFix(std::uint32_t n, int diff);
+
+    Slot* slots_;
+    std::uint32_t size_;
+    std::uint32_t capacity_;
+    std::uint32_t root_;
+};
+
+/*
+  -------------------------------------------------------------
+  Begin implementations for the CompactAVLTree::iterator class.
+  -------------------------------------------------------------
+*/
+
+/**
+* A default constructor that initializes the iterator to end().
+*/
+template<class Key, class Value, class Compare>
+CompactAVLTree<Key, Value, Compare>::iterator::iterator() :
+    slot_(NIL),
+    tree_(NULL)
+{
+}
+
+template<class Key, class Value, class Compare>
+CompactAVLTree<Key, Value, Compare>::iterator::iterator(std::uint32_t slot, const CompactAVLTree* tree) :
+    slot_(slot),
+    tree_(tree)
+{
+}
+
+template<class Key, class Value, class Compare>
+std::pair<const Key,Value>&
+CompactAVLTree<Key, Value, Compare>::iterator::operator*() const
+{
+    return *tree_->item(slot_);
+}
+
+template<class Key, class Value, class Compare>
+std::pair<const Key,Value>*
+CompactAVLTree<Key, Value, Compare>::iterator::operator->() const
+{
+    return tree_->item(slot_);
+}
+
+template<class Key, class Value, class Compare>
+bool CompactAVLTree<Key, Value, Compare>::iterator::operator==(const iterator& rhs) const
+{
+    return slot_ == rhs.slot_;
+}
+
+template<class Key, class Value, class Compare>
+bool CompactAVLTree<Key, Value, Compare>::iterator::operator!=(const iterator& rhs) const
+{
+    return slot_ != rhs.slot_;
+}
+
+template<class Key, class Value, class Compare>
+typename CompactAVLTree<Key, Value, Compare>::iterator&
+CompactAVLTree<Key, Value, Compare>::iterator::operator++()
+{
+    slot_ = tree_->successor(slot_);
+    return *this;
+}
+
+template<class Key, class Value, class Compare>
+typename CompactAVLTree<Key, Value, Compare>::iterator
+CompactAVLTree<Key, Value, Compare>::iterator::operator++(int)
+{
+    iterator previous = *this;
+    ++(*this);
+    return previous;
+}
+
+template<class Key, class Value, class Compare>
+typename CompactAVLTree<Key, Value, Compare>::iterator&
+CompactAVLTree<Key, Value, Compare>::iterator::operator--()
+{
+    slot_ = tree_->predecessor(slot_);
+    return *this;
+}
+
+template<class Key, class Value, class Compare>
+typename CompactAVLTree<Key, Value, Compare>::iterator
+CompactAVLTree<Key, Value, Compare>::iterator::operator--(int)
+{
+    iterator previous = *this;
+    --(*this);
+    return previous;
+}
+
+/*
+  -----------------------------------------------------------
+  End implementations for the CompactAVLTree::iterator class.
+  -----------------------------------------------------------
+*/
+
+/*
+  ---------------------------------------------------
+  Begin implementations for the CompactAVLTree class.
+  ---------------------------------------------------
+*/
+
+/**
+* An empty tree; the node array is allocated by the first insert or
+* reserve.
+*/
+template<class Key, class Value, class Compare>
+CompactAVLTree<Key, Value, Compare>::CompactAVLTree() :
+    slots_(NULL),
+    size_(0),
+    capacity_(0),
+    root_(NIL)
+{
+}
+
+template<class Key, class Value, class Compare>
+CompactAVLTree<Key, Value, Compare>::~CompactAVLTree()
+{
+    clear();
+    ::operator delete(slots_);
+}
+
+/**
+* Inserts the item, or overwrites the value if its key is present.
+*/
+template<class Key, class Value, class Compare>
+void CompactAVLTree<Key, Value, Compare>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    Compare comp;
+    std::uint32_t p = NIL;
+    std::uint32_t cur = root_;
+    bool goLeft = false;
+    while(cur != NIL) {
+        p = cur;
+        if(comp(keyValuePair.first, item(cur)->first)) {
+            goLeft = true;
+            cur = left(cur);
+        }
+        else if(comp(item(cur)->first, keyValuePair.first)) {
+            goLeft = false;
+            cur = right(cur);
+        }
+        else {
+            item(cur)->second = keyValuePair.second;
+            return;
+        }
+    }
+    std::uint32_t n = newSlot(keyValuePair, p);
+    if(p == NIL) {
+        root_ = n;
+        return;
+    }
+    if(goLeft) {
+        setLeft(p, n);
+    }
+    else {
+        setRight(p, n);
+    }
+    if(getBalance(p) != 0) {
+        setBalance(p, 0);
+        return;
+    }
+    setBalance(p, goLeft ? -1 : 1);
+    insertFix(p, n);
+}
+
+/**
+* Removes key if present. A node with two children first trades places
+* with its predecessor, as in AVLTree; the freed slot is then refilled
+* from the end of the array.
+*/
+template<class Key, class Value, class Compare>
+void CompactAVLTree<Key, Value, Compare>::remove(const Key& key)
+{
+    std::uint32_t n = findSlot(key);
+    if(n == NIL) {
+        return;
+    }
+    if(left(n) != NIL && right(n) != NIL) {
+        std::uint32_t previous = left(n);
+        while(right(previous) != NIL) {
+            previous = right(previous);
+        }
+        nodeSwap(n, previous);
+    }
+    std::uint32_t p = parent(n);
+    int diff = 0;
+    if(p != NIL) {
+        diff = (left(p) == n) ? 1 : -1;
+    }
+    std::uint32_t child = (left(n) != NIL) ? left(n) : right(n);
+    if(child != NIL) {
+        setParent(child, p);
+    }
+    if(p == NIL) {
+        root_ = child;
+    }
+    else if(left(p) == n) {
+        setLeft(p, child);
+    }
+    else {
+        setRight(p, child);
+    }
+    // rebalance before the slots are renumbered
+    removeFix(p, diff);
+    releaseSlot(n);
+}
+
+/**
+* Destroys every item with one pass over the array, keeping the array for
+* reuse.
+*/
+template<class Key, class Value, class Compare>
+void CompactAVLTree<Key, Value, Compare>::clear()
+{
+    if(!std::is_trivially_destructible<Item>::value) {
+        for(std::uint32_t n = 0; n < size_; ++n) {
+            item(n)->~Item();
+        }
+    }
+    size_ = 0;
+    root_ = NIL;
+}
+
+/**
+* Makes room for n entries without further allocation.
+*/
+template<class Key, class Value, class Compare>
+void CompactAVLTree<Key, Value, Compare>::reserve(std::size_t n)
+{
+    if(n > MAX_SIZE) {
+        throw std::length_error("CompactAVLTree::reserve");
+    }
+    if(n > capacity_) {
+        relocate(static_cast<Slot*>(::operator new(n * sizeof(Slot))), static_cast<std::uint32_t>(n));
+    }
+}
+
+/**
+* Return true iff the tree is balanced, computing every height once and
+* checking each stored balance against it.
+*/
+template<class Key, class Value, class Compare>
+bool CompactAVLTree<Key, Value, Compare>::isBalanced() const
+{
+    auto children = [this](std::uint32_t n, std::uint32_t& l, std::uint32_t& r) {
+        l = left(n);
+        r = right(n);
+    };
+    auto matches = [this](std::uint32_t n, int leftHeight, int rightHeight, int) {
+        return rightHeight - leftHeight == getBalance(n);
+    };
+    return checkedAVLHeight(root_, NIL, children, matches) >= 0;
+}
+
+template<class Key, class Value, class Compare>
+bool CompactAVLTree<Key, Value, Compare>::empty() const
+{
+    return size_ == 0;
+}
+
+template<class Key, class Value, class Compare>
+std::size_t CompactAVLTree<Key, Value, Compare>::size() const
+{
+    return size_;
+}
+
+template<class Key, class Value, class Compare>
+typename CompactAVLTree<Key, Value, Compare>::iterator
+CompactAVLTree<Key, Value, Compare>::begin() const
+{
+    std::uint32_t n = root_;
+    if(n != NIL) {
+        while(left(n) != NIL) {
+            n = left(n);
+        }
+    }
+    return iterator(n, this);
+}
+
+template<class Key, class Value, class Compare>
+typename CompactAVLTree<Key, Value, Compare>::iterator
+CompactAVLTree<Key, Value, Compare>::end() const
+{
+    return iterator(NIL, this);
+}
+
+/**
+* Returns an iterator to the item with the given key, or end().
+*/
+template<class Key, class Value, class Compare>
+typename CompactAVLTree<Key, Value, Compare>::iterator
+CompactAVLTree<Key, Value, Compare>::find(const Key& key) const
+{
+    return iterator(findSlot(key), this);
+}
+
+/**
+* Returns an iterator to the first item whose key is not below key.
+*/
+template<class Key, class Value, class Compare>
+typename CompactAVLTree<Key, Value, Compare>::iterator
+CompactAVLTree<Key, Value, Compare>::lower_bound(const Key& key) const
+{
+    return iterator(lowerBoundSlot(key), this);
+}
+
+/**
+* Returns the value of key, throwing std::out_of_range if it is missing.
+*/
+template<class Key, class Value, class Compare>
+Value& CompactAVLTree<Key, Value, Compare>::operator[](const Key& key)
+{
+    std::uint32_t n = findSlot(key);
+    if(n == NIL) throw std::out_of_range("Invalid key");
+    return item(n)->second;
+}
+
+template<class Key, class Value, class Compare>
+Value const & CompactAVLTree<Key, Value, Compare>::operator[](const Key& key) const
+{
+    std::uint32_t n = findSlot(key);
+    if(n == NIL) throw std::out_of_range("Invalid key");
+    return item(n)->second;
+}
+
+template<class Key, class Value, class Compare>
+std::size_t CompactAVLTree<Key, Value, Compare>::nodeBytes()
+{
+    return sizeof(Slot);
+}
+
+template<class Key, class Value, class Compare>
+std::uint32_t CompactAVLTree<Key, Value, Compare>::left(std::uint32_t n) const
+{
+    return slots_[n].left;
+}
+
+template<class Key, class Value, class Compare>
+std::uint32_t CompactAVLTree<Key, Value, Compare>::right(std::uint32_t n) const
+{
+    return slots_[n].right;
+}
+
+template<class Key, class Value, class Compare>
+std::uint32_t CompactAVLTree<Key, Value, Compare>::parent(std::uint32_t n) const
+{
+    return slots_[n].parentBalance & NIL;
+}
+
+template<class Key, class Value, class Compare>
+int CompactAVLTree<Key, Value, Compare>::getBalance(std::uint32_t n) const
+{
+    return static_cast<int>(slots_[n].parentBalance >> PARENT_BITS) - BALANCE_BIAS;
+}
+
+template<class Key, class Value, class Compare>
+void CompactAVLTree<Key, Value, Compare>::setLeft(std::uint32_t n, std::uint32_t child)
+{
+    slots_[n].left = child;
+}
+
+template<class Key, class Value, class Compare>
+void CompactAVLTree<Key, Value, Compare>::setRight(std::uint32_t n, std::uint32_t child)
+{
+    slots_[n].right = child;
+}
+
+/**
+* Replaces the parent link, keeping the balance bits.
+*/
+template<class Key, class Value, class Compare>
+void CompactAVLTree<Key, Value, Compare>::setParent(std::uint32_t n, std::uint32_t p)
+{
+    slots_[n].parentBalance = (slots_[n].parentBalance & ~NIL) | p;
+}
+
+template<class Key, class Value, class Compare>
+void CompactAVLTree<Key, Value, Compare>::setBalance(std::uint32_t n, int balance)
+{
+    slots_[n].parentBalance = (slots_[n].parentBalance & NIL)
+        | (static_cast<std::uint32_t>(balance + BALANCE_BIAS) << PARENT_BITS);
+}
+
+template<class Key, class Value, class Compare>
+void CompactAVLTree<Key, Value, Compare>::updateBalance(std::uint32_t n, int diff)
+{
+    setBalance(n, getBalance(n) + diff);
+}
+
+template<class Key, class Value, class Compare>
+typename CompactAVLTree<Key, Value, Compare>::Item*
+CompactAVLTree<Key, Value, Compare>::item(std::uint32_t n) const
+{
+    return reinterpret_cast<Item*>(&slots_[n].item);
+}
+
+/**
+* Appends a balanced leaf holding a copy of value under p, doubling the
+* array when it is full. value may live in the array, so when it grows the
+* copy is made before the old array goes away.
+*/
+template<class Key, class Value, class Compare>
+std::uint32_t CompactAVLTree<Key, Value, Compare>::newSlot(const Item& value, std::uint32_t p)
+{
+    if(size_ == capacity_) {
+        if(size_ == MAX_SIZE) {
+            throw std::length_error("CompactAVLTree::insert");
+        }
+        std::uint32_t capacity = (capacity_ < 8) ? 16 : capacity_ * 2;
+        if(capacity > MAX_SIZE || capacity < capacity_) {
+            capacity = static_cast<std::uint32_t>(MAX_SIZE);
+        }
+        Slot* fresh = static_cast<Slot*>(::operator new(capacity * sizeof(Slot)));
+        try {
+            new (&fresh[size_].item) Item(value);
+        }
+        catch(...) {
+            ::operator delete(fresh);
+            throw;
+        }
+        relocate(fresh, capacity);
+    }
+    else {
+        new (&slots_[size_].item) Item(value);
+    }
+    std::uint32_t n = size_++;
+    slots_[n].left = NIL;
+    slots_[n].right = NIL;
+    slots_[n].parentBalance = p | (static_cast<std::uint32_t>(BALANCE_BIAS) << PARENT_BITS);
+    return n;
+}
+
+/**
+* Destroys the item of the unlinked slot n and moves the last slot into
+* it, pointing that slot's neighbours at its new index.
+*/
+template<class Key, class Value, class Compare>
+void CompactAVLTree<Key, Value, Compare>::releaseSlot(std::uint32_t n)
+{
+    item(n)->~Item();
+    std::uint32_t last = --size_;
+    if(n == last) {
+        return;
+    }
+    new (&slots_[n].item) Item(std::move(*item(last)));
+    item(last)->~Item();
+    slots_[n].left = slots_[last].left;
+    slots_[n].right = slots_[last].right;
+    slots_[n].parentBalance = slots_[last].parentBalance;
+    std::uint32_t p = parent(n);
+    if(p == NIL) {
+        root_ = n;
+    }
+    else if(left(p) == last) {
+        setLeft(p, n);
+    }
+    else {
+        setRight(p, n);
+    }
+    if(left(n) != NIL) {
+        setParent(left(n), n);
+    }
+    if(right(n) != NIL) {
+        setParent(right(n), n);
+    }
+}
+
+/**
+* Moves the entries into fresh, a block of capacity slots, and frees the
+* old array. Indices, and so every link, stay the same.
+*/
+template<class Key, class Value, class Compare>
+void CompactAVLTree<Key, Value, Compare>::relocate(Slot* fresh, std::uint32_t capacity)
+{
+    for(std::uint32_t n = 0; n < size_; ++n) {
+        fresh[n].left = slots_[n].left;
+        fresh[n].right = slots_[n].right;
+        fresh[n].parentBalance = slots_[n].parentBalance;
+        new (&fresh[n].item) Item(std::move(*item(n)));
+        item(n)->~Item();
+    }
+    ::operator delete(slots_);
+    slots_ = fresh;
+    capacity_ = capacity;
+}
+
+template<class Key, class Value, class Compare>
+std::uint32_t CompactAVLTree<Key, Value, Compare>::findSlot(const Key& key) const
+{
+    std::uint32_t n = lowerBoundSlot(key);
+    Compare comp;
+    if(n == NIL || comp(key, item(n)->first)) {
+        return NIL;
+    }
+    return n;
+}
+
+template<class Key, class Value, class Compare>
+std::uint32_t CompactAVLTree<Key, Value, Compare>::lowerBoundSlot(const Key& key) const
+{
+    Compare comp;
+    std::uint32_t found = NIL;
+    std::uint32_t n = root_;
+    while(n != NIL) {
+        if(comp(item(n)->first, key)) {
+            n = right(n);
+        }
+        else {
+            found = n;
+            n = left(n);
+        }
+    }
+    return found;
+}
+
+/**
+* The next slot in key order, or NIL after the last.
+*/
+template<class Key, class Value, class Compare>
+std::uint32_t CompactAVLTree<Key, Value, Compare>::successor(std::uint32_t n) const
+{
+    if(right(n) != NIL) {
+        n = right(n);
+        while(left(n) != NIL) {
+            n = left(n);
+        }
+        return n;
+    }
+    std::uint32_t p = parent(n);
+    while(p != NIL && right(p) == n) {
+        n = p;
+        p = parent(p);
+    }
+    return p;
+}
+
+/**
+* The previous slot in key order; from NIL, the last slot.
+*/
+template<class Key, class Value, class Compare>
+std::uint32_t CompactAVLTree<Key, Value, Compare>::predecessor(std::uint32_t n) const
+{
+    if(n == NIL || left(n) != NIL) {
+        n = (n == NIL) ? root_ : left(n);
+        while(right(n) != NIL) {
+            n = right(n);
+        }
+        return n;
+    }
+    std::uint32_t p = parent(n);
+    while(p != NIL && left(p) == n) {
+        n = p;
+        p = parent(p);
+    }
+    return p;
+}
+
+/**
+* Exchanges the positions of two nodes in the tree; each position keeps
+* its balance. See BinarySearchTree::nodeSwap.
+*/
+template<class Key, class Value, class Compare>
+void CompactAVLTree<Key, Value, Compare>::nodeSwap(std::uint32_t n1, std::uint32_t n2)
+{
+    if(n1 == n2 || n1 == NIL || n2 == NIL) {
+        return;
+    }
+    std::uint32_t n1p = parent(n1);
+    std::uint32_t n1r = right(n1);
+    std::uint32_t n1lt = left(n1);
+    bool n1isLeft = (n1p != NIL && n1 == left(n1p));
+    std::uint32_t n2p = parent(n2);
+    std::uint32_t n2r = right(n2);
+    std::uint32_t n2lt = left(n2);
+    bool n2isLeft = (n2p != NIL && n2 == left(n2p));
+
+    std::uint32_t temp = slots_[n1].parentBalance;
+    slots_[n1].parentBalance = slots_[n2].parentBalance;
+    slots_[n2].parentBalance = temp;
+    std::swap(slots_[n1].left, slots_[n2].left);
+    std::swap(slots_[n1].right, slots_[n2].right);
+
+    if(n1r == n2) {
+        setRight(n2, n1);
+        setParent(n1, n2);
+    }
+    else if(n2r == n1) {
+        setRight(n1, n2);
+        setParent(n2, n1);
+    }
+    else if(n1lt == n2) {
+        setLeft(n2, n1);
+        setParent(n1, n2);
+    }
+    else if(n2lt == n1) {
+        setLeft(n1, n2);
+        setParent(n2, n1);
+    }
+
+    if(n1p != NIL && n1p != n2) {
+        if(n1isLeft) setLeft(n1p, n2);
+        else setRight(n1p, n2);
+    }
+    if(n1r != NIL && n1r != n2) {
+        setParent(n1r, n2);
+    }
+    if(n1lt != NIL && n1lt != n2) {
+        setParent(n1lt, n2);
+    }
+    if(n2p != NIL && n2p != n1) {
+        if(n2isLeft) setLeft(n2p, n1);
+        else setRight(n2p, n1);
+    }
+    if(n2r != NIL && n2r != n1) {
+        setParent(n2r, n1);
+    }
+    if(n2lt != NIL && n2lt != n1) {
+        setParent(n2lt, n1);
+    }
+
+    if(root_ == n1) {
+        root_ = n2;
+    }
+    else if(root_ == n2) {
+        root_ = n1;
+    }
+}
+
+template<class Key, class Value, class Compare>
+void CompactAVLTree<Key, Value, Compare>::rotateLeft(std::uint32_t x)
+{
+    std::uint32_t y = right(x);
+    std::uint32_t b = left(y);
+    std::uint32_t p = parent(x);
+
+    // Link p and y
+    setParent(y, p);
+    if(p != NIL) {
+        if(x == left(p)) {
+            setLeft(p, y);
+        }
+        else {
+            setRight(p, y);
+        }
+    }
+    else {
+        root_ = y;
+    }
+
+    // Link x and y
+    setParent(x, y);
+    setLeft(y, x);
+
+    // Link x and b
+    setRight(x, b);
+    if(b != NIL) {
+        setParent(b, x);
+    }
+}
+
+template<class Key, class Value, class Compare>
+void CompactAVLTree<Key, Value, Compare>::rotateRight(std::uint32_t x)
+{
+    std::uint32_t y = left(x);
+    std::uint32_t b = right(y);
+    std::uint32_t p = parent(x);
+
+    // Link p and y
+    setParent(y, p);
+    if(p != NIL) {
+        if(x == left(p)) {
+            setLeft(p, y);
+        }
+        else {
+            setRight(p, y);
+        }
+    }
+    else {
+        root_ = y;
+    }
+
+    // Link x and y
+    setParent(x, y);
+    setRight(y, x);
+
+    // Link x and b
+    setLeft(x, b);
+    if(b != NIL) {
+        setParent(b, x);
+    }
+}
+
+/**
+* The insert fix-up of AVLTree: p has just grown taller on n's side.
+*/
+template<class Key, class Value, class Compare>
+void CompactAVLTree<Key, Value, Compare>::insertFix(std::uint32_t p, std::uint32_t n)
+{
+    if(p == NIL || parent(p) == NIL) {
+        return;
+    }
+    std::uint32_t g = parent(p);
+    int side = (left(g) == p) ? -1 : 1;
+    updateBalance(g, side);
+    if(getBalance(g) == 0) {
+        return;
+    }
+    if(getBalance(g) == side) {
+        insertFix(g, p);
+        return;
+    }
+    // |balance(g)| == 2
+    bool outer = (side == -1) ? (n == left(p)) : (n == right(p));
+    if(outer) {
+        if(side == -1) {
+            rotateRight(g);
+        }
+        else {
+            rotateLeft(g);
+        }
+        setBalance(p, 0);
+        setBalance(g, 0);
+        return;
+    }
+    if(side == -1) {
+        rotateLeft(p);
+        rotateRight(g);
+    }
+    else {
+        rotateRight(p);
+        rotateLeft(g);
+    }
+    int nb = getBalance(n);
+    setBalance(p, (nb == -side) ? side : 0);
+    setBalance(g, (nb == side) ? -side : 0);
+    setBalance(n, 0);
+}
+
+/**
+* The remove fix-up of AVLTree: n's subtree on the side given by diff
+* (+1 for left, -1 for right) has just lost a level.
+*/
+template<class Key, class Value, class Compare>
+void CompactAVLTree<Key, Value, Compare>::removeFix(std::uint32_t n, int diff)
+{
+    if(n == NIL) {
+        return;
+    }
+    std::uint32_t p = parent(n);
+    int ndiff = 0;
+    if(p != NIL) {
+        ndiff = (left(p) == n) ? 1 : -1;
+    }
+    int balance = getBalance(n) + diff;
+    if(balance == 0) {
+        setBalance(n, 0);
+        removeFix(p, ndiff);
+        return;
+    }
+    if(balance == 1 || balance == -1) {
+        setBalance(n, balance);
+        return;
+    }
+    // |balance| == 2: rotate the taller child, c, up
+    int side = (balance == 2) ? 1 : -1;
+    std::uint32_t c = (side == 1) ? right(n) : left(n);
+    int cb = getBalance(c);
+    if(cb == side || cb == 0) {
+        if(side == 1) {
+            rotateLeft(n);
+        }
+        else {
+            rotateRight(n);
+        }
+        if(cb == 0) {
+            setBalance(n, side);
+            setBalance(c, -side);
+            return;
+        }
+        setBalance(n, 0);
+        setBalance(c, 0);
+        removeFix(p, ndiff);
+        return;
+    }
+    std::uint32_t g = (side == 1) ? left(c) : right(c);
+    if(side == 1) {
+        rotateRight(c);
+        rotateLeft(n);
+    }
+    else {
+        rotateLeft(c);
+        rotateRight(n);
+    }
+    int gb = getBalance(g);
+    setBalance(n, (gb == side) ? -side : 0);
+    setBalance(c, (gb == -side) ? side : 0);
+    setBalance(g, 0);
+    removeFix(p, ndiff);
+}
+
+/*
+  -------------------------------------------------
+  End implementations for the CompactAVLTree class.
+  -------------------------------------------------
+*/
+
+#endif
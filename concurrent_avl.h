@@ -0,0 +1,1080 @@
+#ifndef CONCURRENT_AVL_H
+#define CONCURRENT_AVL_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include "epoch.h"
+#include "tree_walk.h"
+
+/**
+* An AVL tree for many concurrent readers and writers, after Bronson,
+* Casper, Chafi and Olukotun, "A Practical Concurrent Binary Search Tree"
+* (PPoPP 2010).
+*
+* Each node carries a lock and a version word. Readers take no locks:
+* they descend hand over hand, checking that the node they came from has
+* not shrunk (lost part of its key range to a rotation) or been unlinked
+* since they read its version, and retry from there if it has. Writers
+* lock only the nodes they change: a leaf insert locks the parent, an
+* unlink the parent, the node and its child, and a rotation the nodes it
+* moves and the parent above them, always top down.
+* Heights are repaired and rotations done on the way back up, one node at
+* a time, so the tree is strictly balanced whenever it is quiescent.
+*
+* Removing a key whose node has two children leaves the node in place as
+* a routing node with no value; it is unlinked once it has at most one
+* child. Values live in separate immutable blocks so that a reader can
+* copy one while it is being replaced. Unlinked nodes and replaced values
+* are freed through an EpochDomain once no operation can still see them.
+* Nodes come from the global heap, since NodePool is single-threaded.
+*/
+template <typename Key, typename Value, typename Compare = std::less<Key> >
+class ConcurrentAVLTree
+{
+public:
+    ConcurrentAVLTree();
+    ~ConcurrentAVLTree();
+
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    bool find(const Key& key, Value& value) const;
+    bool contains(const Key& key) const;
+    std::size_t size() const;
+    bool empty() const;
+    // Only meaningful while no operation is running.
+    bool isBalanced() const;
+
+private:
+    ConcurrentAVLTree(const ConcurrentAVLTree&);
+    ConcurrentAVLTree& operator=(const ConcurrentAVLTree&);
+
+    struct Node
+    {
+        Node();
+        Node(const Key& key, Value* value, Node* parent);
+        ~Node();
+        const Key& key() const;
+        Node* child(int dir) const;
+        void setChild(int dir, Node* n);
+        void lock();
+        void unlock();
+
+        std::atomic<std::uint64_t> version;
+        std::atomic<Node*> parent;
+        std::atomic<Node*> left;
+        std::atomic<Node*> right;
+        std::atomic<Value*> value;
+        std::atomic<int> height;
+        std::atomic<bool> locked;
+        bool hasKey;
+        typename std::aligned_storage<sizeof(Key), std::alignment_of<Key>::value>::type keyStorage;
+    };
+
+    /**
+    * Holds a node's lock for the enclosing scope.
+    */
+    struct NodeLock
+    {
+        explicit NodeLock(Node* n) : n_(n) { n_->lock(); }
+        ~NodeLock() { n_->unlock(); }
+        Node* n_;
+    };
+
+    /**
+    * NodeLock for a subtree that may be empty.
+    */
+    struct SubtreeLock
+    {
+        explicit SubtreeLock(Node* n) : n_(n) { if(n_ != NULL) n_->lock(); }
+        ~SubtreeLock() { if(n_ != NULL) n_->unlock(); }
+        Node* n_;
+    };
+
+    enum Result { NOT_FOUND, FOUND, RETRY };
+
+    // Version word: the unlinked flag, the shrinking flag, and a count of
+    // finished shrinks above them.
+    static const std::uint64_t UNLINKED = 1;
+    static const std::uint64_t SHRINKING = 2;
+    static const std::uint64_t SHRINK_STEP = 4;
+    static bool isUnlinked(std::uint64_t version);
+    static bool isShrinkingOrUnlinked(std::uint64_t version);
+    static bool hasShrunkOrUnlinked(std::uint64_t original, std::uint64_t current);
+    static void waitUntilNotShrinking(Node* n);
+
+    // nodeCondition results other than a new height.
+    static const int UNLINK_REQUIRED = -1;
+    static const int REBALANCE_REQUIRED = -2;
+    static const int NOTHING_REQUIRED = -3;
+
+    // Retired memory is checked for reclamation once this much piles up.
+    static const std::size_t RECLAIM_BATCH = 1024;
+
+    static int compareKeys(const Key& a, const Key& b);
+    static int height(Node* n);
+    Result attemptGet(const Key& key, Node* node, int dir, std::uint64_t nodeVersion, Value& value) const;
+    Result attemptPut(const Key& key, Value* newValue, Node* node, int dir, std::uint64_t nodeVersion, Value*& previous);
+    Result attemptNodeUpdate(Value* newValue, Node* parent, Node* node, Value*& previous);
+    static bool attemptUnlink_nl(Node* parent, Node* node);
+
+    // Height repair and rotations; the _nl functions expect the caller to
+    // hold the locks of the nodes they are given.
+    void fixHeightAndRebalance(Node* node);
+    static int nodeCondition(Node* n);
+    static Node* fixHeight_nl(Node* n);
+    Node* rebalance_nl(Node* nParent, Node* n);
+    Node* rebalanceToRight_nl(Node* nParent, Node* n, Node* nL, int hR0);
+    Node* rebalanceToLeft_nl(Node* nParent, Node* n, Node* nR, int hL0);
+    static Node* rotateRight_nl(Node* nParent, Node* n, Node* nL, int hR, int hLL, Node* nLR, int hLR);
+    static Node* rotateLeft_nl(Node* nParent, Node* n, int hL, Node* nR, Node* nRL, int hRL, int hRR);
+    static Node* rotateRightOverLeft_nl(Node* nParent, Node* n, Node* nL, int hR, int hLL, Node* nLR, int hLRL);
+    static Node* rotateLeftOverRight_nl(Node* nParent, Node* n, int hL, Node* nR, Node* nRL, int hRR, int hRLR);
+
+    void retireNode(Node* n);
+    void retireValue(Value* v);
+    void reclaim_l();
+    static void freeTree(Node* n);
+
+    // The root hangs off the right of this keyless node, which is never
+    // unlinked and never shrinks.
+    mutable Node holder_;
+    std::atomic<std::size_t> size_;
+    mutable EpochDomain domain_;
+    std::mutex retireLock_;
+    std::deque<std::pair<std::uint64_t, Node*> > retiredNodes_;
+    std::deque<std::pair<std::uint64_t, Value*> > retiredValues_;
+};
+
+/*
+  -------------------------------------------------------------
+  Begin implementations for the ConcurrentAVLTree::Node class.
+  -------------------------------------------------------------
+*/
+
+/**
+* The keyless root holder.
+*/
+template<class Key, class Value, class Compare>
+ConcurrentAVLTree<Key, Value, Compare>::Node::Node() :
+    version(0),
+    parent(NULL),
+    left(NULL),
+    right(NULL),
+    value(NULL),
+    height(0),
+    locked(false),
+    hasKey(false)
+{
+}
+
+/**
+* A new leaf.
+*/
+template<class Key, class Value, class Compare>
+ConcurrentAVLTree<Key, Value, Compare>::Node::Node(const Key& key, Value* v, Node* p) :
+    version(0),
+    parent(p),
+    left(NULL),
+    right(NULL),
+    value(v),
+    height(1),
+    locked(false),
+    hasKey(true)
+{
+    new (&keyStorage) Key(key);
+}
+
+template<class Key, class Value, class Compare>
+ConcurrentAVLTree<Key, Value, Compare>::Node::~Node()
+{
+    if(hasKey) {
+        reinterpret_cast<Key*>(&keyStorage)->~Key();
+    }
+}
+
+template<class Key, class Value, class Compare>
+const Key& ConcurrentAVLTree<Key, Value, Compare>::Node::key() const
+{
+    return *reinterpret_cast<const Key*>(&keyStorage);
+}
+
+/**
+* The left child for dir < 0, the right child otherwise.
+*/
+template<class Key, class Value, class Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::Node*
+ConcurrentAVLTree<Key, Value, Compare>::Node::child(int dir) const
+{
+    return (dir < 0) ? left.load() : right.load();
+}
+
+template<class Key, class Value, class Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::Node::setChild(int dir, Node* n)
+{
+    if(dir < 0) {
+        left.store(n);
+    }
+    else {
+        right.store(n);
+    }
+}
+
+/**
+* A test-and-test-and-set spinlock that yields the processor while it
+* waits; critical sections are a handful of stores.
+*/
+template<class Key, class Value, class Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::Node::lock()
+{
+    while(locked.exchange(true, std::memory_order_acquire)) {
+        while(locked.load(std::memory_order_relaxed)) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+template<class Key, class Value, class Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::Node::unlock()
+{
+    locked.store(false, std::memory_order_release);
+}
+
+/*
+  -----------------------------------------------------------
+  End implementations for the ConcurrentAVLTree::Node class.
+  -----------------------------------------------------------
+*/
+
+/*
+  ------------------------------------------------------
+  Begin implementations for the ConcurrentAVLTree class.
+  ------------------------------------------------------
+*/
+
+template<class Key, class Value, class Compare>
+ConcurrentAVLTree<Key, Value, Compare>::ConcurrentAVLTree() :
+    size_(0)
+{
+}
+
+/**
+* No operation may be running while the tree is destroyed.
+*/
+template<class Key, class Value, class Compare>
+ConcurrentAVLTree<Key, Value, Compare>::~ConcurrentAVLTree()
+{
+    freeTree(holder_.right.load());
+    for(std::size_t i = 0; i < retiredNodes_.size(); ++i) {
+        delete retiredNodes_[i].second;
+    }
+    for(std::size_t i = 0; i < retiredValues_.size(); ++i) {
+        delete retiredValues_[i].second;
+    }
+}
+
+/**
+* Inserts the item, or replaces the value if its key is present.
+*/
+template<class Key, class Value, class Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    Value* value = new Value(keyValuePair.second);
+    Value* previous = NULL;
+    {
+        EpochGuard guard(domain_);
+        while(attemptPut(keyValuePair.first, value, &holder_, 1, 0, previous) == RETRY) {
+        }
+    }
+    if(previous != NULL) {
+        retireValue(previous);
+    }
+    else {
+        size_.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+/**
+* Removes key if present.
+*/
+template<class Key, class Value, class Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::remove(const Key& key)
+{
+    Value* previous = NULL;
+    {
+        EpochGuard guard(domain_);
+        while(attemptPut(key, NULL, &holder_, 1, 0, previous) == RETRY) {
+        }
+    }
+    if(previous != NULL) {
+        retireValue(previous);
+        size_.fetch_sub(1, std::memory_order_relaxed);
+    }
+}
+
+/**
+* Copies the value of key into value and returns true, or returns false
+* if it is missing.
+*/
+template<class Key, class Value, class Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::find(const Key& key, Value& value) const
+{
+    EpochGuard guard(domain_);
+    Result result;
+    while((result = attemptGet(key, &holder_, 1, 0, value)) == RETRY) {
+    }
+    return result == FOUND;
+}
+
+template<class Key, class Value, class Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::contains(const Key& key) const
+{
+    Value ignored;
+    return find(key, ignored);
+}
+
+template<class Key, class Value, class Compare>
+std::size_t ConcurrentAVLTree<Key, Value, Compare>::size() const
+{
+    return size_.load(std::memory_order_relaxed);
+}
+
+template<class Key, class Value, class Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::empty() const
+{
+    return size() == 0;
+}
+
+/**
+* Return true iff every height is correct and every node balanced.
+*/
+template<class Key, class Value, class Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::isBalanced() const
+{
+    return checkedAVLHeight(holder_.right.load()) >= 0;
+}
+
+template<class Key, class Value, class Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::isUnlinked(std::uint64_t version)
+{
+    return (version & UNLINKED) != 0;
+}
+
+template<class Key, class Value, class Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::isShrinkingOrUnlinked(std::uint64_t version)
+{
+    return (version & (SHRINKING | UNLINKED)) != 0;
+}
+
+/**
+* Growth is not tracked, so any change of version means a shrink or an
+* unlink.
+*/
+template<class Key, class Value, class Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::hasShrunkOrUnlinked(std::uint64_t original, std::uint64_t current)
+{
+    return original != current;
+}
+
+template<class Key, class Value, class Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::waitUntilNotShrinking(Node* n)
+{
+    while((n->version.load() & SHRINKING) != 0) {
+        std::this_thread::yield();
+    }
+}
+
+template<class Key, class Value, class Compare>
+int ConcurrentAVLTree<Key, Value, Compare>::compareKeys(const Key& a, const Key& b)
+{
+    Compare comp;
+    if(comp(a, b)) {
+        return -1;
+    }
+    return comp(b, a) ? 1 : 0;
+}
+
+template<class Key, class Value, class Compare>
+int ConcurrentAVLTree<Key, Value, Compare>::height(Node* n)
+{
+    return (n == NULL) ? 0 : n->height.load();
+}
+
+/**
+* Searches below node, in direction dir, for key. nodeVersion is the
+* version of node when the caller chose it; if node has shrunk or been
+* unlinked since, the caller's choice may be stale and RETRY sends it
+* back to re-check its own step.
+*/
+template<class Key, class Value, class Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::Result
+ConcurrentAVLTree<Key, Value, Compare>::attemptGet(const Key& key, Node* node, int dir,
+                                                  std::uint64_t nodeVersion, Value& value) const
+{
+    for(;;) {
+        Node* child = node->child(dir);
+        if(hasShrunkOrUnlinked(nodeVersion, node->version.load())) {
+            return RETRY;
+        }
+        if(child == NULL) {
+            return NOT_FOUND;
+        }
+        int nextDir = compareKeys(key, child->key());
+        if(nextDir == 0) {
+            // an unlinked or routing node has no value
+            Value* v = child->value.load();
+            if(v == NULL) {
+                return NOT_FOUND;
+            }
+            value = *v;
+            return FOUND;
+        }
+        std::uint64_t childVersion = child->version.load();
+        if(isShrinkingOrUnlinked(childVersion)) {
+            waitUntilNotShrinking(child);
+            continue;
+        }
+        if(child != node->child(dir)) {
+            continue;
+        }
+        if(hasShrunkOrUnlinked(nodeVersion, node->version.load())) {
+            return RETRY;
+        }
+        Result result = attemptGet(key, child, nextDir, childVersion, value);
+        if(result != RETRY) {
+            return result;
+        }
+    }
+}
+
+/**
+* The update counterpart of attemptGet. newValue is the value to store,
+* or NULL to remove; the value it replaces goes to previous.
+*/
+template<class Key, class Value, class Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::Result
+ConcurrentAVLTree<Key, Value, Compare>::attemptPut(const Key& key, Value* newValue, Node* node, int dir,
+                                                  std::uint64_t nodeVersion, Value*& previous)
+{
+    for(;;) {
+        Node* child = node->child(dir);
+        if(hasShrunkOrUnlinked(nodeVersion, node->version.load())) {
+            return RETRY;
+        }
+        if(child == NULL) {
+            if(newValue == NULL) {
+                return NOT_FOUND;
+            }
+            {
+                NodeLock lock(node);
+                if(hasShrunkOrUnlinked(nodeVersion, node->version.load())) {
+                    return RETRY;
+                }
+                if(node->child(dir) != NULL) {
+                    // someone else attached a child first
+                    continue;
+                }
+                node->setChild(dir, new Node(key, newValue, node));
+            }
+            fixHeightAndRebalance(node);
+            return FOUND;
+        }
+        int nextDir = compareKeys(key, child->key());
+        if(nextDir == 0) {
+            Result result = attemptNodeUpdate(newValue, node, child, previous);
+            if(result != RETRY) {
+                return result;
+            }
+            continue;
+        }
+        std::uint64_t childVersion = child->version.load();
+        if(isShrinkingOrUnlinked(childVersion)) {
+            waitUntilNotShrinking(child);
+            continue;
+        }
+        if(child != node->child(dir)) {
+            continue;
+        }
+        if(hasShrunkOrUnlinked(nodeVersion, node->version.load())) {
+            return RETRY;
+        }
+        Result result = attemptPut(key, newValue, child, nextDir, childVersion, previous);
+        if(result != RETRY) {
+            return result;
+        }
+    }
+}
+
+/**
+* Stores newValue in node, a child of parent holding the key. Removing
+* from a node with at most one child unlinks it, which needs the parent's
+* lock as well; removing from a node with two children just clears its
+* value.
+*/
+template<class Key, class Value, class Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::Result
+ConcurrentAVLTree<Key, Value, Compare>::attemptNodeUpdate(Value* newValue, Node* parent, Node* node, Value*& previous)
+{
+    if(newValue == NULL && (node->left.load() == NULL || node->right.load() == NULL)) {
+        Value* old;
+        {
+            NodeLock parentLock(parent);
+            if(isUnlinked(parent->version.load()) || node->parent.load() != parent) {
+                return RETRY;
+            }
+            NodeLock nodeLock(node);
+            if(isUnlinked(node->version.load())) {
+                return RETRY;
+            }
+            old = node->value.load();
+            if(old == NULL) {
+                return NOT_FOUND;
+            }
+            if(!attemptUnlink_nl(parent, node)) {
+                return RETRY;
+            }
+        }
+        retireNode(node);
+        fixHeightAndRebalance(parent);
+        previous = old;
+        return FOUND;
+    }
+    NodeLock nodeLock(node);
+    if(isUnlinked(node->version.load())) {
+        return RETRY;
+    }
+    if(newValue == NULL && (node->left.load() == NULL || node->right.load() == NULL)) {
+        // lost a child since the check above; take the unlink path
+        return RETRY;
+    }
+    Value* old = node->value.load();
+    if(newValue == NULL && old == NULL) {
+        return NOT_FOUND;
+    }
+    node->value.store(newValue);
+    previous = old;
+    return FOUND;
+}
+
+/**
+* Splices node, which has at most one child, out from under parent. Fails
+* if the shape changed since the caller looked.
+*/
+template<class Key, class Value, class Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::attemptUnlink_nl(Node* parent, Node* node)
+{
+    Node* parentL = parent->left.load();
+    Node* parentR = parent->right.load();
+    if(parentL != node && parentR != node) {
+        return false;
+    }
+    Node* left = node->left.load();
+    Node* right = node->right.load();
+    if(left != NULL && right != NULL) {
+        return false;
+    }
+    Node* splice = (left != NULL) ? left : right;
+    // a thread fixing the height of splice must see its new parent
+    SubtreeLock spliceLock(splice);
+    if(parentL == node) {
+        parent->left.store(splice);
+    }
+    else {
+        parent->right.store(splice);
+    }
+    if(splice != NULL) {
+        splice->parent.store(parent);
+    }
+    node->version.store(UNLINKED);
+    node->value.store(NULL);
+    return true;
+}
+
+/**
+* Walks up from node, fixing heights, unlinking routing nodes that have
+* lost a child and rotating, until nothing changes. Each step locks the
+* node, and its parent first when the tree's shape must change.
+*
+* A rotation may send the walk back down to a node it left unbalanced or
+* unlinkable. pending then remembers the parent of the rotation, and the
+* walk climbs back to it even through nodes that need nothing, since the
+* heights above the rotation have not been checked yet.
+*/
+template<class Key, class Value, class Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::fixHeightAndRebalance(Node* node)
+{
+    Node* pending = NULL;
+    while(node != NULL && node->parent.load() != NULL) {
+        if(node == pending) {
+            pending = NULL;
+        }
+        Node* next = NULL;
+        int condition = nodeCondition(node);
+        bool unlinked = isUnlinked(node->version.load());
+        if(unlinked) {
+            next = NULL;
+        }
+        else if(condition != UNLINK_REQUIRED && condition != REBALANCE_REQUIRED) {
+            // Even "nothing" is only decided under the lock: a rotation
+            // holding it may be about to store a height it computed from
+            // a child before that child's height changed.
+            NodeLock lock(node);
+            next = fixHeight_nl(node);
+        }
+        else {
+            next = node;
+            Node* nParent = node->parent.load();
+            NodeLock parentLock(nParent);
+            if(!isUnlinked(nParent->version.load()) && node->parent.load() == nParent) {
+                if(pending == NULL) {
+                    pending = nParent;
+                }
+                NodeLock lock(node);
+                next = rebalance_nl(nParent, node);
+            }
+        }
+        if(next == NULL && pending != NULL) {
+            next = unlinked ? pending : node->parent.load();
+        }
+        node = next;
+    }
+}
+
+/**
+* What n needs: an unlink, a rotation, a new height (returned as is), or
+* nothing.
+*/
+template<class Key, class Value, class Compare>
+int ConcurrentAVLTree<Key, Value, Compare>::nodeCondition(Node* n)
+{
+    Node* nL = n->left.load();
+    Node* nR = n->right.load();
+    if((nL == NULL || nR == NULL) && n->value.load() == NULL) {
+        return UNLINK_REQUIRED;
+    }
+    int hN = n->height.load();
+    int hL0 = height(nL);
+    int hR0 = height(nR);
+    int hNRepl = 1 + ((hL0 > hR0) ? hL0 : hR0);
+    int bal = hL0 - hR0;
+    if(bal < -1 || bal > 1) {
+        return REBALANCE_REQUIRED;
+    }
+    return (hN != hNRepl) ? hNRepl : NOTHING_REQUIRED;
+}
+
+/**
+* Updates the height of n and returns the next node to look at: n itself
+* if it needs more than a height, its parent if the height changed, or
+* NULL.
+*/
+template<class Key, class Value, class Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::Node*
+ConcurrentAVLTree<Key, Value, Compare>::fixHeight_nl(Node* n)
+{
+    int condition = nodeCondition(n);
+    switch(condition) {
+        case REBALANCE_REQUIRED:
+        case UNLINK_REQUIRED:
+            return n;
+        case NOTHING_REQUIRED:
+            return NULL;
+        default:
+            n->height.store(condition);
+            return n->parent.load();
+    }
+}
+
+template<class Key, class Value, class Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::Node*
+ConcurrentAVLTree<Key, Value, Compare>::rebalance_nl(Node* nParent, Node* n)
+{
+    Node* nL = n->left.load();
+    Node* nR = n->right.load();
+    if((nL == NULL || nR == NULL) && n->value.load() == NULL) {
+        if(attemptUnlink_nl(nParent, n)) {
+            retireNode(n);
+            return fixHeight_nl(nParent);
+        }
+        return n;
+    }
+    int hN = n->height.load();
+    int hL0 = height(nL);
+    int hR0 = height(nR);
+    int hNRepl = 1 + ((hL0 > hR0) ? hL0 : hR0);
+    int bal = hL0 - hR0;
+    if(bal > 1) {
+        return rebalanceToRight_nl(nParent, n, nL, hR0);
+    }
+    if(bal < -1) {
+        return rebalanceToLeft_nl(nParent, n, nR, hL0);
+    }
+    if(hNRepl != hN) {
+        n->height.store(hNRepl);
+        return fixHeight_nl(nParent);
+    }
+    return NULL;
+}
+
+/**
+* n is left-heavy: rotate it right, or right over left when nL leans
+* right. If a double rotation would itself leave nL unbalanced, nL is
+* rotated left first and n is revisited.
+*
+* The subtrees that change parent are locked too. Their heights feed the
+* new heights of n and nL, and a thread that changes one of them stores
+* it and then reads the parent to fix under the same lock, so it either
+* finishes before the rotation reads the height or fixes the new parent.
+*/
+template<class Key, class Value, class Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::Node*
+ConcurrentAVLTree<Key, Value, Compare>::rebalanceToRight_nl(Node* nParent, Node* n, Node* nL, int hR0)
+{
+    NodeLock leftLock(nL);
+    int hL = nL->height.load();
+    if(hL - hR0 <= 1) {
+        return n;
+    }
+    Node* nLR = nL->right.load();
+    int hLL0 = height(nL->left.load());
+    {
+        SubtreeLock leftRightLock(nLR);
+        int hLR = height(nLR);
+        if(hLL0 >= hLR) {
+            return rotateRight_nl(nParent, n, nL, hR0, hLL0, nLR, hLR);
+        }
+        Node* nLRL = nLR->left.load();
+        SubtreeLock leftRightLeftLock(nLRL);
+        SubtreeLock leftRightRightLock(nLR->right.load());
+        int hLRL = height(nLRL);
+        int b = hLL0 - hLRL;
+        if(b >= -1 && b <= 1) {
+            return rotateRightOverLeft_nl(nParent, n, nL, hR0, hLL0, nLR, hLRL);
+        }
+    }
+    return rebalanceToLeft_nl(n, nL, nLR, hLL0);
+}
+
+/**
+* The mirror image of rebalanceToRight_nl.
+*/
+template<class Key, class Value, class Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::Node*
+ConcurrentAVLTree<Key, Value, Compare>::rebalanceToLeft_nl(Node* nParent, Node* n, Node* nR, int hL0)
+{
+    NodeLock rightLock(nR);
+    int hR = nR->height.load();
+    if(hL0 - hR >= -1) {
+        return n;
+    }
+    Node* nRL = nR->left.load();
+    int hRR0 = height(nR->right.load());
+    {
+        SubtreeLock rightLeftLock(nRL);
+        int hRL = height(nRL);
+        if(hRR0 >= hRL) {
+            return rotateLeft_nl(nParent, n, hL0, nR, nRL, hRL, hRR0);
+        }
+        Node* nRLR = nRL->right.load();
+        SubtreeLock rightLeftLeftLock(nRL->left.load());
+        SubtreeLock rightLeftRightLock(nRLR);
+        int hRLR = height(nRLR);
+        int b = hRR0 - hRLR;
+        if(b >= -1 && b <= 1) {
+            return rotateLeftOverRight_nl(nParent, n, hL0, nR, nRL, hRR0, hRLR);
+        }
+    }
+    return rebalanceToRight_nl(n, nR, nRL, hRR0);
+}
+
+/**
+* The link changes of AVLTree::rotateRight, bracketed by marking n, the
+* node that moves down, as shrinking. Returns the next node that needs
+* attention.
+*/
+template<class Key, class Value, class Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::Node*
+ConcurrentAVLTree<Key, Value, Compare>::rotateRight_nl(Node* nParent, Node* n, Node* nL, int hR, int hLL,
+                                                      Node* nLR, int hLR)
+{
+    std::uint64_t nodeVersion = n->version.load();
+    Node* nPL = nParent->left.load();
+    n->version.store(nodeVersion | SHRINKING);
+
+    n->left.store(nLR);
+    if(nLR != NULL) {
+        nLR->parent.store(n);
+    }
+    nL->right.store(n);
+    n->parent.store(nL);
+    if(nPL == n) {
+        nParent->left.store(nL);
+    }
+    else {
+        nParent->right.store(nL);
+    }
+    nL->parent.store(nParent);
+
+    int hNRepl = 1 + ((hLR > hR) ? hLR : hR);
+    n->height.store(hNRepl);
+    nL->height.store(1 + ((hLL > hNRepl) ? hLL : hNRepl));
+    n->version.store(nodeVersion + SHRINK_STEP);
+
+    int balN = hLR - hR;
+    if(balN < -1 || balN > 1) {
+        return n;
+    }
+    if((nLR == NULL || hR == 0) && n->value.load() == NULL) {
+        return n;
+    }
+    int balL = hLL - hNRepl;
+    if(balL < -1 || balL > 1) {
+        return nL;
+    }
+    if(hLL == 0 && nL->value.load() == NULL) {
+        return nL;
+    }
+    return fixHeight_nl(nParent);
+}
+
+/**
+* The mirror image of rotateRight_nl.
+*/
+template<class Key, class Value, class Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::Node*
+ConcurrentAVLTree<Key, Value, Compare>::rotateLeft_nl(Node* nParent, Node* n, int hL, Node* nR, Node* nRL,
+                                                     int hRL, int hRR)
+{
+    std::uint64_t nodeVersion = n->version.load();
+    Node* nPL = nParent->left.load();
+    n->version.store(nodeVersion | SHRINKING);
+
+    n->right.store(nRL);
+    if(nRL != NULL) {
+        nRL->parent.store(n);
+    }
+    nR->left.store(n);
+    n->parent.store(nR);
+    if(nPL == n) {
+        nParent->left.store(nR);
+    }
+    else {
+        nParent->right.store(nR);
+    }
+    nR->parent.store(nParent);
+
+    int hNRepl = 1 + ((hL > hRL) ? hL : hRL);
+    n->height.store(hNRepl);
+    nR->height.store(1 + ((hNRepl > hRR) ? hNRepl : hRR));
+    n->version.store(nodeVersion + SHRINK_STEP);
+
+    int balN = hRL - hL;
+    if(balN < -1 || balN > 1) {
+        return n;
+    }
+    if((nRL == NULL || hL == 0) && n->value.load() == NULL) {
+        return n;
+    }
+    int balR = hRR - hNRepl;
+    if(balR < -1 || balR > 1) {
+        return nR;
+    }
+    if(hRR == 0 && nR->value.load() == NULL) {
+        return nR;
+    }
+    return fixHeight_nl(nParent);
+}
+
+/**
+* A double rotation done as one step: nLR moves up past both nL and n,
+* which both shrink.
+*/
+template<class Key, class Value, class Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::Node*
+ConcurrentAVLTree<Key, Value, Compare>::rotateRightOverLeft_nl(Node* nParent, Node* n, Node* nL, int hR, int hLL,
+                                                              Node* nLR, int hLRL)
+{
+    std::uint64_t nodeVersion = n->version.load();
+    std::uint64_t leftVersion = nL->version.load();
+    Node* nPL = nParent->left.load();
+    Node* nLRL = nLR->left.load();
+    Node* nLRR = nLR->right.load();
+    int hLRR = height(nLRR);
+    n->version.store(nodeVersion | SHRINKING);
+    nL->version.store(leftVersion | SHRINKING);
+
+    n->left.store(nLRR);
+    if(nLRR != NULL) {
+        nLRR->parent.store(n);
+    }
+    nL->right.store(nLRL);
+    if(nLRL != NULL) {
+        nLRL->parent.store(nL);
+    }
+    nLR->left.store(nL);
+    nL->parent.store(nLR);
+    nLR->right.store(n);
+    n->parent.store(nLR);
+    if(nPL == n) {
+        nParent->left.store(nLR);
+    }
+    else {
+        nParent->right.store(nLR);
+    }
+    nLR->parent.store(nParent);
+
+    int hNRepl = 1 + ((hLRR > hR) ? hLRR : hR);
+    n->height.store(hNRepl);
+    int hLRepl = 1 + ((hLL > hLRL) ? hLL : hLRL);
+    nL->height.store(hLRepl);
+    nLR->height.store(1 + ((hLRepl > hNRepl) ? hLRepl : hNRepl));
+    n->version.store(nodeVersion + SHRINK_STEP);
+    nL->version.store(leftVersion + SHRINK_STEP);
+
+    int balN = hLRR - hR;
+    if(balN < -1 || balN > 1) {
+        return n;
+    }
+    if((nLRR == NULL || hR == 0) && n->value.load() == NULL) {
+        return n;
+    }
+    if((nLRL == NULL || hLL == 0) && nL->value.load() == NULL) {
+        return nL;
+    }
+    int balLR = hLRepl - hNRepl;
+    if(balLR < -1 || balLR > 1) {
+        return nLR;
+    }
+    return fixHeight_nl(nParent);
+}
+
+/**
+* The mirror image of rotateRightOverLeft_nl.
+*/
+template<class Key, class Value, class Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::Node*
+ConcurrentAVLTree<Key, Value, Compare>::rotateLeftOverRight_nl(Node* nParent, Node* n, int hL, Node* nR, Node* nRL,
+                                                              int hRR, int hRLR)
+{
+    std::uint64_t nodeVersion = n->version.load();
+    std::uint64_t rightVersion = nR->version.load();
+    Node* nPL = nParent->left.load();
+    Node* nRLL = nRL->left.load();
+    Node* nRLR = nRL->right.load();
+    int hRLL = height(nRLL);
+    n->version.store(nodeVersion | SHRINKING);
+    nR->version.store(rightVersion | SHRINKING);
+
+    n->right.store(nRLL);
+    if(nRLL != NULL) {
+        nRLL->parent.store(n);
+    }
+    nR->left.store(nRLR);
+    if(nRLR != NULL) {
+        nRLR->parent.store(nR);
+    }
+    nRL->right.store(nR);
+    nR->parent.store(nRL);
+    nRL->left.store(n);
+    n->parent.store(nRL);
+    if(nPL == n) {
+        nParent->left.store(nRL);
+    }
+    else {
+        nParent->right.store(nRL);
+    }
+    nRL->parent.store(nParent);
+
+    int hNRepl = 1 + ((hL > hRLL) ? hL : hRLL);
+    n->height.store(hNRepl);
+    int hRRepl = 1 + ((hRLR > hRR) ? hRLR : hRR);
+    nR->height.store(hRRepl);
+    nRL->height.store(1 + ((hNRepl > hRRepl) ? hNRepl : hRRepl));
+    n->version.store(nodeVersion + SHRINK_STEP);
+    nR->version.store(rightVersion + SHRINK_STEP);
+
+    int balN = hRLL - hL;
+    if(balN < -1 || balN > 1) {
+        return n;
+    }
+    if((nRLL == NULL || hL == 0) && n->value.load() == NULL) {
+        return n;
+    }
+    if((nRLR == NULL || hRR == 0) && nR->value.load() == NULL) {
+        return nR;
+    }
+    int balRL = hRRepl - hNRepl;
+    if(balRL < -1 || balRL > 1) {
+        return nRL;
+    }
+    return fixHeight_nl(nParent);
+}
+
+/**
+* Queues an unlinked node to be freed once no operation can reach it.
+*/
+template<class Key, class Value, class Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::retireNode(Node* n)
+{
+    std::lock_guard<std::mutex> lock(retireLock_);
+    retiredNodes_.push_back(std::make_pair(domain_.epoch(), n));
+    if(retiredNodes_.size() + retiredValues_.size() >= RECLAIM_BATCH) {
+        reclaim_l();
+    }
+}
+
+template<class Key, class Value, class Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::retireValue(Value* v)
+{
+    std::lock_guard<std::mutex> lock(retireLock_);
+    retiredValues_.push_back(std::make_pair(domain_.epoch(), v));
+    if(retiredNodes_.size() + retiredValues_.size() >= RECLAIM_BATCH) {
+        reclaim_l();
+    }
+}
+
+/**
+* Advances the epoch and frees what no pinned operation can hold. Called
+* with retireLock_ held.
+*/
+template<class Key, class Value, class Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::reclaim_l()
+{
+    domain_.advance();
+    std::uint64_t safe = domain_.safeBefore();
+    while(!retiredNodes_.empty() && retiredNodes_.front().first < safe) {
+        delete retiredNodes_.front().second;
+        retiredNodes_.pop_front();
+    }
+    while(!retiredValues_.empty() && retiredValues_.front().first < safe) {
+        delete retiredValues_.front().second;
+        retiredValues_.pop_front();
+    }
+}
+
+template<class Key, class Value, class Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::freeTree(Node* n)
+{
+    if(n == NULL) {
+        return;
+    }
+    freeTree(n->left.load());
+    freeTree(n->right.load());
+    delete n->value.load();
+    delete n;
+}
+
+/*
+  ----------------------------------------------------
+  End implementations for the ConcurrentAVLTree class.
+  ----------------------------------------------------
+*/
+
+#endif
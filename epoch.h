@@ -0,0 +1,174 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <thread>
+
+/**
+* Epoch-based reclamation for structures whose readers take no locks.
+*
+* A reader pins the current epoch in one of a fixed set of slots for the
+* duration of a read, and unpins it afterwards. A writer that unlinks
+* memory tags it with the epoch current at that moment. The memory may be
+* freed once every pinned slot shows a later epoch, because any reader
+* still holding it must have pinned at or before that tag. The writer
+* moves the epoch forward with advance().
+*
+* Slots are padded to a cache line each, so readers on different slots
+* never write to a shared line. A reader that finds every slot taken
+* yields until one frees up.
+*/
+class EpochDomain
+{
+public:
+    static const std::size_t SLOTS = 128;
+
+    EpochDomain();
+
+    // Reader side: pin() returns the slot to hand back to unpin().
+    std::size_t pin();
+    void unpin(std::size_t slot);
+
+    // Writer side.
+    std::uint64_t epoch() const;
+    void advance();
+    // Memory tagged with an epoch below this may be freed.
+    std::uint64_t safeBefore() const;
+
+private:
+    EpochDomain(const EpochDomain&);
+    EpochDomain& operator=(const EpochDomain&);
+
+    struct Slot
+    {
+        // 0 when free, otherwise the pinned epoch + 1
+        std::atomic<std::uint64_t> state;
+        char pad_[64 - sizeof(std::atomic<std::uint64_t>)];
+    };
+
+    std::atomic<std::uint64_t> epoch_;
+    char pad_[64 - sizeof(std::atomic<std::uint64_t>)];
+    Slot slots_[SLOTS];
+};
+
+/**
+* Pins the domain for the lifetime of the guard.
+*/
+class EpochGuard
+{
+public:
+    explicit EpochGuard(EpochDomain& domain);
+    ~EpochGuard();
+
+private:
+    EpochGuard(const EpochGuard&);
+    EpochGuard& operator=(const EpochGuard&);
+
+    EpochDomain& domain_;
+    std::size_t slot_;
+};
+
+/*
+  ------------------------------------------------
+  Begin implementations for the EpochDomain class.
+  ------------------------------------------------
+*/
+
+inline EpochDomain::EpochDomain() :
+    epoch_(0)
+{
+    for(std::size_t i = 0; i < SLOTS; ++i) {
+        slots_[i].state.store(0, std::memory_order_relaxed);
+    }
+}
+
+/**
+* Claims a free slot, starting from one picked by thread id so that a
+* thread usually finds the same slot free, and announces the current
+* epoch in it. The claim is sequentially consistent: a writer that
+* publishes a change after this reader's next load of shared state will
+* see the claim when it scans the slots.
+*/
+inline std::size_t EpochDomain::pin()
+{
+    std::size_t start = std::hash<std::thread::id>()(std::this_thread::get_id());
+    for(;;) {
+        for(std::size_t i = 0; i < SLOTS; ++i) {
+            std::size_t slot = (start + i) % SLOTS;
+            if(slots_[slot].state.load(std::memory_order_relaxed) != 0) {
+                continue;
+            }
+            std::uint64_t expected = 0;
+            std::uint64_t pinned = epoch_.load() + 1;
+            if(slots_[slot].state.compare_exchange_strong(expected, pinned)) {
+                return slot;
+            }
+        }
+        std::this_thread::yield();
+    }
+}
+
+inline void EpochDomain::unpin(std::size_t slot)
+{
+    slots_[slot].state.store(0, std::memory_order_release);
+}
+
+inline std::uint64_t EpochDomain::epoch() const
+{
+    return epoch_.load();
+}
+
+inline void EpochDomain::advance()
+{
+    epoch_.fetch_add(1);
+}
+
+/**
+* The oldest pinned epoch, or one past the current epoch when no reader
+* is pinned: a reader that pins later only sees what is published by then.
+*/
+inline std::uint64_t EpochDomain::safeBefore() const
+{
+    std::uint64_t oldest = epoch_.load() + 1;
+    for(std::size_t i = 0; i < SLOTS; ++i) {
+        std::uint64_t state = slots_[i].state.load();
+        if(state != 0 && state - 1 < oldest) {
+            oldest = state - 1;
+        }
+    }
+    return oldest;
+}
+
+/*
+  ----------------------------------------------
+  End implementations for the EpochDomain class.
+  ----------------------------------------------
+*/
+
+/*
+  -----------------------------------------------
+  Begin implementations for the EpochGuard class.
+  -----------------------------------------------
+*/
+
+inline EpochGuard::EpochGuard(EpochDomain& domain) :
+    domain_(domain),
+    slot_(domain.pin())
+{
+}
+
+inline EpochGuard::~EpochGuard()
+{
+    domain_.unpin(slot_);
+}
+
+/*
+  ---------------------------------------------
+  End implementations for the EpochGuard class.
+  ---------------------------------------------
+*/
+
+#endif
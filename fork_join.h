@@ -0,0 +1,322 @@
+#ifndef FORK_JOIN_H
+#define FORK_JOIN_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+* A work-stealing thread pool for fork-join recursion.
+*
+* Each worker owns a deque of tasks. invoke(a, b) pushes b onto the bottom
+* of the calling worker's deque, runs a, and then takes b back if no idle
+* worker has stolen it from the top in the meantime. A worker waiting for a
+* stolen task keeps running other tasks instead of blocking, so nested
+* invoke calls never deadlock. Tasks live on the stack of the invoke that
+* created them, which does not return before they are done.
+*
+* Work enters the pool through run(), which blocks the calling thread until
+* the function it was given has finished on a worker.
+*/
+class ForkJoinPool
+{
+public:
+    explicit ForkJoinPool(unsigned threads = std::thread::hardware_concurrency());
+    ~ForkJoinPool();
+
+    template<typename F>
+    void run(F f);
+    template<typename F1, typename F2>
+    void invoke(F1& a, F2& b);
+
+    unsigned size() const;
+
+private:
+    ForkJoinPool(const ForkJoinPool&);
+    ForkJoinPool& operator=(const ForkJoinPool&);
+
+    struct Task
+    {
+        Task() : done(false) { }
+        virtual ~Task() { }
+        virtual void execute() = 0;
+
+        std::atomic<bool> done;
+        std::exception_ptr error;
+    };
+
+    template<typename F>
+    struct FunctionTask : public Task
+    {
+        explicit FunctionTask(F& f) : f_(f) { }
+        void execute()
+        {
+            try {
+                f_();
+            }
+            catch(...) {
+                this->error = std::current_exception();
+            }
+            this->done.store(true, std::memory_order_release);
+        }
+
+        F& f_;
+    };
+
+    struct Worker
+    {
+        std::mutex lock;
+        std::deque<Task*> tasks;
+        std::thread thread;
+    };
+
+    static int& currentWorker();
+    void workerLoop(unsigned index);
+    void push(unsigned index, Task* task);
+    bool takeBack(unsigned index, Task* task);
+    bool runOne(unsigned index);
+
+    std::vector<std::unique_ptr<Worker> > workers_;
+    std::mutex injectLock_;
+    std::deque<Task*> injected_;
+    std::mutex sleepLock_;
+    std::condition_variable wake_;
+    std::atomic<int> sleeping_;
+    std::atomic<bool> stop_;
+};
+
+/**
+* Starts the given number of workers (at least one).
+*/
+inline ForkJoinPool::ForkJoinPool(unsigned threads) :
+    sleeping_(0),
+    stop_(false)
+{
+    if(threads == 0) {
+        threads = 1;
+    }
+    for(unsigned i = 0; i < threads; ++i) {
+        workers_.push_back(std::unique_ptr<Worker>(new Worker));
+    }
+    for(unsigned i = 0; i < threads; ++i) {
+        workers_[i]->thread = std::thread(&ForkJoinPool::workerLoop, this, i);
+    }
+}
+
+/**
+* Stops and joins every worker. No run() may be in progress.
+*/
+inline ForkJoinPool::~ForkJoinPool()
+{
+    stop_.store(true);
+    {
+        std::lock_guard<std::mutex> guard(sleepLock_);
+        wake_.notify_all();
+    }
+    for(std::size_t i = 0; i < workers_.size(); ++i) {
+        workers_[i]->thread.join();
+    }
+}
+
+/**
+* Returns the number of workers.
+*/
+inline unsigned ForkJoinPool::size() const
+{
+    return static_cast<unsigned>(workers_.size());
+}
+
+/**
+* Runs f on a worker and waits for it, rethrowing anything it threw. When
+* called from a worker, f simply runs inline.
+*/
+template<typename F>
+void ForkJoinPool::run(F f)
+{
+    if(currentWorker() >= 0) {
+        f();
+        return;
+    }
+    std::mutex doneLock;
+    std::condition_variable doneSignal;
+    bool finished = false;
+    auto body = [&]() {
+        try {
+            f();
+        }
+        catch(...) {
+            std::lock_guard<std::mutex> guard(doneLock);
+            finished = true;
+            doneSignal.notify_one();
+            throw;
+        }
+        std::lock_guard<std::mutex> guard(doneLock);
+        finished = true;
+        doneSignal.notify_one();
+    };
+    FunctionTask<decltype(body)> task(body);
+    {
+        std::lock_guard<std::mutex> guard(injectLock_);
+        injected_.push_back(&task);
+    }
+    {
+        std::lock_guard<std::mutex> guard(sleepLock_);
+        wake_.notify_one();
+    }
+    {
+        std::unique_lock<std::mutex> guard(doneLock);
+        while(!finished) {
+            doneSignal.wait(guard);
+        }
+    }
+    // finished is set just before done; wait for the task to let go of us
+    while(!task.done.load(std::memory_order_acquire)) {
+        std::this_thread::yield();
+    }
+    if(task.error) {
+        std::rethrow_exception(task.error);
+    }
+}
+
+/**
+* Runs a and b, possibly in parallel, and returns once both are done. The
+* first exception thrown by either is rethrown. Must be called from inside
+* run().
+*/
+template<typename F1, typename F2>
+void ForkJoinPool::invoke(F1& a, F2& b)
+{
+    int self = currentWorker();
+    if(self < 0) {
+        a();
+        b();
+        return;
+    }
+    FunctionTask<F2> second(b);
+    push(static_cast<unsigned>(self), &second);
+    std::exception_ptr firstError;
+    try {
+        a();
+    }
+    catch(...) {
+        firstError = std::current_exception();
+    }
+    if(takeBack(static_cast<unsigned>(self), &second)) {
+        second.execute();
+    }
+    else {
+        while(!second.done.load(std::memory_order_acquire)) {
+            if(!runOne(static_cast<unsigned>(self))) {
+                std::this_thread::yield();
+            }
+        }
+    }
+    if(firstError) {
+        std::rethrow_exception(firstError);
+    }
+    if(second.error) {
+        std::rethrow_exception(second.error);
+    }
+}
+
+/**
+* The index of the worker running on this thread, or -1 elsewhere.
+*/
+inline int& ForkJoinPool::currentWorker()
+{
+    static thread_local int index = -1;
+    return index;
+}
+
+/**
+* Each worker runs tasks until the pool stops, sleeping briefly when there
+* is nothing to run or steal.
+*/
+inline void ForkJoinPool::workerLoop(unsigned index)
+{
+    currentWorker() = static_cast<int>(index);
+    while(!stop_.load()) {
+        if(runOne(index)) {
+            continue;
+        }
+        std::unique_lock<std::mutex> guard(sleepLock_);
+        ++sleeping_;
+        wake_.wait_for(guard, std::chrono::milliseconds(1));
+        --sleeping_;
+    }
+}
+
+/**
+* Pushes a task onto the bottom of a worker's deque and wakes a sleeper to
+* steal it.
+*/
+inline void ForkJoinPool::push(unsigned index, Task* task)
+{
+    {
+        std::lock_guard<std::mutex> guard(workers_[index]->lock);
+        workers_[index]->tasks.push_back(task);
+    }
+    if(sleeping_.load() > 0) {
+        std::lock_guard<std::mutex> guard(sleepLock_);
+        wake_.notify_one();
+    }
+}
+
+/**
+* Pops task off the bottom of the worker's deque if it is still there.
+*/
+inline bool ForkJoinPool::takeBack(unsigned index, Task* task)
+{
+    std::lock_guard<std::mutex> guard(workers_[index]->lock);
+    std::deque<Task*>& tasks = workers_[index]->tasks;
+    if(!tasks.empty() && tasks.back() == task) {
+        tasks.pop_back();
+        return true;
+    }
+    return false;
+}
+
+/**
+* Runs one task: the newest one of this worker, else the oldest one of
+* another worker, else one submitted through run(). Returns false if there
+* was nothing to do.
+*/
+inline bool ForkJoinPool::runOne(unsigned index)
+{
+    Task* task = NULL;
+    {
+        std::lock_guard<std::mutex> guard(workers_[index]->lock);
+        if(!workers_[index]->tasks.empty()) {
+            task = workers_[index]->tasks.back();
+            workers_[index]->tasks.pop_back();
+        }
+    }
+    for(std::size_t i = 1; task == NULL && i < workers_.size(); ++i) {
+        Worker& victim = *workers_[(index + i) % workers_.size()];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if(!victim.tasks.empty()) {
+            task = victim.tasks.front();
+            victim.tasks.pop_front();
+        }
+    }
+    if(task == NULL) {
+        std::lock_guard<std::mutex> guard(injectLock_);
+        if(!injected_.empty()) {
+            task = injected_.front();
+            injected_.pop_front();
+        }
+    }
+    if(task == NULL) {
+        return false;
+    }
+    task->execute();
+    return true;
+}
+
+#endif
@@ -0,0 +1,413 @@
+#ifndef FROZEN_TREE_H
+#define FROZEN_TREE_H
+
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+/**
+* An immutable ordered map, built once from sorted unique items, normally
+* by AVLTree::freeze(). The items sit in one array in Eytzinger order:
+* slot k has children 2k and 2k + 1, as in a binary heap, and slot 0 is
+* unused. The top levels of the tree share a few cache lines, and the
+* descent has no data-dependent branch, so it can prefetch a cache line
+* several levels ahead. The search ends on the slot of the answer, so no
+* further memory is touched.
+*
+* The array is the only storage: sizeof(value_type) bytes per entry, with
+* no links or balance data.
+*/
+template <typename Key, typename Value, typename Compare = std::less<Key> >
+class FrozenTree
+{
+public:
+    typedef std::pair<const Key, Value> value_type;
+
+    FrozenTree();
+    template<typename InputIt>
+    FrozenTree(InputIt first, InputIt last);
+
+    /**
+    * A bidirectional iterator in key order. It walks the implicit tree,
+    * so a step is O(1) amortized but does not read the array in order.
+    */
+    class iterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const std::pair<const Key, Value>* pointer;
+        typedef const std::pair<const Key, Value>& reference;
+
+        iterator();
+
+        const std::pair<const Key,Value>& operator*() const;
+        const std::pair<const Key,Value>* operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+        iterator operator++(int);
+        iterator& operator--();
+        iterator operator--(int);
+
+    protected:
+        friend class FrozenTree<Key, Value, Compare>;
+        iterator(std::size_t slot, const FrozenTree* tree);
+        std::size_t slot_;
+        const FrozenTree* tree_;
+    };
+    typedef iterator const_iterator;
+
+    iterator begin() const;
+    iterator end() const;
+    std::size_t size() const;
+    bool empty() const;
+    iterator find(const Key& key) const;
+    iterator lower_bound(const Key& key) const;
+    Value const & operator[](const Key& key) const;
+
+    // Bytes held by the item array.
+    std::size_t bytes() const;
+
+private:
+    // How far ahead the search prefetches: the descendants of slot k that
+    // are this many levels down lie in one line of items.
+    static const std::size_t PREFETCH_SLOTS = (sizeof(value_type) < 64) ? 64 / sizeof(value_type) : 1;
+
+    std::size_t lowerBoundSlot(const Key& key) const;
+    std::size_t next(std::size_t k) const;
+    std::size_t prev(std::size_t k) const;
+    static std::size_t layout(std::vector<std::size_t>& slotRank, std::size_t i, std::size_t k);
+    static void prefetch(const void* p);
+    static std::size_t lastLeftTurn(std::size_t k);
+
+    std::vector<value_type> items_;
+    std::size_t size_;
+};
+
+/*
+  ---------------------------------------------------------
+  Begin implementations for the FrozenTree::iterator class.
+  ---------------------------------------------------------
+*/
+
+/**
+* A default constructor that initializes the iterator to end().
+*/
+template<class Key, class Value, class Compare>
+FrozenTree<Key, Value, Compare>::iterator::iterator() :
+    slot_(0),
+    tree_(NULL)
+{
+}
+
+/**
+* Points at the given slot; slot 0 is end().
+*/
+template<class Key, class Value, class Compare>
+FrozenTree<Key, Value, Compare>::iterator::iterator(std::size_t slot, const FrozenTree* tree) :
+    slot_(slot),
+    tree_(tree)
+{
+}
+
+template<class Key, class Value, class Compare>
+const std::pair<const Key,Value>&
+FrozenTree<Key, Value, Compare>::iterator::operator*() const
+{
+    return tree_->items_[slot_];
+}
+
+template<class Key, class Value, class Compare>
+const std::pair<const Key,Value>*
+FrozenTree<Key, Value, Compare>::iterator::operator->() const
+{
+    return &tree_->items_[slot_];
+}
+
+template<class Key, class Value, class Compare>
+bool FrozenTree<Key, Value, Compare>::iterator::operator==(const iterator& rhs) const
+{
+    return slot_ == rhs.slot_;
+}
+
+template<class Key, class Value, class Compare>
+bool FrozenTree<Key, Value, Compare>::iterator::operator!=(const iterator& rhs) const
+{
+    return slot_ != rhs.slot_;
+}
+
+template<class Key, class Value, class Compare>
+typename FrozenTree<Key, Value, Compare>::iterator&
+FrozenTree<Key, Value, Compare>::iterator::operator++()
+{
+    slot_ = tree_->next(slot_);
+    return *this;
+}
+
+template<class Key, class Value, class Compare>
+typename FrozenTree<Key, Value, Compare>::iterator
+FrozenTree<Key, Value, Compare>::iterator::operator++(int)
+{
+    iterator previous = *this;
+    ++(*this);
+    return previous;
+}
+
+template<class Key, class Value, class Compare>
+typename FrozenTree<Key, Value, Compare>::iterator&
+FrozenTree<Key, Value, Compare>::iterator::operator--()
+{
+    slot_ = tree_->prev(slot_);
+    return *this;
+}
+
+template<class Key, class Value, class Compare>
+typename FrozenTree<Key, Value, Compare>::iterator
+FrozenTree<Key, Value, Compare>::iterator::operator--(int)
+{
+    iterator previous = *this;
+    --(*this);
+    return previous;
+}
+
+/*
+  -------------------------------------------------------
+  End implementations for the FrozenTree::iterator class.
+  -------------------------------------------------------
+*/
+
+/*
+  -----------------------------------------------
+  Begin implementations for the FrozenTree class.
+  -----------------------------------------------
+*/
+
+/**
+* An empty snapshot.
+*/
+template<class Key, class Value, class Compare>
+FrozenTree<Key, Value, Compare>::FrozenTree() :
+    size_(0)
+{
+}
+
+/**
+* Copies the items in [first, last), which must be sorted by Compare with
+* no repeated keys, into Eytzinger order.
+*/
+template<class Key, class Value, class Compare>
+template<typename InputIt>
+FrozenTree<Key, Value, Compare>::FrozenTree(InputIt first, InputIt last) :
+    size_(0)
+{
+    std::vector<value_type> sorted;
+    for(; first != last; ++first) {
+        sorted.push_back(*first);
+    }
+    size_ = sorted.size();
+    if(size_ == 0) {
+        return;
+    }
+    std::vector<std::size_t> slotRank(size_ + 1);
+    layout(slotRank, 0, 1);
+    items_.reserve(size_ + 1);
+    // slot 0 is unused so that the children of k are 2k and 2k + 1
+    items_.push_back(sorted[0]);
+    for(std::size_t k = 1; k <= size_; ++k) {
+        items_.push_back(sorted[slotRank[k]]);
+    }
+}
+
+/**
+* The first item is the leftmost slot.
+*/
+template<class Key, class Value, class Compare>
+typename FrozenTree<Key, Value, Compare>::iterator
+FrozenTree<Key, Value, Compare>::begin() const
+{
+    if(size_ == 0) {
+        return end();
+    }
+    std::size_t k = 1;
+    while(2 * k <= size_) {
+        k = 2 * k;
+    }
+    return iterator(k, this);
+}
+
+template<class Key, class Value, class Compare>
+typename FrozenTree<Key, Value, Compare>::iterator
+FrozenTree<Key, Value, Compare>::end() const
+{
+    return iterator(0, this);
+}
+
+template<class Key, class Value, class Compare>
+std::size_t FrozenTree<Key, Value, Compare>::size() const
+{
+    return size_;
+}
+
+template<class Key, class Value, class Compare>
+bool FrozenTree<Key, Value, Compare>::empty() const
+{
+    return size_ == 0;
+}
+
+/**
+* Returns an iterator to the item with the given key, or end().
+*/
+template<class Key, class Value, class Compare>
+typename FrozenTree<Key, Value, Compare>::iterator
+FrozenTree<Key, Value, Compare>::find(const Key& key) const
+{
+    std::size_t k = lowerBoundSlot(key);
+    Compare comp;
+    if(k == 0 || comp(key, items_[k].first)) {
+        return end();
+    }
+    return iterator(k, this);
+}
+
+/**
+* Returns an iterator to the first item whose key is not below key.
+*/
+template<class Key, class Value, class Compare>
+typename FrozenTree<Key, Value, Compare>::iterator
+FrozenTree<Key, Value, Compare>::lower_bound(const Key& key) const
+{
+    return iterator(lowerBoundSlot(key), this);
+}
+
+/**
+* Returns the value of key, throwing std::out_of_range if it is missing.
+*/
+template<class Key, class Value, class Compare>
+Value const & FrozenTree<Key, Value, Compare>::operator[](const Key& key) const
+{
+    iterator it = find(key);
+    if(it == end()) throw std::out_of_range("Invalid key");
+    return it->second;
+}
+
+template<class Key, class Value, class Compare>
+std::size_t FrozenTree<Key, Value, Compare>::bytes() const
+{
+    return items_.capacity() * sizeof(value_type);
+}
+
+/**
+* The slot of the first item whose key is not below key, or 0. The descent
+* always runs to the bottom of the implicit tree; each step appends the
+* comparison result to k as one more bit. The answer is the last slot
+* where the path went left, so dropping the trailing right turns, and that
+* left turn itself, from k gives it. If the path never went left, k drops
+* to 0, which is end().
+*/
+template<class Key, class Value, class Compare>
+std::size_t FrozenTree<Key, Value, Compare>::lowerBoundSlot(const Key& key) const
+{
+    const value_type* items = items_.data();
+    std::size_t n = size_;
+    std::size_t k = 1;
+    Compare comp;
+    while(k <= n) {
+        std::size_t ahead = k * PREFETCH_SLOTS;
+        prefetch(items + ((ahead < n) ? ahead : n));
+        k = 2 * k + comp(items[k].first, key);
+    }
+    return lastLeftTurn(k);
+}
+
+/**
+* In-order successor of slot k: the leftmost slot of its right subtree,
+* or else the nearest ancestor it lies to the left of.
+*/
+template<class Key, class Value, class Compare>
+std::size_t FrozenTree<Key, Value, Compare>::next(std::size_t k) const
+{
+    if(2 * k + 1 <= size_) {
+        k = 2 * k + 1;
+        while(2 * k <= size_) {
+            k = 2 * k;
+        }
+        return k;
+    }
+    return lastLeftTurn(k);
+}
+
+/**
+* In-order predecessor of slot k, with end() stepping back to the last
+* slot.
+*/
+template<class Key, class Value, class Compare>
+std::size_t FrozenTree<Key, Value, Compare>::prev(std::size_t k) const
+{
+    if(k == 0 || 2 * k <= size_) {
+        k = (k == 0) ? 1 : 2 * k;
+        while(2 * k + 1 <= size_) {
+            k = 2 * k + 1;
+        }
+        return k;
+    }
+    while(k > 1 && (k & 1) == 0) {
+        k >>= 1;
+    }
+    return k >> 1;
+}
+
+/**
+* Helper for the constructor: numbers the slots of the subtree at k in
+* order, from sorted position i on, and returns the position after them.
+*/
+template<class Key, class Value, class Compare>
+std::size_t FrozenTree<Key, Value, Compare>::layout(std::vector<std::size_t>& slotRank, std::size_t i, std::size_t k)
+{
+    if(k < slotRank.size()) {
+        i = layout(slotRank, i, 2 * k);
+        slotRank[k] = i;
+        i = layout(slotRank, i + 1, 2 * k + 1);
+    }
+    return i;
+}
+
+template<class Key, class Value, class Compare>
+void FrozenTree<Key, Value, Compare>::prefetch(const void* p)
+{
+#if defined(__GNUC__)
+    __builtin_prefetch(p);
+#else
+    (void)p;
+#endif
+}
+
+/**
+* Strips the trailing one bits of k and the zero bit above them.
+*/
+template<class Key, class Value, class Compare>
+std::size_t FrozenTree<Key, Value, Compare>::lastLeftTurn(std::size_t k)
+{
+#if defined(__GNUC__)
+    return k >> __builtin_ffsll(static_cast<long long>(~k));
+#else
+    while(k & 1) {
+        k >>= 1;
+    }
+    return k >> 1;
+#endif
+}
+
+/*
+  ---------------------------------------------
+  End implementations for the FrozenTree class.
+  ---------------------------------------------
+*/
+
+#endif
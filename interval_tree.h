@@ -0,0 +1,214 @@
+#ifndef INTERVAL_TREE_H
+#define INTERVAL_TREE_H
+
+#include <iostream>
+#include <vector>
+#include "avlbst.h"
+
+/**
+* A closed interval [low, high], ordered by low and then by high so that
+* several intervals may share a start.
+*/
+template <typename T>
+struct Interval
+{
+    Interval() : low(), high() { }
+    Interval(const T& l, const T& h) : low(l), high(h) { }
+
+    bool operator<(const Interval& rhs) const
+    {
+        return low < rhs.low || (!(rhs.low < low) && high < rhs.high);
+    }
+    bool operator>(const Interval& rhs) const
+    {
+        return rhs < *this;
+    }
+    bool operator<=(const Interval& rhs) const
+    {
+        return !(rhs < *this);
+    }
+    bool operator>=(const Interval& rhs) const
+    {
+        return !(*this < rhs);
+    }
+    bool operator==(const Interval& rhs) const
+    {
+        return !(*this < rhs) && !(rhs < *this);
+    }
+    bool operator!=(const Interval& rhs) const
+    {
+        return !(*this == rhs);
+    }
+
+    T low;
+    T high;
+};
+
+template <typename T>
+std::ostream& operator<<(std::ostream& os, const Interval<T>& interval)
+{
+    return os << "[" << interval.low << ", " << interval.high << "]";
+}
+
+/**
+* The augmentation policy behind IntervalTree: caches the largest high end
+* of any interval in a subtree.
+*/
+template <typename T, typename Base = NoAugment>
+struct IntervalMax : public Base
+{
+    static const bool enabled = true;
+    struct Data : public Base::Data
+    {
+        T maxHigh;
+    };
+    template<typename NodeType>
+    static void update(NodeType* n)
+    {
+        Base::update(n);
+        T maxHigh = n->getKey().high;
+        if(n->getLeft() != NULL && maxHigh < n->getLeft()->augment().maxHigh) {
+            maxHigh = n->getLeft()->augment().maxHigh;
+        }
+        if(n->getRight() != NULL && maxHigh < n->getRight()->augment().maxHigh) {
+            maxHigh = n->getRight()->augment().maxHigh;
+        }
+        n->augment().maxHigh = maxHigh;
+    }
+};
+
+/**
+* An AVL tree of closed intervals, each mapped to a Value. Every node knows
+* the largest high end below it, so overlap and stabbing queries skip the
+* subtrees that end too early and, by key order, those that start too late.
+*/
+template <typename T, typename Value, typename Alloc = NodePool>
+class IntervalTree : public AVLTree<Interval<T>, Value, Alloc, IntervalMax<T> >
+{
+public:
+    typedef typename AVLTree<Interval<T>, Value, Alloc, IntervalMax<T> >::iterator iterator;
+
+    // Calls fn on every item whose interval meets [lo, hi], or contains
+    // point, in key order.
+    template<typename Fn>
+    void for_each_overlap(const T& lo, const T& hi, Fn fn) const;
+    template<typename Fn>
+    void for_each_stabbing(const T& point, Fn fn) const;
+    // Returns the entries for_each_overlap would visit.
+    std::vector<iterator> overlapping(const T& lo, const T& hi) const;
+    // Returns an entry whose interval meets [lo, hi], or end(), in O(log n).
+    iterator find_overlap(const T& lo, const T& hi) const;
+
+protected:
+    template<typename Fn>
+    static void overlapNodes(AVLNode<Interval<T>, Value, IntervalMax<T> >* n, const T& lo, const T& hi, Fn& fn);
+};
+
+/*
+  -------------------------------------------------
+  Begin implementations for the IntervalTree class.
+  -------------------------------------------------
+*/
+
+/**
+* Walks the tree in order, skipping subtrees whose largest high end is
+* below lo and, once an interval starts after hi, everything to its right.
+* Each node visited is reported or lies on a path to one that is, so the
+* cost is O(log n) per reported entry at worst and usually much less.
+*/
+template<class T, class Value, class Alloc>
+template<typename Fn>
+void IntervalTree<T, Value, Alloc>::for_each_overlap(const T& lo, const T& hi, Fn fn) const
+{
+    if(hi < lo) {
+        return;
+    }
+    auto visit = [&](AVLNode<Interval<T>, Value, IntervalMax<T> >* n) {
+        fn(n->getItem());
+    };
+    overlapNodes(static_cast<AVLNode<Interval<T>, Value, IntervalMax<T> >*>(this->root_), lo, hi, visit);
+}
+
+/**
+* The intervals that contain point are the ones that meet [point, point].
+*/
+template<class T, class Value, class Alloc>
+template<typename Fn>
+void IntervalTree<T, Value, Alloc>::for_each_stabbing(const T& point, Fn fn) const
+{
+    for_each_overlap(point, point, fn);
+}
+
+/**
+* Collects the matches of for_each_overlap as iterators.
+*/
+template<class T, class Value, class Alloc>
+std::vector<typename IntervalTree<T, Value, Alloc>::iterator>
+IntervalTree<T, Value, Alloc>::overlapping(const T& lo, const T& hi) const
+{
+    std::vector<iterator> found;
+    if(hi < lo) {
+        return found;
+    }
+    auto collect = [&](AVLNode<Interval<T>, Value, IntervalMax<T> >* n) {
+        found.push_back(this->makeIterator(n));
+    };
+    overlapNodes(static_cast<AVLNode<Interval<T>, Value, IntervalMax<T> >*>(this->root_), lo, hi, collect);
+    return found;
+}
+
+/**
+* The classic single-path search: at each node that does not overlap, go
+* left if the left subtree reaches lo (if it holds no overlap, nothing to
+* the right can hold one either), and right otherwise.
+*/
+template<class T, class Value, class Alloc>
+typename IntervalTree<T, Value, Alloc>::iterator
+IntervalTree<T, Value, Alloc>::find_overlap(const T& lo, const T& hi) const
+{
+    AVLNode<Interval<T>, Value, IntervalMax<T> >* n =
+        static_cast<AVLNode<Interval<T>, Value, IntervalMax<T> >*>(this->root_);
+    while(n != NULL && !(hi < lo)) {
+        const Interval<T>& interval = n->getKey();
+        if(!(hi < interval.low) && !(interval.high < lo)) {
+            return this->makeIterator(n);
+        }
+        if(n->getLeft() != NULL && !(n->getLeft()->augment().maxHigh < lo)) {
+            n = n->getLeft();
+        }
+        else {
+            n = n->getRight();
+        }
+    }
+    return this->end();
+}
+
+/**
+* Helper for the overlap queries: calls fn with each node whose interval
+* meets [lo, hi], in key order.
+*/
+template<class T, class Value, class Alloc>
+template<typename Fn>
+void IntervalTree<T, Value, Alloc>::overlapNodes(AVLNode<Interval<T>, Value, IntervalMax<T> >* n,
+                                                 const T& lo, const T& hi, Fn& fn)
+{
+    while(n != NULL && !(n->augment().maxHigh < lo)) {
+        overlapNodes(n->getLeft(), lo, hi, fn);
+        const Interval<T>& interval = n->getKey();
+        if(hi < interval.low) {
+            return;
+        }
+        if(!(interval.high < lo)) {
+            fn(n);
+        }
+        n = n->getRight();
+    }
+}
+
+/*
+  -----------------------------------------------
+  End implementations for the IntervalTree class.
+  -----------------------------------------------
+*/
+
+#endif
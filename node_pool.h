@@ -0,0 +1,530 @@
+#ifndef NODE_POOL_H
+#define NODE_POOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <memory>
+#include <type_traits>
+#include <atomic>
+#include <vector>
+
+/**
+* A slab allocator for the nodes of a search tree.
+*
+* Every block handed out has the same size, which is fixed by the first call
+* to allocate() (a tree only ever allocates one kind of node). Blocks are
+* carved out of large slabs, and deallocated blocks go onto a free list so
+* that remove() followed by insert() recycles memory instead of growing it.
+* release() hands every slab back at once, which lets clear() skip the
+* per-node walk when the nodes have nothing to destroy. reserve() sets up a
+* single slab for a known number of nodes, which bulk loads use. Blocks
+* whose size is a whole number of 64-byte cache lines start on a cache line,
+* so a padded node never straddles one more line than it has to.
+*
+* A NodePool is a handle to the arena it carves blocks from, plus any
+* arenas it only keeps alive because it holds some of their blocks. When a
+* tree is split, share() freezes the source arena: no pool carves from it
+* again, and each piece keeps it alive until it is released. A freed block
+* always goes onto the free list of the freeing pool's own arena, whichever
+* arena it came from. adopt() moves another pool's arenas over in O(1) for
+* a join, and folds in any kept arena it turns out to be the last holder of.
+* The arena is only created when first needed, so making or moving a pool
+* never allocates, and a moved-from pool starts over with an arena of its
+* own.
+*
+* Thread safety: a pool is not locked. Copies of a pool share its arena and
+* must not be used from different threads at the same time. Pools that are
+* only linked through share() or adopt() never write to the same arena, so
+* the trees made by a split can be used from different threads.
+*
+* Any class with the same allocate/deallocate/release/releasable/reserve/
+* adopt/share interface and copy semantics, whose moved-from objects can still
+* allocate, can be used as the Alloc parameter of BinarySearchTree and
+* AVLTree.
+*/
+class NodePool
+{
+public:
+    NodePool();
+
+    void* allocate(std::size_t bytes);
+    void deallocate(void* p, std::size_t bytes);
+    bool release();
+    bool releasable() const;
+    void reserve(std::size_t bytes, std::size_t count);
+    bool adopt(NodePool& other);
+    void share(NodePool& other);
+
+    bool operator==(const NodePool& rhs) const;
+    bool operator!=(const NodePool& rhs) const;
+
+private:
+    // A block on the free list reuses its own storage for the link.
+    struct FreeBlock
+    {
+        FreeBlock* next;
+    };
+    // Slabs are chained through a header placed in front of their blocks.
+    union SlabHeader
+    {
+        SlabHeader* next;
+        std::max_align_t align;
+    };
+    // The state shared by every copy of a pool.
+    struct Arena
+    {
+        Arena();
+        ~Arena();
+        void freeSlabs();
+        void addSlab(std::size_t blocks);
+        bool takeSpare(Arena& other);
+        bool absorb(Arena& other);
+
+        std::size_t blockSize_;
+        std::size_t nextSlabBlocks_;
+        // both lists keep their tail so another arena's can be spliced on
+        FreeBlock* freeList_;
+        FreeBlock* freeTail_;
+        SlabHeader* slabs_;
+        SlabHeader* slabTail_;
+        char* bump_;
+        char* bumpEnd_;
+    };
+
+    static const std::size_t MIN_SLAB_BLOCKS = 64;
+    static const std::size_t MAX_SLAB_BLOCKS = 8192;
+    static const std::size_t CACHE_LINE = 64;
+
+    static std::size_t roundBlockSize(std::size_t bytes);
+    static std::size_t blockAlignment(std::size_t blockSize);
+    Arena& arena();
+    void keep(const std::shared_ptr<Arena>& other);
+    void absorbKept();
+
+    std::shared_ptr<Arena> arena_;
+    // Frozen or foreign arenas whose blocks this pool may still hold
+    std::vector<std::shared_ptr<Arena> > kept_;
+};
+
+/**
+* A default constructor. Nothing, not even the arena, is allocated until
+* the first node is requested.
+*/
+inline NodePool::NodePool()
+{
+
+}
+
+inline NodePool::Arena::Arena() :
+    blockSize_(0),
+    nextSlabBlocks_(MIN_SLAB_BLOCKS),
+    freeList_(NULL),
+    freeTail_(NULL),
+    slabs_(NULL),
+    slabTail_(NULL),
+    bump_(NULL),
+    bumpEnd_(NULL)
+{
+
+}
+
+/**
+* Destructor, which returns every slab. The trees are responsible for having
+* destroyed the nodes that live in them.
+*/
+inline NodePool::Arena::~Arena()
+{
+    freeSlabs();
+}
+
+/**
+* Returns a block of at least the given size. Recycled blocks are preferred,
+* then the unused tail of the newest slab, then a new slab which is twice the
+* size of the last one (up to MAX_SLAB_BLOCKS).
+*/
+inline void* NodePool::allocate(std::size_t bytes)
+{
+    Arena& a = arena();
+    if(a.blockSize_ == 0) {
+        a.blockSize_ = roundBlockSize(bytes);
+    }
+    if(a.freeList_ != NULL) {
+        FreeBlock* block = a.freeList_;
+        a.freeList_ = block->next;
+        if(a.freeList_ == NULL) {
+            a.freeTail_ = NULL;
+        }
+        return block;
+    }
+    if(a.bump_ == a.bumpEnd_) {
+        a.addSlab(a.nextSlabBlocks_);
+        if(a.nextSlabBlocks_ < MAX_SLAB_BLOCKS) {
+            a.nextSlabBlocks_ *= 2;
+        }
+    }
+    void* block = a.bump_;
+    a.bump_ += a.blockSize_;
+    return block;
+}
+
+/**
+* Puts a block back on the free list so the next allocate() reuses it. The
+* block may come from a kept arena; it is recycled here all the same.
+*/
+inline void NodePool::deallocate(void* p, std::size_t)
+{
+    if(p == NULL) {
+        return;
+    }
+    Arena& a = arena();
+    FreeBlock* block = static_cast<FreeBlock*>(p);
+    block->next = a.freeList_;
+    if(a.freeList_ == NULL) {
+        a.freeTail_ = block;
+    }
+    a.freeList_ = block;
+}
+
+/**
+* Frees every slab at once, invalidating all blocks that were handed out,
+* and lets go of the kept arenas (which are freed by whichever pool drops
+* them last). Returns false, and frees nothing, if a copy of this pool
+* shares its arena.
+*/
+inline bool NodePool::release()
+{
+    if(!releasable()) {
+        return false;
+    }
+    if(arena_) {
+        arena_->freeSlabs();
+    }
+    kept_.clear();
+    return true;
+}
+
+/**
+* Returns true iff release() would succeed, so a caller holding several
+* pools can check them all before releasing any.
+*/
+inline bool NodePool::releasable() const
+{
+    return !arena_ || arena_.use_count() == 1;
+}
+
+/**
+* Makes sure the next count blocks of the given size come from one
+* contiguous slab, unless recycled blocks are waiting on the free list.
+*/
+inline void NodePool::reserve(std::size_t bytes, std::size_t count)
+{
+    Arena& a = arena();
+    if(a.blockSize_ == 0) {
+        a.blockSize_ = roundBlockSize(bytes);
+    }
+    if(count == 0 || a.freeList_ != NULL) {
+        return;
+    }
+    if(static_cast<std::size_t>(a.bumpEnd_ - a.bump_) / a.blockSize_ < count) {
+        a.addSlab(count);
+    }
+}
+
+/**
+* Makes blocks allocated by other safe to deallocate through this pool, and
+* keeps them alive as long as this pool. other's own arena is spliced into
+* this one in O(1) when nothing else refers to it, and kept otherwise;
+* other's kept arenas are kept too. other is left without an arena until
+* it next needs one. Returns false, leaving both pools as they were, only
+* if other hands out blocks of a different size, in which case nodes have
+* to be copied instead.
+*/
+inline bool NodePool::adopt(NodePool& other)
+{
+    if(&other == this) {
+        return true;
+    }
+    if(other.arena_ && other.arena_ != arena_) {
+        Arena& mine = arena();
+        Arena& theirs = *other.arena_;
+        if(mine.blockSize_ != 0 && theirs.blockSize_ != 0 && mine.blockSize_ != theirs.blockSize_) {
+            return false;
+        }
+        if(other.arena_.use_count() != 1 || !mine.absorb(theirs)) {
+            keep(other.arena_);
+        }
+    }
+    for(std::size_t i = 0; i < other.kept_.size(); ++i) {
+        keep(other.kept_[i]);
+    }
+    other.arena_.reset();
+    other.kept_.clear();
+    absorbKept();
+    return true;
+}
+
+/**
+* Lets this pool hold, and free, blocks that other handed out, for when
+* other's nodes are divided between several trees. other's arena is
+* frozen: neither pool carves from it again, and it lives until the last
+* pool holding it lets go. Its free blocks and unused slab space come to
+* this pool, so nothing is wasted when other shares with several pools.
+*/
+inline void NodePool::share(NodePool& other)
+{
+    if(&other == this) {
+        return;
+    }
+    if(other.arena_ && other.arena_ != arena_) {
+        if(other.arena_.use_count() == 1) {
+            arena().takeSpare(*other.arena_);
+        }
+        other.kept_.push_back(other.arena_);
+        other.arena_.reset();
+    }
+    else if(other.arena_) {
+        // a copy of other: freeze the shared arena for both
+        other.kept_.push_back(other.arena_);
+        other.arena_.reset();
+        arena_.reset();
+    }
+    for(std::size_t i = 0; i < other.kept_.size(); ++i) {
+        keep(other.kept_[i]);
+    }
+}
+
+/**
+* Pools compare equal when they share an arena and can free each other's
+* blocks.
+*/
+inline bool NodePool::operator==(const NodePool& rhs) const
+{
+    return arena_ == rhs.arena_;
+}
+
+inline bool NodePool::operator!=(const NodePool& rhs) const
+{
+    return arena_ != rhs.arena_;
+}
+
+/**
+* Rounds a block size up so a block can always hold a free list link and
+* every block in a slab stays aligned for a pointer.
+*/
+inline std::size_t NodePool::roundBlockSize(std::size_t bytes)
+{
+    return (bytes + sizeof(void*) - 1) / sizeof(void*) * sizeof(void*);
+}
+
+/**
+* Helper that returns the alignment of the blocks of the given size: a
+* cache line for blocks made of whole cache lines, and otherwise that of the
+* slab header, which is enough for any type.
+*/
+inline std::size_t NodePool::blockAlignment(std::size_t blockSize)
+{
+    if(blockSize % CACHE_LINE == 0) {
+        return CACHE_LINE;
+    }
+    return std::alignment_of<SlabHeader>::value;
+}
+
+/**
+* Helper that returns the arena, creating it on first use.
+*/
+inline NodePool::Arena& NodePool::arena()
+{
+    if(!arena_) {
+        arena_ = std::make_shared<Arena>();
+    }
+    return *arena_;
+}
+
+/**
+* Helper that adds other to the kept arenas, unless it is already there or
+* is this pool's own arena.
+*/
+inline void NodePool::keep(const std::shared_ptr<Arena>& other)
+{
+    if(other == arena_) {
+        return;
+    }
+    for(std::size_t i = 0; i < kept_.size(); ++i) {
+        if(kept_[i] == other) {
+            return;
+        }
+    }
+    kept_.push_back(other);
+}
+
+/**
+* Helper that splices every kept arena no other pool holds any more into
+* this pool's own arena, so kept arenas do not pile up over repeated
+* splits and joins.
+*/
+inline void NodePool::absorbKept()
+{
+    std::size_t i = 0;
+    while(i < kept_.size()) {
+        if(kept_[i].use_count() == 1) {
+            // pairs with the release in the last other holder's reset
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if(arena().absorb(*kept_[i])) {
+                kept_[i] = kept_.back();
+                kept_.pop_back();
+                continue;
+            }
+        }
+        ++i;
+    }
+}
+
+/**
+* Helper that frees every slab and resets the arena to its initial state
+* (apart from the block size).
+*/
+inline void NodePool::Arena::freeSlabs()
+{
+    while(slabs_ != NULL) {
+        SlabHeader* next = slabs_->next;
+        std::free(slabs_);
+        slabs_ = next;
+    }
+    slabTail_ = NULL;
+    freeList_ = NULL;
+    freeTail_ = NULL;
+    bump_ = NULL;
+    bumpEnd_ = NULL;
+    nextSlabBlocks_ = MIN_SLAB_BLOCKS;
+}
+
+/**
+* Helper that allocates a slab with room for the given number of blocks and
+* makes it the one allocate() carves from. The blocks start past the
+* header, rounded up to their alignment.
+*/
+inline void NodePool::Arena::addSlab(std::size_t blocks)
+{
+    std::size_t align = blockAlignment(blockSize_);
+    // malloc only promises the header's alignment
+    std::size_t slack = align - std::alignment_of<SlabHeader>::value;
+    void* mem = std::malloc(sizeof(SlabHeader) + slack + blocks * blockSize_);
+    if(mem == NULL) {
+        throw std::bad_alloc();
+    }
+    SlabHeader* slab = static_cast<SlabHeader*>(mem);
+    slab->next = slabs_;
+    if(slabs_ == NULL) {
+        slabTail_ = slab;
+    }
+    slabs_ = slab;
+    std::uintptr_t start = reinterpret_cast<std::uintptr_t>(slab + 1);
+    bump_ = reinterpret_cast<char*>(slab + 1) + (align - start % align) % align;
+    bumpEnd_ = bump_ + blocks * blockSize_;
+}
+
+/**
+* Helper that moves other's free blocks onto this arena's free list, and
+* its unused slab space here if this arena has none, in O(1). The slabs
+* themselves stay with other. Returns false if the block sizes differ.
+*/
+inline bool NodePool::Arena::takeSpare(Arena& other)
+{
+    if(blockSize_ != 0 && other.blockSize_ != 0 && blockSize_ != other.blockSize_) {
+        return false;
+    }
+    if(blockSize_ == 0) {
+        blockSize_ = other.blockSize_;
+    }
+    if(other.freeList_ != NULL) {
+        other.freeTail_->next = freeList_;
+        if(freeList_ == NULL) {
+            freeTail_ = other.freeTail_;
+        }
+        freeList_ = other.freeList_;
+        other.freeList_ = NULL;
+        other.freeTail_ = NULL;
+    }
+    if(bump_ == bumpEnd_) {
+        bump_ = other.bump_;
+        bumpEnd_ = other.bumpEnd_;
+    }
+    other.bump_ = NULL;
+    other.bumpEnd_ = NULL;
+    return true;
+}
+
+/**
+* Helper that takes over everything other owns, slabs included, in O(1),
+* and leaves other empty. Any unused space of other's newest slab is kept
+* only if this arena has none of its own. Returns false if the block sizes
+* differ.
+*/
+inline bool NodePool::Arena::absorb(Arena& other)
+{
+    if(!takeSpare(other)) {
+        return false;
+    }
+    if(other.slabs_ != NULL) {
+        other.slabTail_->next = slabs_;
+        if(slabs_ == NULL) {
+            slabTail_ = other.slabTail_;
+        }
+        slabs_ = other.slabs_;
+        other.slabs_ = NULL;
+        other.slabTail_ = NULL;
+    }
+    if(nextSlabBlocks_ < other.nextSlabBlocks_) {
+        nextSlabBlocks_ = other.nextSlabBlocks_;
+    }
+    return true;
+}
+
+/**
+* An allocator that sends every node straight to the global heap. It cannot
+* release nodes in bulk, so clear() falls back to freeing them one by one.
+*/
+class HeapAllocator
+{
+public:
+    void* allocate(std::size_t bytes)
+    {
+        return ::operator new(bytes);
+    }
+    void deallocate(void* p, std::size_t)
+    {
+        ::operator delete(p);
+    }
+    bool release()
+    {
+        return false;
+    }
+    bool releasable() const
+    {
+        return false;
+    }
+    void reserve(std::size_t, std::size_t)
+    {
+
+    }
+    bool adopt(HeapAllocator&)
+    {
+        return true;
+    }
+    void share(HeapAllocator&)
+    {
+
+    }
+    bool operator==(const HeapAllocator&) const
+    {
+        return true;
+    }
+    bool operator!=(const HeapAllocator&) const
+    {
+        return false;
+    }
+};
+
+#endif
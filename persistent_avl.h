@@ -0,0 +1,588 @@
+#ifndef PERSISTENT_AVL_H
+#define PERSISTENT_AVL_H
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <stdexcept>
+#include <utility>
+#include "tree_walk.h"
+
+/**
+* An AVL tree whose versions share structure, so that snapshot() is O(1).
+*
+* Nodes carry reference counts: one per parent link or root that points
+* at them. An update walks down from the root taking ownership of each
+* node on its path. A node with a count of one belongs to this version
+* alone and is changed in place; a node also referenced elsewhere is
+* copied first, and the copy takes its place. While no snapshot is held
+* an update therefore costs about what it does in AVLTree, and after one
+* is taken the first update of each path copies O(log n) nodes and shares
+* everything else.
+*
+* A Snapshot holds one reference to the root it was taken from and never
+* sees later updates. Snapshots may be read, copied and destroyed on other
+* threads while the tree is updated, since shared nodes are never written
+* and counts are atomic; nodes come from the global heap for the same
+* reason. The tree itself, snapshot() included, is used by one thread.
+*/
+template <typename Key, typename Value, typename Compare = std::less<Key> >
+class PersistentAVLTree
+{
+private:
+    struct Node
+    {
+        Node(const std::pair<const Key, Value>& item, Node* l, Node* r, int height);
+
+        std::pair<const Key, Value> item;
+        Node* left;
+        Node* right;
+        int height;
+        std::atomic<int> refs;
+    };
+
+public:
+    PersistentAVLTree();
+    ~PersistentAVLTree();
+
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    void clear();
+    bool find(const Key& key, Value& value) const;
+    bool contains(const Key& key) const;
+    Value const & operator[](const Key& key) const;
+    bool isBalanced() const;
+    bool empty() const;
+    std::size_t size() const;
+
+    /**
+    * A read-only version of the tree as it was when taken.
+    */
+    class Snapshot
+    {
+    public:
+        Snapshot();
+        Snapshot(const Snapshot& other);
+        Snapshot& operator=(const Snapshot& other);
+        ~Snapshot();
+
+        // A forward iterator in key order; see PathIterator.
+        typedef PathIterator<Node, std::pair<const Key, Value> > iterator;
+
+        iterator begin() const;
+        iterator end() const;
+        iterator find(const Key& key) const;
+        iterator lower_bound(const Key& key) const;
+        Value const & operator[](const Key& key) const;
+        bool empty() const;
+        std::size_t size() const;
+
+    private:
+        friend class PersistentAVLTree;
+        Snapshot(Node* root, std::size_t size);
+
+        Node* root_;
+        std::size_t size_;
+    };
+
+    Snapshot snapshot() const;
+
+private:
+    PersistentAVLTree(const PersistentAVLTree&);
+    PersistentAVLTree& operator=(const PersistentAVLTree&);
+
+    static int height(const Node* n);
+    static void updateHeight(Node* n);
+    static const Node* findNode(const Node* n, const Key& key);
+    static void retain(Node* n);
+    static void release(Node* n);
+
+    // Update helpers; each takes ownership of the nodes it changes and
+    // returns the new root of the subtree it was given.
+    static Node* own(Node* n);
+    static Node* rotateLeft(Node* n);
+    static Node* rotateRight(Node* n);
+    static Node* rebalance(Node* n);
+    static Node* insertNode(Node* n, const std::pair<const Key, Value>& item, bool& added);
+    static Node* removeNode(Node* n, const Key& key);
+    static Node* removeMin(Node* n, Node*& min);
+
+    Node* root_;
+    std::size_t size_;
+};
+
+/*
+  -----------------------------------------------------------
+  Begin implementations for the PersistentAVLTree::Node class.
+  -----------------------------------------------------------
+*/
+
+/**
+* Takes a reference to each child; the new node starts with the one
+* reference its creator holds.
+*/
+template<class Key, class Value, class Compare>
+PersistentAVLTree<Key, Value, Compare>::Node::Node(const std::pair<const Key, Value>& i, Node* l, Node* r, int h) :
+    item(i),
+    left(l),
+    right(r),
+    height(h),
+    refs(1)
+{
+    retain(l);
+    retain(r);
+}
+
+/*
+  ---------------------------------------------------------
+  End implementations for the PersistentAVLTree::Node class.
+  ---------------------------------------------------------
+*/
+
+/*
+  ---------------------------------------------------------------
+  Begin implementations for the PersistentAVLTree::Snapshot class.
+  ---------------------------------------------------------------
+*/
+
+/**
+* An empty snapshot.
+*/
+template<class Key, class Value, class Compare>
+PersistentAVLTree<Key, Value, Compare>::Snapshot::Snapshot() :
+    root_(NULL),
+    size_(0)
+{
+}
+
+/**
+* Adopts a reference to root that the caller has already taken.
+*/
+template<class Key, class Value, class Compare>
+PersistentAVLTree<Key, Value, Compare>::Snapshot::Snapshot(Node* root, std::size_t size) :
+    root_(root),
+    size_(size)
+{
+}
+
+template<class Key, class Value, class Compare>
+PersistentAVLTree<Key, Value, Compare>::Snapshot::Snapshot(const Snapshot& other) :
+    root_(other.root_),
+    size_(other.size_)
+{
+    retain(root_);
+}
+
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Snapshot&
+PersistentAVLTree<Key, Value, Compare>::Snapshot::operator=(const Snapshot& other)
+{
+    retain(other.root_);
+    release(root_);
+    root_ = other.root_;
+    size_ = other.size_;
+    return *this;
+}
+
+/**
+* Drops the reference to the root; nodes no longer shared with the tree
+* or another snapshot are freed.
+*/
+template<class Key, class Value, class Compare>
+PersistentAVLTree<Key, Value, Compare>::Snapshot::~Snapshot()
+{
+    release(root_);
+}
+
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Snapshot::iterator
+PersistentAVLTree<Key, Value, Compare>::Snapshot::begin() const
+{
+    return iterator::first(root_);
+}
+
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Snapshot::iterator
+PersistentAVLTree<Key, Value, Compare>::Snapshot::end() const
+{
+    return iterator();
+}
+
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Snapshot::iterator
+PersistentAVLTree<Key, Value, Compare>::Snapshot::find(const Key& key) const
+{
+    return iterator::find(root_, key, Compare());
+}
+
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Snapshot::iterator
+PersistentAVLTree<Key, Value, Compare>::Snapshot::lower_bound(const Key& key) const
+{
+    return iterator::lowerBound(root_, key, Compare());
+}
+
+/**
+* Returns the value of key, throwing std::out_of_range if it is missing.
+*/
+template<class Key, class Value, class Compare>
+Value const & PersistentAVLTree<Key, Value, Compare>::Snapshot::operator[](const Key& key) const
+{
+    const Node* n = findNode(root_, key);
+    if(n == NULL) throw std::out_of_range("Invalid key");
+    return n->item.second;
+}
+
+template<class Key, class Value, class Compare>
+bool PersistentAVLTree<Key, Value, Compare>::Snapshot::empty() const
+{
+    return root_ == NULL;
+}
+
+template<class Key, class Value, class Compare>
+std::size_t PersistentAVLTree<Key, Value, Compare>::Snapshot::size() const
+{
+    return size_;
+}
+
+/*
+  -------------------------------------------------------------
+  End implementations for the PersistentAVLTree::Snapshot class.
+  -------------------------------------------------------------
+*/
+
+/*
+  ------------------------------------------------------
+  Begin implementations for the PersistentAVLTree class.
+  ------------------------------------------------------
+*/
+
+template<class Key, class Value, class Compare>
+PersistentAVLTree<Key, Value, Compare>::PersistentAVLTree() :
+    root_(NULL),
+    size_(0)
+{
+}
+
+/**
+* Releases the tree's version; nodes that snapshots still share survive
+* until the last of those snapshots goes.
+*/
+template<class Key, class Value, class Compare>
+PersistentAVLTree<Key, Value, Compare>::~PersistentAVLTree()
+{
+    release(root_);
+}
+
+/**
+* Inserts the item, or overwrites the value if its key is present.
+*/
+template<class Key, class Value, class Compare>
+void PersistentAVLTree<Key, Value, Compare>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    bool added = false;
+    root_ = insertNode(root_, keyValuePair, added);
+    if(added) {
+        ++size_;
+    }
+}
+
+/**
+* Removes key if present. A missing key copies nothing.
+*/
+template<class Key, class Value, class Compare>
+void PersistentAVLTree<Key, Value, Compare>::remove(const Key& key)
+{
+    if(findNode(root_, key) == NULL) {
+        return;
+    }
+    root_ = removeNode(root_, key);
+    --size_;
+}
+
+template<class Key, class Value, class Compare>
+void PersistentAVLTree<Key, Value, Compare>::clear()
+{
+    release(root_);
+    root_ = NULL;
+    size_ = 0;
+}
+
+/**
+* Copies the value of key into value and returns true, or returns false
+* if it is missing.
+*/
+template<class Key, class Value, class Compare>
+bool PersistentAVLTree<Key, Value, Compare>::find(const Key& key, Value& value) const
+{
+    const Node* n = findNode(root_, key);
+    if(n == NULL) {
+        return false;
+    }
+    value = n->item.second;
+    return true;
+}
+
+template<class Key, class Value, class Compare>
+bool PersistentAVLTree<Key, Value, Compare>::contains(const Key& key) const
+{
+    return findNode(root_, key) != NULL;
+}
+
+/**
+* Returns the value of key, throwing std::out_of_range if it is missing.
+*/
+template<class Key, class Value, class Compare>
+Value const & PersistentAVLTree<Key, Value, Compare>::operator[](const Key& key) const
+{
+    const Node* n = findNode(root_, key);
+    if(n == NULL) throw std::out_of_range("Invalid key");
+    return n->item.second;
+}
+
+/**
+* Return true iff every height is correct and every node balanced.
+*/
+template<class Key, class Value, class Compare>
+bool PersistentAVLTree<Key, Value, Compare>::isBalanced() const
+{
+    return checkedAVLHeight(root_) >= 0;
+}
+
+template<class Key, class Value, class Compare>
+bool PersistentAVLTree<Key, Value, Compare>::empty() const
+{
+    return root_ == NULL;
+}
+
+template<class Key, class Value, class Compare>
+std::size_t PersistentAVLTree<Key, Value, Compare>::size() const
+{
+    return size_;
+}
+
+/**
+* The current version, in O(1): one more reference to the root. The next
+* update of each path copies it instead of changing it in place.
+*/
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Snapshot
+PersistentAVLTree<Key, Value, Compare>::snapshot() const
+{
+    retain(root_);
+    return Snapshot(root_, size_);
+}
+
+template<class Key, class Value, class Compare>
+int PersistentAVLTree<Key, Value, Compare>::height(const Node* n)
+{
+    return (n == NULL) ? 0 : n->height;
+}
+
+template<class Key, class Value, class Compare>
+void PersistentAVLTree<Key, Value, Compare>::updateHeight(Node* n)
+{
+    int l = height(n->left);
+    int r = height(n->right);
+    n->height = 1 + ((l > r) ? l : r);
+}
+
+template<class Key, class Value, class Compare>
+const typename PersistentAVLTree<Key, Value, Compare>::Node*
+PersistentAVLTree<Key, Value, Compare>::findNode(const Node* n, const Key& key)
+{
+    Compare comp;
+    while(n != NULL) {
+        if(comp(key, n->item.first)) {
+            n = n->left;
+        }
+        else if(comp(n->item.first, key)) {
+            n = n->right;
+        }
+        else {
+            return n;
+        }
+    }
+    return NULL;
+}
+
+template<class Key, class Value, class Compare>
+void PersistentAVLTree<Key, Value, Compare>::retain(Node* n)
+{
+    if(n != NULL) {
+        n->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+/**
+* Drops one reference to n, freeing it and releasing its children when it
+* was the last. The decrement is acq_rel so that whoever frees a node sees
+* every other holder's reads of it finished.
+*/
+template<class Key, class Value, class Compare>
+void PersistentAVLTree<Key, Value, Compare>::release(Node* n)
+{
+    while(n != NULL && n->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        Node* left = n->left;
+        Node* right = n->right;
+        delete n;
+        release(left);
+        n = right;
+    }
+}
+
+/**
+* Returns a node that only the caller's link references, with n's
+* contents: n itself if it is not shared, or else a copy, which shares
+* n's children, with the caller's reference to n dropped. Only the tree's
+* thread creates references, so a count of one cannot grow meanwhile.
+*/
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Node*
+PersistentAVLTree<Key, Value, Compare>::own(Node* n)
+{
+    if(n->refs.load(std::memory_order_acquire) == 1) {
+        return n;
+    }
+    Node* copy = new Node(n->item, n->left, n->right, n->height);
+    release(n);
+    return copy;
+}
+
+/**
+* Rotates the owned node n left; its right child is owned first, since it
+* changes, while the subtree that moves across keeps its one reference.
+*/
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Node*
+PersistentAVLTree<Key, Value, Compare>::rotateLeft(Node* n)
+{
+    Node* r = own(n->right);
+    n->right = r->left;
+    r->left = n;
+    updateHeight(n);
+    updateHeight(r);
+    return r;
+}
+
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Node*
+PersistentAVLTree<Key, Value, Compare>::rotateRight(Node* n)
+{
+    Node* l = own(n->left);
+    n->left = l->right;
+    l->right = n;
+    updateHeight(n);
+    updateHeight(l);
+    return l;
+}
+
+/**
+* Restores the balance of the owned node n, whose subtrees differ in
+* height by at most two, and returns the new root of its subtree.
+*/
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Node*
+PersistentAVLTree<Key, Value, Compare>::rebalance(Node* n)
+{
+    updateHeight(n);
+    int balance = height(n->left) - height(n->right);
+    if(balance > 1) {
+        if(height(n->left->left) < height(n->left->right)) {
+            n->left = own(n->left);
+            n->left = rotateLeft(n->left);
+        }
+        return rotateRight(n);
+    }
+    if(balance < -1) {
+        if(height(n->right->right) < height(n->right->left)) {
+            n->right = own(n->right);
+            n->right = rotateRight(n->right);
+        }
+        return rotateLeft(n);
+    }
+    return n;
+}
+
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Node*
+PersistentAVLTree<Key, Value, Compare>::insertNode(Node* n, const std::pair<const Key, Value>& item, bool& added)
+{
+    if(n == NULL) {
+        added = true;
+        return new Node(item, NULL, NULL, 1);
+    }
+    Compare comp;
+    n = own(n);
+    if(comp(item.first, n->item.first)) {
+        n->left = insertNode(n->left, item, added);
+    }
+    else if(comp(n->item.first, item.first)) {
+        n->right = insertNode(n->right, item, added);
+    }
+    else {
+        n->item.second = item.second;
+        return n;
+    }
+    return rebalance(n);
+}
+
+/**
+* Returns the subtree at n without key, which must be present. The removed
+* node's children pass to whatever takes its place, so only the node
+* itself is freed.
+*/
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Node*
+PersistentAVLTree<Key, Value, Compare>::removeNode(Node* n, const Key& key)
+{
+    Compare comp;
+    n = own(n);
+    if(comp(key, n->item.first)) {
+        n->left = removeNode(n->left, key);
+        return rebalance(n);
+    }
+    if(comp(n->item.first, key)) {
+        n->right = removeNode(n->right, key);
+        return rebalance(n);
+    }
+    Node* left = n->left;
+    Node* right = n->right;
+    delete n;
+    if(left == NULL) {
+        return right;
+    }
+    if(right == NULL) {
+        return left;
+    }
+    Node* min = NULL;
+    right = removeMin(right, min);
+    min->left = left;
+    min->right = right;
+    return rebalance(min);
+}
+
+/**
+* Returns the subtree at n without its first node, which is detached,
+* owned, and stored in min.
+*/
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Node*
+PersistentAVLTree<Key, Value, Compare>::removeMin(Node* n, Node*& min)
+{
+    n = own(n);
+    if(n->left == NULL) {
+        min = n;
+        return n->right;
+    }
+    n->left = removeMin(n->left, min);
+    return rebalance(n);
+}
+
+/*
+  ----------------------------------------------------
+  End implementations for the PersistentAVLTree class.
+  ----------------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,523 @@
+#ifndef RCU_TREE_H
+#define RCU_TREE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+#include "node_pool.h"
+#include "epoch.h"
+#include "tree_walk.h"
+
+/**
+* An AVL tree that many threads can read while one thread writes, with no
+* locks on the read side.
+*
+* Published nodes are never modified. An update copies the nodes on its
+* root path, and any it rotates, then publishes the new root with one
+* atomic store. A reader therefore always sees a complete, balanced
+* version. The nodes a write replaced are retired into an EpochDomain and
+* freed once no reader that might hold them is still pinned. Readers
+* never wait for the writer and share no cache lines with each other.
+* Writers are serialized by a mutex, so there is one writer at a time.
+*
+* Simple lookups pin an epoch per call. A Reader pins one version for
+* its lifetime and offers iteration and lower_bound over that version;
+* keep its lifetime short, as it holds back reclamation.
+*/
+template <typename Key, typename Value, typename Alloc = NodePool, typename Compare = std::less<Key> >
+class RcuAVLTree
+{
+private:
+    struct Node
+    {
+        Node(const Key& key, const Value& value, const Node* l, const Node* r);
+
+        std::pair<const Key, Value> item;
+        const Node* left;
+        const Node* right;
+        int height;
+    };
+
+public:
+    RcuAVLTree();
+    ~RcuAVLTree();
+
+    // Writer side; concurrent calls are serialized.
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    void clear();
+
+    // Reader side; lock-free.
+    bool find(const Key& key, Value& value) const;
+    bool contains(const Key& key) const;
+    bool isBalanced() const;
+    bool empty() const;
+    std::size_t size() const;
+
+    /**
+    * A pinned, consistent version of the tree.
+    */
+    class Reader
+    {
+    public:
+        explicit Reader(const RcuAVLTree& tree);
+        ~Reader();
+
+        // A forward iterator in key order; see PathIterator.
+        typedef PathIterator<Node, std::pair<const Key, Value> > iterator;
+
+        iterator begin() const;
+        iterator end() const;
+        iterator find(const Key& key) const;
+        iterator lower_bound(const Key& key) const;
+
+    private:
+        Reader(const Reader&);
+        Reader& operator=(const Reader&);
+
+        const RcuAVLTree& tree_;
+        std::size_t slot_;
+        const Node* root_;
+    };
+
+private:
+    RcuAVLTree(const RcuAVLTree&);
+    RcuAVLTree& operator=(const RcuAVLTree&);
+
+    // Retired nodes are checked for reclamation once this many pile up.
+    static const std::size_t RECLAIM_BATCH = 1024;
+
+    static int height(const Node* n);
+    static const Node* findNode(const Node* n, const Key& key);
+
+    // Writer helpers; each replaced node goes to pending_.
+    const Node* makeNode(const std::pair<const Key, Value>& item, const Node* l, const Node* r);
+    const Node* rebalance(const std::pair<const Key, Value>& item, const Node* l, const Node* r);
+    const Node* insertNode(const Node* n, const std::pair<const Key, Value>& item, bool& added);
+    const Node* removeNode(const Node* n, const Key& key, bool& removed);
+    const Node* removeMin(const Node* n, const Node*& min);
+    void retireAll(const Node* n);
+    void publish(const Node* root);
+    void reclaim();
+    void freeNode(const Node* n);
+    void freeTree(const Node* n);
+
+    std::atomic<const Node*> root_;
+    std::atomic<std::size_t> size_;
+    mutable EpochDomain domain_;
+    std::mutex writeLock_;
+    std::vector<const Node*> pending_;
+    std::deque<std::pair<std::uint64_t, const Node*> > retired_;
+    Alloc alloc_;
+};
+
+/*
+  -----------------------------------------------------
+  Begin implementations for the RcuAVLTree::Node class.
+  -----------------------------------------------------
+*/
+
+template<class Key, class Value, class Alloc, class Compare>
+RcuAVLTree<Key, Value, Alloc, Compare>::Node::Node(const Key& key, const Value& value, const Node* l, const Node* r) :
+    item(key, value),
+    left(l),
+    right(r),
+    height(1 + ((RcuAVLTree::height(l) > RcuAVLTree::height(r)) ? RcuAVLTree::height(l) : RcuAVLTree::height(r)))
+{
+}
+
+/*
+  ---------------------------------------------------
+  End implementations for the RcuAVLTree::Node class.
+  ---------------------------------------------------
+*/
+
+/*
+  -------------------------------------------------------
+  Begin implementations for the RcuAVLTree::Reader class.
+  -------------------------------------------------------
+*/
+
+/**
+* Pins an epoch, then reads the current root; everything reachable from
+* it stays allocated until the Reader is destroyed.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+RcuAVLTree<Key, Value, Alloc, Compare>::Reader::Reader(const RcuAVLTree& tree) :
+    tree_(tree),
+    slot_(tree.domain_.pin()),
+    root_(tree.root_.load())
+{
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+RcuAVLTree<Key, Value, Alloc, Compare>::Reader::~Reader()
+{
+    tree_.domain_.unpin(slot_);
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+typename RcuAVLTree<Key, Value, Alloc, Compare>::Reader::iterator
+RcuAVLTree<Key, Value, Alloc, Compare>::Reader::begin() const
+{
+    return iterator::first(root_);
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+typename RcuAVLTree<Key, Value, Alloc, Compare>::Reader::iterator
+RcuAVLTree<Key, Value, Alloc, Compare>::Reader::end() const
+{
+    return iterator();
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+typename RcuAVLTree<Key, Value, Alloc, Compare>::Reader::iterator
+RcuAVLTree<Key, Value, Alloc, Compare>::Reader::find(const Key& key) const
+{
+    return iterator::find(root_, key, Compare());
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+typename RcuAVLTree<Key, Value, Alloc, Compare>::Reader::iterator
+RcuAVLTree<Key, Value, Alloc, Compare>::Reader::lower_bound(const Key& key) const
+{
+    return iterator::lowerBound(root_, key, Compare());
+}
+
+/*
+  -----------------------------------------------------
+  End implementations for the RcuAVLTree::Reader class.
+  -----------------------------------------------------
+*/
+
+/*
+  -----------------------------------------------
+  Begin implementations for the RcuAVLTree class.
+  -----------------------------------------------
+*/
+
+template<class Key, class Value, class Alloc, class Compare>
+RcuAVLTree<Key, Value, Alloc, Compare>::RcuAVLTree() :
+    root_(NULL),
+    size_(0)
+{
+}
+
+/**
+* No reader may be active while the tree is destroyed.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+RcuAVLTree<Key, Value, Alloc, Compare>::~RcuAVLTree()
+{
+    freeTree(root_.load());
+    for(std::size_t i = 0; i < retired_.size(); ++i) {
+        freeNode(retired_[i].second);
+    }
+}
+
+/**
+* Inserts the item, or overwrites the value if its key is present, by
+* publishing a new version of the root path.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+void RcuAVLTree<Key, Value, Alloc, Compare>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    std::lock_guard<std::mutex> lock(writeLock_);
+    bool added = false;
+    const Node* root = insertNode(root_.load(std::memory_order_relaxed), keyValuePair, added);
+    publish(root);
+    if(added) {
+        size_.store(size_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+}
+
+/**
+* Removes key if present.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+void RcuAVLTree<Key, Value, Alloc, Compare>::remove(const Key& key)
+{
+    std::lock_guard<std::mutex> lock(writeLock_);
+    bool removed = false;
+    const Node* root = removeNode(root_.load(std::memory_order_relaxed), key, removed);
+    if(removed) {
+        publish(root);
+        size_.store(size_.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+    }
+}
+
+/**
+* Publishes an empty tree and retires every node of the old one.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+void RcuAVLTree<Key, Value, Alloc, Compare>::clear()
+{
+    std::lock_guard<std::mutex> lock(writeLock_);
+    retireAll(root_.load(std::memory_order_relaxed));
+    publish(NULL);
+    size_.store(0, std::memory_order_relaxed);
+}
+
+/**
+* Copies the value of key into value and returns true, or returns false
+* if it is missing.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+bool RcuAVLTree<Key, Value, Alloc, Compare>::find(const Key& key, Value& value) const
+{
+    EpochGuard guard(domain_);
+    const Node* n = findNode(root_.load(), key);
+    if(n == NULL) {
+        return false;
+    }
+    value = n->item.second;
+    return true;
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+bool RcuAVLTree<Key, Value, Alloc, Compare>::contains(const Key& key) const
+{
+    EpochGuard guard(domain_);
+    return findNode(root_.load(), key) != NULL;
+}
+
+/**
+* Return true iff the current version is balanced, computing every height
+* once.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+bool RcuAVLTree<Key, Value, Alloc, Compare>::isBalanced() const
+{
+    EpochGuard guard(domain_);
+    return checkedAVLHeight(root_.load()) >= 0;
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+bool RcuAVLTree<Key, Value, Alloc, Compare>::empty() const
+{
+    return root_.load(std::memory_order_relaxed) == NULL;
+}
+
+/**
+* The number of entries as of the last completed write.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+std::size_t RcuAVLTree<Key, Value, Alloc, Compare>::size() const
+{
+    return size_.load(std::memory_order_relaxed);
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+int RcuAVLTree<Key, Value, Alloc, Compare>::height(const Node* n)
+{
+    return (n == NULL) ? 0 : n->height;
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+const typename RcuAVLTree<Key, Value, Alloc, Compare>::Node*
+RcuAVLTree<Key, Value, Alloc, Compare>::findNode(const Node* n, const Key& key)
+{
+    Compare comp;
+    while(n != NULL) {
+        if(comp(key, n->item.first)) {
+            n = n->left;
+        }
+        else if(comp(n->item.first, key)) {
+            n = n->right;
+        }
+        else {
+            return n;
+        }
+    }
+    return NULL;
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+const typename RcuAVLTree<Key, Value, Alloc, Compare>::Node*
+RcuAVLTree<Key, Value, Alloc, Compare>::makeNode(const std::pair<const Key, Value>& item, const Node* l, const Node* r)
+{
+    return new (alloc_.allocate(sizeof(Node))) Node(item.first, item.second, l, r);
+}
+
+/**
+* Builds a node for item over l and r, whose heights differ by at most
+* two, rotating as needed. Rotated nodes are copied, and the originals
+* retired.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+const typename RcuAVLTree<Key, Value, Alloc, Compare>::Node*
+RcuAVLTree<Key, Value, Alloc, Compare>::rebalance(const std::pair<const Key, Value>& item, const Node* l, const Node* r)
+{
+    if(height(l) > height(r) + 1) {
+        pending_.push_back(l);
+        if(height(l->left) >= height(l->right)) {
+            return makeNode(l->item, l->left, makeNode(item, l->right, r));
+        }
+        const Node* lr = l->right;
+        pending_.push_back(lr);
+        return makeNode(lr->item, makeNode(l->item, l->left, lr->left), makeNode(item, lr->right, r));
+    }
+    if(height(r) > height(l) + 1) {
+        pending_.push_back(r);
+        if(height(r->right) >= height(r->left)) {
+            return makeNode(r->item, makeNode(item, l, r->left), r->right);
+        }
+        const Node* rl = r->left;
+        pending_.push_back(rl);
+        return makeNode(rl->item, makeNode(item, l, rl->left), makeNode(r->item, rl->right, r->right));
+    }
+    return makeNode(item, l, r);
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+const typename RcuAVLTree<Key, Value, Alloc, Compare>::Node*
+RcuAVLTree<Key, Value, Alloc, Compare>::insertNode(const Node* n, const std::pair<const Key, Value>& item, bool& added)
+{
+    if(n == NULL) {
+        added = true;
+        return makeNode(item, NULL, NULL);
+    }
+    Compare comp;
+    pending_.push_back(n);
+    if(comp(item.first, n->item.first)) {
+        return rebalance(n->item, insertNode(n->left, item, added), n->right);
+    }
+    if(comp(n->item.first, item.first)) {
+        return rebalance(n->item, n->left, insertNode(n->right, item, added));
+    }
+    return makeNode(item, n->left, n->right);
+}
+
+/**
+* Returns the new version of the subtree at n without key; when key is
+* missing, n itself is returned and nothing is copied.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+const typename RcuAVLTree<Key, Value, Alloc, Compare>::Node*
+RcuAVLTree<Key, Value, Alloc, Compare>::removeNode(const Node* n, const Key& key, bool& removed)
+{
+    if(n == NULL) {
+        return NULL;
+    }
+    Compare comp;
+    if(comp(key, n->item.first)) {
+        const Node* l = removeNode(n->left, key, removed);
+        if(!removed) {
+            return n;
+        }
+        pending_.push_back(n);
+        return rebalance(n->item, l, n->right);
+    }
+    if(comp(n->item.first, key)) {
+        const Node* r = removeNode(n->right, key, removed);
+        if(!removed) {
+            return n;
+        }
+        pending_.push_back(n);
+        return rebalance(n->item, n->left, r);
+    }
+    removed = true;
+    pending_.push_back(n);
+    if(n->left == NULL) {
+        return n->right;
+    }
+    if(n->right == NULL) {
+        return n->left;
+    }
+    const Node* min = NULL;
+    const Node* r = removeMin(n->right, min);
+    return rebalance(min->item, n->left, r);
+}
+
+/**
+* Returns the subtree at n without its first node, which is stored in min.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+const typename RcuAVLTree<Key, Value, Alloc, Compare>::Node*
+RcuAVLTree<Key, Value, Alloc, Compare>::removeMin(const Node* n, const Node*& min)
+{
+    pending_.push_back(n);
+    if(n->left == NULL) {
+        min = n;
+        return n->right;
+    }
+    return rebalance(n->item, removeMin(n->left, min), n->right);
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+void RcuAVLTree<Key, Value, Alloc, Compare>::retireAll(const Node* n)
+{
+    if(n == NULL) {
+        return;
+    }
+    retireAll(n->left);
+    retireAll(n->right);
+    pending_.push_back(n);
+}
+
+/**
+* Makes root the version readers see, then retires the nodes it replaced
+* under the current epoch. A reader that could still reach them pinned no
+* later than that epoch.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+void RcuAVLTree<Key, Value, Alloc, Compare>::publish(const Node* root)
+{
+    root_.store(root);
+    std::uint64_t epoch = domain_.epoch();
+    for(std::size_t i = 0; i < pending_.size(); ++i) {
+        retired_.push_back(std::make_pair(epoch, pending_[i]));
+    }
+    pending_.clear();
+    if(retired_.size() >= RECLAIM_BATCH) {
+        reclaim();
+    }
+}
+
+/**
+* Advances the epoch and frees the retired nodes no pinned reader can
+* hold.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+void RcuAVLTree<Key, Value, Alloc, Compare>::reclaim()
+{
+    domain_.advance();
+    std::uint64_t safe = domain_.safeBefore();
+    while(!retired_.empty() && retired_.front().first < safe) {
+        freeNode(retired_.front().second);
+        retired_.pop_front();
+    }
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+void RcuAVLTree<Key, Value, Alloc, Compare>::freeNode(const Node* n)
+{
+    Node* node = const_cast<Node*>(n);
+    node->~Node();
+    alloc_.deallocate(node, sizeof(Node));
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+void RcuAVLTree<Key, Value, Alloc, Compare>::freeTree(const Node* n)
+{
+    if(n == NULL) {
+        return;
+    }
+    freeTree(n->left);
+    freeTree(n->right);
+    freeNode(n);
+}
+
+/*
+  ---------------------------------------------
+  End implementations for the RcuAVLTree class.
+  ---------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,582 @@
+#ifndef STRING_TREE_H
+#define STRING_TREE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "avlbst.h"
+
+/**
+* A string key whose bytes live elsewhere, normally in the StringArena of a
+* StringTree. Eight of its bytes are also kept inline as a big-endian
+* integer, so comparing two keys that differ early never leaves the node.
+* They are the eight after the first skip bytes, where skip is either zero
+* or the length of a leading part that every key with that skip shares
+* (such as "https://" for URLs), which would otherwise fill the prefix.
+*/
+class ArenaKey
+{
+public:
+    // skip is stored in 16 bits and the size in 48
+    static const std::size_t MAX_SKIP = 0xFFFF;
+
+    ArenaKey();
+    ArenaKey(const char* data, std::size_t size, std::size_t skip = 0);
+
+    std::uint64_t prefix() const;
+    const char* data() const;
+    std::size_t size() const;
+    std::size_t skip() const;
+    std::string str() const;
+
+private:
+    std::uint64_t prefix_;
+    const char* data_;
+    std::uint64_t size_ : 48;
+    std::uint64_t skip_ : 16;
+};
+
+std::ostream& operator<<(std::ostream& os, const ArenaKey& key);
+
+/**
+* Orders ArenaKeys by their bytes, as std::string does, comparing the
+* inline prefixes first when both keys skip the same leading part.
+*/
+struct ArenaKeyCompare
+{
+    bool operator()(const ArenaKey& a, const ArenaKey& b) const;
+    static int compare(const ArenaKey& a, const ArenaKey& b);
+};
+
+/**
+* Append-only storage for key bytes. Chunks are never moved, so the
+* pointers handed out stay valid until clear(), or until the arena they
+* were swapped into is cleared or destroyed. Only the most recent append
+* can be taken back.
+*/
+class StringArena
+{
+public:
+    StringArena();
+
+    const char* append(const char* data, std::size_t size);
+    void unappend(std::size_t size);
+    void clear();
+    void swap(StringArena& other);
+    std::size_t bytes() const;
+
+private:
+    StringArena(const StringArena&);
+    StringArena& operator=(const StringArena&);
+
+    static const std::size_t CHUNK_BYTES = 64 * 1024;
+
+    std::vector<std::unique_ptr<char[]> > chunks_;
+    char* bump_;
+    char* bumpEnd_;
+    std::size_t bytes_;
+};
+
+/**
+* A map from strings to Value, kept in an AVLTree keyed by ArenaKey. Each
+* node holds a key's prefix, pointer and length, and the key bytes are
+* packed into an arena owned by the tree. This avoids a separate heap
+* block per key, and most comparisons stop at the prefix. Lookups point
+* an ArenaKey at the caller's bytes, so they never copy the key.
+*
+* Removed keys leave dead bytes in the arena. Once they outnumber the live
+* bytes, the live keys are copied into a fresh arena in one in-order pass,
+* so churn costs amortized O(1) per removed byte and memory stays within
+* about twice the live key bytes.
+*
+* A leading part shared by every key, given to the constructor or else
+* detected, is left out of the inline prefixes so that they hold bytes
+* that tell keys apart. Detection takes the longest common prefix of the
+* smallest and largest keys, which every key then shares; it runs when
+* the number of entries reaches 1024, 2048, 4096 and so on, and on each
+* compaction. Keys that do not start with the shared part still work,
+* but compare against the others byte by byte.
+*/
+template <typename Value, typename Alloc = NodePool>
+class StringTree
+{
+public:
+    typedef AVLTree<ArenaKey, Value, Alloc, NoAugment, ArenaKeyCompare> tree_type;
+    typedef typename tree_type::iterator iterator;
+
+    StringTree();
+    // Skips commonPrefix in the inline prefixes, with no detection.
+    explicit StringTree(const std::string& commonPrefix);
+
+    void insert(const std::string& key, const Value& value);
+    void remove(const std::string& key);
+    void clear();
+    bool empty() const;
+    bool isBalanced() const;
+
+    iterator begin() const;
+    iterator end() const;
+    iterator find(const char* key, std::size_t size) const;
+    iterator find(const std::string& key) const;
+    iterator find(const char* key) const;
+    iterator lower_bound(const std::string& key) const;
+    Value& operator[](const std::string& key);
+    Value const & operator[](const std::string& key) const;
+
+    // Copies the live keys into a fresh arena right away.
+    void compact();
+    // Bytes of key storage in the arena, including removed keys that have
+    // not been compacted away yet.
+    std::size_t arenaBytes() const;
+    const std::string& commonPrefix() const;
+
+private:
+    static const std::size_t FIRST_DETECTION = 1024;
+
+    ArenaKey makeKey(const char* data, std::size_t size) const;
+    void rebuild(bool moveBytes);
+
+    tree_type tree_;
+    StringArena arena_;
+    // The leading bytes skipped by the inline prefixes of keys that have them
+    std::string commonPrefix_;
+    bool detect_;
+    std::size_t count_;
+    std::size_t deadBytes_;
+    std::size_t nextDetection_;
+};
+
+/*
+  ---------------------------------------------
+  Begin implementations for the ArenaKey class.
+  ---------------------------------------------
+*/
+
+/**
+* An empty key.
+*/
+inline ArenaKey::ArenaKey() :
+    prefix_(0),
+    data_(""),
+    size_(0),
+    skip_(0)
+{
+}
+
+/**
+* Refers to size bytes at data, which must outlive the key. The inline
+* prefix starts skip bytes in; skip must not exceed size or MAX_SKIP.
+*/
+inline ArenaKey::ArenaKey(const char* data, std::size_t size, std::size_t skip) :
+    prefix_(0),
+    data_(data),
+    size_(size),
+    skip_(skip)
+{
+    for(std::size_t i = skip; i < skip + 8; ++i) {
+        unsigned char byte = (i < size) ? static_cast<unsigned char>(data[i]) : 0;
+        prefix_ = (prefix_ << 8) | byte;
+    }
+}
+
+inline std::uint64_t ArenaKey::prefix() const
+{
+    return prefix_;
+}
+
+inline const char* ArenaKey::data() const
+{
+    return data_;
+}
+
+inline std::size_t ArenaKey::size() const
+{
+    return size_;
+}
+
+inline std::size_t ArenaKey::skip() const
+{
+    return skip_;
+}
+
+/**
+* Copies the key out into a std::string.
+*/
+inline std::string ArenaKey::str() const
+{
+    return std::string(data_, size_);
+}
+
+inline std::ostream& operator<<(std::ostream& os, const ArenaKey& key)
+{
+    return os.write(key.data(), static_cast<std::streamsize>(key.size()));
+}
+
+/**
+* Three-way comparison. Keys with the same skip share their first skip
+* bytes, so equal prefixes mean the first skip + 8 bytes match (short keys
+* are zero padded), and only the bytes after them and the lengths are left
+* to compare. Keys with different skips are compared byte by byte.
+*/
+inline int ArenaKeyCompare::compare(const ArenaKey& a, const ArenaKey& b)
+{
+    std::size_t from = 0;
+    if(a.skip() == b.skip()) {
+        if(a.prefix() != b.prefix()) {
+            return (a.prefix() < b.prefix()) ? -1 : 1;
+        }
+        from = a.skip() + 8;
+    }
+    std::size_t common = (a.size() < b.size()) ? a.size() : b.size();
+    if(common > from) {
+        int cmp = std::memcmp(a.data() + from, b.data() + from, common - from);
+        if(cmp != 0) {
+            return cmp;
+        }
+    }
+    if(a.size() == b.size()) {
+        return 0;
+    }
+    return (a.size() < b.size()) ? -1 : 1;
+}
+
+inline bool ArenaKeyCompare::operator()(const ArenaKey& a, const ArenaKey& b) const
+{
+    return compare(a, b) < 0;
+}
+
+/*
+  -------------------------------------------
+  End implementations for the ArenaKey class.
+  -------------------------------------------
+*/
+
+/*
+  ------------------------------------------------
+  Begin implementations for the StringArena class.
+  ------------------------------------------------
+*/
+
+/**
+* An empty arena; the first chunk is allocated by the first append.
+*/
+inline StringArena::StringArena() :
+    bump_(NULL),
+    bumpEnd_(NULL),
+    bytes_(0)
+{
+}
+
+/**
+* Copies size bytes into the arena and returns where they now live. Keys
+* longer than a chunk get a chunk of their own.
+*/
+inline const char* StringArena::append(const char* data, std::size_t size)
+{
+    if(static_cast<std::size_t>(bumpEnd_ - bump_) < size) {
+        std::size_t chunk = (size > CHUNK_BYTES) ? size : CHUNK_BYTES;
+        chunks_.push_back(std::unique_ptr<char[]>(new char[chunk]));
+        bump_ = chunks_.back().get();
+        bumpEnd_ = bump_ + chunk;
+    }
+    char* stored = bump_;
+    if(size > 0) {
+        std::memcpy(stored, data, size);
+    }
+    bump_ += size;
+    bytes_ += size;
+    return stored;
+}
+
+/**
+* Takes back the last append, which was size bytes long.
+*/
+inline void StringArena::unappend(std::size_t size)
+{
+    bump_ -= size;
+    bytes_ -= size;
+}
+
+/**
+* Frees every chunk. Pointers handed out earlier dangle afterwards.
+*/
+inline void StringArena::clear()
+{
+    chunks_.clear();
+    bump_ = NULL;
+    bumpEnd_ = NULL;
+    bytes_ = 0;
+}
+
+/**
+* Exchanges the contents of two arenas; pointers into either stay valid.
+*/
+inline void StringArena::swap(StringArena& other)
+{
+    chunks_.swap(other.chunks_);
+    std::swap(bump_, other.bump_);
+    std::swap(bumpEnd_, other.bumpEnd_);
+    std::swap(bytes_, other.bytes_);
+}
+
+inline std::size_t StringArena::bytes() const
+{
+    return bytes_;
+}
+
+/*
+  ----------------------------------------------
+  End implementations for the StringArena class.
+  ----------------------------------------------
+*/
+
+/*
+  -----------------------------------------------
+  Begin implementations for the StringTree class.
+  -----------------------------------------------
+*/
+
+/**
+* An empty tree that detects the common prefix of its keys.
+*/
+template<class Value, class Alloc>
+StringTree<Value, Alloc>::StringTree() :
+    detect_(true),
+    count_(0),
+    deadBytes_(0),
+    nextDetection_(FIRST_DETECTION)
+{
+}
+
+/**
+* An empty tree whose inline prefixes skip commonPrefix (at most MAX_SKIP
+* bytes of it) in every key that starts with it.
+*/
+template<class Value, class Alloc>
+StringTree<Value, Alloc>::StringTree(const std::string& commonPrefix) :
+    commonPrefix_(commonPrefix, 0, ArenaKey::MAX_SKIP),
+    detect_(false),
+    count_(0),
+    deadBytes_(0),
+    nextDetection_(FIRST_DETECTION)
+{
+}
+
+/**
+* Inserts key, or overwrites its value if it is already present. The key
+* bytes are copied into the arena before the single descent and taken back
+* if the key turns out to exist. Throws std::length_error for keys of
+* 2^48 bytes or more.
+*/
+template<class Value, class Alloc>
+void StringTree<Value, Alloc>::insert(const std::string& key, const Value& value)
+{
+    if(key.size() >> 48 != 0) {
+        throw std::length_error("StringTree key too long");
+    }
+    ArenaKey stored = makeKey(arena_.append(key.data(), key.size()), key.size());
+    std::pair<iterator, bool> result = tree_.try_emplace(stored, value);
+    if(!result.second) {
+        arena_.unappend(key.size());
+        result.first->second = value;
+        return;
+    }
+    ++count_;
+    if(detect_ && count_ >= nextDetection_) {
+        nextDetection_ *= 2;
+        rebuild(false);
+    }
+}
+
+/**
+* Removes key if present. Its bytes stay in the arena until dead bytes
+* outnumber live ones, and then every live key is compacted.
+*/
+template<class Value, class Alloc>
+void StringTree<Value, Alloc>::remove(const std::string& key)
+{
+    iterator it = find(key);
+    if(it == tree_.end()) {
+        return;
+    }
+    // a copy, since the node's own key goes away during the removal
+    ArenaKey stored = it->first;
+    tree_.remove(stored);
+    --count_;
+    deadBytes_ += stored.size();
+    if(deadBytes_ > arena_.bytes() - deadBytes_) {
+        rebuild(true);
+    }
+}
+
+/**
+* Removes every entry and frees the arena.
+*/
+template<class Value, class Alloc>
+void StringTree<Value, Alloc>::clear()
+{
+    tree_.clear();
+    arena_.clear();
+    count_ = 0;
+    deadBytes_ = 0;
+    nextDetection_ = FIRST_DETECTION;
+    if(detect_) {
+        commonPrefix_.clear();
+    }
+}
+
+template<class Value, class Alloc>
+bool StringTree<Value, Alloc>::empty() const
+{
+    return tree_.empty();
+}
+
+template<class Value, class Alloc>
+bool StringTree<Value, Alloc>::isBalanced() const
+{
+    return tree_.isBalanced();
+}
+
+template<class Value, class Alloc>
+typename StringTree<Value, Alloc>::iterator
+StringTree<Value, Alloc>::begin() const
+{
+    return tree_.begin();
+}
+
+template<class Value, class Alloc>
+typename StringTree<Value, Alloc>::iterator
+StringTree<Value, Alloc>::end() const
+{
+    return tree_.end();
+}
+
+/**
+* Looks up the size bytes at key without copying them.
+*/
+template<class Value, class Alloc>
+typename StringTree<Value, Alloc>::iterator
+StringTree<Value, Alloc>::find(const char* key, std::size_t size) const
+{
+    return tree_.find(makeKey(key, size));
+}
+
+template<class Value, class Alloc>
+typename StringTree<Value, Alloc>::iterator
+StringTree<Value, Alloc>::find(const std::string& key) const
+{
+    return find(key.data(), key.size());
+}
+
+template<class Value, class Alloc>
+typename StringTree<Value, Alloc>::iterator
+StringTree<Value, Alloc>::find(const char* key) const
+{
+    return find(key, std::strlen(key));
+}
+
+template<class Value, class Alloc>
+typename StringTree<Value, Alloc>::iterator
+StringTree<Value, Alloc>::lower_bound(const std::string& key) const
+{
+    return tree_.lower_bound(makeKey(key.data(), key.size()));
+}
+
+/**
+* Returns the value of key, throwing std::out_of_range if it is missing.
+*/
+template<class Value, class Alloc>
+Value& StringTree<Value, Alloc>::operator[](const std::string& key)
+{
+    return tree_[makeKey(key.data(), key.size())];
+}
+
+template<class Value, class Alloc>
+Value const & StringTree<Value, Alloc>::operator[](const std::string& key) const
+{
+    return tree_[makeKey(key.data(), key.size())];
+}
+
+template<class Value, class Alloc>
+void StringTree<Value, Alloc>::compact()
+{
+    rebuild(true);
+}
+
+template<class Value, class Alloc>
+std::size_t StringTree<Value, Alloc>::arenaBytes() const
+{
+    return arena_.bytes();
+}
+
+template<class Value, class Alloc>
+const std::string& StringTree<Value, Alloc>::commonPrefix() const
+{
+    return commonPrefix_;
+}
+
+/**
+* Helper that wraps size bytes at data in an ArenaKey, skipping the common
+* prefix if the bytes start with it.
+*/
+template<class Value, class Alloc>
+ArenaKey StringTree<Value, Alloc>::makeKey(const char* data, std::size_t size) const
+{
+    std::size_t skip = commonPrefix_.size();
+    if(skip > size || (skip != 0 && std::memcmp(data, commonPrefix_.data(), skip) != 0)) {
+        skip = 0;
+    }
+    return ArenaKey(data, size, skip);
+}
+
+/**
+* Helper that redoes every key in one in-order pass: the common prefix is
+* detected again first (unless one was given), and each key is made anew
+* against it, from a copy of its bytes in a fresh arena if moveBytes is
+* set, which drops the bytes of removed keys. The keys' order does not
+* change, so the tree's shape stays valid.
+*/
+template<class Value, class Alloc>
+void StringTree<Value, Alloc>::rebuild(bool moveBytes)
+{
+    if(detect_ && !tree_.empty()) {
+        const ArenaKey& first = tree_.begin()->first;
+        iterator lastIt = tree_.end();
+        --lastIt;
+        const ArenaKey& last = lastIt->first;
+        std::size_t limit = (first.size() < last.size()) ? first.size() : last.size();
+        if(limit > ArenaKey::MAX_SKIP) {
+            limit = ArenaKey::MAX_SKIP;
+        }
+        std::size_t common = 0;
+        while(common < limit && first.data()[common] == last.data()[common]) {
+            ++common;
+        }
+        commonPrefix_.assign(first.data(), common);
+    }
+    StringArena fresh;
+    for(iterator it = tree_.begin(); it != tree_.end(); ++it) {
+        const ArenaKey& key = it->first;
+        const char* data = moveBytes ? fresh.append(key.data(), key.size()) : key.data();
+        // items keep their key const; the new key holds the same bytes, so
+        // the tree's order is untouched
+        const_cast<ArenaKey&>(key) = makeKey(data, key.size());
+    }
+    if(moveBytes) {
+        arena_.swap(fresh);
+        deadBytes_ = 0;
+    }
+}
+
+/*
+  ---------------------------------------------
+  End implementations for the StringTree class.
+  ---------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,255 @@
+#ifndef TREE_WALK_H
+#define TREE_WALK_H
+
+#include <atomic>
+#include <cstddef>
+#include <iterator>
+#include <vector>
+
+/**
+* Walks shared by the trees whose nodes have no parent links: a path-stack
+* iterator for the read-only views of RcuAVLTree and PersistentAVLTree, and
+* the AVL height check behind their isBalanced(), and that of
+* ConcurrentAVLTree and CompactAVLTree.
+*/
+
+/**
+* A forward iterator in key order over nodes with item, left and right
+* members. It keeps the path from the root, since nodes have no parent
+* links: exactly the nodes whose items are still to come, nearest last.
+* It never writes to a node, so it may run over nodes other threads read.
+*/
+template <typename NodeType, typename Item>
+class PathIterator
+{
+public:
+    typedef std::forward_iterator_tag iterator_category;
+    typedef Item value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef const Item* pointer;
+    typedef const Item& reference;
+
+    PathIterator();
+
+    static PathIterator first(const NodeType* root);
+    template<typename Key, typename Compare>
+    static PathIterator lowerBound(const NodeType* root, const Key& key, const Compare& comp);
+    template<typename Key, typename Compare>
+    static PathIterator find(const NodeType* root, const Key& key, const Compare& comp);
+
+    const Item& operator*() const;
+    const Item* operator->() const;
+
+    bool operator==(const PathIterator& rhs) const;
+    bool operator!=(const PathIterator& rhs) const;
+
+    PathIterator& operator++();
+    PathIterator operator++(int);
+
+private:
+    void pushLeftSpine(const NodeType* n);
+
+    std::vector<const NodeType*> path_;
+};
+
+/*
+  -----------------------------------------------
+  Begin implementations for the PathIterator class.
+  -----------------------------------------------
+*/
+
+/**
+* A default constructor that initializes the iterator to the end.
+*/
+template<class NodeType, class Item>
+PathIterator<NodeType, Item>::PathIterator()
+{
+}
+
+/**
+* Returns an iterator to the smallest item under root.
+*/
+template<class NodeType, class Item>
+PathIterator<NodeType, Item> PathIterator<NodeType, Item>::first(const NodeType* root)
+{
+    PathIterator it;
+    it.pushLeftSpine(root);
+    return it;
+}
+
+/**
+* Returns an iterator to the first item whose key is not below key. The
+* path keeps exactly the nodes where the search went left, which are the
+* ones iteration comes back to.
+*/
+template<class NodeType, class Item>
+template<typename Key, typename Compare>
+PathIterator<NodeType, Item> PathIterator<NodeType, Item>::lowerBound(const NodeType* root, const Key& key, const Compare& comp)
+{
+    PathIterator it;
+    const NodeType* n = root;
+    while(n != NULL) {
+        if(comp(n->item.first, key)) {
+            n = n->right;
+        }
+        else {
+            it.path_.push_back(n);
+            n = n->left;
+        }
+    }
+    return it;
+}
+
+/**
+* Returns an iterator to the item with the given key, or the end.
+*/
+template<class NodeType, class Item>
+template<typename Key, typename Compare>
+PathIterator<NodeType, Item> PathIterator<NodeType, Item>::find(const NodeType* root, const Key& key, const Compare& comp)
+{
+    PathIterator it = lowerBound(root, key, comp);
+    if(!it.path_.empty() && comp(key, it->first)) {
+        return PathIterator();
+    }
+    return it;
+}
+
+template<class NodeType, class Item>
+const Item& PathIterator<NodeType, Item>::operator*() const
+{
+    return path_.back()->item;
+}
+
+template<class NodeType, class Item>
+const Item* PathIterator<NodeType, Item>::operator->() const
+{
+    return &path_.back()->item;
+}
+
+template<class NodeType, class Item>
+bool PathIterator<NodeType, Item>::operator==(const PathIterator& rhs) const
+{
+    if(path_.empty() || rhs.path_.empty()) {
+        return path_.empty() == rhs.path_.empty();
+    }
+    return path_.back() == rhs.path_.back();
+}
+
+template<class NodeType, class Item>
+bool PathIterator<NodeType, Item>::operator!=(const PathIterator& rhs) const
+{
+    return !(*this == rhs);
+}
+
+/**
+* Leaves the current node; its right subtree, if any, comes next, and
+* otherwise the nearest ancestor still on the path.
+*/
+template<class NodeType, class Item>
+PathIterator<NodeType, Item>& PathIterator<NodeType, Item>::operator++()
+{
+    const NodeType* n = path_.back();
+    path_.pop_back();
+    pushLeftSpine(n->right);
+    return *this;
+}
+
+template<class NodeType, class Item>
+PathIterator<NodeType, Item> PathIterator<NodeType, Item>::operator++(int)
+{
+    PathIterator previous = *this;
+    ++(*this);
+    return previous;
+}
+
+template<class NodeType, class Item>
+void PathIterator<NodeType, Item>::pushLeftSpine(const NodeType* n)
+{
+    while(n != NULL) {
+        path_.push_back(n);
+        n = n->left;
+    }
+}
+
+/*
+  ---------------------------------------------
+  End implementations for the PathIterator class.
+  ---------------------------------------------
+*/
+
+/**
+* The height of the subtree at n, or -1 if some node in it is out of
+* balance or its own record of the shape disagrees. none is the empty
+* subtree, children(n, left, right) reads n's children, and
+* matches(n, leftHeight, rightHeight, height) checks whatever n stores
+* (a height or a balance) against the heights just computed.
+*/
+template<typename NodeRef, typename Children, typename Matches>
+int checkedAVLHeight(NodeRef n, NodeRef none, const Children& children, const Matches& matches)
+{
+    if(n == none) {
+        return 0;
+    }
+    NodeRef left;
+    NodeRef right;
+    children(n, left, right);
+    int leftHeight = checkedAVLHeight(left, none, children, matches);
+    int rightHeight = checkedAVLHeight(right, none, children, matches);
+    if(leftHeight < 0 || rightHeight < 0 || leftHeight - rightHeight > 1 || rightHeight - leftHeight > 1) {
+        return -1;
+    }
+    int height = 1 + ((leftHeight > rightHeight) ? leftHeight : rightHeight);
+    return matches(n, leftHeight, rightHeight, height) ? height : -1;
+}
+
+/**
+* Helpers that read a link or a stored height whether or not it is atomic.
+*/
+template<typename T>
+T* loadTreeLink(T* link)
+{
+    return link;
+}
+
+template<typename T>
+T* loadTreeLink(const std::atomic<T*>& link)
+{
+    return link.load();
+}
+
+inline int loadTreeHeight(int height)
+{
+    return height;
+}
+
+inline int loadTreeHeight(const std::atomic<int>& height)
+{
+    return height.load();
+}
+
+/**
+* checkedAVLHeight for nodes with left, right and height members, plain or
+* atomic.
+*/
+template<typename NodeType>
+struct StoredHeightWalk
+{
+    void operator()(const NodeType* n, const NodeType*& left, const NodeType*& right) const
+    {
+        left = loadTreeLink(n->left);
+        right = loadTreeLink(n->right);
+    }
+    bool operator()(const NodeType* n, int, int, int height) const
+    {
+        return loadTreeHeight(n->height) == height;
+    }
+};
+
+template<typename NodeType>
+int checkedAVLHeight(const NodeType* root)
+{
+    StoredHeightWalk<NodeType> walk;
+    return checkedAVLHeight(root, static_cast<const NodeType*>(NULL), walk, walk);
+}
+
+#endif